@@ -0,0 +1,158 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "bench.h"
+#include "addressindex.h"
+#include "crypto/common.h"
+#include "mempoolindex.h"
+#include "primitives/transaction.h"
+#include "random.h"
+#include "spentindex.h"
+
+#include <map>
+#include <vector>
+
+// Mempool transactions with two inputs and two outputs each, paying to a
+// pool of addresses a quarter the size of the mempool, so that addresses
+// are shared between transactions as they are on a busy node.
+struct BenchMempoolTx {
+    CTransaction tx;
+    std::vector<CMempoolAddressIndex::Delta> deltas;
+};
+
+static uint256 RandomHash(FastRandomContext& rng)
+{
+    uint256 hash;
+    for (int i = 0; i < 4; i++) {
+        WriteLE64(hash.begin() + 8 * i, rng.rand64());
+    }
+    return hash;
+}
+
+static std::vector<BenchMempoolTx> MakeMempoolTxs(size_t nTxs)
+{
+    FastRandomContext rng(true);
+    std::vector<uint160> addresses(std::max<size_t>(1, nTxs / 4));
+    for (uint160& address : addresses) {
+        uint256 hash = RandomHash(rng);
+        memcpy(address.begin(), hash.begin(), 20);
+    }
+
+    std::vector<BenchMempoolTx> txs(nTxs);
+    for (BenchMempoolTx& benchTx : txs) {
+        CMutableTransaction mtx;
+        for (unsigned int j = 0; j < 2; j++) {
+            mtx.vin.push_back(CTxIn(COutPoint(RandomHash(rng), j)));
+            mtx.vout.push_back(CTxOut(1000, CScript()));
+        }
+        benchTx.tx = CTransaction(mtx);
+        for (unsigned int j = 0; j < 2; j++) {
+            const uint160& input = addresses[rng.randrange(addresses.size())];
+            const uint160& output = addresses[rng.randrange(addresses.size())];
+            benchTx.deltas.push_back({CScript::P2PKH, input, j, true, -1000, mtx.vin[j].prevout});
+            benchTx.deltas.push_back({CScript::P2PKH, output, j, false, 1000, COutPoint()});
+        }
+    }
+    return txs;
+}
+
+// The index layout the mempool used before CMempoolAddressIndex and
+// CMempoolSpentIndex: ordered maps plus a list of keys per transaction.
+class MapMempoolIndex
+{
+private:
+    std::map<CMempoolAddressDeltaKey, CMempoolAddressDelta, CMempoolAddressDeltaKeyCompare> mapAddress;
+    std::map<uint256, std::vector<CMempoolAddressDeltaKey>> mapAddressInserted;
+    std::map<CSpentIndexKey, CSpentIndexValue, CSpentIndexKeyCompare> mapSpent;
+    std::map<uint256, std::vector<CSpentIndexKey>> mapSpentInserted;
+
+public:
+    void Add(const BenchMempoolTx& benchTx)
+    {
+        const uint256& txhash = benchTx.tx.GetHash();
+        std::vector<CMempoolAddressDeltaKey> addressInserted;
+        for (const CMempoolAddressIndex::Delta& delta : benchTx.deltas) {
+            CMempoolAddressDeltaKey key(delta.type, delta.addressBytes, txhash, delta.index, delta.spending);
+            mapAddress.insert(std::make_pair(key, CMempoolAddressDelta(0, delta.amount, delta.prevout.hash, delta.prevout.n)));
+            addressInserted.push_back(key);
+        }
+        mapAddressInserted.insert(std::make_pair(txhash, addressInserted));
+
+        std::vector<CSpentIndexKey> spentInserted;
+        for (unsigned int j = 0; j < benchTx.tx.vin.size(); j++) {
+            CSpentIndexKey key(benchTx.tx.vin[j].prevout.hash, benchTx.tx.vin[j].prevout.n);
+            mapSpent.insert(std::make_pair(key, CSpentIndexValue(txhash, j, -1, 1000, CScript::P2PKH, uint160())));
+            spentInserted.push_back(key);
+        }
+        mapSpentInserted.insert(std::make_pair(txhash, spentInserted));
+    }
+
+    void Remove(const BenchMempoolTx& benchTx)
+    {
+        auto ait = mapAddressInserted.find(benchTx.tx.GetHash());
+        for (const CMempoolAddressDeltaKey& key : ait->second) {
+            mapAddress.erase(key);
+        }
+        mapAddressInserted.erase(ait);
+
+        auto sit = mapSpentInserted.find(benchTx.tx.GetHash());
+        for (const CSpentIndexKey& key : sit->second) {
+            mapSpent.erase(key);
+        }
+        mapSpentInserted.erase(sit);
+    }
+};
+
+class CompactMempoolIndex
+{
+private:
+    CMempoolAddressIndex addressIndex;
+    CMempoolSpentIndex spentIndex;
+
+public:
+    void Add(const BenchMempoolTx& benchTx)
+    {
+        const uint256& txhash = benchTx.tx.GetHash();
+        addressIndex.AddTx(txhash, 0, benchTx.deltas);
+        for (unsigned int j = 0; j < benchTx.tx.vin.size(); j++) {
+            CSpentIndexKey key(benchTx.tx.vin[j].prevout.hash, benchTx.tx.vin[j].prevout.n);
+            spentIndex.Add(key, CSpentIndexValue(txhash, j, -1, 1000, CScript::P2PKH, uint160()));
+        }
+    }
+
+    void Remove(const BenchMempoolTx& benchTx)
+    {
+        addressIndex.RemoveTx(benchTx.tx.GetHash());
+        spentIndex.RemoveTx(benchTx.tx);
+    }
+};
+
+// Keeps nMempoolSize transactions indexed and times replacing the oldest
+// with a new one, the steady state of a full mempool.
+template <typename Index>
+static void MempoolIndexAddRemove(benchmark::State& state, size_t nMempoolSize)
+{
+    std::vector<BenchMempoolTx> txs = MakeMempoolTxs(nMempoolSize + 1);
+    Index index;
+    for (size_t i = 0; i < nMempoolSize; i++) {
+        index.Add(txs[i]);
+    }
+
+    size_t nOldest = 0;
+    while (state.KeepRunning()) {
+        index.Add(txs[(nOldest + nMempoolSize) % txs.size()]);
+        index.Remove(txs[nOldest]);
+        nOldest = (nOldest + 1) % txs.size();
+    }
+}
+
+static void MempoolIndexMap10k(benchmark::State& state) { MempoolIndexAddRemove<MapMempoolIndex>(state, 10000); }
+static void MempoolIndexCompact10k(benchmark::State& state) { MempoolIndexAddRemove<CompactMempoolIndex>(state, 10000); }
+static void MempoolIndexMap100k(benchmark::State& state) { MempoolIndexAddRemove<MapMempoolIndex>(state, 100000); }
+static void MempoolIndexCompact100k(benchmark::State& state) { MempoolIndexAddRemove<CompactMempoolIndex>(state, 100000); }
+
+BENCHMARK(MempoolIndexMap10k);
+BENCHMARK(MempoolIndexCompact10k);
+BENCHMARK(MempoolIndexMap100k);
+BENCHMARK(MempoolIndexCompact100k);
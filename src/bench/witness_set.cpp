@@ -0,0 +1,97 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "bench.h"
+#include "crypto/common.h"
+#include "random.h"
+#include "zcash/IncrementalMerkleTree.hpp"
+
+#include <vector>
+
+/** Commitments appended per iteration, about a busy block's worth. */
+static const size_t WITNESS_BENCH_BLOCK_COMMITMENTS = 64;
+
+static uint256 RandomHash(FastRandomContext& rng)
+{
+    uint256 hash;
+    for (int i = 0; i < 4; i++) {
+        WriteLE64(hash.begin() + 8 * i, rng.rand64());
+    }
+    return hash;
+}
+
+// A tree whose last nNotes leaves are the wallet's notes, each with an
+// up-to-date witness, plus the commitments of the next block.
+struct BenchWitnesses {
+    SaplingMerkleTree tree;
+    std::vector<SaplingWitness> witnesses;
+    std::vector<uint256> block;
+};
+
+static BenchWitnesses MakeWitnesses(size_t nNotes)
+{
+    FastRandomContext rng(true);
+    BenchWitnesses wallet;
+    for (size_t i = 0; i < 1000; i++) {
+        wallet.tree.append(RandomHash(rng));
+    }
+    for (size_t i = 0; i < nNotes; i++) {
+        uint256 cm = RandomHash(rng);
+        wallet.tree.append(cm);
+        for (SaplingWitness& witness : wallet.witnesses) {
+            witness.append(cm);
+        }
+        wallet.witnesses.push_back(wallet.tree.witness());
+    }
+    for (size_t i = 0; i < WITNESS_BENCH_BLOCK_COMMITMENTS; i++) {
+        wallet.block.push_back(RandomHash(rng));
+    }
+    return wallet;
+}
+
+// Every witness hashes its own copy of each new subtree.
+static void WitnessAppendDirect(benchmark::State& state, size_t nNotes)
+{
+    BenchWitnesses wallet = MakeWitnesses(nNotes);
+    while (state.KeepRunning()) {
+        std::vector<SaplingWitness> witnesses = wallet.witnesses;
+        for (const uint256& cm : wallet.block) {
+            for (SaplingWitness& witness : witnesses) {
+                witness.append(cm);
+            }
+        }
+    }
+}
+
+// The witnesses share one frontier, so each subtree is hashed once.
+static void WitnessAppendShared(benchmark::State& state, size_t nNotes)
+{
+    BenchWitnesses wallet = MakeWitnesses(nNotes);
+    while (state.KeepRunning()) {
+        SaplingWitnessSet witnesses(wallet.tree);
+        for (const SaplingWitness& witness : wallet.witnesses) {
+            witnesses.add(witness);
+        }
+        for (const uint256& cm : wallet.block) {
+            witnesses.append(cm);
+        }
+        for (size_t i = 0; i < witnesses.size(); i++) {
+            witnesses.witness(i);
+        }
+    }
+}
+
+static void WitnessAppendDirect1(benchmark::State& state) { WitnessAppendDirect(state, 1); }
+static void WitnessAppendShared1(benchmark::State& state) { WitnessAppendShared(state, 1); }
+static void WitnessAppendDirect10(benchmark::State& state) { WitnessAppendDirect(state, 10); }
+static void WitnessAppendShared10(benchmark::State& state) { WitnessAppendShared(state, 10); }
+static void WitnessAppendDirect100(benchmark::State& state) { WitnessAppendDirect(state, 100); }
+static void WitnessAppendShared100(benchmark::State& state) { WitnessAppendShared(state, 100); }
+
+BENCHMARK(WitnessAppendDirect1);
+BENCHMARK(WitnessAppendShared1);
+BENCHMARK(WitnessAppendDirect10);
+BENCHMARK(WitnessAppendShared10);
+BENCHMARK(WitnessAppendDirect100);
+BENCHMARK(WitnessAppendShared100);
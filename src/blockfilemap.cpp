@@ -0,0 +1,89 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilemap.h"
+
+#include "util.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+CMappedBlockFile::~CMappedBlockFile()
+{
+#ifndef WIN32
+    munmap(const_cast<char*>(pdata), nSize);
+#endif
+}
+
+std::shared_ptr<const CMappedBlockFile> CMappedBlockFile::Open(const boost::filesystem::path& path, size_t nLength)
+{
+#ifdef WIN32
+    return nullptr;
+#else
+    if (nLength == 0)
+        return nullptr;
+
+    int fd = open(path.string().c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return nullptr;
+
+    // Never map past the end of the file: touching such pages raises SIGBUS
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < nLength) {
+        close(fd);
+        return nullptr;
+    }
+
+    void* p = mmap(nullptr, nLength, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        LogPrintf("Unable to map %s: %s\n", path.string(), strerror(errno));
+        return nullptr;
+    }
+    return std::make_shared<const CMappedBlockFile>((const char*)p, nLength);
+#endif
+}
+
+std::shared_ptr<const CMappedBlockFile> CBlockFileMappings::Get(int nFile, const boost::filesystem::path& path, size_t nLength)
+{
+    LOCK(cs);
+    auto it = mapMappings.find(nFile);
+    if (it != mapMappings.end()) {
+        lruFiles.splice(lruFiles.begin(), lruFiles, it->second.second);
+        return it->second.first;
+    }
+
+    std::shared_ptr<const CMappedBlockFile> mapped = CMappedBlockFile::Open(path, nLength);
+    if (!mapped)
+        return nullptr;
+
+    lruFiles.push_front(nFile);
+    mapMappings.emplace(nFile, std::make_pair(mapped, lruFiles.begin()));
+    while (mapMappings.size() > nMaxMappings) {
+        mapMappings.erase(lruFiles.back());
+        lruFiles.pop_back();
+    }
+    return mapped;
+}
+
+void CBlockFileMappings::Erase(int nFile)
+{
+    LOCK(cs);
+    auto it = mapMappings.find(nFile);
+    if (it != mapMappings.end()) {
+        lruFiles.erase(it->second.second);
+        mapMappings.erase(it);
+    }
+}
+
+void CBlockFileMappings::Clear()
+{
+    LOCK(cs);
+    mapMappings.clear();
+    lruFiles.clear();
+}
@@ -0,0 +1,71 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILEMAP_H
+#define BITCOIN_BLOCKFILEMAP_H
+
+#include "streams.h"
+#include "sync.h"
+
+#include <list>
+#include <map>
+#include <memory>
+
+#include <boost/filesystem/path.hpp>
+
+/** Number of finalized block files kept mapped at once. */
+static const size_t DEFAULT_BLOCKFILE_MAPPINGS = 64;
+
+/** A read-only memory mapping of the first bytes of a block file. */
+class CMappedBlockFile
+{
+private:
+    const char* pdata;
+    size_t nSize;
+
+public:
+    CMappedBlockFile(const char* pdataIn, size_t nSizeIn) : pdata(pdataIn), nSize(nSizeIn) {}
+    ~CMappedBlockFile();
+
+    CMappedBlockFile(const CMappedBlockFile&) = delete;
+    CMappedBlockFile& operator=(const CMappedBlockFile&) = delete;
+
+    /**
+     * Map the first nLength bytes of the file at path. Returns nullptr if the
+     * file is shorter than that or can't be mapped on this platform.
+     */
+    static std::shared_ptr<const CMappedBlockFile> Open(const boost::filesystem::path& path, size_t nLength);
+
+    const char* begin() const { return pdata; }
+    const char* end() const { return pdata + nSize; }
+    size_t size() const { return nSize; }
+};
+
+/**
+ * LRU of block file mappings, keyed by file number. Holders of a mapping
+ * can keep reading from it after it is evicted or its file is deleted.
+ */
+class CBlockFileMappings
+{
+private:
+    typedef std::list<int> LruList;
+
+    CCriticalSection cs;
+    const size_t nMaxMappings;
+    //! File numbers, most recently used first
+    LruList lruFiles;
+    std::map<int, std::pair<std::shared_ptr<const CMappedBlockFile>, LruList::iterator>> mapMappings;
+
+public:
+    explicit CBlockFileMappings(size_t nMaxMappingsIn) : nMaxMappings(nMaxMappingsIn) {}
+
+    /** Return the mapping of file nFile, mapping nLength bytes of path if it isn't mapped yet. */
+    std::shared_ptr<const CMappedBlockFile> Get(int nFile, const boost::filesystem::path& path, size_t nLength);
+
+    /** Forget the mapping of a file, e.g. because it was pruned. */
+    void Erase(int nFile);
+    void Clear();
+};
+
+#endif // BITCOIN_BLOCKFILEMAP_H
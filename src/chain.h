@@ -274,8 +274,15 @@ public:
     unsigned int nTime;
     unsigned int nBits;
     uint256 nNonce;
+
+protected:
+    //! Equihash solution. Only held in memory until the entry has been
+    //! written to the block tree DB, after which it is trimmed and read back
+    //! on demand by GetSolution().
     std::vector<unsigned char> nSolution;
+    bool fSolutionTrimmed;
 
+public:
     //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
     uint32_t nSequenceId;
 
@@ -308,6 +315,7 @@ public:
         nBits = 0;
         nNonce = uint256();
         nSolution.clear();
+        fSolutionTrimmed = false;
     }
 
     CBlockIndex()
@@ -348,9 +356,9 @@ public:
         return ret;
     }
 
-    CBlockHeader GetBlockHeader() const
+    //! Fails if the trimmed Equihash solution can't be read back.
+    bool GetBlockHeader(CBlockHeader& block) const
     {
-        CBlockHeader block;
         block.nVersion = nVersion;
         if (pprev)
             block.hashPrevBlock = pprev->GetBlockHash();
@@ -359,8 +367,25 @@ public:
         block.nTime = nTime;
         block.nBits = nBits;
         block.nNonce = nNonce;
-        block.nSolution = nSolution;
-        return block;
+        return GetSolution(block.nSolution);
+    }
+
+    //! Whether the Equihash solution is still held in memory.
+    bool HasSolution() const
+    {
+        return !fSolutionTrimmed;
+    }
+
+    //! The Equihash solution, read from the block tree DB if it has been
+    //! trimmed. Returns false if that read fails. Defined in main.cpp.
+    bool GetSolution(std::vector<unsigned char>& solution) const;
+
+    //! Release the in-memory Equihash solution. Only valid once this entry
+    //! has been written to the block tree DB.
+    void TrimSolution()
+    {
+        std::vector<unsigned char>().swap(nSolution);
+        fSolutionTrimmed = true;
     }
 
     uint256 GetBlockHash() const
@@ -442,6 +467,14 @@ public:
     explicit CDiskBlockIndex(const CBlockIndex* pindex) : CBlockIndex(*pindex)
     {
         hashPrev = (pprev ? pprev->GetBlockHash() : uint256());
+        // Stays trimmed if the solution can't be read; don't write it then.
+        if (!HasSolution() && pindex->GetSolution(nSolution))
+            fSolutionTrimmed = false;
+    }
+
+    const std::vector<unsigned char>& GetDiskSolution() const
+    {
+        return nSolution;
     }
 
     ADD_SERIALIZE_METHODS;
@@ -4,6 +4,8 @@
 
 #include "coins.h"
 
+#include "clientversion.h"
+#include "crypto/chacha20.h"
 #include "memusage.h"
 #include "random.h"
 #include "version.h"
@@ -44,6 +46,87 @@ bool CCoins::Spend(uint32_t nPos)
     Cleanup();
     return true;
 }
+
+void CCoinsSetHash::Update(const uint256 &txid, const CCoins &coins, bool fAdd)
+{
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << txid;
+    ss << VARINT(coins.nHeight * 2 + (coins.fCoinBase ? 1 : 0));
+    for (unsigned int i = 0; i < coins.vout.size(); i++) {
+        if (!coins.vout[i].IsNull()) {
+            ss << VARINT(i + 1);
+            ss << coins.vout[i];
+        }
+    }
+    ss << VARINT(0);
+    uint256 seed = ss.GetHash();
+
+    // Expand the record hash to one value per lane
+    unsigned char expanded[LANES * 2];
+    ChaCha20 rng(seed.begin(), seed.size());
+    rng.Output(expanded, sizeof(expanded));
+    for (size_t i = 0; i < LANES; i++) {
+        uint16_t v = expanded[2 * i] | (expanded[2 * i + 1] << 8);
+        lanes[i] = fAdd ? lanes[i] + v : lanes[i] - v;
+    }
+}
+
+CCoinsSetHash& CCoinsSetHash::operator+=(const CCoinsSetHash &other)
+{
+    for (size_t i = 0; i < LANES; i++) {
+        lanes[i] += other.lanes[i];
+    }
+    return *this;
+}
+
+uint256 CCoinsSetHash::GetHash() const
+{
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    for (size_t i = 0; i < LANES; i++) {
+        ss << lanes[i];
+    }
+    return ss.GetHash();
+}
+
+void CCoinsStats::AddCoins(const uint256 &txid, const CCoins &coins)
+{
+    if (coins.IsPruned())
+        return;
+    nTransactions++;
+    for (const CTxOut &out : coins.vout) {
+        if (!out.IsNull()) {
+            nTransactionOutputs++;
+            nTotalAmount += out.nValue;
+        }
+    }
+    // The txid and the record, as stored in the coins database
+    nSerializedSize += 32 + ::GetSerializeSize(coins, SER_DISK, CLIENT_VERSION);
+    setHash.Add(txid, coins);
+}
+
+void CCoinsStats::RemoveCoins(const uint256 &txid, const CCoins &coins)
+{
+    if (coins.IsPruned())
+        return;
+    nTransactions--;
+    for (const CTxOut &out : coins.vout) {
+        if (!out.IsNull()) {
+            nTransactionOutputs--;
+            nTotalAmount -= out.nValue;
+        }
+    }
+    nSerializedSize -= 32 + ::GetSerializeSize(coins, SER_DISK, CLIENT_VERSION);
+    setHash.Remove(txid, coins);
+}
+
+void CCoinsStats::Merge(const CCoinsStats &other)
+{
+    nTransactions += other.nTransactions;
+    nTransactionOutputs += other.nTransactionOutputs;
+    nSerializedSize += other.nSerializedSize;
+    nTotalAmount += other.nTotalAmount;
+    setHash += other.setHash;
+}
 bool CCoinsView::GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const { return false; }
 bool CCoinsView::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const { return false; }
 bool CCoinsView::GetNullifier(const uint256 &nullifier, ShieldedType type) const { return false; }
@@ -97,7 +180,7 @@ bool CCoinsViewBacked::GetStats(CCoinsStats &stats) const { return base->GetStat
 
 SaltedTxidHasher::SaltedTxidHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), cachedCoinsUsage(0) { }
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), cachedCoinsUsage(0), nWriteSequence(0) { }
 
 CCoinsViewCache::~CCoinsViewCache()
 {
@@ -105,31 +188,41 @@ CCoinsViewCache::~CCoinsViewCache()
 }
 
 size_t CCoinsViewCache::DynamicMemoryUsage() const {
-    return memusage::DynamicUsage(cacheCoins) +
-           memusage::DynamicUsage(cacheSproutAnchors) +
-           memusage::DynamicUsage(cacheSaplingAnchors) +
-           memusage::DynamicUsage(cacheSproutNullifiers) +
-           memusage::DynamicUsage(cacheSaplingNullifiers) +
-           memusage::DynamicUsage(historyCacheMap) +
-           cachedCoinsUsage;
+    size_t usage = memusage::DynamicUsage(cacheSproutAnchors) +
+                   memusage::DynamicUsage(cacheSaplingAnchors) +
+                   memusage::DynamicUsage(cacheSproutNullifiers) +
+                   memusage::DynamicUsage(cacheSaplingNullifiers) +
+                   memusage::DynamicUsage(historyCacheMap) +
+                   cachedCoinsUsage;
+    for (CCoinsCacheShard& shard : cacheCoins) {
+        std::lock_guard<std::mutex> lock(shard.cs);
+        usage += memusage::DynamicUsage(shard.map) + shard.cachedCoinsUsage;
+    }
+    return usage;
 }
 
-CCoinsMap::const_iterator CCoinsViewCache::FetchCoins(const uint256 &txid) const {
-    CCoinsMap::iterator it = cacheCoins.find(txid);
-    if (it != cacheCoins.end())
-        return it;
+CCoinsCacheShard& CCoinsViewCache::GetShard(const uint256 &txid) const {
+    return cacheCoins[shardHasher(txid) % COINS_CACHE_SHARDS];
+}
+
+CCoinsCacheEntry* CCoinsViewCache::FetchCoins(CCoinsCacheShard &shard, const uint256 &txid) const {
+    CCoinsMap::iterator it = shard.map.find(txid);
+    if (it != shard.map.end()) {
+        it->second.flags |= CCoinsCacheEntry::HOT;
+        return &it->second;
+    }
     CCoins tmp;
     if (!base->GetCoins(txid, tmp))
-        return cacheCoins.end();
-    CCoinsMap::iterator ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry())).first;
+        return NULL;
+    CCoinsMap::iterator ret = shard.map.insert(std::make_pair(txid, CCoinsCacheEntry())).first;
     tmp.swap(ret->second.coins);
     if (ret->second.coins.IsPruned()) {
         // The parent only has an empty entry for this txid; we can consider our
         // version as fresh.
         ret->second.flags = CCoinsCacheEntry::FRESH;
     }
-    cachedCoinsUsage += ret->second.coins.DynamicMemoryUsage();
-    return ret;
+    shard.cachedCoinsUsage += ret->second.coins.DynamicMemoryUsage();
+    return &ret->second;
 }
 
 
@@ -647,9 +740,11 @@ void CCoinsViewCache::SetNullifiers(const CTransaction& tx, bool spent) {
 }
 
 bool CCoinsViewCache::GetCoins(const uint256 &txid, CCoins &coins) const {
-    CCoinsMap::const_iterator it = FetchCoins(txid);
-    if (it != cacheCoins.end()) {
-        coins = it->second.coins;
+    CCoinsCacheShard& shard = GetShard(txid);
+    std::lock_guard<std::mutex> lock(shard.cs);
+    const CCoinsCacheEntry* entry = FetchCoins(shard, txid);
+    if (entry) {
+        coins = entry->coins;
         return true;
     }
     return false;
@@ -657,7 +752,9 @@ bool CCoinsViewCache::GetCoins(const uint256 &txid, CCoins &coins) const {
 
 CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256 &txid) {
     assert(!hasModifier);
-    std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry()));
+    CCoinsCacheShard& shard = GetShard(txid);
+    std::lock_guard<std::mutex> lock(shard.cs);
+    std::pair<CCoinsMap::iterator, bool> ret = shard.map.insert(std::make_pair(txid, CCoinsCacheEntry()));
     size_t cachedCoinUsage = 0;
     if (ret.second) {
         if (!base->GetCoins(txid, ret.first->second.coins)) {
@@ -673,37 +770,57 @@ CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256 &txid) {
     }
     // Assume that whenever ModifyCoins is called, the entry will be modified.
     ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
-    return CCoinsModifier(*this, ret.first, cachedCoinUsage);
+    return CCoinsModifier(*this, shard, ret.first, cachedCoinUsage);
 }
 
 CCoinsModifier CCoinsViewCache::ModifyNewCoins(const uint256 &txid) {
     assert(!hasModifier);
-    std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry()));
+    CCoinsCacheShard& shard = GetShard(txid);
+    std::lock_guard<std::mutex> lock(shard.cs);
+    std::pair<CCoinsMap::iterator, bool> ret = shard.map.insert(std::make_pair(txid, CCoinsCacheEntry()));
     ret.first->second.coins.Clear();
     ret.first->second.flags = CCoinsCacheEntry::FRESH;
     ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
-    return CCoinsModifier(*this, ret.first, 0);
+    return CCoinsModifier(*this, shard, ret.first, 0);
 }
 
 const CCoins* CCoinsViewCache::AccessCoins(const uint256 &txid) const {
-    CCoinsMap::const_iterator it = FetchCoins(txid);
-    if (it == cacheCoins.end()) {
+    CCoinsCacheShard& shard = GetShard(txid);
+    std::lock_guard<std::mutex> lock(shard.cs);
+    const CCoinsCacheEntry* entry = FetchCoins(shard, txid);
+    if (!entry) {
         return NULL;
     } else {
-        return &it->second.coins;
+        return &entry->coins;
     }
 }
 
 bool CCoinsViewCache::HaveCoins(const uint256 &txid) const {
-    CCoinsMap::const_iterator it = FetchCoins(txid);
+    CCoinsCacheShard& shard = GetShard(txid);
+    std::lock_guard<std::mutex> lock(shard.cs);
+    const CCoinsCacheEntry* entry = FetchCoins(shard, txid);
     // We're using vtx.empty() instead of IsPruned here for performance reasons,
     // as we only care about the case where a transaction was replaced entirely
     // in a reorganization (which wipes vout entirely, as opposed to spending
     // which just cleans individual outputs).
-    return (it != cacheCoins.end() && !it->second.coins.vout.empty());
+    return (entry && !entry->coins.vout.empty());
+}
+
+bool CCoinsViewCache::PeekCoins(const uint256 &txid, CCoins &coins) const {
+    CCoinsCacheShard& shard = GetShard(txid);
+    std::lock_guard<std::mutex> lock(shard.cs);
+    CCoinsMap::const_iterator it = shard.map.find(txid);
+    if (it != shard.map.end()) {
+        coins = it->second.coins;
+        return true;
+    }
+    // Don't cache a miss: the caller may not exclude holders of a
+    // CCoinsModifier, whose iterator an insert could invalidate.
+    return base->GetCoins(txid, coins);
 }
 
 uint256 CCoinsViewCache::GetBestBlock() const {
+    std::lock_guard<std::mutex> lock(cs_hashBlock);
     if (hashBlock.IsNull())
         hashBlock = base->GetBestBlock();
     return hashBlock;
@@ -728,6 +845,7 @@ uint256 CCoinsViewCache::GetBestAnchor(ShieldedType type) const {
 }
 
 void CCoinsViewCache::SetBestBlock(const uint256 &hashBlockIn) {
+    std::lock_guard<std::mutex> lock(cs_hashBlock);
     hashBlock = hashBlockIn;
 }
 
@@ -823,19 +941,22 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins,
                                  CNullifiersMap &mapSaplingNullifiers,
                                  CHistoryCacheMap &historyCacheMapIn) {
     assert(!hasModifier);
+    nWriteSequence++;
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) { // Ignore non-dirty entries (optimization).
-            CCoinsMap::iterator itUs = cacheCoins.find(it->first);
-            if (itUs == cacheCoins.end()) {
+            CCoinsCacheShard& shard = GetShard(it->first);
+            std::lock_guard<std::mutex> lock(shard.cs);
+            CCoinsMap::iterator itUs = shard.map.find(it->first);
+            if (itUs == shard.map.end()) {
                 if (!it->second.coins.IsPruned()) {
                     // The parent cache does not have an entry, while the child
                     // cache does have (a non-pruned) one. Move the data up, and
                     // mark it as fresh (if the grandparent did have it, we
                     // would have pulled it in at first GetCoins).
                     assert(it->second.flags & CCoinsCacheEntry::FRESH);
-                    CCoinsCacheEntry& entry = cacheCoins[it->first];
+                    CCoinsCacheEntry& entry = shard.map[it->first];
                     entry.coins.swap(it->second.coins);
-                    cachedCoinsUsage += entry.coins.DynamicMemoryUsage();
+                    shard.cachedCoinsUsage += entry.coins.DynamicMemoryUsage();
                     entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
                 }
             } else {
@@ -843,13 +964,13 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins,
                     // The grandparent does not have an entry, and the child is
                     // modified and being pruned. This means we can just delete
                     // it from the parent.
-                    cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
-                    cacheCoins.erase(itUs);
+                    shard.cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
+                    shard.map.erase(itUs);
                 } else {
                     // A normal modification.
-                    cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
+                    shard.cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
                     itUs->second.coins.swap(it->second.coins);
-                    cachedCoinsUsage += itUs->second.coins.DynamicMemoryUsage();
+                    shard.cachedCoinsUsage += itUs->second.coins.DynamicMemoryUsage();
                     itUs->second.flags |= CCoinsCacheEntry::DIRTY;
                 }
             }
@@ -867,13 +988,61 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins,
 
     hashSproutAnchor = hashSproutAnchorIn;
     hashSaplingAnchor = hashSaplingAnchorIn;
-    hashBlock = hashBlockIn;
+    SetBestBlock(hashBlockIn);
+    nWriteSequence++;
     return true;
 }
 
-bool CCoinsViewCache::Flush() {
-    bool fOk = base->BatchWrite(cacheCoins,
-                                hashBlock,
+bool CCoinsViewCache::Flush(size_t nKeepUsage) {
+    // Hold every shard until the base has the coins, so that concurrent
+    // readers never miss an entry and fall through to a stale base.
+    std::vector<std::unique_lock<std::mutex>> shardLocks;
+    shardLocks.reserve(COINS_CACHE_SHARDS);
+    for (CCoinsCacheShard& shard : cacheCoins)
+        shardLocks.emplace_back(shard.cs);
+    nWriteSequence++;
+
+    uint256 hashBlockCopy;
+    {
+        std::lock_guard<std::mutex> lock(cs_hashBlock);
+        hashBlockCopy = hashBlock;
+    }
+
+    // The base takes a single map, so that it can write all of it at once.
+    // Entries that stay cached are copied to it when dirty, the rest moved.
+    const size_t nNodeUsage = memusage::MallocUsage(sizeof(memusage::boost_unordered_node<CCoinsMap::value_type>));
+    const size_t nKeepPerShard = nKeepUsage / COINS_CACHE_SHARDS;
+    CCoinsMap mapCoins;
+    for (CCoinsCacheShard& shard : cacheCoins) {
+        size_t nKept = 0;
+        size_t nKeptCoinsUsage = 0;
+        for (CCoinsMap::iterator it = shard.map.begin(); it != shard.map.end();) {
+            size_t nCoinsUsage = it->second.coins.DynamicMemoryUsage();
+            bool fKeep = (it->second.flags & (CCoinsCacheEntry::FRESH | CCoinsCacheEntry::HOT)) &&
+                         !it->second.coins.IsPruned() &&
+                         nKept + nNodeUsage + nCoinsUsage <= nKeepPerShard;
+            if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+                CCoinsCacheEntry& entry = mapCoins[it->first];
+                if (fKeep)
+                    entry.coins = it->second.coins;
+                else
+                    entry.coins.swap(it->second.coins);
+                entry.flags = it->second.flags;
+            }
+            if (fKeep) {
+                it->second.flags = 0;
+                nKept += nNodeUsage + nCoinsUsage;
+                nKeptCoinsUsage += nCoinsUsage;
+                it++;
+            } else {
+                it = shard.map.erase(it);
+            }
+        }
+        shard.cachedCoinsUsage = nKeptCoinsUsage;
+    }
+
+    bool fOk = base->BatchWrite(mapCoins,
+                                hashBlockCopy,
                                 hashSproutAnchor,
                                 hashSaplingAnchor,
                                 cacheSproutAnchors,
@@ -881,18 +1050,23 @@ bool CCoinsViewCache::Flush() {
                                 cacheSproutNullifiers,
                                 cacheSaplingNullifiers,
                                 historyCacheMap);
-    cacheCoins.clear();
     cacheSproutAnchors.clear();
     cacheSaplingAnchors.clear();
     cacheSproutNullifiers.clear();
     cacheSaplingNullifiers.clear();
     historyCacheMap.clear();
     cachedCoinsUsage = 0;
+    nWriteSequence++;
     return fOk;
 }
 
 unsigned int CCoinsViewCache::GetCacheSize() const {
-    return cacheCoins.size();
+    unsigned int nSize = 0;
+    for (CCoinsCacheShard& shard : cacheCoins) {
+        std::lock_guard<std::mutex> lock(shard.cs);
+        nSize += shard.map.size();
+    }
+    return nSize;
 }
 
 const CTxOut &CCoinsViewCache::GetOutputFor(const CTxIn& input) const
@@ -1024,7 +1198,7 @@ double CCoinsViewCache::GetPriority(const CTransaction &tx, int nHeight) const
     return tx.ComputePriority(dResult);
 }
 
-CCoinsModifier::CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage) : cache(cache_), it(it_), cachedCoinUsage(usage) {
+CCoinsModifier::CCoinsModifier(CCoinsViewCache& cache_, CCoinsCacheShard& shard_, CCoinsMap::iterator it_, size_t usage) : cache(cache_), shard(shard_), it(it_), cachedCoinUsage(usage) {
     assert(!cache.hasModifier);
     cache.hasModifier = true;
 }
@@ -1033,12 +1207,13 @@ CCoinsModifier::~CCoinsModifier()
 {
     assert(cache.hasModifier);
     cache.hasModifier = false;
+    std::lock_guard<std::mutex> lock(shard.cs);
     it->second.coins.Cleanup();
-    cache.cachedCoinsUsage -= cachedCoinUsage; // Subtract the old usage
+    shard.cachedCoinsUsage -= cachedCoinUsage; // Subtract the old usage
     if ((it->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
-        cache.cacheCoins.erase(it);
+        shard.map.erase(it);
     } else {
         // If the coin still exists after the modification, add the new usage
-        cache.cachedCoinsUsage += it->second.coins.DynamicMemoryUsage();
+        shard.cachedCoinsUsage += it->second.coins.DynamicMemoryUsage();
     }
 }
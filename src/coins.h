@@ -14,7 +14,10 @@
 #include "uint256.h"
 
 #include <assert.h>
+#include <atomic>
+#include <mutex>
 #include <stdint.h>
+#include <string.h>
 
 #include <boost/unordered_map.hpp>
 #include "zcash/History.hpp"
@@ -270,6 +273,7 @@ struct CCoinsCacheEntry
     enum Flags {
         DIRTY = (1 << 0), // This cache entry is potentially different from the version in the parent view.
         FRESH = (1 << 1), // The parent view does not have this entry (or it is pruned).
+        HOT = (1 << 2), // This cache entry has been read again since it was cached or last flushed.
     };
 
     CCoinsCacheEntry() : coins(), flags(0) {}
@@ -325,6 +329,46 @@ typedef boost::unordered_map<uint256, CAnchorsSaplingCacheEntry, SaltedTxidHashe
 typedef boost::unordered_map<uint256, CNullifiersCacheEntry, SaltedTxidHasher> CNullifiersMap;
 typedef boost::unordered_map<uint32_t, HistoryCache> CHistoryCacheMap;
 
+/** Number of partitions of a CCoinsViewCache's coins, each behind its own lock. */
+static const size_t COINS_CACHE_SHARDS = 16;
+
+/**
+ * One partition of the coins held by a CCoinsViewCache. The lock is never
+ * held while taking another lock of the same cache, only those of its base.
+ */
+struct CCoinsCacheShard
+{
+    //! Guards map and cachedCoinsUsage
+    std::mutex cs;
+    CCoinsMap map;
+    //! Cached dynamic memory usage for the CCoins objects in map
+    size_t cachedCoinsUsage;
+
+    CCoinsCacheShard() : cachedCoinsUsage(0) {}
+};
+
+/**
+ * Order-independent hash of a set of CCoins records: each record is
+ * expanded to 1024 16-bit lanes which are summed lane-wise (LtHash), so a
+ * set can be hashed in shards and updated as records come and go.
+ */
+class CCoinsSetHash
+{
+private:
+    static const size_t LANES = 1024;
+    uint16_t lanes[LANES];
+
+    void Update(const uint256 &txid, const CCoins &coins, bool fAdd);
+
+public:
+    CCoinsSetHash() { memset(lanes, 0, sizeof(lanes)); }
+
+    void Add(const uint256 &txid, const CCoins &coins) { Update(txid, coins, true); }
+    void Remove(const uint256 &txid, const CCoins &coins) { Update(txid, coins, false); }
+    CCoinsSetHash& operator+=(const CCoinsSetHash &other);
+    uint256 GetHash() const;
+};
+
 struct CCoinsStats
 {
     int nHeight;
@@ -332,10 +376,19 @@ struct CCoinsStats
     uint64_t nTransactions;
     uint64_t nTransactionOutputs;
     uint64_t nSerializedSize;
+    //! Hash of setHash, identifying the unspent output set. Not kept up to
+    //! date by the methods below; set it once the totals are complete.
     uint256 hashSerialized;
     CAmount nTotalAmount;
+    CCoinsSetHash setHash;
 
     CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
+
+    //! Count a record of the set; pruned records are not part of it
+    void AddCoins(const uint256 &txid, const CCoins &coins);
+    void RemoveCoins(const uint256 &txid, const CCoins &coins);
+    //! Add the totals of a disjoint part of the same set
+    void Merge(const CCoinsStats &other);
 };
 
 
@@ -437,9 +490,10 @@ class CCoinsModifier
 {
 private:
     CCoinsViewCache& cache;
+    CCoinsCacheShard& shard;
     CCoinsMap::iterator it;
     size_t cachedCoinUsage; // Cached memory usage of the CCoins object before modification
-    CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage);
+    CCoinsModifier(CCoinsViewCache& cache_, CCoinsCacheShard& shard_, CCoinsMap::iterator it_, size_t usage);
 
 public:
     CCoins* operator->() { return &it->second.coins; }
@@ -456,20 +510,35 @@ enum class UnsatisfiedShieldedReq {
     SaplingUnknownAnchor,
 };
 
-/** CCoinsView that adds a memory cache for transactions to another CCoinsView */
+/**
+ * CCoinsView that adds a memory cache for transactions to another CCoinsView.
+ *
+ * The coins are partitioned into COINS_CACHE_SHARDS shards by a salted txid
+ * hash, each with its own lock. GetCoins, HaveCoins and GetBestBlock copy
+ * their result out under those locks, so they may run on several threads at
+ * once, also while BatchWrite or Flush updates this cache. GetCoins and
+ * HaveCoins cache what they read from the base, which invalidates the
+ * iterator held by a CCoinsModifier, so callers that don't hold off
+ * modifiers (cs_main, for pcoinsTip) must use PeekCoins instead. Everything
+ * else, including pointers from AccessCoins, still relies on the caller to
+ * keep out other users.
+ */
 class CCoinsViewCache : public CCoinsViewBacked
 {
 protected:
     /* Whether this cache has an active modifier. */
     bool hasModifier;
 
+    /** Picks the shard of a txid. */
+    const SaltedTxidHasher shardHasher;
 
     /**
      * Make mutable so that we can "fill the cache" even from Get-methods
      * declared as "const".
      */
+    mutable std::mutex cs_hashBlock;
     mutable uint256 hashBlock;
-    mutable CCoinsMap cacheCoins;
+    mutable CCoinsCacheShard cacheCoins[COINS_CACHE_SHARDS];
     mutable uint256 hashSproutAnchor;
     mutable uint256 hashSaplingAnchor;
     mutable CAnchorsSproutMap cacheSproutAnchors;
@@ -478,9 +547,12 @@ protected:
     mutable CNullifiersMap cacheSaplingNullifiers;
     mutable CHistoryCacheMap historyCacheMap;
 
-    /* Cached dynamic memory usage for the inner CCoins objects. */
+    /* Cached dynamic memory usage for the commitment trees; coins are counted per shard. */
     mutable size_t cachedCoinsUsage;
 
+    /* Bumped before and after every BatchWrite and Flush, so odd while one runs. */
+    std::atomic<uint64_t> nWriteSequence;
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
     ~CCoinsViewCache();
@@ -552,12 +624,28 @@ public:
      * Push the modifications applied to this cache to its base.
      * Failure to call this method before destruction will cause the changes to be forgotten.
      * If false is returned, the state of this cache (and its backing view) will be undefined.
+     *
+     * Up to nKeepUsage bytes of coins that were created or read again since
+     * the last flush stay cached, as clean entries; everything else is dropped.
      */
-    bool Flush();
+    bool Flush(size_t nKeepUsage = 0);
 
     //! Calculate the size of the cache (in number of transactions)
     unsigned int GetCacheSize() const;
 
+    /**
+     * Lets readers that don't exclude writers check that several lookups saw
+     * the same state: take the sequence before and after, and retry if it
+     * was odd or changed.
+     */
+    uint64_t GetWriteSequence() const { return nWriteSequence.load(); }
+
+    /**
+     * Like GetCoins, but reads a coin that isn't cached straight from the
+     * base, leaving the cache as it is. Safe alongside CCoinsModifiers.
+     */
+    bool PeekCoins(const uint256 &txid, CCoins &coins) const;
+
     //! Calculate the size of the cache (in bytes)
     size_t DynamicMemoryUsage() const;
 
@@ -584,9 +672,12 @@ public:
 
     friend class CCoinsModifier;
 
+protected:
+    CCoinsCacheShard& GetShard(const uint256 &txid) const;
+
 private:
-    CCoinsMap::iterator FetchCoins(const uint256 &txid);
-    CCoinsMap::const_iterator FetchCoins(const uint256 &txid) const;
+    //! Find or pull in the cache entry of txid; shard.cs must be held
+    CCoinsCacheEntry* FetchCoins(CCoinsCacheShard &shard, const uint256 &txid) const;
 
     /**
      * By making the copy constructor private, we prevent accidentally using it when one intends to create a cache on top of a base cache.
@@ -53,6 +53,11 @@ public:
      */
     CDBBatch(const CDBWrapper& _parent) : parent(_parent){};
 
+    void Clear()
+    {
+        batch.Clear();
+    }
+
     template <typename K, typename V>
     void Write(const K& key, const V& value)
     {
@@ -150,6 +155,7 @@ public:
 
 class CDBWrapper
 {
+    friend class CDBSnapshot;
 private:
     //! custom environment this database is using (may be NULL in case of default environment)
     leveldb::Env* penv;
@@ -172,18 +178,8 @@ private:
     //! the database itself
     leveldb::DB* pdb;
 
-public:
-    /**
-     * @param[in] path        Location in the filesystem where leveldb data will be stored.
-     * @param[in] nCacheSize  Configures various leveldb cache settings.
-     * @param[in] fMemory     If true, use leveldb's memory environment.
-     * @param[in] fWipe       If true, remove all existing data.
-     */
-    CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
-    ~CDBWrapper();
-
     template <typename K, typename V>
-    bool Read(const K& key, V& value) const
+    bool Read(const K& key, V& value, const leveldb::ReadOptions& options) const
     {
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
@@ -191,7 +187,7 @@ public:
         leveldb::Slice slKey(&ssKey[0], ssKey.size());
 
         std::string strValue;
-        leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
+        leveldb::Status status = pdb->Get(options, slKey, &strValue);
         if (!status.ok()) {
             if (status.IsNotFound())
                 return false;
@@ -207,6 +203,22 @@ public:
         return true;
     }
 
+public:
+    /**
+     * @param[in] path        Location in the filesystem where leveldb data will be stored.
+     * @param[in] nCacheSize  Configures various leveldb cache settings.
+     * @param[in] fMemory     If true, use leveldb's memory environment.
+     * @param[in] fWipe       If true, remove all existing data.
+     */
+    CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    ~CDBWrapper();
+
+    template <typename K, typename V>
+    bool Read(const K& key, V& value) const
+    {
+        return Read(key, value, readoptions);
+    }
+
     template <typename K, typename V>
     bool Write(const K& key, const V& value, bool fSync = false)
     {
@@ -267,4 +279,40 @@ public:
     bool IsEmpty();
 };
 
+/**
+ * Reads a CDBWrapper as it was when the snapshot was taken, unaffected by
+ * later writes. The database must outlive the snapshot.
+ */
+class CDBSnapshot
+{
+private:
+    const CDBWrapper& parent;
+    const leveldb::Snapshot* psnapshot;
+
+    CDBSnapshot(const CDBSnapshot&);
+    CDBSnapshot& operator=(const CDBSnapshot&);
+
+    leveldb::ReadOptions Options(const leveldb::ReadOptions& base) const
+    {
+        leveldb::ReadOptions options = base;
+        options.snapshot = psnapshot;
+        return options;
+    }
+
+public:
+    explicit CDBSnapshot(const CDBWrapper& _parent) : parent(_parent), psnapshot(_parent.pdb->GetSnapshot()) {}
+    ~CDBSnapshot() { parent.pdb->ReleaseSnapshot(psnapshot); }
+
+    template <typename K, typename V>
+    bool Read(const K& key, V& value) const
+    {
+        return parent.Read(key, value, Options(parent.readoptions));
+    }
+
+    CDBIterator* NewIterator() const
+    {
+        return new CDBIterator(parent, parent.pdb->NewIterator(Options(parent.iteroptions)));
+    }
+};
+
 #endif // BITCOIN_DBWRAPPER_H
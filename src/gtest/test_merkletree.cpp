@@ -16,6 +16,7 @@
 
 #include <stdexcept>
 
+#include "random.h"
 #include "serialize.h"
 #include "streams.h"
 #include "utilstrencodings.h"
@@ -289,3 +290,58 @@ TEST(merkletree, testZeroElements)
         ASSERT_TRUE(newTree.root() == oldroot);
     }
 }
+
+// Witnesses kept in an IncrementalWitnessSet must match witnesses that had
+// every commitment appended to them directly, however the notes interleave.
+template <typename Tree, typename Witness, typename WitnessSet>
+void test_witness_set()
+{
+    const size_t capacity = (size_t)1 << INCREMENTAL_MERKLE_TREE_DEPTH_TESTING;
+
+    for (int trial = 0; trial < 50; trial++) {
+        Tree tree;
+        size_t nPrefix = GetRandInt(capacity / 2);
+        for (size_t i = 0; i < nPrefix; i++) {
+            tree.append(GetRandHash());
+        }
+
+        WitnessSet witnesses(tree);
+        std::vector<Witness> expected;
+        while (witnesses.frontier().size() < capacity) {
+            auto cm = GetRandHash();
+            witnesses.append(cm);
+            for (Witness& w : expected) {
+                w.append(cm);
+            }
+
+            // Witness the commitment just appended now and then
+            if (GetRandInt(3) == 0) {
+                Witness w = witnesses.frontier().witness();
+                ASSERT_EQ(expected.size(), witnesses.add(w));
+                expected.push_back(w);
+            }
+
+            for (size_t i = 0; i < expected.size(); i++) {
+                Witness w = witnesses.witness(i);
+                ASSERT_TRUE(w == expected[i]);
+                ASSERT_EQ(expected[i].root(), w.root());
+                ASSERT_EQ(witnesses.frontier().root(), w.root());
+            }
+        }
+
+        // A witness that missed commitments can't join
+        Tree stale;
+        stale.append(GetRandHash());
+        ASSERT_THROW(witnesses.add(stale.witness()), std::runtime_error);
+    }
+}
+
+TEST(merkletree, WitnessSet)
+{
+    test_witness_set<SproutTestingMerkleTree, SproutTestingWitness, SproutTestingWitnessSet>();
+}
+
+TEST(merkletree, SaplingWitnessSet)
+{
+    test_witness_set<SaplingTestingMerkleTree, SaplingTestingWitness, SaplingTestingWitnessSet>();
+}
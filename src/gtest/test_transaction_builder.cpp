@@ -149,6 +149,65 @@ TEST(TransactionBuilder, SaplingToSapling) {
     RegtestDeactivateSapling();
 }
 
+TEST(TransactionBuilder, SaplingBatchVerification) {
+    auto consensusParams = RegtestActivateSapling();
+
+    auto sk = libzcash::SaplingSpendingKey::random();
+    auto expsk = sk.expanded_spending_key();
+    auto fvk = sk.full_viewing_key();
+    auto pa = sk.default_address();
+
+    std::vector<CTransaction> txs;
+    for (int i = 0; i < 2; i++) {
+        auto testNote = GetTestSaplingNote(pa, 40000);
+        auto builder = TransactionBuilder(consensusParams, 2);
+        builder.AddSaplingSpend(expsk, testNote.note, testNote.tree.root(), testNote.tree.witness());
+        builder.AddSaplingOutput(fvk.ovk, pa, 25000, {});
+        txs.push_back(builder.Build().GetTxOrThrow());
+    }
+
+    auto branchId = CurrentEpochBranchId(2, consensusParams);
+    std::vector<uint256> sighashes;
+    for (const CTransaction& tx : txs) {
+        sighashes.push_back(SignatureHash(CScript(), tx, NOT_AN_INPUT, SIGHASH_ALL, 0, branchId));
+    }
+
+    // Valid transactions pass as a batch
+    auto verifier = ProofVerifier::SaplingBatch();
+    EXPECT_TRUE(verifier.IsSaplingBatch());
+    for (size_t i = 0; i < txs.size(); i++) {
+        EXPECT_EQ(verifier.VerifySapling(txs[i], sighashes[i]), ProofVerifier::SAPLING_OK);
+    }
+    EXPECT_TRUE(verifier.VerifySaplingBatch());
+
+    // Swap in a well-formed proof for a different statement. Only the
+    // deferred batch check can notice it.
+    CMutableTransaction mtx(txs[0]);
+    mtx.vShieldedOutput[0].zkproof = txs[1].vShieldedOutput[0].zkproof;
+    CTransaction badTx(mtx);
+
+    EXPECT_EQ(verifier.VerifySapling(txs[1], sighashes[1]), ProofVerifier::SAPLING_OK);
+    EXPECT_EQ(verifier.VerifySapling(badTx, sighashes[0]), ProofVerifier::SAPLING_OK);
+    EXPECT_FALSE(verifier.VerifySaplingBatch());
+
+    // Checking transactions one at a time identifies the culprit
+    auto strict = ProofVerifier::Strict();
+    EXPECT_EQ(strict.VerifySapling(txs[1], sighashes[1]), ProofVerifier::SAPLING_OK);
+    EXPECT_EQ(strict.VerifySapling(badTx, sighashes[0]), ProofVerifier::SAPLING_OUTPUT_INVALID);
+
+    // The same checks as a check queue job
+    std::vector<const CTransaction*> vptxGood{&txs[0], &txs[1]};
+    CProofCheck goodCheck(vptxGood, CProofCheck::SAPLING, branchId);
+    EXPECT_TRUE(goodCheck());
+    std::vector<const CTransaction*> vptxBad{&txs[1], &badTx};
+    CProofCheck badProofCheck(vptxBad, CProofCheck::SAPLING, branchId);
+    CValidationCheck badCheck(badProofCheck);
+    EXPECT_FALSE(badCheck());
+
+    // Revert to default
+    RegtestDeactivateSapling();
+}
+
 TEST(TransactionBuilder, SaplingToSprout) {
     auto consensusParams = RegtestActivateSapling();
 
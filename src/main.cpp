@@ -12,6 +12,7 @@
 #include "addrman.h"
 #include "alert.h"
 #include "arith_uint256.h"
+#include "blockfilemap.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
@@ -226,6 +227,8 @@ int nLastBlockFile = 0;
  *  or if we allocate more file space when we're in prune mode
  */
 bool fCheckForPruning = false;
+/** Read-only mappings of finalized block files, shared by block and transaction reads. */
+static CBlockFileMappings blockFileMappings(DEFAULT_BLOCKFILE_MAPPINGS);
 
 /**
  * Every received block is assigned a unique and increasing identifier, so we
@@ -656,6 +659,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewCache* pcoinsTip = NULL;
+CCoinsViewWriteBehind* pcoinsWriteBehind = NULL;
 CBlockTreeDB* pblocktree = NULL;
 CSporkDB* pSporkDB = NULL;
 
@@ -971,6 +975,24 @@ bool ContextualCheckTransaction(
     const int nHeight,
     const int dosLevel,
     bool (*isInitBlockDownload)(const Consensus::Params&))
+{
+    auto verifier = ProofVerifier::Strict();
+    return ContextualCheckTransaction(tx, state, chainparams, nHeight, dosLevel, verifier, isInitBlockDownload);
+}
+
+/**
+ * As above, but Sapling descriptions are checked with the given verifier. If it is
+ * a batch verifier, the Sapling proofs of tx are only queued in it, and the caller
+ * is responsible for calling verifier.VerifySaplingBatch().
+ */
+bool ContextualCheckTransaction(
+    const CTransaction& tx,
+    CValidationState& state,
+    const CChainParams& chainparams,
+    const int nHeight,
+    const int dosLevel,
+    ProofVerifier& verifier,
+    bool (*isInitBlockDownload)(const Consensus::Params&))
 {
     auto consensus = chainparams.GetConsensus();
     auto consensusBranchId = CurrentEpochBranchId(nHeight, consensus);
@@ -1114,48 +1136,19 @@ bool ContextualCheckTransaction(
 
     if (!tx.vShieldedSpend.empty() ||
         !tx.vShieldedOutput.empty()) {
-        auto ctx = librustzcash_sapling_verification_ctx_init();
-
-        for (const SpendDescription& spend : tx.vShieldedSpend) {
-            if (!librustzcash_sapling_check_spend(
-                    ctx,
-                    spend.cv.begin(),
-                    spend.anchor.begin(),
-                    spend.nullifier.begin(),
-                    spend.rk.begin(),
-                    spend.zkproof.begin(),
-                    spend.spendAuthSig.begin(),
-                    dataToBeSigned.begin())) {
-                librustzcash_sapling_verification_ctx_free(ctx);
-                return state.DoS(100, error("ContextualCheckTransaction(): Sapling spend description invalid"),
-                                 REJECT_INVALID, "bad-txns-sapling-spend-description-invalid");
-            }
-        }
-
-        for (const OutputDescription& output : tx.vShieldedOutput) {
-            if (!librustzcash_sapling_check_output(
-                    ctx,
-                    output.cv.begin(),
-                    output.cm.begin(),
-                    output.ephemeralKey.begin(),
-                    output.zkproof.begin())) {
-                librustzcash_sapling_verification_ctx_free(ctx);
-                return state.DoS(100, error("ContextualCheckTransaction(): Sapling output description invalid"),
-                                 REJECT_INVALID, "bad-txns-sapling-output-description-invalid");
-            }
-        }
-
-        if (!librustzcash_sapling_final_check(
-                ctx,
-                tx.valueBalance,
-                tx.bindingSig.begin(),
-                dataToBeSigned.begin())) {
-            librustzcash_sapling_verification_ctx_free(ctx);
+        switch (verifier.VerifySapling(tx, dataToBeSigned)) {
+        case ProofVerifier::SAPLING_SPEND_INVALID:
+            return state.DoS(100, error("ContextualCheckTransaction(): Sapling spend description invalid"),
+                             REJECT_INVALID, "bad-txns-sapling-spend-description-invalid");
+        case ProofVerifier::SAPLING_OUTPUT_INVALID:
+            return state.DoS(100, error("ContextualCheckTransaction(): Sapling output description invalid"),
+                             REJECT_INVALID, "bad-txns-sapling-output-description-invalid");
+        case ProofVerifier::SAPLING_BINDING_SIG_INVALID:
             return state.DoS(100, error("ContextualCheckTransaction(): Sapling binding signature invalid"),
                              REJECT_INVALID, "bad-txns-sapling-binding-signature-invalid");
+        case ProofVerifier::SAPLING_OK:
+            break;
         }
-
-        librustzcash_sapling_verification_ctx_free(ctx);
     }
     return true;
 }
@@ -1697,6 +1690,19 @@ bool AcceptToMemoryPool(const CChainParams& chainparams, CTxMemPool& pool, CVali
             return state.Error("AcceptToMemoryPool: " + errmsg);
         }
 
+        // Calculate in-mempool ancestors, up to a limit, so that a long
+        // unconfirmed chain can't make package tracking and block assembly slow.
+        CTxMemPool::setEntries setAncestors;
+        size_t nLimitAncestors = GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+        size_t nLimitAncestorSize = GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT) * 1000;
+        size_t nLimitDescendants = GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+        size_t nLimitDescendantSize = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT) * 1000;
+        std::string errString;
+        if (!pool.CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString)) {
+            return state.DoS(0, error("AcceptToMemoryPool: too-long-mempool-chain %s: %s", hash.ToString(), errString),
+                             REJECT_NONSTANDARD, "too-long-mempool-chain");
+        }
+
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
         PrecomputedTransactionData txdata(tx);
@@ -1763,17 +1769,32 @@ bool GetSpentIndex(CSpentIndexKey& key, CSpentIndexValue& value)
     return true;
 }
 
-bool GetAddressIndex(uint160 addressHash, int type, std::vector<std::pair<CAddressIndexKey, CAmount>>& addressIndex, int start, int end)
+bool GetAddressIndex(uint160 addressHash, int type, std::vector<std::pair<CAddressIndexKey, CAmount>>& addressIndex, int start, int end,
+                     const CAddressIndexKey* pAfter, size_t nLimit)
 {
     if (!fAddressIndex)
         return error("address index not enabled");
 
-    if (!pblocktree->ReadAddressIndex(addressHash, type, addressIndex, start, end))
+    if (!pblocktree->ReadAddressIndex(addressHash, type, addressIndex, start, end, pAfter, nLimit))
         return error("unable to get txids for address");
 
     return true;
 }
 
+bool GetAddressBalance(uint160 addressHash, int type, CAmount& balance, CAmount& received)
+{
+    if (!fAddressIndex)
+        return error("address index not enabled");
+
+    CAddressBalanceValue value;
+    if (!pblocktree->ReadAddressBalance(addressHash, type, value))
+        return error("unable to get balance for address");
+
+    balance = value.balance;
+    received = value.received;
+    return true;
+}
+
 bool GetAddressUnspent(uint160 addressHash, int type, std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue>>& unspentOutputs)
 {
     if (!fAddressIndex)
@@ -1978,6 +1999,44 @@ bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransact
     return true;
 }
 
+/**
+ * The mapping of a block file, if it is finalized. The file still being
+ * appended to is read through stdio instead.
+ */
+static std::shared_ptr<const CMappedBlockFile> GetMappedBlockFile(int nFile)
+{
+    size_t nLength;
+    {
+        LOCK(cs_LastBlockFile);
+        if (nFile < 0 || nFile >= nLastBlockFile || nFile >= (int)vinfoBlockFile.size())
+            return nullptr;
+        nLength = vinfoBlockFile[nFile].nSize;
+    }
+    return blockFileMappings.Get(nFile, GetBlockPosFilename(CDiskBlockPos(nFile, 0), "blk"), nLength);
+}
+
+/**
+ * Call read(s) with s a stream positioned at pos in a block file: a span of
+ * the file's mapping when it is finalized, otherwise the opened file.
+ * Returns false if the file can't be opened; read errors are thrown.
+ */
+template <typename Reader>
+static bool ReadFromBlockFile(const CDiskBlockPos& pos, Reader read)
+{
+    std::shared_ptr<const CMappedBlockFile> mapped = GetMappedBlockFile(pos.nFile);
+    if (mapped && pos.nPos <= mapped->size()) {
+        CSpanReader s(SER_DISK, CLIENT_VERSION, mapped->begin() + pos.nPos, mapped->end());
+        read(s);
+        return true;
+    }
+
+    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return false;
+    read(filein);
+    return true;
+}
+
 /** Return transaction in tx, and if it was found inside a block, its hash is placed in hashBlock */
 bool GetTransaction(const uint256& hash, CTransaction& txOut, const Consensus::Params& consensusParams, uint256& hashBlock, bool fAllowSlow)
 {
@@ -1992,14 +2051,14 @@ bool GetTransaction(const uint256& hash, CTransaction& txOut, const Consensus::P
     if (fTxIndex) {
         CDiskTxPos postx;
         if (pblocktree->ReadTxIndex(hash, postx)) {
-            CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-            if (file.IsNull())
-                return error("%s: OpenBlockFile failed", __func__);
             CBlockHeader header;
             try {
-                file >> header;
-                fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                file >> txOut;
+                if (!ReadFromBlockFile(postx, [&](auto& s) { s >> header; }))
+                    return error("%s: OpenBlockFile failed", __func__);
+                // The transaction follows the header at nTxOffset
+                CDiskBlockPos postxData(postx.nFile, postx.nPos + ::GetSerializeSize(header, SER_DISK, CLIENT_VERSION) + postx.nTxOffset);
+                if (!ReadFromBlockFile(postxData, [&](auto& s) { s >> txOut; }))
+                    return error("%s: OpenBlockFile failed", __func__);
             } catch (const std::exception& e) {
                 return error("%s: Deserialize or I/O error - %s", __func__, e.what());
             }
@@ -2069,14 +2128,10 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
-
     // Read block
     try {
-        filein >> block;
+        if (!ReadFromBlockFile(pos, [&](auto& s) { s >> block; }))
+            return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
     } catch (const std::exception& e) {
         return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
     }
@@ -2099,6 +2154,43 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+{
+    block.clear();
+
+    // Seek back to the index header written by WriteBlockToDisk
+    CDiskBlockPos hpos = pos;
+    if (hpos.nPos < MESSAGE_START_SIZE + sizeof(unsigned int))
+        return error("ReadRawBlockFromDisk: no index header before %s", pos.ToString());
+    hpos.nPos -= MESSAGE_START_SIZE + sizeof(unsigned int);
+
+    try {
+        CMessageHeader::MessageStartChars blkStart;
+        unsigned int nSize = 0;
+        if (!ReadFromBlockFile(hpos, [&](auto& s) {
+                s >> FLATDATA(blkStart) >> nSize;
+                if (memcmp(blkStart, messageStart, MESSAGE_START_SIZE) || nSize > MAX_BLOCK_SIZE_AFTER_UPGRADE)
+                    return;
+                block.resize(nSize);
+                s.read((char*)block.data(), nSize);
+            }))
+            return error("ReadRawBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+        if (memcmp(blkStart, messageStart, MESSAGE_START_SIZE))
+            return error("ReadRawBlockFromDisk: Block magic mismatch for %s", pos.ToString());
+        if (nSize > MAX_BLOCK_SIZE_AFTER_UPGRADE)
+            return error("ReadRawBlockFromDisk: Block data is larger than maximum deserialization size for %s", pos.ToString());
+    } catch (const std::exception& e) {
+        return error("%s: Read from block file failed - %s at %s", __func__, e.what(), pos.ToString());
+    }
+
+    return true;
+}
+
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart)
+{
+    return ReadRawBlockFromDisk(block, pindex->GetBlockPos(), messageStart);
+}
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
     CAmount nSubsidy = 20 * COIN;
@@ -2439,6 +2531,38 @@ bool CScriptCheck::operator()()
     return true;
 }
 
+bool CProofCheck::operator()()
+{
+    if (type == SPROUT) {
+        auto verifier = ProofVerifier::Strict();
+        for (const CTransaction* ptx : vptx) {
+            for (const JSDescription& joinsplit : ptx->vjoinsplit) {
+                if (!verifier.VerifySprout(joinsplit, ptx->joinSplitPubKey)) {
+                    return ::error("CProofCheck(): %s joinsplit does not verify", ptx->GetHash().ToString());
+                }
+            }
+        }
+        return true;
+    }
+
+    auto verifier = ProofVerifier::SaplingBatch();
+    for (const CTransaction* ptx : vptx) {
+        uint256 dataToBeSigned;
+        try {
+            dataToBeSigned = SignatureHash(CScript(), *ptx, NOT_AN_INPUT, SIGHASH_ALL, 0, consensusBranchId);
+        } catch (const std::logic_error&) {
+            return ::error("CProofCheck(): %s error computing signature hash", ptx->GetHash().ToString());
+        }
+        if (verifier.VerifySapling(*ptx, dataToBeSigned) != ProofVerifier::SAPLING_OK) {
+            return ::error("CProofCheck(): %s Sapling descriptions invalid", ptx->GetHash().ToString());
+        }
+    }
+    if (!verifier.VerifySaplingBatch()) {
+        return ::error("CProofCheck(): Sapling proof batch of %u transactions invalid", vptx.size());
+    }
+    return true;
+}
+
 int GetSpendHeight(const CCoinsViewCache& inputs)
 {
     LOCK(cs_main);
@@ -2874,7 +2998,7 @@ void static FlushBlockFile(bool fFinalize = false)
 
 bool FindUndoPos(CValidationState& state, int nFile, CDiskBlockPos& pos, unsigned int nAddSize);
 
-static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+static CCheckQueue<CValidationCheck> scriptcheckqueue(128);
 
 void ThreadScriptCheck()
 {
@@ -2882,6 +3006,48 @@ void ThreadScriptCheck()
     scriptcheckqueue.Thread();
 }
 
+/**
+ * Verify the Sapling descriptions of the block's transactions on the check
+ * queue workers, split into about one proof batch per worker.
+ */
+static bool CheckSaplingProofsParallel(const CBlock& block, uint32_t consensusBranchId)
+{
+    size_t nDescriptions = 0;
+    for (const CTransaction& tx : block.vtx) {
+        nDescriptions += tx.vShieldedSpend.size() + tx.vShieldedOutput.size();
+    }
+    if (nDescriptions == 0) {
+        return true;
+    }
+
+    const size_t nPerBatch = (nDescriptions + nScriptCheckThreads - 1) / nScriptCheckThreads;
+    std::vector<CValidationCheck> vChecks;
+    std::vector<const CTransaction*> vptx;
+    size_t nBatch = 0;
+    for (const CTransaction& tx : block.vtx) {
+        size_t n = tx.vShieldedSpend.size() + tx.vShieldedOutput.size();
+        if (n == 0) {
+            continue;
+        }
+        vptx.push_back(&tx);
+        nBatch += n;
+        if (nBatch >= nPerBatch) {
+            CProofCheck check(vptx, CProofCheck::SAPLING, consensusBranchId);
+            vChecks.emplace_back(check);
+            vptx.clear();
+            nBatch = 0;
+        }
+    }
+    if (!vptx.empty()) {
+        CProofCheck check(vptx, CProofCheck::SAPLING, consensusBranchId);
+        vChecks.emplace_back(check);
+    }
+
+    CCheckQueueControl<CValidationCheck> control(&scriptcheckqueue);
+    control.Add(vChecks);
+    return control.Wait();
+}
+
 static int64_t nTimeVerify = 0;
 static int64_t nTimeConnect = 0;
 static int64_t nTimeIndex = 0;
@@ -2904,8 +3070,12 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     auto verifier = ProofVerifier::Strict();
     auto disabledVerifier = ProofVerifier::Disabled();
 
+    // With -par, JoinSplit proofs are verified on the check queue workers
+    // together with the scripts, instead of inline by CheckBlock.
+    const bool fParallelChecks = fExpensiveChecks && nScriptCheckThreads;
+
     // Check it again to verify JoinSplit proofs, and in case a previous version let a bad block in
-    if (!CheckBlock(block, state, chainparams, fExpensiveChecks ? verifier : disabledVerifier, !fJustCheck, !fJustCheck))
+    if (!CheckBlock(block, state, chainparams, fExpensiveChecks && !fParallelChecks ? verifier : disabledVerifier, !fJustCheck, !fJustCheck))
         return false;
 
     // verify that the view's current state corresponds to the previous block
@@ -2941,7 +3111,19 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     CBlockUndo blockundo;
 
-    CCheckQueueControl<CScriptCheck> control(fExpensiveChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
+    CCheckQueueControl<CValidationCheck> control(fParallelChecks ? &scriptcheckqueue : NULL);
+
+    if (fParallelChecks) {
+        std::vector<CValidationCheck> vProofChecks;
+        for (const CTransaction& tx : block.vtx) {
+            if (!tx.vjoinsplit.empty()) {
+                std::vector<const CTransaction*> vptx{&tx};
+                CProofCheck check(vptx, CProofCheck::SPROUT, 0);
+                vProofChecks.emplace_back(check);
+            }
+        }
+        control.Add(vProofChecks);
+    }
 
     int64_t nTimeStart = GetTimeMicros();
     CAmount nFees = 0;
@@ -3060,7 +3242,12 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             std::vector<CScriptCheck> vChecks;
             if (!ContextualCheckInputs(tx, state, view, fExpensiveChecks, flags, false, txdata[i], chainparams.GetConsensus(), consensusBranchId, nScriptCheckThreads ? &vChecks : NULL))
                 return false;
-            control.Add(vChecks);
+            std::vector<CValidationCheck> vQueued;
+            vQueued.reserve(vChecks.size());
+            for (CScriptCheck& check : vChecks) {
+                vQueued.emplace_back(check);
+            }
+            control.Add(vQueued);
         }
 
         if (fAddressIndex) {
@@ -3280,6 +3467,10 @@ bool static FlushStateToDisk(
             nLastFlush = nNow;
         }
         size_t cacheSize = pcoinsTip->DynamicMemoryUsage();
+        // Coins from the last flush that are still being written stay in
+        // memory until the write finishes.
+        if (pcoinsWriteBehind)
+            cacheSize += pcoinsWriteBehind->PendingUsage();
         // The cache is large and close to the limit, but we have time now (not in the middle of a block processing).
         bool fCacheLarge = mode == FLUSH_STATE_PERIODIC && cacheSize * (10.0 / 9) > nCoinCacheUsage;
         // The cache is over the limit, we have to write now.
@@ -3306,14 +3497,21 @@ bool static FlushStateToDisk(
                     it = setDirtyFileInfo.erase(it);
                 }
                 std::vector<const CBlockIndex*> vBlocks;
+                std::vector<CBlockIndex*> vTrim;
                 vBlocks.reserve(setDirtyBlockIndex.size());
+                vTrim.reserve(setDirtyBlockIndex.size());
                 for (set<CBlockIndex*>::iterator it = setDirtyBlockIndex.begin(); it != setDirtyBlockIndex.end();) {
                     vBlocks.push_back(*it);
+                    vTrim.push_back(*it);
                     it = setDirtyBlockIndex.erase(it);
                 }
                 if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks)) {
                     return AbortNode(state, "Files to write to block index database");
                 }
+                // The solutions are on disk now; stop holding them in memory.
+                for (CBlockIndex* pindex : vTrim) {
+                    pindex->TrimSolution();
+                }
             }
             // Finally remove any pruned files
             if (fFlushForPrune)
@@ -3330,8 +3528,15 @@ bool static FlushStateToDisk(
             if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
                 return state.Error("out of disk space");
             // Flush the chainstate (which may refer to block index entries).
-            if (!pcoinsTip->Flush())
+            // The coin database is written in the background, except when
+            // the caller relies on it being on disk or pruning has just
+            // removed the blocks needed to replay up to the tip.
+            if (!pcoinsTip->Flush(nCoinCacheUsage / 100 * COINS_CACHE_KEEP_PERCENT))
                 return AbortNode(state, "Failed to write to coin database");
+            if (pcoinsWriteBehind && (mode == FLUSH_STATE_ALWAYS || fFlushForPrune)) {
+                if (!pcoinsWriteBehind->Sync())
+                    return AbortNode(state, "Failed to write to coin database");
+            }
             nLastFlush = nNow;
         }
         // Don't flush the wallet witness cache (SetBestChain()) here, see #4301
@@ -3347,6 +3552,131 @@ void FlushStateToDisk()
     FlushStateToDisk(state, FLUSH_STATE_ALWAYS);
 }
 
+/**
+ * Statistics of the unspent output set at pcoinsTip's best block. Seeded by
+ * a full scan in GetUTXOStats and then carried across each connected or
+ * disconnected block. Protected by cs_main.
+ */
+static std::optional<CCoinsStats> coinsStatsTip;
+
+/**
+ * While GetUTXOStats scans the coins database: the changes made by each
+ * block connected or disconnected since the scan started, with hashBlock
+ * set to the best block after it. The first entry is empty and marks the
+ * best block when the scan started. Emptied if the changes can no longer
+ * be followed. Protected by cs_main.
+ */
+static std::optional<std::vector<CCoinsStats>> coinsStatsChanges;
+
+/** Only one scan at a time; later callers wait for it and use its result. */
+static CCriticalSection cs_coinsStatsScan;
+
+/**
+ * Carry coinsStatsTip across a block applied to pcoinsTip through view,
+ * before view is flushed. Only the records of the block's transactions and
+ * of the outputs they spend can change.
+ */
+static void UpdateCoinsStats(const CBlock& block, const CCoinsViewCache& view, const CBlockIndex* pindexNew)
+{
+    AssertLockHeld(cs_main);
+    if (coinsStatsTip && coinsStatsTip->hashBlock != pcoinsTip->GetBestBlock())
+        coinsStatsTip.reset();
+    if (coinsStatsChanges && !coinsStatsChanges->empty() &&
+        coinsStatsChanges->back().hashBlock != pcoinsTip->GetBestBlock())
+        coinsStatsChanges->clear();
+    bool fLogChanges = coinsStatsChanges && !coinsStatsChanges->empty();
+    if (!coinsStatsTip && !fLogChanges)
+        return;
+
+    std::set<uint256> setTouched;
+    for (const CTransaction& tx : block.vtx) {
+        setTouched.insert(tx.GetHash());
+        for (const CTxIn& txin : tx.vin) {
+            setTouched.insert(txin.prevout.hash);
+        }
+    }
+    // The totals wrap around where the block removes more than it adds,
+    // and come out right once merged into a complete set.
+    CCoinsStats changes;
+    for (const uint256& txid : setTouched) {
+        const CCoins* before = pcoinsTip->AccessCoins(txid);
+        if (before)
+            changes.RemoveCoins(txid, *before);
+        const CCoins* after = view.AccessCoins(txid);
+        if (after)
+            changes.AddCoins(txid, *after);
+    }
+    changes.hashBlock = view.GetBestBlock();
+    changes.nHeight = pindexNew ? pindexNew->nHeight : 0;
+
+    if (coinsStatsTip) {
+        coinsStatsTip->Merge(changes);
+        coinsStatsTip->hashBlock = changes.hashBlock;
+        coinsStatsTip->nHeight = changes.nHeight;
+        coinsStatsTip->hashSerialized = coinsStatsTip->setHash.GetHash();
+    }
+    if (fLogChanges)
+        coinsStatsChanges->push_back(changes);
+}
+
+/** Requires cs_coinsStatsScan. */
+static bool ScanUTXOStats(CCoinsStats& stats)
+{
+    {
+        LOCK(cs_main);
+        if (coinsStatsTip && coinsStatsTip->hashBlock == pcoinsTip->GetBestBlock()) {
+            stats = *coinsStatsTip;
+            return true;
+        }
+        CCoinsStats start;
+        start.hashBlock = pcoinsTip->GetBestBlock();
+        coinsStatsChanges = std::vector<CCoinsStats>(1, start);
+    }
+
+    // Scan without cs_main, like the database snapshot it reads. The flush
+    // puts the snapshot's block at or after the start of the change log.
+    FlushStateToDisk();
+    bool fOk = false;
+    try {
+        fOk = pcoinsTip->GetStats(stats);
+    } catch (...) {
+        LOCK(cs_main);
+        coinsStatsChanges.reset();
+        throw;
+    }
+
+    LOCK(cs_main);
+    std::vector<CCoinsStats> vChanges;
+    if (coinsStatsChanges)
+        vChanges.swap(*coinsStatsChanges);
+    coinsStatsChanges.reset();
+    if (!fOk)
+        return false;
+
+    // Catch up with the blocks applied since the snapshot's block. Failing
+    // that, the scan is still a consistent result for its own block.
+    for (size_t i = vChanges.size(); i-- > 0;) {
+        if (vChanges[i].hashBlock != stats.hashBlock)
+            continue;
+        for (size_t j = i + 1; j < vChanges.size(); j++) {
+            stats.Merge(vChanges[j]);
+            stats.hashBlock = vChanges[j].hashBlock;
+            stats.nHeight = vChanges[j].nHeight;
+        }
+        stats.hashSerialized = stats.setHash.GetHash();
+        if (stats.hashBlock == pcoinsTip->GetBestBlock())
+            coinsStatsTip = stats;
+        break;
+    }
+    return true;
+}
+
+bool GetUTXOStats(CCoinsStats& stats)
+{
+    LOCK(cs_coinsStatsScan);
+    return ScanUTXOStats(stats);
+}
+
 void PruneAndFlush()
 {
     CValidationState state;
@@ -3391,6 +3721,7 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
         CCoinsViewCache view(pcoinsTip);
         if (!DisconnectBlock(block, state, pindexDelete, view, chainparams))
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
+        UpdateCoinsStats(block, view, pindexDelete->pprev);
         assert(view.Flush());
     }
     LogPrint("bench", "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
@@ -3468,6 +3799,7 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
         nTime3 = GetTimeMicros();
         nTimeConnectTotal += nTime3 - nTime2;
         LogPrint("bench", "  - Connect total: %.2fms [%.2fs]\n", (nTime3 - nTime2) * 0.001, nTimeConnectTotal * 0.000001);
+        UpdateCoinsStats(*pblock, view, pindexNew);
         assert(view.Flush());
     }
     int64_t nTime4 = GetTimeMicros();
@@ -3942,6 +4274,22 @@ bool ReconsiderBlock(CValidationState& state, CBlockIndex* pindex)
     return true;
 }
 
+bool CBlockIndex::GetSolution(std::vector<unsigned char>& solution) const
+{
+    if (HasSolution()) {
+        solution = nSolution;
+        return true;
+    }
+
+    CDiskBlockIndex dbindex;
+    if (!pblocktree->ReadDiskBlockIndex(GetBlockHash(), dbindex))
+        return error("%s: failed to read block index entry %s", __func__, GetBlockHash().ToString());
+    if (dbindex.GetBlockHash() != GetBlockHash())
+        return error("%s: block index entry %s does not hash to its key", __func__, GetBlockHash().ToString());
+    solution = dbindex.GetDiskSolution();
+    return true;
+}
+
 CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
 {
     // Check for duplicate
@@ -4341,10 +4689,17 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, const CC
 {
     const int nHeight = pindexPrev == NULL ? 0 : pindexPrev->nHeight + 1;
 
+    // Sapling proofs of the whole block are verified together once every
+    // transaction has passed its other contextual checks. With -par, the
+    // Sapling checks are instead split into batches that are verified on the
+    // check queue workers.
+    const bool fParallelProofs = nScriptCheckThreads != 0;
+    auto saplingVerifier = fParallelProofs ? ProofVerifier::Disabled() : ProofVerifier::SaplingBatch();
+
     // Check that all transactions are finalized
     for (const CTransaction& tx : block.vtx) {
         // Check transaction contextually against consensus rules at block height
-        if (!ContextualCheckTransaction(tx, state, chainparams, nHeight, 100)) {
+        if (!ContextualCheckTransaction(tx, state, chainparams, nHeight, 100, saplingVerifier)) {
             return false; // Failure reason has been set in validation state object
         }
 
@@ -4355,6 +4710,26 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, const CC
         }
     }
 
+    bool fSaplingValid = saplingVerifier.VerifySaplingBatch();
+    if (fParallelProofs) {
+        fSaplingValid = CheckSaplingProofsParallel(block, CurrentEpochBranchId(nHeight, chainparams.GetConsensus()));
+    }
+
+    if (!fSaplingValid) {
+        // At least one proof in the block is invalid. Re-check the shielded
+        // transactions one by one so that the rejection names the culprit.
+        for (const CTransaction& tx : block.vtx) {
+            if (tx.vShieldedSpend.empty() && tx.vShieldedOutput.empty()) {
+                continue;
+            }
+            if (!ContextualCheckTransaction(tx, state, chainparams, nHeight, 100)) {
+                return false;
+            }
+        }
+        return state.DoS(100, error("%s: Sapling proof batch verification failed", __func__),
+                         REJECT_INVALID, "bad-txns-sapling-batch-invalid");
+    }
+
     // Enforce BIP 34 rule that the coinbase starts with serialized block height.
     // In Gemlink this has been enforced since launch, except that the genesis
     // block didn't include the height in the coinbase (see Gemlink protocol spec
@@ -4707,6 +5082,7 @@ void UnlinkPrunedFiles(std::set<int>& setFilesToPrune)
 {
     for (set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        blockFileMappings.Erase(*it);
         boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
         boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -4970,6 +5346,19 @@ bool static LoadBlockIndexDB()
         fAddressIndex = true;
     }
 
+    // Address indexes created before the per-address balance totals were
+    // maintained need them built once from the existing deltas.
+    if (fAddressIndex) {
+        bool fAddressBalanceIndex = false;
+        pblocktree->ReadFlag("addressbalanceindex", fAddressBalanceIndex);
+        if (!fAddressBalanceIndex) {
+            LogPrintf("%s: building address balance index...\n", __func__);
+            if (!pblocktree->BuildAddressBalanceIndex())
+                return error("%s: failed to build address balance index", __func__);
+            pblocktree->WriteFlag("addressbalanceindex", true);
+        }
+    }
+
     // Fill in-memory data
     for (const std::pair<uint256, CBlockIndex*>& item : mapBlockIndex) {
         CBlockIndex* pindex = item.second;
@@ -5248,6 +5637,8 @@ bool RewindBlockIndex(const CChainParams& params, bool& clearWitnessCaches)
 void UnloadBlockIndex()
 {
     LOCK(cs_main);
+    coinsStatsTip.reset();
+    coinsStatsChanges.reset();
     setBlockIndexCandidates.clear();
     chainActive.SetTip(NULL);
     pindexBestInvalid = NULL;
@@ -5258,6 +5649,7 @@ void UnloadBlockIndex()
     nSyncStarted = 0;
     mapBlocksUnlinked.clear();
     vinfoBlockFile.clear();
+    blockFileMappings.Clear();
     nLastBlockFile = 0;
     nBlockSequenceId = 1;
     mapBlockSource.clear();
@@ -5311,6 +5703,9 @@ bool InitBlockIndex()
     } else if (fExperimentalLightWalletd) {
         fAddressIndex = true;
     }
+    if (fAddressIndex) {
+        pblocktree->WriteFlag("addressbalanceindex", true);
+    }
 
     LogPrintf("Initializing databases...\n");
 
@@ -5773,13 +6168,17 @@ void static ProcessGetData(const Consensus::Params& consensusParams, CNode* pfro
                 // it's available before trying to send.
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
                     // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second, consensusParams))
-                        assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessage("block", block);
-                    else // MSG_FILTERED_BLOCK)
+                    if (inv.type == MSG_BLOCK) {
+                        // The stored bytes are already the network serialization
+                        std::vector<unsigned char> vRawBlock;
+                        if (!ReadRawBlockFromDisk(vRawBlock, (*mi).second, Params().MessageStart()))
+                            assert(!"cannot load block from disk");
+                        pfrom->PushMessage("block", CFlatData(vRawBlock));
+                    } else // MSG_FILTERED_BLOCK)
                     {
+                        CBlock block;
+                        if (!ReadBlockFromDisk(block, (*mi).second, consensusParams))
+                            assert(!"cannot load block from disk");
                         LOCK(pfrom->cs_filter);
                         if (pfrom->pfilter) {
                             CMerkleBlock merkleBlock(block, *pfrom->pfilter);
@@ -6344,7 +6743,12 @@ bool static ProcessMessage(const CChainParams& chainparams, CNode* pfrom, string
         int nLimit = MAX_HEADERS_RESULTS;
         LogPrint("net", "getheaders %d to %s from peer=%d\n", (pindex ? pindex->nHeight : -1), hashStop.ToString(), pfrom->id);
         for (; pindex; pindex = chainActive.Next(pindex)) {
-            vHeaders.push_back(pindex->GetBlockHeader());
+            // Headers have to connect, so stop at one we can't read; the
+            // peer asks again from the last one it got.
+            CBlockHeader header;
+            if (!pindex->GetBlockHeader(header))
+                break;
+            vHeaders.push_back(header);
             if (--nLimit <= 0 || pindex->GetBlockHash() == hashStop)
                 break;
         }
@@ -42,6 +42,7 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CCoinsViewWriteBehind;
 class CSporkDB;
 class CBloomFilter;
 class CInv;
@@ -71,6 +72,14 @@ static const unsigned int DEFAULT_MIN_RELAY_TX_FEE = 100;
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
 /** Default for -txexpirydelta, in number of blocks */
 static const unsigned int DEFAULT_TX_EXPIRY_DELTA = 20;
+/** Default for -limitancestorcount, max number of in-mempool ancestors */
+static const unsigned int DEFAULT_ANCESTOR_LIMIT = 25;
+/** Default for -limitancestorsize, maximum kilobytes of tx + all in-mempool ancestors; just over the largest transaction */
+static const unsigned int DEFAULT_ANCESTOR_SIZE_LIMIT = MAX_TX_SIZE_AFTER_ALFHEIMR / 1000 + 1;
+/** Default for -limitdescendantcount, max number of in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
+/** Default for -limitdescendantsize, maximum kilobytes of in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = MAX_TX_SIZE_AFTER_ALFHEIMR / 1000 + 1;
 /** The number of blocks within expiry height when a tx is considered to be expiring soon */
 static constexpr uint32_t TX_EXPIRING_SOON_THRESHOLD = 3;
 /** The maximum size of a blk?????.dat file (since 0.8) */
@@ -99,6 +108,8 @@ static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
 static const unsigned int DATABASE_WRITE_INTERVAL = 60 * 60;
 /** Time to wait (in seconds) between flushing chainstate to disk. */
 static const unsigned int DATABASE_FLUSH_INTERVAL = 24 * 60 * 60;
+/** Percentage of the coins cache limit that recently created or read coins may keep occupying across a flush */
+static const unsigned int COINS_CACHE_KEEP_PERCENT = 50;
 /** Time to wait (in seconds) between writing wallet witness data to disk. */
 static const unsigned int WITNESS_WRITE_INTERVAL = 10 * 60;
 /** Maximum length of reject messages. */
@@ -297,6 +308,8 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats& stats);
 void Misbehaving(NodeId nodeid, int howmuch);
 /** Flush all state, indexes and buffers to disk. */
 void FlushStateToDisk();
+/** Statistics of the unspent output set at the tip; a full scan, without cs_main, only on first use. */
+bool GetUTXOStats(CCoinsStats& stats);
 /** Prune block files and flush state to disk. */
 void PruneAndFlush();
 /** See whether the protocol update is enforced for connected nodes */
@@ -617,6 +630,12 @@ struct CAddressIndexKey {
         index = 0;
         spending = false;
     }
+
+    friend bool operator==(const CAddressIndexKey& a, const CAddressIndexKey& b)
+    {
+        return a.type == b.type && a.hashBytes == b.hashBytes && a.blockHeight == b.blockHeight &&
+               a.txindex == b.txindex && a.txhash == b.txhash && a.index == b.index && a.spending == b.spending;
+    }
 };
 
 struct CAddressIndexIteratorKey {
@@ -702,6 +721,43 @@ struct CAddressIndexIteratorHeightKey {
     }
 };
 
+/** Running totals of the address index deltas of one (type, hash) address. */
+struct CAddressBalanceValue {
+    CAmount balance;
+    CAmount received;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        READWRITE(balance);
+        READWRITE(received);
+    }
+
+    CAddressBalanceValue(CAmount balanceIn, CAmount receivedIn)
+    {
+        balance = balanceIn;
+        received = receivedIn;
+    }
+
+    CAddressBalanceValue()
+    {
+        SetNull();
+    }
+
+    void SetNull()
+    {
+        balance = 0;
+        received = 0;
+    }
+
+    bool IsNull() const
+    {
+        return (balance == 0 && received == 0);
+    }
+};
+
 CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowFree);
 
 /**
@@ -749,6 +805,7 @@ bool ContextualCheckInputs(const CTransaction& tx, CValidationState& state, cons
 
 /** Check a transaction contextually against a set of consensus rules */
 bool ContextualCheckTransaction(const CTransaction& tx, CValidationState& state, const CChainParams& chainparams, int nHeight, int dosLevel, bool (*isInitBlockDownload)(const Consensus::Params&) = IsInitialBlockDownload);
+bool ContextualCheckTransaction(const CTransaction& tx, CValidationState& state, const CChainParams& chainparams, int nHeight, int dosLevel, ProofVerifier& verifier, bool (*isInitBlockDownload)(const Consensus::Params&) = IsInitialBlockDownload);
 
 /** Apply the effects of this transaction on the UTXO set represented by view */
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight);
@@ -844,15 +901,91 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure representing the verification of the shielded proofs of a set of
+ * transactions: either their JoinSplit proofs, or their Sapling descriptions
+ * and binding signatures (the latter verified as one batch).
+ */
+class CProofCheck
+{
+public:
+    enum ProofType {
+        SPROUT,
+        SAPLING,
+    };
+
+private:
+    std::vector<const CTransaction*> vptx;
+    ProofType type;
+    uint32_t consensusBranchId;
+
+public:
+    CProofCheck() : type(SPROUT), consensusBranchId(0) {}
+    CProofCheck(std::vector<const CTransaction*>& vptxIn, ProofType typeIn, uint32_t consensusBranchIdIn) : type(typeIn), consensusBranchId(consensusBranchIdIn)
+    {
+        vptx.swap(vptxIn);
+    }
+
+    bool operator()();
+
+    void swap(CProofCheck& check)
+    {
+        vptx.swap(check.vptx);
+        std::swap(type, check.type);
+        std::swap(consensusBranchId, check.consensusBranchId);
+    }
+};
+
+/**
+ * A unit of work for the -par check queue. Script checks and shielded proof
+ * checks share the queue so that both are spread over the same workers.
+ */
+class CValidationCheck
+{
+private:
+    CScriptCheck scriptCheck;
+    CProofCheck proofCheck;
+    bool fProof;
+
+public:
+    CValidationCheck() : fProof(false) {}
+    explicit CValidationCheck(CScriptCheck& check) : fProof(false) { scriptCheck.swap(check); }
+    explicit CValidationCheck(CProofCheck& check) : fProof(true) { proofCheck.swap(check); }
+
+    bool operator()() { return fProof ? proofCheck() : scriptCheck(); }
+
+    void swap(CValidationCheck& check)
+    {
+        scriptCheck.swap(check.scriptCheck);
+        proofCheck.swap(check.proofCheck);
+        std::swap(fProof, check.fProof);
+    }
+};
+
 bool GetTimestampIndex(const unsigned int& high, const unsigned int& low, const bool fActiveOnly, std::vector<std::pair<uint256, unsigned int>>& hashes);
 bool GetSpentIndex(CSpentIndexKey& key, CSpentIndexValue& value);
-bool GetAddressIndex(uint160 addressHash, int type, std::vector<std::pair<CAddressIndexKey, CAmount>>& addressIndex, int start = 0, int end = 0);
+/**
+ * Append the address index entries of an address to addressIndex. With pAfter,
+ * reading resumes at the entry following that key; with nLimit, at most that
+ * many entries are read.
+ */
+bool GetAddressIndex(uint160 addressHash, int type, std::vector<std::pair<CAddressIndexKey, CAmount>>& addressIndex, int start = 0, int end = 0,
+                     const CAddressIndexKey* pAfter = nullptr, size_t nLimit = 0);
 bool GetAddressUnspent(uint160 addressHash, int type, std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue>>& unspentOutputs);
+/** Current balance and total received of an address, without reading its deltas */
+bool GetAddressBalance(uint160 addressHash, int type, CAmount& balance, CAmount& received);
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/**
+ * Read a block's serialized bytes as stored on disk, which is also its network
+ * serialization, without deserializing it. The header is not rechecked, so
+ * only use this for blocks that were validated when they were written.
+ */
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart);
 
 
 /** Functions for validating blocks and updating the block tree */
@@ -926,6 +1059,9 @@ extern CChain chainActive;
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache* pcoinsTip;
 
+/** Global variable that points to the background coin database writer under pcoinsTip, if any */
+extern CCoinsViewWriteBehind* pcoinsWriteBehind;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB* pblocktree;
 
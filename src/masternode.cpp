@@ -146,6 +146,8 @@ bool CMasternode::UpdateFromNewBroadcast(CMasternodeBroadcast& mnb)
         protocolVersion = mnb.protocolVersion;
         addr = mnb.addr;
         lastTimeChecked = 0;
+        // the masternode key, payee and address may all have changed
+        mnodeman.RebuildIndexes();
         int nDoS = 0;
         if (mnb.lastPing.IsNull() || (!mnb.lastPing.IsNull() && mnb.lastPing.CheckAndUpdate(nDoS, false))) {
             lastPing = mnb.lastPing;
@@ -175,6 +177,11 @@ arith_uint256 CMasternode::CalculateScore(int64_t nBlockHeight) const
         return arith_uint256();
     }
 
+    return CalculateScore(hash);
+}
+
+arith_uint256 CMasternode::CalculateScore(const uint256& hash) const
+{
     uint256 aux = ArithToUint256(UintToArith256(vin.prevout.hash) + vin.prevout.n);
 
     CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
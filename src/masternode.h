@@ -199,6 +199,7 @@ public:
 
     // CALCULATE A RANK AGAINST OF GIVEN BLOCK
     arith_uint256 CalculateScore(int64_t nBlockHeight = 0) const;
+    arith_uint256 CalculateScore(const uint256& hashBlock) const;
 
     ADD_SERIALIZE_METHODS;
 
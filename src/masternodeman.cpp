@@ -34,11 +34,11 @@ struct CompareLastPaid {
     }
 };
 
-struct CompareScoreTxIn {
+struct CompareScoreTxInDesc {
     bool operator()(const pair<int64_t, CTxIn>& t1,
                     const pair<int64_t, CTxIn>& t2) const
     {
-        return t1.first < t2.first;
+        return t1.first > t2.first;
     }
 };
 
@@ -204,6 +204,7 @@ void DumpMasternodes()
 CMasternodeMan::CMasternodeMan()
 {
     nDsqCount = 0;
+    nScoreTableQueries = 0;
 }
 
 bool CMasternodeMan::Add(CMasternode& mn)
@@ -217,6 +218,8 @@ bool CMasternodeMan::Add(CMasternode& mn)
     if (pmn == NULL) {
         LogPrint("masternode", "CMasternodeMan: Adding new Masternode %s - %i now\n", mn.vin.prevout.hash.ToString(), size() + 1);
         vMasternodes.push_back(mn);
+        AddToIndexes(vMasternodes.size() - 1);
+        mapScoreTables.clear();
         return true;
     }
 
@@ -245,10 +248,9 @@ void CMasternodeMan::CheckSpentCollaterals(const std::vector<CTransaction>& vtx)
     LOCK(cs);
     for (const auto& tx : vtx) {
         for (const auto& in : tx.vin) {
-            for (CMasternode& mn : vMasternodes) {
-                if (mn.vin == in) {
-                    mn.SetSpent();
-                }
+            auto it = mapIndexByOutPoint.find(in.prevout);
+            if (it != mapIndexByOutPoint.end() && vMasternodes[it->second].vin == in) {
+                vMasternodes[it->second].SetSpent();
             }
         }
     }
@@ -270,6 +272,7 @@ void CMasternodeMan::CheckAndRemove(bool forceExpiredRemoval)
     LOCK(cs);
 
     // remove inactive and outdated
+    bool fRemoved = false;
     vector<CMasternode>::iterator it = vMasternodes.begin();
     while (it != vMasternodes.end()) {
         auto activeState = (*it).activeState;
@@ -303,10 +306,13 @@ void CMasternodeMan::CheckAndRemove(bool forceExpiredRemoval)
             }
 
             it = vMasternodes.erase(it);
+            fRemoved = true;
         } else {
             ++it;
         }
     }
+    if (fRemoved)
+        RebuildIndexes();
 
     // check who's asked for the Masternode list
     std::map<CNetAddr, int64_t>::iterator it1 = mAskedUsForMasternodeList.begin();
@@ -365,6 +371,7 @@ void CMasternodeMan::Clear()
 {
     LOCK(cs);
     vMasternodes.clear();
+    RebuildIndexes();
     mAskedUsForMasternodeList.clear();
     mWeAskedForMasternodeList.clear();
     mWeAskedForMasternodeListEntry.clear();
@@ -462,28 +469,111 @@ void CMasternodeMan::DsegUpdate(CNode* pnode)
     mWeAskedForMasternodeList[pnode->addr] = askAgain;
 }
 
-CMasternode* CMasternodeMan::Find(const CScript& payee)
+void CMasternodeMan::AddToIndexes(size_t i)
+{
+    const CMasternode& mn = vMasternodes[i];
+    const COutPoint& outpoint = mn.vin.prevout;
+
+    // the earliest entry wins, as it would in a scan of vMasternodes
+    mapIndexByOutPoint.emplace(outpoint, i);
+    mapIndexByPubKeyMasternode.emplace(mn.pubKeyMasternode.GetID(), outpoint);
+    mapIndexByPayee.emplace(mn.pubKeyCollateralAddress.GetID(), outpoint);
+    mapIndexByAddr.emplace((CNetAddr)mn.addr, outpoint);
+}
+
+void CMasternodeMan::RebuildIndexes()
 {
     LOCK(cs);
-    CScript payee2;
 
+    mapIndexByOutPoint.clear();
+    mapIndexByPubKeyMasternode.clear();
+    mapIndexByPayee.clear();
+    mapIndexByAddr.clear();
+    for (size_t i = 0; i < vMasternodes.size(); i++) {
+        AddToIndexes(i);
+    }
+
+    // the protocol versions, or the masternodes themselves, may have changed
+    mapScoreTables.clear();
+}
+
+const CMasternodeScoreTable* CMasternodeMan::GetScoreTable(int64_t nBlockHeight, int minProtocol)
+{
+    AssertLockHeld(cs);
+
+    {
+        LOCK(cs_main);
+        if (chainActive.Tip() == NULL)
+            return NULL;
+    }
+
+    uint256 hash;
+    if (!GetBlockHash(hash, nBlockHeight))
+        return NULL;
+
+    auto key = make_pair(nBlockHeight, minProtocol);
+    auto it = mapScoreTables.find(key);
+    if (it != mapScoreTables.end() && it->second.blockHash == hash) {
+        it->second.nLastUsed = ++nScoreTableQueries;
+        return &it->second;
+    }
+
+    CMasternodeScoreTable table;
+    table.blockHash = hash;
+    table.nLastUsed = ++nScoreTableQueries;
     for (CMasternode& mn : vMasternodes) {
-        payee2 = GetScriptForDestination(mn.pubKeyCollateralAddress.GetID());
-        if (payee2 == payee)
-            return &mn;
+        if (mn.protocolVersion < minProtocol)
+            continue;
+        arith_uint256 n = mn.CalculateScore(hash);
+        table.vecScores.push_back(make_pair(n.GetCompact(false), mn.vin));
+        table.mapScores.emplace(mn.vin.prevout, n);
     }
-    return NULL;
+    // equal scores keep their vMasternodes order, so the first Masternode
+    // scanned still wins a tie
+    stable_sort(table.vecScores.begin(), table.vecScores.end(), CompareScoreTxInDesc());
+
+    // drop the table that went unused the longest
+    if (it == mapScoreTables.end() && mapScoreTables.size() >= MASTERNODES_SCORE_CACHE_SIZE) {
+        auto itOldest = mapScoreTables.begin();
+        for (auto itTable = mapScoreTables.begin(); itTable != mapScoreTables.end(); ++itTable) {
+            if (itTable->second.nLastUsed < itOldest->second.nLastUsed)
+                itOldest = itTable;
+        }
+        mapScoreTables.erase(itOldest);
+    }
+    CMasternodeScoreTable& cached = mapScoreTables[key];
+    cached = std::move(table);
+    return &cached;
+}
+
+CMasternode* CMasternodeMan::Find(const CScript& payee)
+{
+    LOCK(cs);
+
+    // masternodes are only ever paid to the P2PKH script of their collateral key
+    if (!payee.IsPayToPublicKeyHash())
+        return NULL;
+    CKeyID keyID(uint160(std::vector<unsigned char>(payee.begin() + 3, payee.begin() + 23)));
+
+    auto it = mapIndexByPayee.find(keyID);
+    if (it == mapIndexByPayee.end())
+        return NULL;
+    return FindByOutPoint(it->second);
+}
+
+CMasternode* CMasternodeMan::FindByOutPoint(const COutPoint& outpoint)
+{
+    auto it = mapIndexByOutPoint.find(outpoint);
+    if (it == mapIndexByOutPoint.end())
+        return NULL;
+    return &vMasternodes[it->second];
 }
 
 CMasternode* CMasternodeMan::Find(const CTxIn& vin)
 {
     LOCK(cs);
 
-    for (CMasternode& mn : vMasternodes) {
-        if (mn.vin.prevout == vin.prevout)
-            return &mn;
-    }
-    return NULL;
+    return FindByOutPoint(vin.prevout);
 }
 
 
@@ -491,22 +581,23 @@ CMasternode* CMasternodeMan::Find(const CPubKey& pubKeyMasternode)
 {
     LOCK(cs);
 
-    for (CMasternode& mn : vMasternodes) {
-        if (mn.pubKeyMasternode == pubKeyMasternode)
-            return &mn;
-    }
-    return NULL;
+    auto it = mapIndexByPubKeyMasternode.find(pubKeyMasternode.GetID());
+    if (it == mapIndexByPubKeyMasternode.end())
+        return NULL;
+    CMasternode* pmn = FindByOutPoint(it->second);
+    if (pmn == NULL || pmn->pubKeyMasternode != pubKeyMasternode)
+        return NULL;
+    return pmn;
 }
 
 CMasternode* CMasternodeMan::Find(const CAddress& addr)
 {
     LOCK(cs);
 
-    for (CMasternode& mn : vMasternodes) {
-        if ((CNetAddr)(mn.addr) == (CNetAddr)addr)
-            return &mn;
-    }
-    return NULL;
+    auto it = mapIndexByAddr.find((CNetAddr)addr);
+    if (it == mapIndexByAddr.end())
+        return NULL;
+    return FindByOutPoint(it->second);
 }
 
 //
@@ -564,12 +655,18 @@ CMasternode* CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight
     int nTenthNetwork = nMnCount / 10;
     int nCountTenth = 0;
     arith_uint256 nHighest = 0;
+    const CMasternodeScoreTable* scores = GetScoreTable(nBlockHeight - 101, 0);
     for (PAIRTYPE(int64_t, CTxIn) & s : vecMasternodeLastPaid) {
         CMasternode* pmn = Find(s.second);
         if (!pmn)
             break;
 
-        arith_uint256 n = pmn->CalculateScore(nBlockHeight - 101);
+        arith_uint256 n = 0;
+        if (scores != NULL) {
+            auto it = scores->mapScores.find(s.second.prevout);
+            if (it != scores->mapScores.end())
+                n = it->second;
+        }
         if (n > nHighest) {
             nHighest = n;
             pBestMasternode = pmn;
@@ -583,50 +680,56 @@ CMasternode* CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight
 
 CMasternode* CMasternodeMan::GetCurrentMasterNode(int mod, int64_t nBlockHeight, int minProtocol)
 {
-    int64_t score = 0;
-    CMasternode* winner = NULL;
+    LOCK(cs);
 
-    // scan for winner
-    for (CMasternode& mn : vMasternodes) {
+    // Check() also moves expired Masternodes towards removal, so keep
+    // running it over the whole list as the scan for the winner did
+    for (CMasternode& mn : vMasternodes)
         mn.Check();
-        if (mn.protocolVersion < minProtocol || !mn.IsEnabled())
-            continue;
 
-        // calculate the score for each Masternode
-        arith_uint256 n = mn.CalculateScore(nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
+    const CMasternodeScoreTable* scores = GetScoreTable(nBlockHeight, minProtocol);
+    if (scores == NULL)
+        return NULL;
 
-        // determine the winner
-        if (n2 > score) {
-            score = n2;
-            winner = &mn;
-        }
+    // the winner is the enabled Masternode with the highest score
+    for (const PAIRTYPE(int64_t, CTxIn) & s : scores->vecScores) {
+        if (s.first <= 0)
+            break;
+        CMasternode* pmn = FindByOutPoint(s.second.prevout);
+        if (pmn == NULL)
+            continue;
+        if (pmn->IsEnabled())
+            return pmn;
     }
 
-    return winner;
+    return NULL;
 }
 
 int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
 {
-    std::vector<pair<int64_t, CTxIn>> vecMasternodeScores;
     int64_t nMasternode_Min_Age = MN_WINNER_MINIMUM_AGE;
     int64_t nMasternode_Age = 0;
 
+    LOCK(cs);
+
     // make sure we know about this block
-    uint256 hash;
-    if (!GetBlockHash(hash, nBlockHeight))
+    const CMasternodeScoreTable* scores = GetScoreTable(nBlockHeight, minProtocol);
+    if (scores == NULL)
         return -1;
 
-    // scan for winner
-    for (CMasternode& mn : vMasternodes) {
-        if (mn.protocolVersion < minProtocol) {
-            LogPrint("masternode", "Skipping Masternode with obsolete version %d\n", mn.protocolVersion);
-            continue; // Skip obsolete versions
-        }
+    const bool fFilterAge =
+        (sporkManager.IsSporkActive(SPORK_8_MASTERNODE_PAYMENT_ENFORCEMENT) && !Params().GetConsensus().NetworkUpgradeActive(chainActive.Height() + 1, Consensus::UPGRADE_MORAG)) ||
+        (sporkManager.IsSporkActive(SPORK_19_MASTERNODE_PAYMENT_ENFORCEMENT_MORAG) && Params().GetConsensus().NetworkUpgradeActive(chainActive.Height() + 1, Consensus::UPGRADE_MORAG));
 
-        if ((sporkManager.IsSporkActive(SPORK_8_MASTERNODE_PAYMENT_ENFORCEMENT) && !Params().GetConsensus().NetworkUpgradeActive(chainActive.Height() + 1, Consensus::UPGRADE_MORAG)) ||
-            (sporkManager.IsSporkActive(SPORK_19_MASTERNODE_PAYMENT_ENFORCEMENT_MORAG) && Params().GetConsensus().NetworkUpgradeActive(chainActive.Height() + 1, Consensus::UPGRADE_MORAG))) {
-            nMasternode_Age = GetAdjustedTime() - mn.sigTime;
+    // walk the Masternodes from the highest score down, skipping those that don't qualify
+    int rank = 0;
+    for (const PAIRTYPE(int64_t, CTxIn) & s : scores->vecScores) {
+        CMasternode* pmn = FindByOutPoint(s.second.prevout);
+        if (pmn == NULL)
+            continue;
+
+        if (fFilterAge) {
+            nMasternode_Age = GetAdjustedTime() - pmn->sigTime;
             if ((nMasternode_Age) < nMasternode_Min_Age) {
                 if (fDebug)
                     LogPrint("masternode", "Skipping just activated Masternode. Age: %ld\n", nMasternode_Age);
@@ -634,20 +737,11 @@ int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, in
             }
         }
         if (fOnlyActive) {
-            mn.Check();
-            if (!mn.IsEnabled())
+            pmn->Check();
+            if (!pmn->IsEnabled())
                 continue;
         }
-        arith_uint256 n = mn.CalculateScore(nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
-
-        vecMasternodeScores.push_back(make_pair(n2, mn.vin));
-    }
-
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreTxIn());
 
-    int rank = 0;
-    for (PAIRTYPE(int64_t, CTxIn) & s : vecMasternodeScores) {
         rank++;
         if (s.second.prevout == vin.prevout) {
             return rank;
@@ -662,6 +756,9 @@ std::vector<pair<int, CMasternode>> CMasternodeMan::GetMasternodeRanks(int64_t n
     std::vector<pair<int64_t, CMasternode>> vecMasternodeScores;
     std::vector<pair<int, CMasternode>> vecMasternodeRanks;
 
+    LOCK(cs);
+
+    const CMasternodeScoreTable* scores = GetScoreTable(nBlockHeight, minProtocol);
 
     // scan for winner
     for (CMasternode& mn : vMasternodes) {
@@ -675,7 +772,12 @@ std::vector<pair<int, CMasternode>> CMasternodeMan::GetMasternodeRanks(int64_t n
             continue;
         }
 
-        arith_uint256 n = mn.CalculateScore(nBlockHeight);
+        arith_uint256 n = 0;
+        if (scores != NULL) {
+            auto it = scores->mapScores.find(mn.vin.prevout);
+            if (it != scores->mapScores.end())
+                n = it->second;
+        }
         int64_t n2 = n.GetCompact(false);
 
         vecMasternodeScores.push_back(make_pair(n2, mn));
@@ -934,6 +1036,7 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
                         pmn->addr = addr;
                         // fake ping
                         pmn->lastPing = CMasternodePing(vin);
+                        RebuildIndexes();
                     }
                     pmn->nLastDsee = sigTime;
                     pmn->Check();
@@ -1142,6 +1245,7 @@ void CMasternodeMan::Remove(CTxIn vin)
         if ((*it).vin == vin) {
             LogPrint("masternode", "CMasternodeMan: Removing Masternode %s - %i now\n", (*it).vin.prevout.hash.ToString(), size() - 1);
             vMasternodes.erase(it);
+            RebuildIndexes();
             break;
         }
         ++it;
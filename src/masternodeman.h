@@ -9,6 +9,7 @@
 
 #include "activemasternode.h"
 #include "base58.h"
+#include "crypto/common.h"
 #include "key.h"
 #include "main.h"
 #include "masternode.h"
@@ -16,9 +17,14 @@
 #include "sync.h"
 #include "util.h"
 
+#include <boost/unordered_map.hpp>
+
 #define MASTERNODES_DUMP_SECONDS (15 * 60)
 #define MASTERNODES_DSEG_SECONDS (3 * 60 * 60)
 
+/** How many score tables CMasternodeMan keeps */
+static const size_t MASTERNODES_SCORE_CACHE_SIZE = 32;
+
 using namespace std;
 
 class CMasternodeMan;
@@ -54,6 +60,39 @@ public:
     ReadResult Read(CMasternodeMan& mnodemanToLoad, bool fDryRun = false);
 };
 
+/** Hashers for the CMasternodeMan lookup indexes */
+struct MasternodeOutPointHasher {
+    size_t operator()(const COutPoint& outpoint) const
+    {
+        return outpoint.hash.GetCheapHash() ^ outpoint.n;
+    }
+};
+
+struct MasternodeKeyIDHasher {
+    size_t operator()(const CKeyID& keyID) const
+    {
+        return ReadLE64(keyID.begin());
+    }
+};
+
+struct MasternodeNetAddrHasher {
+    size_t operator()(const CNetAddr& addr) const
+    {
+        return addr.GetHash();
+    }
+};
+
+/** The scores of the masternodes for one block, computed once for all rank and winner queries */
+struct CMasternodeScoreTable {
+    uint256 blockHash;
+    // when the table was last queried, on CMasternodeMan's query counter
+    uint64_t nLastUsed;
+    // compact scores, highest first, ties in vMasternodes order
+    std::vector<pair<int64_t, CTxIn>> vecScores;
+    // full scores by collateral
+    boost::unordered_map<COutPoint, arith_uint256, MasternodeOutPointHasher> mapScores;
+};
+
 class CMasternodeMan
 {
 private:
@@ -72,6 +111,24 @@ private:
     // which Masternodes we've asked for
     std::map<COutPoint, int64_t> mWeAskedForMasternodeListEntry;
 
+    // lookup indexes over vMasternodes: collateral outpoint to position, and
+    // masternode key, collateral key (the payee) and address to the first
+    // entry holding them. Rebuilt whenever entries are removed or re-keyed.
+    boost::unordered_map<COutPoint, size_t, MasternodeOutPointHasher> mapIndexByOutPoint;
+    boost::unordered_map<CKeyID, COutPoint, MasternodeKeyIDHasher> mapIndexByPubKeyMasternode;
+    boost::unordered_map<CKeyID, COutPoint, MasternodeKeyIDHasher> mapIndexByPayee;
+    boost::unordered_map<CNetAddr, COutPoint, MasternodeNetAddrHasher> mapIndexByAddr;
+
+    // score tables by (block height, minimum protocol), dropped whenever the list changes
+    std::map<pair<int64_t, int>, CMasternodeScoreTable> mapScoreTables;
+    uint64_t nScoreTableQueries;
+
+    /// Add the entry at position i of vMasternodes to the indexes
+    void AddToIndexes(size_t i);
+    /// Get the scores for a block of the masternodes of at least minProtocol, or NULL if the block is unknown
+    const CMasternodeScoreTable* GetScoreTable(int64_t nBlockHeight, int minProtocol);
+    CMasternode* FindByOutPoint(const COutPoint& outpoint);
+
 public:
     // Keep track of all broadcasts I've seen
     map<uint256, CMasternodeBroadcast> mapSeenMasternodeBroadcast;
@@ -95,6 +152,9 @@ public:
 
         READWRITE(mapSeenMasternodeBroadcast);
         READWRITE(mapSeenMasternodePing);
+
+        if (ser_action.ForRead())
+            RebuildIndexes();
     }
 
     CMasternodeMan();
@@ -152,6 +212,9 @@ public:
 
     void Remove(CTxIn vin);
 
+    /// Rebuild the lookup indexes, after entries were removed or their keys or address changed
+    void RebuildIndexes();
+
     /// Update masternode list and maps using provided CMasternodeBroadcast
     void UpdateMasternodeList(CMasternodeBroadcast mnb);
 };
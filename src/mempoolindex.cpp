@@ -0,0 +1,174 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "mempoolindex.h"
+
+#include "hash.h"
+#include "random.h"
+
+#include <algorithm>
+#include <string.h>
+
+SaltedAddressHasher::SaltedAddressHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
+size_t SaltedAddressHasher::operator()(const std::pair<uint160, int>& address) const
+{
+    uint256 data;
+    memcpy(data.begin(), address.first.begin(), 20);
+    data.begin()[20] = address.second;
+    return SipHashUint256(k0, k1, data);
+}
+
+SaltedSpentIndexKeyHasher::SaltedSpentIndexKeyHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
+size_t SaltedSpentIndexKeyHasher::operator()(const CSpentIndexKey& key) const
+{
+    return SipHashUint256(k0 ^ key.outputIndex, k1, key.txid);
+}
+
+void CMempoolAddressIndex::AddTx(const uint256& txhash, int64_t nTime, const std::vector<Delta>& deltas)
+{
+    if (deltas.empty() || mapTxs.count(txhash)) {
+        return;
+    }
+
+    uint32_t nTx = txs.Alloc();
+    txs[nTx].txhash = txhash;
+    txs[nTx].nTime = nTime;
+    txs[nTx].nFirst = NONE;
+    mapTxs.emplace(txhash, nTx);
+
+    for (const Delta& delta : deltas) {
+        auto ait = mapAddresses.find(std::make_pair(delta.addressBytes, delta.type));
+        uint32_t nAddress;
+        if (ait == mapAddresses.end()) {
+            nAddress = addresses.Alloc();
+            addresses[nAddress].addressBytes = delta.addressBytes;
+            addresses[nAddress].type = delta.type;
+            addresses[nAddress].nFirst = NONE;
+            mapAddresses.emplace(std::make_pair(delta.addressBytes, delta.type), nAddress);
+        } else {
+            nAddress = ait->second;
+        }
+
+        uint32_t n = entries.Alloc();
+        Entry& entry = entries[n];
+        entry.nTx = nTx;
+        entry.nAddress = nAddress;
+        entry.index = delta.index;
+        entry.spending = delta.spending;
+        entry.amount = delta.amount;
+        entry.prevout = delta.prevout;
+
+        entry.nNextInTx = txs[nTx].nFirst;
+        txs[nTx].nFirst = n;
+
+        entry.nPrevInAddress = NONE;
+        entry.nNextInAddress = addresses[nAddress].nFirst;
+        if (entry.nNextInAddress != NONE) {
+            entries[entry.nNextInAddress].nPrevInAddress = n;
+        }
+        addresses[nAddress].nFirst = n;
+    }
+}
+
+void CMempoolAddressIndex::RemoveTx(const uint256& txhash)
+{
+    auto it = mapTxs.find(txhash);
+    if (it == mapTxs.end()) {
+        return;
+    }
+
+    uint32_t nTx = it->second;
+    uint32_t n = txs[nTx].nFirst;
+    while (n != NONE) {
+        const Entry& entry = entries[n];
+        uint32_t nNext = entry.nNextInTx;
+
+        if (entry.nPrevInAddress != NONE) {
+            entries[entry.nPrevInAddress].nNextInAddress = entry.nNextInAddress;
+        } else {
+            addresses[entry.nAddress].nFirst = entry.nNextInAddress;
+        }
+        if (entry.nNextInAddress != NONE) {
+            entries[entry.nNextInAddress].nPrevInAddress = entry.nPrevInAddress;
+        }
+        if (addresses[entry.nAddress].nFirst == NONE) {
+            const AddressEntries& address = addresses[entry.nAddress];
+            mapAddresses.erase(std::make_pair(address.addressBytes, address.type));
+            addresses.Free(entry.nAddress);
+        }
+
+        entries.Free(n);
+        n = nNext;
+    }
+
+    mapTxs.erase(it);
+    txs.Free(nTx);
+}
+
+void CMempoolAddressIndex::GetDeltas(const uint160& addressBytes, int type,
+                                     std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta>>& results) const
+{
+    auto it = mapAddresses.find(std::make_pair(addressBytes, type));
+    if (it == mapAddresses.end()) {
+        return;
+    }
+
+    size_t nBegin = results.size();
+    for (uint32_t n = addresses[it->second].nFirst; n != NONE; n = entries[n].nNextInAddress) {
+        const Entry& entry = entries[n];
+        const TxEntries& tx = txs[entry.nTx];
+        CMempoolAddressDeltaKey key(type, addressBytes, tx.txhash, entry.index, entry.spending);
+        if (entry.spending) {
+            results.emplace_back(key, CMempoolAddressDelta(tx.nTime, entry.amount, entry.prevout.hash, entry.prevout.n));
+        } else {
+            results.emplace_back(key, CMempoolAddressDelta(tx.nTime, entry.amount));
+        }
+    }
+
+    CMempoolAddressDeltaKeyCompare comp;
+    std::sort(results.begin() + nBegin, results.end(),
+        [&comp](const std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta>& a,
+                const std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta>& b) {
+            return comp(a.first, b.first);
+        });
+}
+
+size_t CMempoolAddressIndex::DynamicMemoryUsage() const
+{
+    return entries.DynamicMemoryUsage() + txs.DynamicMemoryUsage() + addresses.DynamicMemoryUsage() +
+           memusage::DynamicUsage(mapTxs) + memusage::DynamicUsage(mapAddresses);
+}
+
+void CMempoolSpentIndex::Add(const CSpentIndexKey& key, const CSpentIndexValue& value)
+{
+    mapSpent.emplace(key, value);
+}
+
+bool CMempoolSpentIndex::Get(const CSpentIndexKey& key, CSpentIndexValue& value) const
+{
+    auto it = mapSpent.find(key);
+    if (it == mapSpent.end()) {
+        return false;
+    }
+    value = it->second;
+    return true;
+}
+
+void CMempoolSpentIndex::RemoveTx(const CTransaction& tx)
+{
+    const uint256& txhash = tx.GetHash();
+    for (const CTxIn& input : tx.vin) {
+        auto it = mapSpent.find(CSpentIndexKey(input.prevout.hash, input.prevout.n));
+        if (it != mapSpent.end() && it->second.txid == txhash) {
+            mapSpent.erase(it);
+        }
+    }
+}
+
+size_t CMempoolSpentIndex::DynamicMemoryUsage() const
+{
+    return memusage::DynamicUsage(mapSpent);
+}
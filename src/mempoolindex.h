@@ -0,0 +1,174 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_MEMPOOLINDEX_H
+#define BITCOIN_MEMPOOLINDEX_H
+
+#include "addressindex.h"
+#include "amount.h"
+#include "coins.h"
+#include "memusage.h"
+#include "primitives/transaction.h"
+#include "spentindex.h"
+#include "uint256.h"
+
+#include <limits>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+#include <boost/unordered_map.hpp>
+
+class SaltedAddressHasher
+{
+private:
+    /** Salt */
+    const uint64_t k0, k1;
+
+public:
+    SaltedAddressHasher();
+
+    size_t operator()(const std::pair<uint160, int>& address) const;
+};
+
+class SaltedSpentIndexKeyHasher
+{
+private:
+    /** Salt */
+    const uint64_t k0, k1;
+
+public:
+    SaltedSpentIndexKeyHasher();
+
+    size_t operator()(const CSpentIndexKey& key) const;
+};
+
+/**
+ * Vector of slots that are reused once freed, so that the entries of an
+ * index are allocated in bulk rather than one heap node each.
+ */
+template <typename T>
+class CIndexSlotPool
+{
+private:
+    std::vector<T> vSlots;
+    std::vector<uint32_t> vFree;
+
+public:
+    uint32_t Alloc()
+    {
+        if (!vFree.empty()) {
+            uint32_t n = vFree.back();
+            vFree.pop_back();
+            return n;
+        }
+        vSlots.emplace_back();
+        return vSlots.size() - 1;
+    }
+
+    void Free(uint32_t n)
+    {
+        vFree.push_back(n);
+        if (vFree.size() == vSlots.size()) {
+            // Give the memory back once the index has drained
+            std::vector<T>().swap(vSlots);
+            std::vector<uint32_t>().swap(vFree);
+        }
+    }
+
+    T& operator[](uint32_t n) { return vSlots[n]; }
+    const T& operator[](uint32_t n) const { return vSlots[n]; }
+    size_t Size() const { return vSlots.size() - vFree.size(); }
+    size_t Capacity() const { return vSlots.size(); }
+    size_t DynamicMemoryUsage() const { return memusage::DynamicUsage(vSlots) + memusage::DynamicUsage(vFree); }
+};
+
+/**
+ * The mempool side of the address index (-insightexplorer): the transparent
+ * inputs and outputs of the mempool transactions, by address.
+ *
+ * Every delta is a slot in one pool, chained both to the other deltas of its
+ * address and to those of its transaction. Once the pools have grown, the
+ * deltas of a new transaction reuse freed slots; only the txid and address
+ * maps still allocate, one node per transaction and per new address.
+ * Removing a transaction only visits its own deltas.
+ */
+class CMempoolAddressIndex
+{
+public:
+    /** One transparent input (spending) or output of a transaction. */
+    struct Delta {
+        int type;
+        uint160 addressBytes;
+        unsigned int index;
+        bool spending;
+        CAmount amount;
+        //! For inputs, the output they spend
+        COutPoint prevout;
+    };
+
+    /** Index the deltas of a transaction, unless it is indexed already. */
+    void AddTx(const uint256& txhash, int64_t nTime, const std::vector<Delta>& deltas);
+    void RemoveTx(const uint256& txhash);
+    /** Append the deltas of an address, in CMempoolAddressDeltaKeyCompare order. */
+    void GetDeltas(const uint160& addressBytes, int type,
+                   std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta>>& results) const;
+
+    size_t Size() const { return entries.Size(); }
+    /** Delta slots allocated, whether in use or free. */
+    size_t Capacity() const { return entries.Capacity(); }
+    size_t DynamicMemoryUsage() const;
+
+private:
+    static const uint32_t NONE = std::numeric_limits<uint32_t>::max();
+
+    struct Entry {
+        uint32_t nTx;
+        uint32_t nAddress;
+        uint32_t nNextInTx;
+        uint32_t nPrevInAddress;
+        uint32_t nNextInAddress;
+        uint32_t index;
+        bool spending;
+        CAmount amount;
+        COutPoint prevout;
+    };
+    struct TxEntries {
+        uint256 txhash;
+        int64_t nTime;
+        uint32_t nFirst;
+    };
+    struct AddressEntries {
+        uint160 addressBytes;
+        int type;
+        uint32_t nFirst;
+    };
+
+    CIndexSlotPool<Entry> entries;
+    CIndexSlotPool<TxEntries> txs;
+    CIndexSlotPool<AddressEntries> addresses;
+    boost::unordered_map<uint256, uint32_t, SaltedTxidHasher> mapTxs;
+    boost::unordered_map<std::pair<uint160, int>, uint32_t, SaltedAddressHasher> mapAddresses;
+};
+
+/**
+ * The mempool side of the spent index (-insightexplorer): which mempool
+ * transaction spends an output. A transaction's entries are found again from
+ * its own inputs, so nothing is kept per transaction.
+ */
+class CMempoolSpentIndex
+{
+private:
+    boost::unordered_map<CSpentIndexKey, CSpentIndexValue, SaltedSpentIndexKeyHasher> mapSpent;
+
+public:
+    void Add(const CSpentIndexKey& key, const CSpentIndexValue& value);
+    bool Get(const CSpentIndexKey& key, CSpentIndexValue& value) const;
+    void RemoveTx(const CTransaction& tx);
+
+    size_t Size() const { return mapSpent.size(); }
+    size_t DynamicMemoryUsage() const;
+};
+
+#endif // BITCOIN_MEMPOOLINDEX_H
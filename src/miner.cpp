@@ -38,7 +38,8 @@
 #include "spork.h"
 
 #include <boost/thread.hpp>
-#include <boost/tuple/tuple.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index_container.hpp>
 #ifdef ENABLE_MINING
 #include <functional>
 #endif
@@ -53,49 +54,91 @@ using namespace std;
 //
 
 //
-// Unconfirmed transactions in the memory pool often depend on other
-// transactions in the memory pool. When we select transactions from the
-// pool, we select by highest priority or fee rate, so we might consider
-// transactions that depend on transactions that aren't yet in the block.
-// The COrphan class keeps track of these 'temporary orphans' while
-// CreateBlock is figuring out which transactions to include.
+// CreateNewBlock fills a block in two passes. The first, bounded by
+// -blockprioritysize, takes transactions by coin-age priority. The second
+// takes packages of a transaction and those of its in-mempool ancestors not
+// yet in the block, by the fee rate of the whole package, which the mempool
+// keeps up to date; a high-fee child thus pays for its low-fee parents.
 //
-class COrphan
+
+uint64_t nLastBlockTx = 0;
+uint64_t nLastBlockSize = 0;
+
+/**
+ * A mempool entry some of whose ancestors are in the block being assembled
+ * already, with its package sums reduced by them.
+ */
+struct CTxMemPoolModifiedEntry {
+    CTxMemPool::txiter iter;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
+
+    explicit CTxMemPoolModifiedEntry(CTxMemPool::txiter entry) :
+        iter(entry), nSizeWithAncestors(entry->GetSizeWithAncestors()),
+        nModFeesWithAncestors(entry->GetModFeesWithAncestors()) {}
+};
+
+// extracts the mempool entry of a CTxMemPoolModifiedEntry
+struct modifiedentry_iter {
+    typedef CTxMemPool::txiter result_type;
+    result_type operator()(const CTxMemPoolModifiedEntry& entry) const
+    {
+        return entry.iter;
+    }
+};
+
+// Highest package fee rate first, as CompareTxMemPoolEntryByAncestorFee
+class CompareModifiedEntry
 {
 public:
-    const CTransaction* ptx;
-    set<uint256> setDependsOn;
-    CFeeRate feeRate;
-    double dPriority;
-
-    COrphan(const CTransaction* ptxIn) : ptx(ptxIn), feeRate(0), dPriority(0)
+    bool operator()(const CTxMemPoolModifiedEntry& a, const CTxMemPoolModifiedEntry& b) const
     {
+        double f1 = (double)a.nModFeesWithAncestors * b.nSizeWithAncestors;
+        double f2 = (double)b.nModFeesWithAncestors * a.nSizeWithAncestors;
+        if (f1 == f2) {
+            return a.iter->GetTx().GetHash() < b.iter->GetTx().GetHash();
+        }
+        return f1 > f2;
     }
 };
 
-uint64_t nLastBlockTx = 0;
-uint64_t nLastBlockSize = 0;
+typedef boost::multi_index_container<
+    CTxMemPoolModifiedEntry,
+    boost::multi_index::indexed_by<
+        boost::multi_index::ordered_unique<
+            modifiedentry_iter,
+            CTxMemPool::CompareIteratorByHash
+        >,
+        // sorted by modified fee rate with ancestors
+        boost::multi_index::ordered_non_unique<
+            boost::multi_index::identity<CTxMemPoolModifiedEntry>,
+            CompareModifiedEntry
+        >
+    >
+> indexed_modified_transaction_set;
+
+struct update_for_parent_inclusion {
+    update_for_parent_inclusion(CTxMemPool::txiter it) : iter(it) {}
+
+    void operator()(CTxMemPoolModifiedEntry& e)
+    {
+        e.nModFeesWithAncestors -= iter->GetModifiedFee();
+        e.nSizeWithAncestors -= iter->GetTxSize();
+    }
 
-// We want to sort transactions by priority and fee rate, so:
-typedef boost::tuple<double, CFeeRate, const CTransaction*> TxPriority;
-class TxPriorityCompare
-{
-    bool byFee;
+    CTxMemPool::txiter iter;
+};
 
+// We want to sort transactions by priority, then fee rate, so:
+typedef std::pair<double, CTxMemPool::txiter> TxCoinAgePriority;
+class TxCoinAgePriorityCompare
+{
 public:
-    TxPriorityCompare(bool _byFee) : byFee(_byFee) {}
-
-    bool operator()(const TxPriority& a, const TxPriority& b)
+    bool operator()(const TxCoinAgePriority& a, const TxCoinAgePriority& b)
     {
-        if (byFee) {
-            if (a.get<1>() == b.get<1>())
-                return a.get<0>() < b.get<0>();
-            return a.get<1>() < b.get<1>();
-        } else {
-            if (a.get<0>() == b.get<0>())
-                return a.get<1>() < b.get<1>();
-            return a.get<0>() < b.get<0>();
-        }
+        if (a.first == b.first)
+            return a.second->GetFeeRate() < b.second->GetFeeRate();
+        return a.first < b.first;
     }
 };
 
@@ -114,13 +157,46 @@ void UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams,
     }
 }
 
-CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const CScript& scriptPubKeyIn)
+/**
+ * A block being filled, with the coins view and Sapling tree as of its last
+ * transaction. CreateNewBlock builds one from scratch; CLiveBlockTemplate
+ * keeps one across calls and appends to it.
+ */
+struct CBlockAssembly {
+    std::unique_ptr<CBlockTemplate> pblocktemplate;
+    CScript scriptPubKey;
+    CBlockIndex* pindexPrev;
+    int nHeight;
+    uint32_t consensusBranchId;
+    int64_t nLockTimeCutoff;
+    unsigned int nBlockMaxSize;
+    unsigned int nBlockPrioritySize;
+    unsigned int nBlockMinSize;
+    std::unique_ptr<CCoinsViewCache> view;
+    SaplingMerkleTree sapling_tree;
+    bool fPrintPriority;
+
+    uint64_t nBlockSize;
+    uint64_t nBlockTx;
+    int nBlockSigOps;
+    CAmount nFees;
+
+    //! Transactions in the block, and those that cannot go in it
+    std::set<uint256> setInBlock;
+    std::set<uint256> setFailed;
+    //! Packages left out because the block had no room for them
+    std::set<uint256> setSkipped;
+    //! Entry sequence of the last mempool transaction the block has been filled against
+    uint64_t nEntrySequence;
+};
+
+static void InitBlockAssembly(CBlockAssembly& a, const CChainParams& chainparams, const CScript& scriptPubKeyIn)
 {
-    // Create new block
-    std::unique_ptr<CBlockTemplate> pblocktemplate(new CBlockTemplate());
-    if (!pblocktemplate.get())
-        return NULL;
-    CBlock* pblock = &pblocktemplate->block; // pointer for convenience
+    AssertLockHeld(cs_main);
+
+    a.pblocktemplate.reset(new CBlockTemplate());
+    a.scriptPubKey = scriptPubKeyIn;
+    CBlock* pblock = &a.pblocktemplate->block; // pointer for convenience
 
     // -regtest only: allow overriding block.nVersion with
     // -blockversion=N to test forking scenarios
@@ -129,8 +205,8 @@ CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const CScript& s
 
     // Add dummy coinbase tx as first transaction
     pblock->vtx.push_back(CTransaction());
-    pblocktemplate->vTxFees.push_back(-1);   // updated at end
-    pblocktemplate->vTxSigOps.push_back(-1); // updated at end
+    a.pblocktemplate->vTxFees.push_back(-1);   // updated at end
+    a.pblocktemplate->vTxSigOps.push_back(-1); // updated at end
 
     // Largest block you're willing to create:
     unsigned int nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
@@ -143,259 +219,478 @@ CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const CScript& s
         nBlockMaxSize = MAX_TX_SIZE_AFTER_DIFA;
         nBlockMaxSize = std::max((unsigned int)1000, std::min((unsigned int)(MAX_BLOCK_SIZE(chainActive.Tip() ? chainActive.Tip()->nHeight + 1 : 0) - 1000), nBlockMaxSize));
     }
+    a.nBlockMaxSize = nBlockMaxSize;
     // How much of the block should be dedicated to high-priority transactions,
     // included regardless of the fees they pay
     unsigned int nBlockPrioritySize = GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE);
-    nBlockPrioritySize = std::min(nBlockMaxSize, nBlockPrioritySize);
+    a.nBlockPrioritySize = std::min(nBlockMaxSize, nBlockPrioritySize);
 
     // Minimum block size you want to create; block will be filled with free transactions
     // until there are no more or the block reaches this size:
     unsigned int nBlockMinSize = GetArg("-blockminsize", DEFAULT_BLOCK_MIN_SIZE);
-    nBlockMinSize = std::min(nBlockMaxSize, nBlockMinSize);
+    a.nBlockMinSize = std::min(nBlockMaxSize, nBlockMinSize);
 
-    // Collect memory pool transactions into the block
-    CAmount nFees = 0;
+    a.pindexPrev = chainActive.Tip();
+    a.nHeight = a.pindexPrev->nHeight + 1;
+    a.consensusBranchId = CurrentEpochBranchId(a.nHeight, chainparams.GetConsensus());
+    pblock->nTime = GetAdjustedTime();
+    const int64_t nMedianTimePast = a.pindexPrev->GetMedianTimePast();
+    a.view.reset(new CCoinsViewCache(pcoinsTip));
 
-    {
-        LOCK2(cs_main, mempool.cs);
-        CBlockIndex* pindexPrev = chainActive.Tip();
-        const int nHeight = pindexPrev->nHeight + 1;
-        uint32_t consensusBranchId = CurrentEpochBranchId(nHeight, chainparams.GetConsensus());
-        pblock->nTime = GetAdjustedTime();
-        const int64_t nMedianTimePast = pindexPrev->GetMedianTimePast();
-        CCoinsViewCache view(pcoinsTip);
-
-        SaplingMerkleTree sapling_tree;
-        assert(view.GetSaplingAnchorAt(view.GetBestAnchor(SAPLING), sapling_tree));
-
-        // Priority order to process transactions
-        list<COrphan> vOrphan; // list memory doesn't move
-        map<uint256, vector<COrphan*>> mapDependers;
-        bool fPrintPriority = GetBoolArg("-printpriority", false);
-
-        // This vector will be sorted into a priority queue:
-        vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
-        for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin();
-             mi != mempool.mapTx.end(); ++mi) {
-            const CTransaction& tx = mi->GetTx();
-
-            int64_t nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST) ? nMedianTimePast : pblock->GetBlockTime();
-
-            if (tx.IsCoinBase() || !IsFinalTx(tx, nHeight, nLockTimeCutoff) || IsExpiredTx(tx, nHeight))
-                continue;
+    assert(a.view->GetSaplingAnchorAt(a.view->GetBestAnchor(SAPLING), a.sapling_tree));
 
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            CAmount nTotalIn = 0;
-            bool fMissingInputs = false;
-            for (const CTxIn& txin : tx.vin) {
-                // Read prev transaction
-                if (!view.HaveCoins(txin.prevout.hash)) {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash)) {
-                        LogPrintf("ERROR: mempool transaction missing input\n");
-                        if (fDebug)
-                            assert("mempool transaction missing input" == 0);
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
-                        break;
-                    }
+    a.nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST) ? nMedianTimePast : pblock->GetBlockTime();
+    a.fPrintPriority = GetBoolArg("-printpriority", false);
 
-                    // Has to wait for dependencies
-                    if (!porphan) {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    nTotalIn += mempool.mapTx.find(txin.prevout.hash)->GetTx().vout[txin.prevout.n].nValue;
-                    continue;
-                }
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                assert(coins);
+    a.nBlockSize = 1000;
+    a.nBlockTx = 0;
+    a.nBlockSigOps = 100;
+    a.nFees = 0;
+}
 
-                CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
+// Check a transaction against the block so far, and add it if it fits. Its
+// in-mempool parents must be in the block already.
+static bool AddToBlock(CBlockAssembly& a, CTxMemPool::txiter iter, double dPriority, CTxMemPool::setEntries& inBlock)
+{
+    const CTransaction& tx = iter->GetTx();
+    if (tx.IsCoinBase() || !IsFinalTx(tx, a.nHeight, a.nLockTimeCutoff) || IsExpiredTx(tx, a.nHeight))
+        return false;
 
-                int nConf = nHeight - coins->nHeight;
+    // Size limits
+    unsigned int nTxSize = iter->GetTxSize();
+    if (a.nBlockSize + nTxSize >= a.nBlockMaxSize)
+        return false;
 
-                dPriority += (double)nValueIn * nConf;
-            }
-            nTotalIn += tx.GetShieldedValueIn();
+    // Legacy limits on sigOps:
+    unsigned int nTxSigOps = GetLegacySigOpCount(tx);
+    if (a.nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+        return false;
 
-            if (fMissingInputs)
-                continue;
+    CCoinsViewCache& view = *a.view;
+    if (!view.HaveInputs(tx) || view.HaveShieldedRequirements(tx))
+        return false;
 
-            // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
+    CAmount nTxFees = view.GetValueIn(tx) - tx.GetValueOut();
 
-            uint256 hash = tx.GetHash();
-            mempool.ApplyDeltas(hash, dPriority, nTotalIn);
+    nTxSigOps += GetP2SHSigOpCount(tx, view);
+    if (a.nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+        return false;
 
-            CFeeRate feeRate(nTotalIn - tx.GetValueOut(), nTxSize);
+    // Note that flags: we don't want to set mempool/IsStandard()
+    // policy here, but we still have to ensure that the block we
+    // create only contains transactions that are valid in new blocks.
+    CValidationState state;
+    PrecomputedTransactionData txdata(tx);
+    if (!ContextualCheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, txdata, Params().GetConsensus(), a.consensusBranchId))
+        return false;
 
-            if (porphan) {
-                porphan->dPriority = dPriority;
-                porphan->feeRate = feeRate;
-            } else
-                vecPriority.push_back(TxPriority(dPriority, feeRate, &(mi->GetTx())));
-        }
+    UpdateCoins(tx, view, a.nHeight);
 
-        // Collect transactions into block
-        uint64_t nBlockSize = 1000;
-        uint64_t nBlockTx = 0;
-        int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
+    for (const OutputDescription& outDescription : tx.vShieldedOutput) {
+        a.sapling_tree.append(outDescription.cm);
+    }
 
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
+    // Added
+    a.pblocktemplate->block.vtx.push_back(tx);
+    a.pblocktemplate->vTxFees.push_back(nTxFees);
+    a.pblocktemplate->vTxSigOps.push_back(nTxSigOps);
+    a.nBlockSize += nTxSize;
+    ++a.nBlockTx;
+    a.nBlockSigOps += nTxSigOps;
+    a.nFees += nTxFees;
+    a.setInBlock.insert(tx.GetHash());
+    inBlock.insert(iter);
+
+    if (a.fPrintPriority) {
+        LogPrintf("priority %.1f fee %s txid %s\n",
+                  dPriority, CFeeRate(iter->GetModifiedFee(), nTxSize).ToString(), tx.GetHash().ToString());
+    }
+    return true;
+}
 
-        while (!vecPriority.empty()) {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            CFeeRate feeRate = vecPriority.front().get<1>();
-            const CTransaction& tx = *(vecPriority.front().get<2>());
+// Fill the space reserved for high-priority transactions, regardless of the
+// fees they pay
+static void AddPriorityTransactions(CBlockAssembly& a, CTxMemPool::setEntries& inBlock)
+{
+    if (a.nBlockPrioritySize == 0)
+        return;
 
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
+    vector<TxCoinAgePriority> vecPriority;
+    vecPriority.reserve(mempool.mapTx.size());
+    for (CTxMemPool::txiter mi = mempool.mapTx.begin(); mi != mempool.mapTx.end(); ++mi) {
+        double dPriority = mi->GetPriority(a.nHeight);
+        CAmount dummy = 0;
+        mempool.ApplyDeltas(mi->GetTx().GetHash(), dPriority, dummy);
+        vecPriority.push_back(TxCoinAgePriority(dPriority, mi));
+    }
 
-            // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            if (nBlockSize + nTxSize >= nBlockMaxSize)
-                continue;
+    TxCoinAgePriorityCompare comparer;
+    std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
 
-            // Legacy limits on sigOps:
-            unsigned int nTxSigOps = GetLegacySigOpCount(tx);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
+    // Transactions waiting for an in-mempool parent to be added
+    map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash> waitPriMap;
 
-            // Skip free transactions if we're past the minimum block size:
-            const uint256& hash = tx.GetHash();
-            double dPriorityDelta = 0;
-            CAmount nFeeDelta = 0;
-            mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
-            if (fSortedByFee && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
-                continue;
+    while (!vecPriority.empty()) {
+        // Take highest priority transaction off the priority queue:
+        double dPriority = vecPriority.front().first;
+        CTxMemPool::txiter iter = vecPriority.front().second;
+        std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
+        vecPriority.pop_back();
 
-            // Prioritise by fee once past the priority size or we run out of high-priority
-            // transactions:
-            if (!fSortedByFee &&
-                ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority))) {
-                fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
+        bool fWaiting = false;
+        for (CTxMemPool::txiter parent : mempool.GetMemPoolParents(iter)) {
+            if (!inBlock.count(parent)) {
+                fWaiting = true;
+                break;
             }
+        }
+        if (fWaiting) {
+            waitPriMap.insert(std::make_pair(iter, dPriority));
+            continue;
+        }
 
-            if (!view.HaveInputs(tx))
-                continue;
+        // Done once past the priority size or out of high-priority transactions
+        if (a.nBlockSize + iter->GetTxSize() >= a.nBlockPrioritySize || !AllowFree(dPriority))
+            break;
 
-            CAmount nTxFees = view.GetValueIn(tx) - tx.GetValueOut();
+        if (!AddToBlock(a, iter, dPriority, inBlock))
+            continue;
 
-            nTxSigOps += GetP2SHSigOpCount(tx, view);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
+        // Queue the children that were waiting for this one
+        for (CTxMemPool::txiter child : mempool.GetMemPoolChildren(iter)) {
+            auto wit = waitPriMap.find(child);
+            if (wit != waitPriMap.end()) {
+                vecPriority.push_back(TxCoinAgePriority(wit->second, child));
+                std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
+                waitPriMap.erase(wit);
+            }
+        }
+    }
+}
 
-            // Note that flags: we don't want to set mempool/IsStandard()
-            // policy here, but we still have to ensure that the block we
-            // create only contains transactions that are valid in new blocks.
-            CValidationState state;
-            PrecomputedTransactionData txdata(tx);
-            if (!ContextualCheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, txdata, Params().GetConsensus(), consensusBranchId))
+// Add packages by fee rate. Descendants of transactions in the block get an
+// entry in mapModifiedTx with the package sums of the ancestors they still
+// need. With pvNew, only the packages of those transactions (and of whatever
+// comes to descend from the block through them) are considered; the rest of
+// the mempool was weighed when the block was filled before. Returns the
+// number of packages newly left out for lack of room.
+static unsigned int AddPackages(CBlockAssembly& a, CTxMemPool::setEntries& inBlock, CTxMemPool::setEntries& failedTx,
+                                const std::vector<CTxMemPool::txiter>* pvNew = nullptr)
+{
+    unsigned int nNewlySkipped = 0;
+    indexed_modified_transaction_set mapModifiedTx;
+    auto updatePackagesForAdded = [&](const CTxMemPool::setEntries& added) {
+        for (CTxMemPool::txiter it : added) {
+            CTxMemPool::setEntries descendants;
+            mempool.CalculateDescendants(it, descendants);
+            for (CTxMemPool::txiter desc : descendants) {
+                if (inBlock.count(desc) || failedTx.count(desc))
+                    continue;
+                auto mit = mapModifiedTx.find(desc);
+                if (mit == mapModifiedTx.end()) {
+                    mit = mapModifiedTx.insert(CTxMemPoolModifiedEntry(desc)).first;
+                }
+                mapModifiedTx.modify(mit, update_for_parent_inclusion(it));
+            }
+        }
+    };
+    auto& ancestorIndex = mempool.mapTx.get<ancestor_score>();
+    auto mi = ancestorIndex.begin();
+    if (pvNew) {
+        for (CTxMemPool::txiter it : *pvNew) {
+            if (inBlock.count(it) || failedTx.count(it) || mapModifiedTx.count(it))
                 continue;
+            CTxMemPool::setEntries ancestors;
+            mempool.CalculateMemPoolAncestors(it, ancestors);
+            auto mit = mapModifiedTx.insert(CTxMemPoolModifiedEntry(it)).first;
+            for (CTxMemPool::txiter parent : ancestors) {
+                if (inBlock.count(parent))
+                    mapModifiedTx.modify(mit, update_for_parent_inclusion(parent));
+            }
+        }
+        mi = ancestorIndex.end();
+    } else {
+        updatePackagesForAdded(inBlock);
+    }
 
-            UpdateCoins(tx, view, nHeight);
+    while (mi != ancestorIndex.end() || !mapModifiedTx.empty()) {
+        if (mi != ancestorIndex.end()) {
+            CTxMemPool::txiter it = mempool.mapTx.project<0>(mi);
+            if (inBlock.count(it) || failedTx.count(it) || mapModifiedTx.count(it)) {
+                ++mi;
+                continue;
+            }
+        }
 
-            for (const OutputDescription& outDescription : tx.vShieldedOutput) {
-                sapling_tree.append(outDescription.cm);
+        // Take the better of the next mempool entry and the best modified one
+        auto modit = mapModifiedTx.get<1>().begin();
+        bool fUsingModified = false;
+        CTxMemPool::txiter iter;
+        if (mi == ancestorIndex.end()) {
+            iter = modit->iter;
+            fUsingModified = true;
+        } else {
+            iter = mempool.mapTx.project<0>(mi);
+            if (modit != mapModifiedTx.get<1>().end() &&
+                CompareModifiedEntry()(*modit, CTxMemPoolModifiedEntry(iter))) {
+                iter = modit->iter;
+                fUsingModified = true;
             }
+        }
+        uint64_t nPackageSize = fUsingModified ? modit->nSizeWithAncestors : iter->GetSizeWithAncestors();
+        CAmount nPackageFees = fUsingModified ? modit->nModFeesWithAncestors : iter->GetModFeesWithAncestors();
+        if (fUsingModified) {
+            mapModifiedTx.get<1>().erase(modit);
+        } else {
+            ++mi;
+        }
+        if (inBlock.count(iter) || failedTx.count(iter))
+            continue;
+
+        // Skip free transactions if we're past the minimum block size;
+        // every other package pays a lower fee rate.
+        if (nPackageFees < ::minRelayTxFee.GetFee(nPackageSize) && a.nBlockSize + nPackageSize >= a.nBlockMinSize)
+            break;
+
+        if (a.nBlockSize + nPackageSize >= a.nBlockMaxSize) {
+            if (a.setSkipped.insert(iter->GetTx().GetHash()).second)
+                nNewlySkipped++;
+            // Its ancestor sums no longer hold once its modified entry is gone
+            if (fUsingModified)
+                failedTx.insert(iter);
+            continue;
+        }
 
-            // Added
-            pblock->vtx.push_back(tx);
-            pblocktemplate->vTxFees.push_back(nTxFees);
-            pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
-
-            if (fPrintPriority) {
-                LogPrintf("priority %.1f fee %s txid %s\n",
-                          dPriority, feeRate.ToString(), tx.GetHash().ToString());
+        CTxMemPool::setEntries ancestors;
+        mempool.CalculateMemPoolAncestors(iter, ancestors);
+        vector<CTxMemPool::txiter> vPackage;
+        bool fFailedAncestor = false;
+        for (CTxMemPool::txiter it : ancestors) {
+            if (inBlock.count(it))
+                continue;
+            if (failedTx.count(it)) {
+                fFailedAncestor = true;
+                break;
             }
+            vPackage.push_back(it);
+        }
+        if (fFailedAncestor) {
+            failedTx.insert(iter);
+            continue;
+        }
+        vPackage.push_back(iter);
 
-            // Add transactions that depend on this one to the priority queue
-            if (mapDependers.count(hash)) {
-                for (COrphan* porphan : mapDependers[hash]) {
-                    if (!porphan->setDependsOn.empty()) {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty()) {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->feeRate, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
-                    }
-                }
+        // A transaction has more ancestors than any of its parents, so this puts parents first
+        std::sort(vPackage.begin(), vPackage.end(), [](CTxMemPool::txiter x, CTxMemPool::txiter y) {
+            return x->GetCountWithAncestors() < y->GetCountWithAncestors();
+        });
+
+        CTxMemPool::setEntries added;
+        for (CTxMemPool::txiter it : vPackage) {
+            if (!AddToBlock(a, it, a.fPrintPriority ? it->GetPriority(a.nHeight) : 0, inBlock)) {
+                failedTx.insert(it);
+                failedTx.insert(iter);
+                break;
             }
+            added.insert(it);
+            // Its package sums counted ancestors that are now in the block
+            mapModifiedTx.erase(it);
+        }
+        updatePackagesForAdded(added);
+    }
+
+    for (CTxMemPool::txiter it : failedTx) {
+        a.setFailed.insert(it->GetTx().GetHash());
+    }
+    return nNewlySkipped;
+}
+
+// Create the coinbase paying the fees collected so far, and fill in the header
+static void FinishBlock(CBlockAssembly& a, const CChainParams& chainparams)
+{
+    CBlock* pblock = &a.pblocktemplate->block;
+
+    nLastBlockTx = a.nBlockTx;
+    nLastBlockSize = a.nBlockSize;
+
+    // Create coinbase tx
+    CMutableTransaction txNew = CreateNewContextualCMutableTransaction(chainparams.GetConsensus(), a.nHeight);
+    txNew.vin.resize(1);
+    txNew.vin[0].prevout.SetNull();
+    txNew.vout.resize(1);
+    txNew.vout[0].scriptPubKey = a.scriptPubKey;
+
+    // Masternode and general budget payments
+    CScript payee;
+    FillBlockPayee(txNew, a.nFees, payee);
+
+    // Make payee
+    if(payee != CScript())
+    {
+        CTxDestination address1;
+        ExtractDestination(payee, address1);
+        KeyIO keyIO(chainparams);
+        LogPrint("masternode", "Masternode payment to %s\n", keyIO.EncodeDestination(address1));
+        pblock->payee = payee;
+    }
+
+    txNew.vin[0].scriptSig = CScript() << a.nHeight << OP_0;
+
+    pblock->vtx[0] = txNew;
+    a.pblocktemplate->vTxFees[0] = -a.nFees;
+
+    // Randomise nonce
+    arith_uint256 nonce = UintToArith256(GetRandHash());
+    // Clear the top and bottom 16 bits (for local use as thread flags and counters)
+    nonce <<= 32;
+    nonce >>= 16;
+    pblock->nNonce = ArithToUint256(nonce);
+
+    // Fill in header
+    pblock->hashPrevBlock = a.pindexPrev->GetBlockHash();
+    pblock->hashFinalSaplingRoot = a.sapling_tree.root();
+    UpdateTime(pblock, Params().GetConsensus(), a.pindexPrev);
+    pblock->nBits = GetNextWorkRequired(a.pindexPrev, pblock, Params().GetConsensus());
+    pblock->nSolution.clear();
+    a.pblocktemplate->vTxSigOps[0] = GetLegacySigOpCount(pblock->vtx[0]);
+}
+
+// Fill a new block from the mempool, and check it
+static void AssembleBlock(CBlockAssembly& a, const CChainParams& chainparams, const CScript& scriptPubKeyIn)
+{
+    InitBlockAssembly(a, chainparams, scriptPubKeyIn);
+
+    CTxMemPool::setEntries inBlock;
+    CTxMemPool::setEntries failedTx;
+    AddPriorityTransactions(a, inBlock);
+    AddPackages(a, inBlock, failedTx);
+    FinishBlock(a, chainparams);
+
+    CValidationState state;
+    if (!TestBlockValidity(state, chainparams, a.pblocktemplate->block, a.pindexPrev, false, false)) {
+        if (state.GetRejectCode() != REJECT_TIME_TOO_FAST) {
+            throw std::runtime_error("CreateNewBlock(): TestBlockValidity failed");
         }
+    }
+}
+
+CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const CScript& scriptPubKeyIn)
+{
+    CBlockAssembly a;
+    {
+        LOCK2(cs_main, mempool.cs);
+        AssembleBlock(a, chainparams, scriptPubKeyIn);
+    }
 
-        nLastBlockTx = nBlockTx;
-        nLastBlockSize = nBlockSize;
-
-        // Create coinbase tx
-        CMutableTransaction txNew = CreateNewContextualCMutableTransaction(chainparams.GetConsensus(), nHeight);
-        txNew.vin.resize(1);
-        txNew.vin[0].prevout.SetNull();
-        txNew.vout.resize(1);
-        txNew.vout[0].scriptPubKey = scriptPubKeyIn;
-
-        // Masternode and general budget payments
-        CScript payee;
-        FillBlockPayee(txNew, nFees, payee);
-
-        // Make payee
-        if(payee != CScript())
-        {
-            CTxDestination address1;
-            ExtractDestination(payee, address1);
-            KeyIO keyIO(chainparams);
-            LogPrint("masternode", "Masternode payment to %s\n", keyIO.EncodeDestination(address1));
-            pblock->payee = payee;
+    return a.pblocktemplate.release();
+}
+
+CLiveBlockTemplate liveBlockTemplate;
+
+CLiveBlockTemplate::CLiveBlockTemplate() : nTransactionsUpdatedLast(0), nRebuildTime(0), nValidateTime(0), fStale(false) {}
+
+CLiveBlockTemplate::~CLiveBlockTemplate() {}
+
+CBlockTemplate* CLiveBlockTemplate::Snapshot(const CChainParams& chainparams, const CScript& scriptPubKeyIn)
+{
+    LOCK2(cs_main, mempool.cs);
+    LOCK(cs);
+
+    bool fRebuild = !assembly ||
+                    assembly->pindexPrev != chainActive.Tip() ||
+                    assembly->scriptPubKey != scriptPubKeyIn ||
+                    (fStale && GetTime() - nRebuildTime > LIVE_TEMPLATE_REBUILD_INTERVAL);
+
+    if (!fRebuild && mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast) {
+        // A transaction that left the mempool other than in a block (a
+        // conflict or an eviction) can take descendants in the template with
+        // it, so the template is started over.
+        CTxMemPool::setEntries inBlock;
+        for (const uint256& hash : assembly->setInBlock) {
+            CTxMemPool::txiter it = mempool.mapTx.find(hash);
+            if (it == mempool.mapTx.end()) {
+                fRebuild = true;
+                break;
+            }
+            inBlock.insert(it);
         }
 
-        txNew.vin[0].scriptSig = CScript() << nHeight << OP_0;
-
-        pblock->vtx[0] = txNew;
-        pblocktemplate->vTxFees[0] = -nFees;
-
-        // Randomise nonce
-        arith_uint256 nonce = UintToArith256(GetRandHash());
-        // Clear the top and bottom 16 bits (for local use as thread flags and counters)
-        nonce <<= 32;
-        nonce >>= 16;
-        pblock->nNonce = ArithToUint256(nonce);
-
-        // Fill in header
-        pblock->hashPrevBlock = pindexPrev->GetBlockHash();
-        pblock->hashFinalSaplingRoot = sapling_tree.root();
-        UpdateTime(pblock, Params().GetConsensus(), pindexPrev);
-        pblock->nBits = GetNextWorkRequired(pindexPrev, pblock, Params().GetConsensus());
-        pblock->nSolution.clear();
-        pblocktemplate->vTxSigOps[0] = GetLegacySigOpCount(pblock->vtx[0]);
-
-        CValidationState state;
-        if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
-            if (state.GetRejectCode() != REJECT_TIME_TOO_FAST) {
-                throw std::runtime_error("CreateNewBlock(): TestBlockValidity failed");
+        if (!fRebuild) {
+            CTxMemPool::setEntries failedTx;
+            for (const uint256& hash : assembly->setFailed) {
+                CTxMemPool::txiter it = mempool.mapTx.find(hash);
+                if (it != mempool.mapTx.end())
+                    failedTx.insert(it);
+            }
+            assembly->setFailed.clear();
+
+            // Only transactions that entered the mempool since the last call
+            // are weighed, found from the entry order index. One that left
+            // the mempool and came back is new again, whatever became of it
+            // before.
+            auto& sequenceIndex = mempool.mapTx.get<entry_sequence>();
+            std::vector<CTxMemPool::txiter> vNew;
+            for (auto mi = sequenceIndex.upper_bound(assembly->nEntrySequence); mi != sequenceIndex.end(); ++mi) {
+                CTxMemPool::txiter it = mempool.mapTx.project<0>(mi);
+                failedTx.erase(it);
+                assembly->setSkipped.erase(it->GetTx().GetHash());
+                vNew.push_back(it);
+            }
+            if (!sequenceIndex.empty())
+                assembly->nEntrySequence = sequenceIndex.rbegin()->GetEntrySequence();
+
+            // The block only grows, so what was checked stays checked; only
+            // transactions new to it go through the coins view.
+            const std::vector<CTransaction>& vtx = assembly->pblocktemplate->block.vtx;
+            size_t nTx = vtx.size();
+            if (AddPackages(*assembly, inBlock, failedTx, &vNew) > 0)
+                fStale = true;
+            if (vtx.size() != nTx) {
+                // AddToBlock checked their inputs and scripts; check the rest
+                // of what a block asks of the transactions added to it. Their
+                // proofs were verified when they entered the mempool.
+                auto verifier = ProofVerifier::Disabled();
+                for (size_t i = nTx; i < vtx.size() && !fRebuild; i++) {
+                    CValidationState state;
+                    if (!CheckTransactionWithoutProofVerification(vtx[i], state) ||
+                        !ContextualCheckTransaction(vtx[i], state, chainparams, assembly->nHeight, 100, verifier)) {
+                        LogPrintf("CLiveBlockTemplate: appended transaction %s is invalid (%s), rebuilding\n",
+                                  vtx[i].GetHash().ToString(), state.GetRejectReason());
+                        fRebuild = true;
+                    }
+                }
+                if (!fRebuild)
+                    FinishBlock(*assembly, chainparams);
+            }
+
+            // The block as a whole is checked again at most every
+            // LIVE_TEMPLATE_REBUILD_INTERVAL, rather than on every call
+            if (!fRebuild && vtx.size() != nTx && GetTime() - nValidateTime > LIVE_TEMPLATE_REBUILD_INTERVAL) {
+                CValidationState state;
+                if (!TestBlockValidity(state, chainparams, assembly->pblocktemplate->block, assembly->pindexPrev, false, false) &&
+                    state.GetRejectCode() != REJECT_TIME_TOO_FAST) {
+                    LogPrintf("CLiveBlockTemplate: appended block failed validity (%s), rebuilding\n", state.GetRejectReason());
+                    fRebuild = true;
+                }
+                nValidateTime = GetTime();
             }
         }
     }
 
-    return pblocktemplate.release();
+    if (fRebuild) {
+        assembly.reset();
+        std::unique_ptr<CBlockAssembly> newAssembly(new CBlockAssembly());
+        AssembleBlock(*newAssembly, chainparams, scriptPubKeyIn);
+        auto& sequenceIndex = mempool.mapTx.get<entry_sequence>();
+        newAssembly->nEntrySequence = sequenceIndex.empty() ? 0 : sequenceIndex.rbegin()->GetEntrySequence();
+        assembly = std::move(newAssembly);
+        nRebuildTime = GetTime();
+        nValidateTime = nRebuildTime;
+        fStale = false;
+    }
+    nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
+
+    return new CBlockTemplate(*assembly->pblocktemplate);
 }
 
 #ifdef ENABLE_WALLET
@@ -7,13 +7,16 @@
 #define BITCOIN_MINER_H
 
 #include "primitives/block.h"
+#include "sync.h"
 
 #include <boost/optional.hpp>
+#include <memory>
 #include <stdint.h>
 
 class CBlockIndex;
 class CChainParams;
 class CScript;
+struct CBlockAssembly;
 #ifdef ENABLE_WALLET
 class CReserveKey;
 class CWallet;
@@ -29,8 +32,47 @@ struct CBlockTemplate {
     std::vector<int64_t> vTxSigOps;
 };
 
+/** Seconds a template missing better-paying transactions is kept before it is rebuilt */
+static const int64_t LIVE_TEMPLATE_REBUILD_INTERVAL = 5;
+
 /** Generate a new block, without valid proof-of-work */
 CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const CScript& scriptPubKeyIn);
+
+/**
+ * A block template kept up to date across calls. Transactions that entered
+ * the mempool since the last call are appended by package fee rate, against
+ * the coins view the template was built with; the block is only assembled
+ * afresh when the tip or the payout script changes, a transaction in it
+ * leaves the mempool, an appended transaction or the block fails validation,
+ * or packages that did not fit have waited for longer than
+ * LIVE_TEMPLATE_REBUILD_INTERVAL.
+ *
+ * The new transactions are found from the mempool's entry order, and only
+ * their packages are weighed. Each appended transaction is checked as it is
+ * added; the whole block goes through TestBlockValidity again at most every
+ * LIVE_TEMPLATE_REBUILD_INTERVAL. The priority area is filled on rebuilds only.
+ */
+class CLiveBlockTemplate
+{
+private:
+    CCriticalSection cs;
+    std::unique_ptr<CBlockAssembly> assembly;
+    unsigned int nTransactionsUpdatedLast;
+    int64_t nRebuildTime;
+    //! When the whole template was last run through TestBlockValidity
+    int64_t nValidateTime;
+    //! Whether packages were left out for lack of room since the last rebuild
+    bool fStale;
+
+public:
+    CLiveBlockTemplate();
+    ~CLiveBlockTemplate();
+
+    /** Bring the template up to date and return a copy of it. */
+    CBlockTemplate* Snapshot(const CChainParams& chainparams, const CScript& scriptPubKeyIn);
+};
+
+extern CLiveBlockTemplate liveBlockTemplate;
 #ifdef ENABLE_WALLET
 std::optional<CScript> GetMinerScriptPubKey(CReserveKey& reservekey);
 CBlockTemplate* CreateNewBlockWithKey(const CChainParams& chainparams, CReserveKey& reservekey);
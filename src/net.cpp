@@ -27,6 +27,10 @@
 #include <fcntl.h>
 #endif
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
 #include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
 
@@ -60,6 +64,295 @@ struct ListenSocket {
 
     ListenSocket(SOCKET socket, bool whitelisted) : socket(socket), whitelisted(whitelisted) {}
 };
+
+/** What the socket handler wants to do with a node's socket on this pass. */
+struct SocketWant {
+    NodeId id;
+    SOCKET socket;
+    bool fRecv;
+    bool fSend;
+};
+
+/** Whether complete messages fill the receive buffer. Requires cs_vRecvMsg. */
+static bool IsRecvFlooded(CNode* pnode)
+{
+    return !pnode->vRecvMsg.empty() && pnode->vRecvMsg.front().complete() &&
+           pnode->GetTotalRecvSize() > ReceiveFloodSize();
+}
+
+/**
+ * Find what to wait for on a node's socket. Returns false if a buffer it
+ * needed to look at was locked, in which case that direction is left unset.
+ */
+static bool GetSocketWant(CNode* pnode, SocketWant& want)
+{
+    want = SocketWant{pnode->id, pnode->hSocket, false, false};
+
+    // Implement the following logic:
+    // * If there is data to send, select() for sending data. As this only
+    //   happens when optimistic write failed, we choose to first drain the
+    //   write buffer in this case before receiving more. This avoids
+    //   needlessly queueing received data, if the remote peer is not themselves
+    //   receiving data. This means properly utilizing TCP flow control signalling.
+    // * Otherwise, if there is no (complete) message in the receive buffer,
+    //   or there is space left in the buffer, select() for receiving data.
+    // * (if neither of the above applies, there is certainly one message
+    //   in the receiver buffer ready to be processed).
+    // Together, that means that at least one of the following is always possible,
+    // so we don't deadlock:
+    // * We send some data.
+    // * We wait for data to be received (and disconnect after timeout).
+    // * We process a message in the buffer (message handler thread).
+    bool fLocked = true;
+    {
+        TRY_LOCK(pnode->cs_vSend, lockSend);
+        if (lockSend)
+            want.fSend = !pnode->vSendMsg.empty();
+        else
+            fLocked = false;
+    }
+    if (!want.fSend) {
+        TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+        if (lockRecv)
+            want.fRecv = !IsRecvFlooded(pnode);
+        else
+            fLocked = false;
+    }
+    return fLocked;
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+/**
+ * Edge-triggered epoll backend for the socket handler. Node sockets are
+ * registered once for both directions instead of being scanned on every
+ * pass. An edge is only reported once, so each node keeps its socket's
+ * readiness until a recv or send comes up short.
+ *
+ * What each node wants is kept up to date rather than collected from every
+ * node on each pass: it is looked at again only for nodes whose buffers
+ * other threads report as changed, and for nodes the handler serviced on
+ * the previous pass.
+ */
+class CEpollSocketEvents
+{
+private:
+    struct SocketState {
+        CNode* pnode;
+        SOCKET socket;
+        bool fReadable;
+        bool fWritable;
+        bool fWantRecv;
+        bool fWantSend;
+
+        bool IsReady() const { return (fReadable && fWantRecv) || (fWritable && fWantSend); }
+    };
+
+    //! Tags listen sockets in epoll_event data, which otherwise holds a node id
+    static const uint64_t LISTEN_SOCKET_TAG = 1ULL << 63;
+    static const int MAX_EVENTS = 1024;
+
+    int epollfd;
+    //! Only used by the socket handler thread
+    std::map<NodeId, SocketState> mapSockets;
+    //! Nodes whose socket is ready for what they want to do
+    std::set<NodeId> setReady;
+
+    CCriticalSection cs;
+    //! Nodes added to vNodes and not registered yet
+    std::vector<CNode*> vAdded;
+    //! Nodes whose wants may have changed since the last pass
+    std::set<NodeId> setChanged;
+
+    bool Register(CNode* pnode)
+    {
+        SOCKET hSocket = pnode->hSocket;
+        if (hSocket == INVALID_SOCKET)
+            return false;
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.u64 = pnode->id;
+        if (epoll_ctl(epollfd, EPOLL_CTL_ADD, hSocket, &event) == SOCKET_ERROR &&
+            (errno != EEXIST || epoll_ctl(epollfd, EPOLL_CTL_MOD, hSocket, &event) == SOCKET_ERROR)) {
+            LogPrintf("epoll_ctl failed for peer=%d: %s\n", pnode->id, NetworkErrorString(errno));
+            return false;
+        }
+        // Assume the socket is ready until it proves otherwise; nothing may
+        // have been read from or written to it since it was connected.
+        mapSockets[pnode->id] = SocketState{pnode, hSocket, true, true, false, false};
+        return true;
+    }
+
+    void UpdateReady(NodeId id, const SocketState& state)
+    {
+        if (state.IsReady())
+            setReady.insert(id);
+        else
+            setReady.erase(id);
+    }
+
+public:
+    CEpollSocketEvents() : epollfd(-1) {}
+    ~CEpollSocketEvents()
+    {
+        if (epollfd != -1)
+            close(epollfd);
+    }
+
+    bool IsActive() const { return epollfd != -1; }
+
+    /** Stop watching all sockets, leaving them to select(). */
+    void Close()
+    {
+        if (epollfd != -1)
+            close(epollfd);
+        epollfd = -1;
+        mapSockets.clear();
+        setReady.clear();
+        LOCK(cs);
+        vAdded.clear();
+        setChanged.clear();
+    }
+
+    bool Init(const std::vector<ListenSocket>& vListenSockets)
+    {
+        epollfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epollfd == -1) {
+            LogPrintf("epoll_create1 failed: %s\n", NetworkErrorString(errno));
+            return false;
+        }
+        for (const ListenSocket& hListenSocket : vListenSockets) {
+            // Level-triggered, so connections left over by AcceptConnection
+            // are reported again on the next pass.
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.u64 = LISTEN_SOCKET_TAG | (uint64_t)hListenSocket.socket;
+            if (epoll_ctl(epollfd, EPOLL_CTL_ADD, hListenSocket.socket, &event) == SOCKET_ERROR) {
+                LogPrintf("epoll_ctl failed for listen socket: %s\n", NetworkErrorString(errno));
+                close(epollfd);
+                epollfd = -1;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /** Start watching a node's socket. Requires cs_vNodes, held since the node was added to vNodes. */
+    void Added(CNode* pnode)
+    {
+        LOCK(cs);
+        vAdded.push_back(pnode);
+    }
+
+    /** Stop watching a node that is being removed from vNodes. Requires cs_vNodes. */
+    void Removed(CNode* pnode)
+    {
+        {
+            LOCK(cs);
+            vAdded.erase(std::remove(vAdded.begin(), vAdded.end(), pnode), vAdded.end());
+            setChanged.erase(pnode->id);
+        }
+        // Closing the socket has already removed it from the epoll set
+        mapSockets.erase(pnode->id);
+        setReady.erase(pnode->id);
+    }
+
+    /** A node's send or receive buffer changed in a way that may change what it waits for. */
+    void Changed(NodeId id)
+    {
+        LOCK(cs);
+        setChanged.insert(id);
+    }
+
+    void Wait(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set)
+    {
+        std::vector<CNode*> vNew;
+        std::set<NodeId> setCheck;
+        {
+            LOCK(cs);
+            vNew.swap(vAdded);
+            setCheck.swap(setChanged);
+        }
+        for (CNode* pnode : vNew) {
+            if (Register(pnode))
+                setCheck.insert(pnode->id);
+        }
+        // Nodes serviced on the last pass have read or sent since
+        setCheck.insert(setReady.begin(), setReady.end());
+
+        std::vector<NodeId> vBusy;
+        for (NodeId id : setCheck) {
+            auto it = mapSockets.find(id);
+            if (it == mapSockets.end())
+                continue;
+            SocketState& state = it->second;
+            SocketWant want{id, state.socket, false, false};
+            if (state.pnode->hSocket == state.socket && !GetSocketWant(state.pnode, want))
+                vBusy.push_back(id);
+            state.fWantRecv = want.fRecv;
+            state.fWantSend = want.fSend;
+            UpdateReady(id, state);
+        }
+        if (!vBusy.empty()) {
+            // Look again on the next pass, when the other thread is done
+            LOCK(cs);
+            setChanged.insert(vBusy.begin(), vBusy.end());
+        }
+
+        // Don't sleep while a socket still has work left from an earlier edge
+        struct epoll_event events[MAX_EVENTS];
+        int nEvents = epoll_wait(epollfd, events, MAX_EVENTS, setReady.empty() ? 50 : 0);
+        boost::this_thread::interruption_point();
+
+        if (nEvents == SOCKET_ERROR) {
+            if (errno != EINTR)
+                LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(errno));
+            nEvents = 0;
+        }
+
+        for (int i = 0; i < nEvents; i++) {
+            if (events[i].data.u64 & LISTEN_SOCKET_TAG) {
+                recv_set.insert((SOCKET)(events[i].data.u64 & ~LISTEN_SOCKET_TAG));
+                continue;
+            }
+            NodeId id = (NodeId)events[i].data.u64;
+            auto it = mapSockets.find(id);
+            if (it == mapSockets.end())
+                continue;
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                it->second.fReadable = true;
+            if (events[i].events & EPOLLOUT)
+                it->second.fWritable = true;
+            if (events[i].events & (EPOLLHUP | EPOLLERR))
+                error_set.insert(it->second.socket);
+            UpdateReady(id, it->second);
+        }
+
+        for (NodeId id : setReady) {
+            const SocketState& state = mapSockets[id];
+            if (state.fReadable && state.fWantRecv)
+                recv_set.insert(state.socket);
+            if (state.fWritable && state.fWantSend)
+                send_set.insert(state.socket);
+        }
+    }
+
+    /** The socket has no more data to read until epoll reports it again. */
+    void RecvDrained(NodeId id)
+    {
+        auto it = mapSockets.find(id);
+        if (it != mapSockets.end())
+            it->second.fReadable = false;
+    }
+
+    /** The socket's send buffer is full until epoll reports it again. */
+    void SendBlocked(NodeId id)
+    {
+        auto it = mapSockets.find(id);
+        if (it != mapSockets.end())
+            it->second.fWritable = false;
+    }
+};
+#endif
 } // namespace
 
 //
@@ -74,6 +367,19 @@ static bool vfLimited[NET_MAX] = {};
 static CNode* pnodeLocalHost = NULL;
 uint64_t nLocalHostNonce = 0;
 static std::vector<ListenSocket> vhListenSocket;
+#ifdef HAVE_SYS_EPOLL_H
+static CEpollSocketEvents epollSocketEvents;
+#endif
+
+/** Whether the socket handler can wait on a socket; only select() is limited to FD_SETSIZE. */
+static bool IsUsableSocket(SOCKET hSocket)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    if (epollSocketEvents.IsActive())
+        return true;
+#endif
+    return IsSelectableSocket(hSocket);
+}
 static list<CNode*> vNodesDisconnected;
 CAddrMan addrman;
 int nMaxConnections = DEFAULT_MAX_PEER_CONNECTIONS;
@@ -389,7 +695,7 @@ CNode* ConnectNode(CAddress addrConnect, const char* pszDest, bool fCountFailure
     bool proxyConnectionFailed = false;
     if (pszDest ? ConnectSocketByName(addrConnect, hSocket, pszDest, Params().GetDefaultPort(), nConnectTimeout, &proxyConnectionFailed) :
                   ConnectSocket(addrConnect, hSocket, nConnectTimeout, &proxyConnectionFailed)) {
-        if (!IsSelectableSocket(hSocket)) {
+        if (!IsUsableSocket(hSocket)) {
             LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
             CloseSocket(hSocket);
             return NULL;
@@ -404,6 +710,10 @@ CNode* ConnectNode(CAddress addrConnect, const char* pszDest, bool fCountFailure
         {
             LOCK(cs_vNodes);
             vNodes.push_back(pnode);
+#ifdef HAVE_SYS_EPOLL_H
+            if (epollSocketEvents.IsActive())
+                epollSocketEvents.Added(pnode);
+#endif
         }
 
         pnode->nTimeConnected = GetTime();
@@ -959,7 +1269,7 @@ static void AcceptConnection(const ListenSocket& hListenSocket)
         LogPrint("net", "masternode list is not synced or masternode protection flag is not enabled\n");
     }
 
-    if (!IsSelectableSocket(hSocket)) {
+    if (!IsUsableSocket(hSocket)) {
         LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
         CloseSocket(hSocket);
         return;
@@ -998,7 +1308,127 @@ static void AcceptConnection(const ListenSocket& hListenSocket)
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
+#ifdef HAVE_SYS_EPOLL_H
+        if (epollSocketEvents.IsActive())
+            epollSocketEvents.Added(pnode);
+#endif
+    }
+}
+
+static std::vector<SocketWant> GetSocketWants()
+{
+    std::vector<SocketWant> vWants;
+    LOCK(cs_vNodes);
+    vWants.reserve(vNodes.size());
+    for (CNode* pnode : vNodes) {
+        if (pnode->hSocket == INVALID_SOCKET)
+            continue;
+        SocketWant want;
+        GetSocketWant(pnode, want);
+        vWants.push_back(want);
+    }
+    return vWants;
+}
+
+static void SocketEventsSelect(const std::vector<SocketWant>& vWants, std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set)
+{
+    struct timeval timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_usec = 50000; // frequency to poll pnode->vSend
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+    bool have_fds = false;
+
+    for (const ListenSocket& hListenSocket : vhListenSocket) {
+        FD_SET(hListenSocket.socket, &fdsetRecv);
+        hSocketMax = max(hSocketMax, hListenSocket.socket);
+        have_fds = true;
+    }
+
+    for (const SocketWant& want : vWants) {
+        FD_SET(want.socket, &fdsetError);
+        hSocketMax = max(hSocketMax, want.socket);
+        have_fds = true;
+        if (want.fSend)
+            FD_SET(want.socket, &fdsetSend);
+        if (want.fRecv)
+            FD_SET(want.socket, &fdsetRecv);
+    }
+
+    int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+                         &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    boost::this_thread::interruption_point();
+
+    if (nSelect == SOCKET_ERROR) {
+        if (have_fds) {
+            int nErr = WSAGetLastError();
+            LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+            for (const ListenSocket& hListenSocket : vhListenSocket)
+                recv_set.insert(hListenSocket.socket);
+            for (const SocketWant& want : vWants)
+                recv_set.insert(want.socket);
+        }
+        MilliSleep(timeout.tv_usec / 1000);
+        return;
+    }
+
+    for (const ListenSocket& hListenSocket : vhListenSocket) {
+        if (FD_ISSET(hListenSocket.socket, &fdsetRecv))
+            recv_set.insert(hListenSocket.socket);
     }
+    for (const SocketWant& want : vWants) {
+        if (FD_ISSET(want.socket, &fdsetRecv))
+            recv_set.insert(want.socket);
+        if (FD_ISSET(want.socket, &fdsetSend))
+            send_set.insert(want.socket);
+        if (FD_ISSET(want.socket, &fdsetError))
+            error_set.insert(want.socket);
+    }
+}
+
+void WaitSocketEvents(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    if (epollSocketEvents.IsActive())
+        epollSocketEvents.Wait(recv_set, send_set, error_set);
+    else
+#endif
+        SocketEventsSelect(GetSocketWants(), recv_set, send_set, error_set);
+}
+
+bool ParseSocketEventsMode(const std::string& strMode, SocketEventsMode& mode)
+{
+    mode = SOCKETEVENTS_SELECT;
+    if (strMode == "select")
+        return true;
+#ifdef HAVE_SYS_EPOLL_H
+    if (strMode == "epoll") {
+        mode = SOCKETEVENTS_EPOLL;
+        return true;
+    }
+#endif
+    return false;
+}
+
+SocketEventsMode InitSocketEvents(const std::string& strMode)
+{
+    SocketEventsMode mode;
+    if (!ParseSocketEventsMode(strMode, mode))
+        LogPrintf("Unsupported -socketevents mode '%s', using select()\n", strMode);
+#ifdef HAVE_SYS_EPOLL_H
+    epollSocketEvents.Close();
+    if (mode == SOCKETEVENTS_EPOLL && !epollSocketEvents.Init(vhListenSocket)) {
+        LogPrintf("Falling back to select() for socket events\n");
+        mode = SOCKETEVENTS_SELECT;
+    }
+#endif
+    return mode;
 }
 
 void ThreadSocketHandler()
@@ -1017,6 +1447,10 @@ void ThreadSocketHandler()
                     (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0 && pnode->ssSend.empty())) {
                     // remove from vNodes
                     vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+#ifdef HAVE_SYS_EPOLL_H
+                    if (epollSocketEvents.IsActive())
+                        epollSocketEvents.Removed(pnode);
+#endif
 
                     // release outbound grant (if any)
                     pnode->grantOutbound.Release();
@@ -1064,86 +1498,14 @@ void ThreadSocketHandler()
         //
         // Find which sockets have data to receive
         //
-        struct timeval timeout;
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        for (const ListenSocket& hListenSocket : vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
-
-        {
-            LOCK(cs_vNodes);
-            for (CNode* pnode : vNodes) {
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is no (complete) message in the receive buffer,
-                //   or there is space left in the buffer, select() for receiving data.
-                // * (if neither of the above applies, there is certainly one message
-                //   in the receiver buffer ready to be processed).
-                // Together, that means that at least one of the following is always possible,
-                // so we don't deadlock:
-                // * We send some data.
-                // * We wait for data to be received (and disconnect after timeout).
-                // * We process a message in the buffer (message handler thread).
-                {
-                    TRY_LOCK(pnode->cs_vSend, lockSend);
-                    if (lockSend && !pnode->vSendMsg.empty()) {
-                        FD_SET(pnode->hSocket, &fdsetSend);
-                        continue;
-                    }
-                }
-                {
-                    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                    if (lockRecv && (pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
-                                     pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
-                        FD_SET(pnode->hSocket, &fdsetRecv);
-                }
-            }
-        }
-
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
-        boost::this_thread::interruption_point();
-
-        if (nSelect == SOCKET_ERROR) {
-            if (have_fds) {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            MilliSleep(timeout.tv_usec / 1000);
-        }
+        std::set<SOCKET> recv_set, send_set, error_set;
+        WaitSocketEvents(recv_set, send_set, error_set);
 
         //
         // Accept new connections
         //
         for (const ListenSocket& hListenSocket : vhListenSocket) {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv)) {
+            if (hListenSocket.socket != INVALID_SOCKET && recv_set.count(hListenSocket.socket)) {
                 AcceptConnection(hListenSocket);
             }
         }
@@ -1166,13 +1528,19 @@ void ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError)) {
+            if (recv_set.count(pnode->hSocket) || error_set.count(pnode->hSocket)) {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
                 if (lockRecv) {
                     {
                         // typical socket buffer is 8K-64K
                         char pchBuf[0x10000];
                         int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+#ifdef HAVE_SYS_EPOLL_H
+                        // A short read emptied the socket; a full one may have left more behind
+                        if (epollSocketEvents.IsActive() &&
+                            (nBytes < 0 ? WSAGetLastError() == WSAEWOULDBLOCK : nBytes < (int)sizeof(pchBuf)))
+                            epollSocketEvents.RecvDrained(pnode->id);
+#endif
                         if (nBytes > 0) {
                             if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
                                 pnode->CloseSocketDisconnect();
@@ -1202,10 +1570,15 @@ void ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetSend)) {
+            if (send_set.count(pnode->hSocket)) {
                 TRY_LOCK(pnode->cs_vSend, lockSend);
-                if (lockSend)
+                if (lockSend) {
                     SocketSendData(pnode);
+#ifdef HAVE_SYS_EPOLL_H
+                    if (epollSocketEvents.IsActive() && !pnode->vSendMsg.empty())
+                        epollSocketEvents.SendBlocked(pnode->id);
+#endif
+                }
             }
 
             //
@@ -1558,8 +1931,15 @@ void ThreadMessageHandler()
             {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
                 if (lockRecv) {
+                    bool fFlooded = IsRecvFlooded(pnode);
                     if (!g_signals.ProcessMessages(chainparams, pnode))
                         pnode->CloseSocketDisconnect();
+#ifdef HAVE_SYS_EPOLL_H
+                    // The socket handler stops reading a full receive buffer
+                    // until it is told there is room again
+                    if (fFlooded && epollSocketEvents.IsActive() && !IsRecvFlooded(pnode))
+                        epollSocketEvents.Changed(pnode->id);
+#endif
 
                     if (pnode->nSendSize < SendBufferSize()) {
                         if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete())) {
@@ -1757,6 +2137,8 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     Discover(threadGroup);
 
+    InitSocketEvents(GetArg("-socketevents", DEFAULT_SOCKETEVENTS));
+
     //
     // Start threads
     //
@@ -2223,8 +2605,14 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
     nSendSize += (*it).size();
 
     // If write queue empty, attempt "optimistic write"
-    if (it == vSendMsg.begin())
+    if (it == vSendMsg.begin()) {
         SocketSendData(this);
+#ifdef HAVE_SYS_EPOLL_H
+        // Have the socket handler send the rest
+        if (!vSendMsg.empty() && epollSocketEvents.IsActive())
+            epollSocketEvents.Changed(id);
+#endif
+    }
 
     LEAVE_CRITICAL_SECTION(cs_vSend);
 }
@@ -62,6 +62,12 @@ static const size_t SETASKFOR_MAX_SZ = 2 * MAX_INV_SZ;
 /** The maximum number of peer connections to maintain. */
 static const unsigned int DEFAULT_MAX_PEER_CONNECTIONS = 125;
 static const unsigned int DEFAULT_MAX_PEER_CONNECTIONS_MASTERNODE = 500;
+/** -socketevents default: epoll where the platform has it, otherwise select() */
+#ifdef HAVE_SYS_EPOLL_H
+static const char* const DEFAULT_SOCKETEVENTS = "epoll";
+#else
+static const char* const DEFAULT_SOCKETEVENTS = "select";
+#endif
 /** The period before a network upgrade activates, where connections to upgrading peers are preferred (in blocks). */
 static const int NETWORK_UPGRADE_PEER_PREFERENCE_BLOCK_PERIOD = 24 * 24 * 3;
 
@@ -83,6 +89,18 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler);
 bool StopNode();
 void SocketSendData(CNode* pnode);
 
+/** How the socket handler waits for socket events */
+enum SocketEventsMode {
+    SOCKETEVENTS_SELECT,
+    SOCKETEVENTS_EPOLL,
+};
+/** Parse a -socketevents mode. Returns false, leaving select(), for modes this build doesn't support. */
+bool ParseSocketEventsMode(const std::string& strMode, SocketEventsMode& mode);
+/** Set up the socket events mode asked for, falling back to select() if it can't. Returns the mode in use. */
+SocketEventsMode InitSocketEvents(const std::string& strMode);
+/** Wait for the sockets of the listen sockets and nodes to be ready, as the socket handler does on each pass */
+void WaitSocketEvents(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set);
+
 typedef int NodeId;
 
 struct CombinerAll {
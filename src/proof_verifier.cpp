@@ -51,12 +51,47 @@ public:
     }
 };
 
+ProofVerifier::ProofVerifier(bool perform_verification, bool batch_sapling) :
+    perform_verification(perform_verification),
+    sapling_batch_ctx(batch_sapling ? librustzcash_sapling_batch_ctx_init() : nullptr) { }
+
+ProofVerifier::ProofVerifier(ProofVerifier&& other) :
+    perform_verification(other.perform_verification),
+    sapling_batch_ctx(other.sapling_batch_ctx)
+{
+    other.sapling_batch_ctx = nullptr;
+}
+
+ProofVerifier& ProofVerifier::operator=(ProofVerifier&& other)
+{
+    if (this != &other) {
+        if (sapling_batch_ctx) {
+            librustzcash_sapling_batch_ctx_free(sapling_batch_ctx);
+        }
+        perform_verification = other.perform_verification;
+        sapling_batch_ctx = other.sapling_batch_ctx;
+        other.sapling_batch_ctx = nullptr;
+    }
+    return *this;
+}
+
+ProofVerifier::~ProofVerifier()
+{
+    if (sapling_batch_ctx) {
+        librustzcash_sapling_batch_ctx_free(sapling_batch_ctx);
+    }
+}
+
 ProofVerifier ProofVerifier::Strict() {
-    return ProofVerifier(true);
+    return ProofVerifier(true, false);
 }
 
 ProofVerifier ProofVerifier::Disabled() {
-    return ProofVerifier(false);
+    return ProofVerifier(false, false);
+}
+
+ProofVerifier ProofVerifier::SaplingBatch() {
+    return ProofVerifier(true, true);
 }
 
 bool ProofVerifier::VerifySprout(
@@ -70,3 +105,102 @@ bool ProofVerifier::VerifySprout(
     auto pv = SproutProofVerifier(*this, joinSplitPubKey, jsdesc);
     return std::visit(pv, jsdesc.proof);
 }
+
+ProofVerifier::SaplingResult ProofVerifier::VerifySapling(
+    const CTransaction& tx,
+    const uint256& dataToBeSigned
+) {
+    if (!perform_verification) {
+        return SAPLING_OK;
+    }
+
+    if (sapling_batch_ctx) {
+        for (const SpendDescription& spend : tx.vShieldedSpend) {
+            if (!librustzcash_sapling_batch_check_spend(
+                    sapling_batch_ctx,
+                    spend.cv.begin(),
+                    spend.anchor.begin(),
+                    spend.nullifier.begin(),
+                    spend.rk.begin(),
+                    spend.zkproof.begin(),
+                    spend.spendAuthSig.begin(),
+                    dataToBeSigned.begin())) {
+                return SAPLING_SPEND_INVALID;
+            }
+        }
+
+        for (const OutputDescription& output : tx.vShieldedOutput) {
+            if (!librustzcash_sapling_batch_check_output(
+                    sapling_batch_ctx,
+                    output.cv.begin(),
+                    output.cm.begin(),
+                    output.ephemeralKey.begin(),
+                    output.zkproof.begin())) {
+                return SAPLING_OUTPUT_INVALID;
+            }
+        }
+
+        if (!librustzcash_sapling_batch_final_check(
+                sapling_batch_ctx,
+                tx.valueBalance,
+                tx.bindingSig.begin(),
+                dataToBeSigned.begin())) {
+            return SAPLING_BINDING_SIG_INVALID;
+        }
+
+        return SAPLING_OK;
+    }
+
+    auto ctx = librustzcash_sapling_verification_ctx_init();
+    SaplingResult result = SAPLING_OK;
+
+    for (const SpendDescription& spend : tx.vShieldedSpend) {
+        if (!librustzcash_sapling_check_spend(
+                ctx,
+                spend.cv.begin(),
+                spend.anchor.begin(),
+                spend.nullifier.begin(),
+                spend.rk.begin(),
+                spend.zkproof.begin(),
+                spend.spendAuthSig.begin(),
+                dataToBeSigned.begin())) {
+            result = SAPLING_SPEND_INVALID;
+            break;
+        }
+    }
+
+    if (result == SAPLING_OK) {
+        for (const OutputDescription& output : tx.vShieldedOutput) {
+            if (!librustzcash_sapling_check_output(
+                    ctx,
+                    output.cv.begin(),
+                    output.cm.begin(),
+                    output.ephemeralKey.begin(),
+                    output.zkproof.begin())) {
+                result = SAPLING_OUTPUT_INVALID;
+                break;
+            }
+        }
+    }
+
+    if (result == SAPLING_OK &&
+        !librustzcash_sapling_final_check(
+            ctx,
+            tx.valueBalance,
+            tx.bindingSig.begin(),
+            dataToBeSigned.begin())) {
+        result = SAPLING_BINDING_SIG_INVALID;
+    }
+
+    librustzcash_sapling_verification_ctx_free(ctx);
+    return result;
+}
+
+bool ProofVerifier::VerifySaplingBatch()
+{
+    if (!sapling_batch_ctx) {
+        return true;
+    }
+
+    return librustzcash_sapling_batch_validate(sapling_batch_ctx);
+}
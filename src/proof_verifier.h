@@ -14,14 +14,26 @@ class ProofVerifier {
 private:
     bool perform_verification;
 
-    ProofVerifier(bool perform_verification) : perform_verification(perform_verification) { }
+    // Sapling batch verification context, or nullptr if Sapling
+    // proofs are verified as soon as they are seen.
+    void* sapling_batch_ctx;
+
+    ProofVerifier(bool perform_verification, bool batch_sapling);
 
 public:
+    enum SaplingResult {
+        SAPLING_OK,
+        SAPLING_SPEND_INVALID,
+        SAPLING_OUTPUT_INVALID,
+        SAPLING_BINDING_SIG_INVALID,
+    };
+
     // ProofVerifier should never be copied
     ProofVerifier(const ProofVerifier&) = delete;
     ProofVerifier& operator=(const ProofVerifier&) = delete;
     ProofVerifier(ProofVerifier&&);
     ProofVerifier& operator=(ProofVerifier&&);
+    ~ProofVerifier();
 
     // Creates a verification context that strictly verifies
     // all proofs.
@@ -32,11 +44,32 @@ public:
     // such as during reindexing.
     static ProofVerifier Disabled();
 
+    // Creates a verification context that strictly verifies
+    // all proofs, but accumulates the Sapling proofs of many
+    // transactions (e.g. a whole block) so that they can be
+    // checked at once by VerifySaplingBatch().
+    static ProofVerifier SaplingBatch();
+
+    bool IsSaplingBatch() const { return sapling_batch_ctx != nullptr; }
+
     // Verifies that the JoinSplit proof is correct.
     bool VerifySprout(
         const JSDescription& jsdesc,
         const Ed25519VerificationKey& joinSplitPubKey
     );
+
+    // Verifies the Sapling spends, outputs and binding signature
+    // of the transaction. In batch mode the spend and output
+    // proofs are only queued, and SAPLING_OK means that every
+    // other check passed.
+    SaplingResult VerifySapling(
+        const CTransaction& tx,
+        const uint256& dataToBeSigned
+    );
+
+    // Verifies all the Sapling proofs queued since the last call.
+    // Returns true if the verifier is not in batch mode.
+    bool VerifySaplingBatch();
 };
 
 #endif // ZCASH_PROOF_VERIFIER_H
@@ -139,6 +139,8 @@ static bool rest_headers(HTTPRequest* req,
 
     std::vector<const CBlockIndex*> headers;
     headers.reserve(count);
+    CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
+    UniValue jsonHeaders(UniValue::VARR);
     {
         LOCK(cs_main);
         BlockMap::const_iterator it = mapBlockIndex.find(hash);
@@ -149,11 +151,23 @@ static bool rest_headers(HTTPRequest* req,
                 break;
             pindex = chainActive.Next(pindex);
         }
-    }
 
-    CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
-    for (const CBlockIndex* pindex : headers) {
-        ssHeader << pindex->GetBlockHeader();
+        // FlushStateToDisk trims the solutions under cs_main, so read them
+        // back while holding it
+        for (const CBlockIndex* pindex : headers) {
+            CBlockHeader header;
+            if (!pindex->GetBlockHeader(header))
+                return RESTERR(req, HTTP_INTERNAL_SERVER_ERROR, "Can't read block header from disk");
+            ssHeader << header;
+        }
+        if (rf == RF_JSON) {
+            try {
+                for (const CBlockIndex* pindex : headers)
+                    jsonHeaders.push_back(blockheaderToJSON(pindex));
+            } catch (const UniValue&) {
+                return RESTERR(req, HTTP_INTERNAL_SERVER_ERROR, "Can't read block header from disk");
+            }
+        }
     }
 
     switch (rf) {
@@ -171,10 +185,6 @@ static bool rest_headers(HTTPRequest* req,
         return true;
     }
     case RF_JSON: {
-        UniValue jsonHeaders(UniValue::VARR);
-        for (const CBlockIndex* pindex : headers) {
-            jsonHeaders.push_back(blockheaderToJSON(pindex));
-        }
         string strJSON = jsonHeaders.write() + "\n";
         req->WriteHeader("Content-Type", "application/json");
         req->WriteReply(HTTP_OK, strJSON);
@@ -204,6 +214,7 @@ static bool rest_block(HTTPRequest* req,
         return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
     CBlock block;
+    std::vector<unsigned char> vRawBlock;
     CBlockIndex* pblockindex = NULL;
     {
         LOCK(cs_main);
@@ -214,23 +225,26 @@ static bool rest_block(HTTPRequest* req,
         if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not available (pruned data)");
 
-        if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
-            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+        // Binary and hex replies are the stored bytes; only JSON needs the block itself
+        if (rf == RF_JSON) {
+            if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+                return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+        } else {
+            if (!ReadRawBlockFromDisk(vRawBlock, pblockindex, Params().MessageStart()))
+                return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+        }
     }
 
-    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-    ssBlock << block;
-
     switch (rf) {
     case RF_BINARY: {
-        string binaryBlock = ssBlock.str();
+        string binaryBlock(vRawBlock.begin(), vRawBlock.end());
         req->WriteHeader("Content-Type", "application/octet-stream");
         req->WriteReply(HTTP_OK, binaryBlock);
         return true;
     }
 
     case RF_HEX: {
-        string strHex = HexStr(ssBlock.begin(), ssBlock.end()) + "\n";
+        string strHex = HexStr(vRawBlock.begin(), vRawBlock.end()) + "\n";
         req->WriteHeader("Content-Type", "text/plain");
         req->WriteReply(HTTP_OK, strHex);
         return true;
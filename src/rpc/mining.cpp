@@ -421,33 +421,33 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
 
     // Update block
     static CBlockIndex* pindexPrev;
-    static int64_t nStart;
     static CBlockTemplate* pblocktemplate;
     if (pindexPrev != chainActive.Tip() ||
-        (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5)) {
+        mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast) {
         // Clear pindexPrev so future calls make a new block, despite any failures from here on
         pindexPrev = NULL;
 
-        // Store the pindexBest used before CreateNewBlockWithKey, to avoid races
+        // Store the pindexBest used before taking the snapshot, to avoid races
         nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
         CBlockIndex* pindexPrevNew = chainActive.Tip();
-        nStart = GetTime();
 
-        // Create new block
+        // Take the live template, which only appends what the mempool gained
         if (pblocktemplate) {
             delete pblocktemplate;
             pblocktemplate = NULL;
         }
 #ifdef ENABLE_WALLET
         CReserveKey reservekey(pwalletMain);
-        pblocktemplate = CreateNewBlockWithKey(Params(), reservekey);
+        std::optional<CScript> scriptPubKey = GetMinerScriptPubKey(reservekey);
 #else
-        pblocktemplate = CreateNewBlockWithKey(Params());
+        std::optional<CScript> scriptPubKey = GetMinerScriptPubKey();
 #endif
+        if (scriptPubKey)
+            pblocktemplate = liveBlockTemplate.Snapshot(Params(), *scriptPubKey);
         if (!pblocktemplate)
             throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
 
-        // Need to update only after we know CreateNewBlockWithKey succeeded
+        // Need to update only after we know the snapshot succeeded
         pindexPrev = pindexPrevNew;
     }
     CBlock* pblock = &pblocktemplate->block; // pointer for convenience
@@ -24,7 +24,14 @@
 #include "wallet/walletdb.h"
 #endif
 
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <optional>
 #include <stdint.h>
+#include <system_error>
+#include <thread>
 
 #include <boost/assign/list_of.hpp>
 
@@ -890,6 +897,195 @@ bool getAddressesFromParams(const UniValue& params, std::vector<std::pair<uint16
     return true;
 }
 
+/** Most threads one multi-address query reads the address indexes with. */
+static const int MAX_ADDRESS_INDEX_READ_THREADS = 8;
+
+/**
+ * Call read(i) for each of nAddresses addresses, spread over a few reader
+ * threads since every address is a separate seek and scan of the index.
+ * The calling thread reads too, so the reads still finish if no reader
+ * thread can be started. The first exception a read throws is rethrown
+ * here once every started thread has been joined.
+ */
+template <typename Read>
+static void readAddressesInParallel(size_t nAddresses, Read read)
+{
+    size_t nThreads = std::min<size_t>(nAddresses, std::min(MAX_ADDRESS_INDEX_READ_THREADS, std::max(1, GetNumCores())));
+    if (nThreads <= 1) {
+        for (size_t i = 0; i < nAddresses; i++) {
+            read(i);
+        }
+        return;
+    }
+
+    std::atomic<size_t> nNext(0);
+    std::mutex csError;
+    std::exception_ptr error;
+    auto worker = [&]() {
+        for (size_t i = nNext++; i < nAddresses; i = nNext++) {
+            try {
+                read(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(csError);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                nNext = nAddresses;
+                return;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(nThreads - 1);
+    for (size_t t = 1; t < nThreads; t++) {
+        try {
+            threads.emplace_back(worker);
+        } catch (const std::system_error& e) {
+            LogPrintf("%s: started %u of %u address index readers: %s\n", __func__, threads.size() + 1, nThreads, e.what());
+            break;
+        }
+    }
+    worker();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+/**
+ * Concatenate per-address results that are each ordered by height, merging
+ * them into one height-ordered vector. Entries at the same height keep the
+ * order of their addresses.
+ */
+template <typename T, typename Compare>
+static std::vector<T> mergeAddressResults(std::vector<std::vector<T>>& parts, Compare comp)
+{
+    std::vector<T> merged;
+    std::vector<size_t> runs(1, 0);
+    for (std::vector<T>& part : parts) {
+        merged.insert(merged.end(), std::make_move_iterator(part.begin()), std::make_move_iterator(part.end()));
+        runs.push_back(merged.size());
+        std::vector<T>().swap(part);
+    }
+
+    // Merge neighbouring runs pairwise until one is left
+    while (runs.size() > 2) {
+        std::vector<size_t> next(1, 0);
+        for (size_t i = 2; i < runs.size(); i += 2) {
+            std::inplace_merge(merged.begin() + runs[i - 2], merged.begin() + runs[i - 1], merged.begin() + runs[i], comp);
+            next.push_back(runs[i]);
+        }
+        if (runs.size() % 2 == 0) {
+            next.push_back(runs.back());
+        }
+        runs.swap(next);
+    }
+    return merged;
+}
+
+/** Largest page getaddressdeltas and getaddresstxids return at once. */
+static const int MAX_ADDRESS_INDEX_PAGE = 100000;
+
+/** Parse the optional "limit" and "cursor" fields of an address index query. */
+static void getAddressIndexPageFromParams(const UniValue& params, size_t& nLimit, std::optional<CAddressIndexKey>& cursor)
+{
+    nLimit = 0;
+    if (!params[0].isObject()) {
+        return;
+    }
+
+    UniValue limitValue = find_value(params[0].get_obj(), "limit");
+    if (!limitValue.isNull()) {
+        int limit = limitValue.get_int();
+        if (limit <= 0 || limit > MAX_ADDRESS_INDEX_PAGE) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Limit is expected to be between 1 and %d", MAX_ADDRESS_INDEX_PAGE));
+        }
+        nLimit = limit;
+    }
+
+    UniValue cursorValue = find_value(params[0].get_obj(), "cursor");
+    if (!cursorValue.isNull()) {
+        if (nLimit == 0) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Cursor is only valid together with a limit");
+        }
+        std::string strCursor = cursorValue.get_str();
+        if (!IsHex(strCursor)) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+        }
+        CDataStream ss(ParseHex(strCursor), SER_DISK, CLIENT_VERSION);
+        CAddressIndexKey key;
+        try {
+            ss >> key;
+        } catch (const std::exception&) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+        }
+        if (!ss.empty()) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+        }
+        cursor = key;
+    }
+}
+
+static std::string getAddressIndexCursor(const CAddressIndexKey& key)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << key;
+    return HexStr(ss.begin(), ss.end());
+}
+
+/**
+ * Read the address index entries of the addresses. Without a limit, the
+ * addresses are read in parallel and their entries merged by height. With a
+ * limit, the addresses are read in turn, in index order, and at most that
+ * many entries are read; true is returned if more remain, and the last entry
+ * read is then the cursor the next page resumes after.
+ */
+static bool getAddressIndexEntries(const std::vector<std::pair<uint160, int>>& addresses, int start, int end,
+                                   const std::optional<CAddressIndexKey>& cursor, size_t nLimit,
+                                   std::vector<std::pair<CAddressIndexKey, CAmount>>& addressIndex)
+{
+    if (nLimit == 0 && addresses.size() > 1) {
+        std::vector<std::vector<std::pair<CAddressIndexKey, CAmount>>> parts(addresses.size());
+        readAddressesInParallel(addresses.size(), [&](size_t i) {
+            if (!GetAddressIndex(addresses[i].first, addresses[i].second, parts[i], start, end)) {
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+            }
+        });
+        addressIndex = mergeAddressResults(parts,
+            [](const std::pair<CAddressIndexKey, CAmount>& a, const std::pair<CAddressIndexKey, CAmount>& b) {
+                return a.first.blockHeight < b.first.blockHeight;
+            });
+        return false;
+    }
+
+    std::vector<std::pair<uint160, int>>::const_iterator it = addresses.begin();
+    const CAddressIndexKey* pAfter = nullptr;
+    if (cursor) {
+        it = std::find(addresses.begin(), addresses.end(), std::make_pair(cursor->hashBytes, (int)cursor->type));
+        if (it == addresses.end()) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Cursor does not belong to the requested addresses");
+        }
+        pAfter = &*cursor;
+    }
+
+    for (; it != addresses.end(); it++) {
+        // Read one entry past the page to find out whether there is a next page
+        size_t nRemaining = nLimit == 0 ? 0 : nLimit - addressIndex.size() + 1;
+        if (!GetAddressIndex(it->first, it->second, addressIndex, start, end, pAfter, nRemaining)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+        }
+        if (nLimit > 0 && addressIndex.size() > nLimit) {
+            addressIndex.pop_back();
+            return true;
+        }
+        pAfter = nullptr;
+    }
+    return false;
+}
+
 bool heightSort(std::pair<CAddressUnspentKey, CAddressUnspentValue> a,
                 std::pair<CAddressUnspentKey, CAddressUnspentValue> b)
 {
@@ -1051,16 +1247,17 @@ UniValue getaddressutxos(const UniValue& params, bool fHelp)
     if (!getAddressesFromParams(params, addresses)) {
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
-    std::vector<CAddressUnspentDbEntry> unspentOutputs;
-    for (const auto& it : addresses) {
-        if (!GetAddressUnspent(it.first, it.second, unspentOutputs)) {
+    auto heightOrder = [](const CAddressUnspentDbEntry& a, const CAddressUnspentDbEntry& b) -> bool {
+        return a.second.blockHeight < b.second.blockHeight;
+    };
+    std::vector<std::vector<CAddressUnspentDbEntry>> parts(addresses.size());
+    readAddressesInParallel(addresses.size(), [&](size_t i) {
+        if (!GetAddressUnspent(addresses[i].first, addresses[i].second, parts[i])) {
             throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
         }
-    }
-    std::sort(unspentOutputs.begin(), unspentOutputs.end(),
-        [](const CAddressUnspentDbEntry& a, const CAddressUnspentDbEntry& b) -> bool {
-            return a.second.blockHeight < b.second.blockHeight;
-        });
+        std::stable_sort(parts[i].begin(), parts[i].end(), heightOrder);
+    });
+    std::vector<CAddressUnspentDbEntry> unspentOutputs = mergeAddressResults(parts, heightOrder);
 
     UniValue utxos(UniValue::VARR);
     for (const auto& it : unspentOutputs) {
@@ -1108,6 +1305,8 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
             "  \"start\" (number) The start block height\n"
             "  \"end\" (number) The end block height\n"
             "  \"chainInfo\" (boolean) Include chain info in results, only applies if start and end specified\n"
+            "  \"limit\" (number, optional) Return at most this many deltas, as a page in index order\n"
+            "  \"cursor\" (string, optional) Resume after the last delta of the previous page\n"
             "}\n"
             "\nResult:\n"
             "[\n"
@@ -1119,6 +1318,13 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
             "    \"address\"  (string) The base58check encoded address\n"
             "  }\n"
             "]\n"
+            "\nResult (with limit, or with chainInfo):\n"
+            "{\n"
+            "  \"deltas\"  (array) The deltas, as above\n"
+            "  \"cursor\"  (string) Only if more deltas remain: the cursor of the next page\n"
+            "  \"start\"  (object) With chainInfo, the hash and height of the start block\n"
+            "  \"end\"  (object) With chainInfo, the hash and height of the end block\n"
+            "}\n"
             "\nExamples:\n" +
             HelpExampleCli("getaddressdeltas", "'{\"addresses\": [\"12c6DSiU4Rq3P4ZxziKxzrL5LmMBrzjrJX\"]}'") + HelpExampleRpc("getaddressdeltas", "{\"addresses\": [\"12c6DSiU4Rq3P4ZxziKxzrL5LmMBrzjrJX\"]}"));
 
@@ -1152,19 +1358,12 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
 
-    std::vector<std::pair<CAddressIndexKey, CAmount>> addressIndex;
+    size_t nLimit;
+    std::optional<CAddressIndexKey> cursor;
+    getAddressIndexPageFromParams(params, nLimit, cursor);
 
-    for (std::vector<std::pair<uint160, int>>::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        if (start > 0 && end > 0) {
-            if (!GetAddressIndex((*it).first, (*it).second, addressIndex, start, end)) {
-                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
-            }
-        } else {
-            if (!GetAddressIndex((*it).first, (*it).second, addressIndex)) {
-                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
-            }
-        }
-    }
+    std::vector<std::pair<CAddressIndexKey, CAmount>> addressIndex;
+    bool fMore = getAddressIndexEntries(addresses, start, end, cursor, nLimit, addressIndex);
 
     UniValue deltas(UniValue::VARR);
 
@@ -1186,6 +1385,13 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
 
     UniValue result(UniValue::VOBJ);
 
+    if (nLimit > 0) {
+        result.push_back(Pair("deltas", deltas));
+        if (fMore) {
+            result.push_back(Pair("cursor", getAddressIndexCursor(addressIndex.back().first)));
+        }
+    }
+
     if (includeChainInfo && start > 0 && end > 0) {
         LOCK(cs_main);
 
@@ -1205,10 +1411,14 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
         endInfo.push_back(Pair("hash", endIndex->GetBlockHash().GetHex()));
         endInfo.push_back(Pair("height", end));
 
-        result.push_back(Pair("deltas", deltas));
+        if (nLimit == 0) {
+            result.push_back(Pair("deltas", deltas));
+        }
         result.push_back(Pair("start", startInfo));
         result.push_back(Pair("end", endInfo));
 
+        return result;
+    } else if (nLimit > 0) {
         return result;
     } else {
         return deltas;
@@ -1243,22 +1453,19 @@ UniValue getaddressbalance(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
 
-    std::vector<std::pair<CAddressIndexKey, CAmount>> addressIndex;
-
-    for (std::vector<std::pair<uint160, int>>::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        if (!GetAddressIndex((*it).first, (*it).second, addressIndex)) {
+    std::vector<CAmount> addressBalances(addresses.size());
+    std::vector<CAmount> addressReceived(addresses.size());
+    readAddressesInParallel(addresses.size(), [&](size_t i) {
+        if (!GetAddressBalance(addresses[i].first, addresses[i].second, addressBalances[i], addressReceived[i])) {
             throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
         }
-    }
+    });
 
     CAmount balance = 0;
     CAmount received = 0;
-
-    for (std::vector<std::pair<CAddressIndexKey, CAmount>>::const_iterator it = addressIndex.begin(); it != addressIndex.end(); it++) {
-        if (it->second > 0) {
-            received += it->second;
-        }
-        balance += it->second;
+    for (size_t i = 0; i < addresses.size(); i++) {
+        balance += addressBalances[i];
+        received += addressReceived[i];
     }
 
     UniValue result(UniValue::VOBJ);
@@ -1283,12 +1490,19 @@ UniValue getaddresstxids(const UniValue& params, bool fHelp)
             "    ]\n"
             "  \"start\" (number) The start block height\n"
             "  \"end\" (number) The end block height\n"
+            "  \"limit\" (number, optional) Read at most this many index entries, as a page in index order\n"
+            "  \"cursor\" (string, optional) Resume after the last entry of the previous page\n"
             "}\n"
             "\nResult:\n"
             "[\n"
             "  \"transactionid\"  (string) The transaction id\n"
             "  ,...\n"
             "]\n"
+            "\nResult (with limit):\n"
+            "{\n"
+            "  \"txids\"  (array) The txids of the page, per address in height order; a txid may recur on the next page\n"
+            "  \"cursor\"  (string) Only if more entries remain: the cursor of the next page\n"
+            "}\n"
             "\nExamples:\n" +
             HelpExampleCli("getaddresstxids", "'{\"addresses\": [\"12c6DSiU4Rq3P4ZxziKxzrL5LmMBrzjrJX\"]}'") + HelpExampleRpc("getaddresstxids", "{\"addresses\": [\"12c6DSiU4Rq3P4ZxziKxzrL5LmMBrzjrJX\"]}"));
 
@@ -1309,20 +1523,18 @@ UniValue getaddresstxids(const UniValue& params, bool fHelp)
         }
     }
 
-    std::vector<std::pair<CAddressIndexKey, CAmount>> addressIndex;
-
-    for (std::vector<std::pair<uint160, int>>::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        if (start > 0 && end > 0) {
-            if (!GetAddressIndex((*it).first, (*it).second, addressIndex, start, end)) {
-                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
-            }
-        } else {
-            if (!GetAddressIndex((*it).first, (*it).second, addressIndex)) {
-                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
-            }
-        }
+    if (start <= 0 || end <= 0) {
+        start = 0;
+        end = 0;
     }
 
+    size_t nLimit;
+    std::optional<CAddressIndexKey> cursor;
+    getAddressIndexPageFromParams(params, nLimit, cursor);
+
+    std::vector<std::pair<CAddressIndexKey, CAmount>> addressIndex;
+    bool fMore = getAddressIndexEntries(addresses, start, end, cursor, nLimit, addressIndex);
+
     std::set<std::pair<int, std::string>> txids;
     UniValue result(UniValue::VARR);
 
@@ -1330,7 +1542,8 @@ UniValue getaddresstxids(const UniValue& params, bool fHelp)
         int height = it->first.blockHeight;
         std::string txid = it->first.txhash.GetHex();
 
-        if (addresses.size() > 1) {
+        // A page keeps index order, so that its cursor follows on from it
+        if (addresses.size() > 1 && nLimit == 0) {
             txids.insert(std::make_pair(height, txid));
         } else {
             if (txids.insert(std::make_pair(height, txid)).second) {
@@ -1339,12 +1552,21 @@ UniValue getaddresstxids(const UniValue& params, bool fHelp)
         }
     }
 
-    if (addresses.size() > 1) {
+    if (addresses.size() > 1 && nLimit == 0) {
         for (std::set<std::pair<int, std::string>>::const_iterator it = txids.begin(); it != txids.end(); it++) {
             result.push_back(it->second);
         }
     }
 
+    if (nLimit > 0) {
+        UniValue page(UniValue::VOBJ);
+        page.push_back(Pair("txids", result));
+        if (fMore) {
+            page.push_back(Pair("cursor", getAddressIndexCursor(addressIndex.back().first)));
+        }
+        return page;
+    }
+
     return result;
 }
 
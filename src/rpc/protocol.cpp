@@ -49,8 +49,16 @@ UniValue JSONRPCReplyObj(const UniValue& result, const UniValue& error, const Un
 
 string JSONRPCReply(const UniValue& result, const UniValue& error, const UniValue& id)
 {
-    UniValue reply = JSONRPCReplyObj(result, error, id);
-    return reply.write() + "\n";
+    // Same output as JSONRPCReplyObj(result, error, id).write(), without first
+    // copying a possibly very large result into the reply object
+    std::string strReply = "{\"result\":";
+    strReply += error.isNull() ? result.write() : NullUniValue.write();
+    strReply += ",\"error\":";
+    strReply += error.write();
+    strReply += ",\"id\":";
+    strReply += id.write();
+    strReply += "}\n";
+    return strReply;
 }
 
 UniValue JSONRPCError(int code, const string& message)
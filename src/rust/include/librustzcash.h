@@ -196,6 +196,53 @@ extern "C" {
     /// `librustzcash_sapling_verification_ctx_init`.
     void librustzcash_sapling_verification_ctx_free(void *);
 
+    /// Creates a Sapling batch verification context, which accumulates
+    /// the proofs of many transactions. Please free this when you're done.
+    void * librustzcash_sapling_batch_ctx_init();
+
+    /// Check the validity of a Sapling Spend description except for its
+    /// proof, which is queued in the batch context. Accumulates the value
+    /// commitment into the context.
+    bool librustzcash_sapling_batch_check_spend(
+        void *ctx,
+        const unsigned char *cv,
+        const unsigned char *anchor,
+        const unsigned char *nullifier,
+        const unsigned char *rk,
+        const unsigned char *zkproof,
+        const unsigned char *spendAuthSig,
+        const unsigned char *sighashValue
+    );
+
+    /// Check the validity of a Sapling Output description except for its
+    /// proof, which is queued in the batch context. Accumulates the value
+    /// commitment into the context.
+    bool librustzcash_sapling_batch_check_output(
+        void *ctx,
+        const unsigned char *cv,
+        const unsigned char *cm,
+        const unsigned char *ephemeralKey,
+        const unsigned char *zkproof
+    );
+
+    /// Checks the binding signature of the transaction whose descriptions
+    /// were just added to the batch context, and resets the value commitment
+    /// accumulator for the next transaction.
+    bool librustzcash_sapling_batch_final_check(
+        void *ctx,
+        int64_t valueBalance,
+        const unsigned char *bindingSig,
+        const unsigned char *sighashValue
+    );
+
+    /// Verifies all the proofs queued in the batch context at once, and
+    /// clears the queue.
+    bool librustzcash_sapling_batch_validate(void *ctx);
+
+    /// Frees a Sapling batch verification context returned from
+    /// `librustzcash_sapling_batch_ctx_init`.
+    void librustzcash_sapling_batch_ctx_free(void *);
+
     /// Compute a Sapling nullifier.
     ///
     /// The `diversifier` parameter must be 11 bytes in length.
@@ -238,6 +285,20 @@ extern "C" {
         unsigned char *result
     );
 
+    /// Compute [sk_i] [8] P for one 32-byte point P
+    /// and `sks_len` 32-byte Fs values, sharing the
+    /// window table of P. Returns false if P is
+    /// invalid. Otherwise writes each agreement to
+    /// `results[i]` and whether `sks[i]` was a valid
+    /// scalar to `results_valid[i]`.
+    bool librustzcash_sapling_ka_agree_batch(
+        const unsigned char *p,
+        const unsigned char *sks,
+        size_t sks_len,
+        unsigned char *results,
+        bool *results_valid
+    );
+
     /// Compute g_d = GH(diversifier) and returns
     /// false if the diversifier is invalid.
     /// Computes [esk] g_d and writes the result
@@ -63,6 +63,7 @@ use zcash_history::{Entry as MMREntry, NodeData as MMRNodeData, Tree as MMRTree}
 
 mod blake2b;
 mod ed25519;
+mod sapling_batch;
 mod tracing_ffi;
 
 #[cfg(test)]
@@ -448,6 +449,52 @@ pub extern "C" fn librustzcash_sapling_ka_agree(
     true
 }
 
+/// Computes \[sk_i\] \[8\] P for one 32-byte point P and `sks_len` 32-byte Fs
+/// values, sharing the cofactor clearing and window table of P across all of
+/// them.
+///
+/// Returns false if P is invalid. Otherwise, for each i the agreement is
+/// written to `results[i]` and `results_valid[i]` is set to whether `sks[i]`
+/// was a valid scalar.
+#[no_mangle]
+pub extern "C" fn librustzcash_sapling_ka_agree_batch(
+    p: *const [c_uchar; 32],
+    sks: *const [c_uchar; 32],
+    sks_len: size_t,
+    results: *mut [c_uchar; 32],
+    results_valid: *mut bool,
+) -> bool {
+    // Deserialize p
+    let p = match de_ct(jubjub::ExtendedPoint::from_bytes(unsafe { &*p })) {
+        Some(p) => p,
+        None => return false,
+    };
+
+    let sks = unsafe { slice::from_raw_parts(sks, sks_len) };
+    let results = unsafe { slice::from_raw_parts_mut(results, sks_len) };
+    let results_valid = unsafe { slice::from_raw_parts_mut(results_valid, sks_len) };
+
+    // [8] P, and its window table, are computed once for every sk
+    let mut wnaf = group::Wnaf::new();
+    let mut base = wnaf.base(p.clear_cofactor(), sks_len);
+
+    for ((sk, result), valid) in sks
+        .iter()
+        .zip(results.iter_mut())
+        .zip(results_valid.iter_mut())
+    {
+        match de_ct(jubjub::Scalar::from_bytes(sk)) {
+            Some(sk) => {
+                *result = base.scalar(&sk).to_bytes();
+                *valid = true;
+            }
+            None => *valid = false,
+        }
+    }
+
+    true
+}
+
 /// Compute g_d = GH(diversifier) and returns false if the diversifier is
 /// invalid. Computes \[esk\] g_d and writes the result to the 32-byte `result`
 /// buffer. Returns false if `esk` is not a valid scalar.
@@ -0,0 +1,336 @@
+// Copyright (c) 2021 The Gemlink developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+//! Block-level batch verification of Sapling Groth16 proofs.
+//!
+//! The checks performed here are the same as those performed by
+//! `SaplingVerificationContext`, except that the Groth16 proofs are not
+//! verified immediately. They are queued, and verified together by
+//! [`librustzcash_sapling_batch_validate`] using a single multi-Miller loop
+//! and a single final exponentiation per circuit.
+
+use bellman::{
+    gadgets::multipack,
+    groth16::{Proof, VerifyingKey},
+};
+use bls12_381::{Bls12, G1Affine, G1Projective, G2Prepared, Gt, Scalar};
+use group::{Curve, GroupEncoding};
+use libc::c_uchar;
+use rand_core::{OsRng, RngCore};
+use zcash_primitives::{
+    constants::{
+        SPENDING_KEY_GENERATOR, VALUE_COMMITMENT_RANDOMNESS_GENERATOR,
+        VALUE_COMMITMENT_VALUE_GENERATOR,
+    },
+    redjubjub::{PublicKey, Signature},
+    transaction::components::Amount,
+};
+
+use crate::{de_ct, GROTH_PROOF_SIZE, SAPLING_OUTPUT_PARAMS, SAPLING_SPEND_PARAMS};
+
+/// Accumulates the Sapling descriptions of a block.
+pub struct SaplingBatchContext {
+    /// Sum of the value commitments of the transaction currently being
+    /// checked; reset by [`librustzcash_sapling_batch_final_check`].
+    cv_sum: jubjub::ExtendedPoint,
+    spends: Vec<(Proof<Bls12>, [Scalar; 7])>,
+    outputs: Vec<(Proof<Bls12>, [Scalar; 5])>,
+}
+
+impl SaplingBatchContext {
+    fn new() -> Self {
+        SaplingBatchContext {
+            cv_sum: jubjub::ExtendedPoint::identity(),
+            spends: vec![],
+            outputs: vec![],
+        }
+    }
+}
+
+/// Computes the value balance in the exponent, as in `zcash_proofs::sapling`.
+fn compute_value_balance(value: Amount) -> Option<jubjub::ExtendedPoint> {
+    // Compute the absolute value (failing if -i64::MAX is the value)
+    let abs = match i64::from(value).checked_abs() {
+        Some(a) => a as u64,
+        None => return None,
+    };
+
+    let mut value_balance = VALUE_COMMITMENT_VALUE_GENERATOR * jubjub::Fr::from(abs);
+
+    if value.is_negative() {
+        value_balance = -value_balance;
+    }
+
+    Some(value_balance.into())
+}
+
+/// Checks that every queued proof satisfies the Groth16 verification equation
+/// for `vk`, using a random linear combination of the equations:
+///
+/// ∏ e(z_i·A_i, B_i) · e(-Σ z_i·ACC_i, γ) · e(-Σ z_i·C_i, δ) · e(-(Σ z_i)·α, β) = 1
+///
+/// where `ACC_i` is the input commitment of the `i`-th proof.
+fn batch_verify<I: AsRef<[Scalar]>>(
+    vk: &VerifyingKey<Bls12>,
+    proofs: &[(Proof<Bls12>, I)],
+) -> bool {
+    if proofs.is_empty() {
+        return true;
+    }
+
+    let mut terms: Vec<(G1Affine, G2Prepared)> = Vec::with_capacity(proofs.len() + 3);
+    let mut acc_sum = G1Projective::identity();
+    let mut c_sum = G1Projective::identity();
+    let mut z_sum = Scalar::zero();
+
+    for (proof, inputs) in proofs {
+        let inputs = inputs.as_ref();
+        if inputs.len() + 1 != vk.ic.len() {
+            return false;
+        }
+
+        // 128-bit random coefficient for this proof.
+        let mut z_bytes = [0u8; 64];
+        OsRng.fill_bytes(&mut z_bytes[..16]);
+        let z = Scalar::from_bytes_wide(&z_bytes);
+
+        let mut acc = G1Projective::from(vk.ic[0]);
+        for (input, base) in inputs.iter().zip(vk.ic.iter().skip(1)) {
+            acc += base * input;
+        }
+
+        terms.push(((proof.a * z).to_affine(), G2Prepared::from(proof.b)));
+        acc_sum += acc * z;
+        c_sum += proof.c * z;
+        z_sum += z;
+    }
+
+    terms.push(((-acc_sum).to_affine(), G2Prepared::from(vk.gamma_g2)));
+    terms.push(((-c_sum).to_affine(), G2Prepared::from(vk.delta_g2)));
+    terms.push((
+        (vk.alpha_g1 * -z_sum).to_affine(),
+        G2Prepared::from(vk.beta_g2),
+    ));
+
+    let term_refs: Vec<(&G1Affine, &G2Prepared)> = terms.iter().map(|(a, b)| (a, b)).collect();
+
+    bls12_381::multi_miller_loop(&term_refs[..]).final_exponentiation() == Gt::identity()
+}
+
+/// Creates a Sapling batch verification context. Please free this when
+/// you're done.
+#[no_mangle]
+pub extern "C" fn librustzcash_sapling_batch_ctx_init() -> *mut SaplingBatchContext {
+    let ctx = Box::new(SaplingBatchContext::new());
+
+    Box::into_raw(ctx)
+}
+
+/// Frees a Sapling batch verification context returned from
+/// [`librustzcash_sapling_batch_ctx_init`].
+#[no_mangle]
+pub extern "C" fn librustzcash_sapling_batch_ctx_free(ctx: *mut SaplingBatchContext) {
+    drop(unsafe { Box::from_raw(ctx) });
+}
+
+/// Checks a Sapling Spend description, accumulating the value commitment into
+/// the context and queueing its proof for [`librustzcash_sapling_batch_validate`].
+#[no_mangle]
+pub extern "C" fn librustzcash_sapling_batch_check_spend(
+    ctx: *mut SaplingBatchContext,
+    cv: *const [c_uchar; 32],
+    anchor: *const [c_uchar; 32],
+    nullifier: *const [c_uchar; 32],
+    rk: *const [c_uchar; 32],
+    zkproof: *const [c_uchar; GROTH_PROOF_SIZE],
+    spend_auth_sig: *const [c_uchar; 64],
+    sighash_value: *const [c_uchar; 32],
+) -> bool {
+    let ctx = unsafe { &mut *ctx };
+
+    // Deserialize the value commitment
+    let cv = match de_ct(jubjub::ExtendedPoint::from_bytes(unsafe { &*cv })) {
+        Some(p) => p,
+        None => return false,
+    };
+
+    // Deserialize the anchor, which should be an element
+    // of Fr.
+    let anchor = match de_ct(Scalar::from_bytes(unsafe { &*anchor })) {
+        Some(a) => a,
+        None => return false,
+    };
+
+    // Deserialize rk
+    let rk = match PublicKey::read(&(unsafe { &*rk })[..]) {
+        Ok(p) => p,
+        Err(_) => return false,
+    };
+
+    // Deserialize the signature
+    let spend_auth_sig = match Signature::read(&(unsafe { &*spend_auth_sig })[..]) {
+        Ok(sig) => sig,
+        Err(_) => return false,
+    };
+
+    // Deserialize the proof
+    let zkproof = match Proof::read(&(unsafe { &*zkproof })[..]) {
+        Ok(p) => p,
+        Err(_) => return false,
+    };
+
+    if bool::from(cv.is_small_order() | rk.0.is_small_order()) {
+        return false;
+    }
+
+    ctx.cv_sum += cv;
+
+    // Verify the spend_auth_sig over rk || sighash
+    let mut data_to_be_signed = [0u8; 64];
+    data_to_be_signed[0..32].copy_from_slice(&rk.0.to_bytes());
+    data_to_be_signed[32..64].copy_from_slice(&(unsafe { &*sighash_value })[..]);
+    if !rk.verify(&data_to_be_signed, &spend_auth_sig, SPENDING_KEY_GENERATOR) {
+        return false;
+    }
+
+    // Construct the public input for the circuit
+    let mut public_input = [Scalar::zero(); 7];
+    {
+        let affine = rk.0.to_affine();
+        public_input[0] = affine.get_u();
+        public_input[1] = affine.get_v();
+    }
+    {
+        let affine = cv.to_affine();
+        public_input[2] = affine.get_u();
+        public_input[3] = affine.get_v();
+    }
+    public_input[4] = anchor;
+    {
+        let nullifier = multipack::bytes_to_bits_le(&(unsafe { &*nullifier })[..]);
+        let nullifier = multipack::compute_multipacking(&nullifier);
+        assert_eq!(nullifier.len(), 2);
+        public_input[5] = nullifier[0];
+        public_input[6] = nullifier[1];
+    }
+
+    ctx.spends.push((zkproof, public_input));
+    true
+}
+
+/// Checks a Sapling Output description, accumulating the value commitment into
+/// the context and queueing its proof for [`librustzcash_sapling_batch_validate`].
+#[no_mangle]
+pub extern "C" fn librustzcash_sapling_batch_check_output(
+    ctx: *mut SaplingBatchContext,
+    cv: *const [c_uchar; 32],
+    cm: *const [c_uchar; 32],
+    epk: *const [c_uchar; 32],
+    zkproof: *const [c_uchar; GROTH_PROOF_SIZE],
+) -> bool {
+    let ctx = unsafe { &mut *ctx };
+
+    // Deserialize the value commitment
+    let cv = match de_ct(jubjub::ExtendedPoint::from_bytes(unsafe { &*cv })) {
+        Some(p) => p,
+        None => return false,
+    };
+
+    // Deserialize the commitment, which should be an element
+    // of Fr.
+    let cm = match de_ct(Scalar::from_bytes(unsafe { &*cm })) {
+        Some(a) => a,
+        None => return false,
+    };
+
+    // Deserialize the ephemeral key
+    let epk = match de_ct(jubjub::ExtendedPoint::from_bytes(unsafe { &*epk })) {
+        Some(p) => p,
+        None => return false,
+    };
+
+    // Deserialize the proof
+    let zkproof = match Proof::read(&(unsafe { &*zkproof })[..]) {
+        Ok(p) => p,
+        Err(_) => return false,
+    };
+
+    if bool::from(cv.is_small_order() | epk.is_small_order()) {
+        return false;
+    }
+
+    ctx.cv_sum -= cv;
+
+    // Construct the public input for the circuit
+    let mut public_input = [Scalar::zero(); 5];
+    {
+        let affine = cv.to_affine();
+        public_input[0] = affine.get_u();
+        public_input[1] = affine.get_v();
+    }
+    {
+        let affine = epk.to_affine();
+        public_input[2] = affine.get_u();
+        public_input[3] = affine.get_v();
+    }
+    public_input[4] = cm;
+
+    ctx.outputs.push((zkproof, public_input));
+    true
+}
+
+/// Checks the binding signature of the transaction whose descriptions were
+/// most recently added to the context, and resets the value commitment
+/// accumulator for the next transaction.
+#[no_mangle]
+pub extern "C" fn librustzcash_sapling_batch_final_check(
+    ctx: *mut SaplingBatchContext,
+    value_balance: i64,
+    binding_sig: *const [c_uchar; 64],
+    sighash_value: *const [c_uchar; 32],
+) -> bool {
+    let ctx = unsafe { &mut *ctx };
+    let cv_sum = std::mem::replace(&mut ctx.cv_sum, jubjub::ExtendedPoint::identity());
+
+    let value_balance = match Amount::from_i64(value_balance) {
+        Ok(vb) => vb,
+        Err(()) => return false,
+    };
+
+    // Deserialize the signature
+    let binding_sig = match Signature::read(&(unsafe { &*binding_sig })[..]) {
+        Ok(sig) => sig,
+        Err(_) => return false,
+    };
+
+    let value_balance = match compute_value_balance(value_balance) {
+        Some(vb) => vb,
+        None => return false,
+    };
+    let bvk = PublicKey(cv_sum - value_balance);
+
+    let mut data_to_be_signed = [0u8; 64];
+    data_to_be_signed[0..32].copy_from_slice(&bvk.0.to_bytes());
+    data_to_be_signed[32..64].copy_from_slice(&(unsafe { &*sighash_value })[..]);
+
+    bvk.verify(
+        &data_to_be_signed,
+        &binding_sig,
+        VALUE_COMMITMENT_RANDOMNESS_GENERATOR,
+    )
+}
+
+/// Verifies every proof queued in the context since it was created or last
+/// validated, and clears the queue. Returns false if any of them is invalid.
+#[no_mangle]
+pub extern "C" fn librustzcash_sapling_batch_validate(ctx: *mut SaplingBatchContext) -> bool {
+    let ctx = unsafe { &mut *ctx };
+    let spends = std::mem::replace(&mut ctx.spends, vec![]);
+    let outputs = std::mem::replace(&mut ctx.outputs, vec![]);
+
+    let spend_vk = &unsafe { SAPLING_SPEND_PARAMS.as_ref() }.unwrap().vk;
+    let output_vk = &unsafe { SAPLING_OUTPUT_PARAMS.as_ref() }.unwrap().vk;
+
+    batch_verify(spend_vk, &spends) && batch_verify(output_vk, &outputs)
+}
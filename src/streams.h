@@ -374,6 +374,55 @@ public:
     }
 };
 
+/** Read-only stream over bytes owned by someone else, such as a mapped file.
+ *
+ * Unlike CDataStream, nothing is copied: objects are deserialized straight
+ * from [pbegin, pend), which must outlive the reader.
+ */
+class CSpanReader
+{
+private:
+    const int nType;
+    const int nVersion;
+    const char* pbegin;
+    const char* pend;
+    const char* pread;
+
+public:
+    CSpanReader(int nTypeIn, int nVersionIn, const char* pbeginIn, const char* pendIn) : nType(nTypeIn), nVersion(nVersionIn), pbegin(pbeginIn), pend(pendIn), pread(pbeginIn) {}
+
+    int GetType() const { return nType; }
+    int GetVersion() const { return nVersion; }
+
+    size_t size() const { return pend - pread; }
+    bool empty() const { return pread == pend; }
+    //! Bytes consumed so far
+    size_t tell() const { return pread - pbegin; }
+
+    void read(char* pch, size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CSpanReader::read(): end of data");
+        memcpy(pch, pread, nSize);
+        pread += nSize;
+    }
+
+    void ignore(size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CSpanReader::ignore(): end of data");
+        pread += nSize;
+    }
+
+    template <typename T>
+    CSpanReader& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj);
+        return (*this);
+    }
+};
+
 
 /** Non-refcounted RAII wrapper for FILE*
  *
@@ -0,0 +1,270 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "key_io.h"
+#include "main.h"
+#include "rpc/server.h"
+#include "txdb.h"
+#include "utilstrencodings.h"
+
+#include "test/test_bitcoin.h"
+#include "test/test_util.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <univalue.h>
+
+BOOST_FIXTURE_TEST_SUITE(addressindex_tests, TestingSetup)
+
+// Two entries per block at heights nFirst to nLast, in index order
+static std::vector<CAddressIndexDbEntry> WriteAddressIndexEntries(const uint160& hash, int nLast, int nFirst = 1)
+{
+    std::vector<CAddressIndexDbEntry> entries;
+    for (int nHeight = nFirst; nHeight <= nLast; nHeight++) {
+        for (unsigned int nTx = 0; nTx < 2; nTx++) {
+            entries.push_back(std::make_pair(CAddressIndexKey(1, hash, nHeight, nTx, GetRandHash(), 0, false), nHeight * 100 + nTx));
+        }
+    }
+    BOOST_CHECK(pblocktree->WriteAddressIndex(entries));
+    return entries;
+}
+
+static std::string AddressIndexQuery(const std::vector<std::string>& addresses, int nLimit, const std::string& cursor = "")
+{
+    std::string query = "{\"addresses\":[";
+    for (size_t i = 0; i < addresses.size(); i++) {
+        query += (i ? ",\"" : "\"") + addresses[i] + "\"";
+    }
+    query += "]";
+    if (nLimit != 0) {
+        query += strprintf(",\"limit\":%d", nLimit);
+    }
+    if (!cursor.empty()) {
+        query += ",\"cursor\":\"" + cursor + "\"";
+    }
+    return query + "}";
+}
+
+static void CheckPageError(const std::string& rpcString, const std::string& expectedErrorMessage)
+{
+    try {
+        CallRPC(rpcString);
+        BOOST_ERROR("Should have caused an error: " + rpcString);
+    } catch (const std::runtime_error& e) {
+        BOOST_CHECK_EQUAL(expectedErrorMessage, e.what());
+    }
+}
+
+// Follow the cursors of a paged query to the end, checking each page's size
+static std::vector<UniValue> ReadAllPages(const std::string& method, const std::string& field,
+                                          const std::vector<std::string>& addresses, int nLimit, size_t& nPages)
+{
+    std::vector<UniValue> items;
+    std::string cursor;
+    nPages = 0;
+    while (true) {
+        UniValue page = CallRPC(method + " " + AddressIndexQuery(addresses, nLimit, cursor));
+        nPages++;
+        const UniValue& pageItems = find_value(page, field);
+        BOOST_REQUIRE(pageItems.isArray());
+        BOOST_CHECK(pageItems.size() <= (size_t)nLimit);
+        for (size_t i = 0; i < pageItems.size(); i++) {
+            items.push_back(pageItems[i]);
+        }
+        const UniValue& next = find_value(page, "cursor");
+        if (next.isNull()) {
+            break;
+        }
+        // A page that has a next one is full
+        BOOST_CHECK_EQUAL(pageItems.size(), (size_t)nLimit);
+        cursor = next.get_str();
+    }
+    return items;
+}
+
+BOOST_AUTO_TEST_CASE(read_address_index_pages)
+{
+    uint160 hashA = uint160(std::vector<unsigned char>(20, 0x01));
+    uint160 hashB = uint160(std::vector<unsigned char>(20, 0x02));
+    std::vector<CAddressIndexDbEntry> entries = WriteAddressIndexEntries(hashA, 10);
+    WriteAddressIndexEntries(hashB, 5);
+
+    std::vector<CAddressIndexDbEntry> all;
+    BOOST_CHECK(pblocktree->ReadAddressIndex(hashA, 1, all));
+    BOOST_CHECK(all == entries);
+
+    // Pages that end short of the last entry, and pages that end right on it
+    for (size_t nLimit : {3, 4, 20, 25}) {
+        std::vector<CAddressIndexDbEntry> paged;
+        const CAddressIndexKey* pAfter = nullptr;
+        std::vector<CAddressIndexDbEntry> page;
+        do {
+            page.clear();
+            BOOST_CHECK(pblocktree->ReadAddressIndex(hashA, 1, page, 0, 0, pAfter, nLimit));
+            BOOST_CHECK(page.size() <= nLimit);
+            paged.insert(paged.end(), page.begin(), page.end());
+            if (!page.empty()) {
+                pAfter = &paged.back().first;
+            }
+        } while (page.size() == nLimit);
+        BOOST_CHECK(paged == entries);
+    }
+
+    // Resuming after the last entry of the address does not run into the next address
+    std::vector<CAddressIndexDbEntry> page;
+    BOOST_CHECK(pblocktree->ReadAddressIndex(hashA, 1, page, 0, 0, &entries.back().first, 5));
+    BOOST_CHECK(page.empty());
+
+    // A cursor between two entries resumes at the later one
+    CAddressIndexKey between = entries[5].first;
+    between.index = 1;
+    BOOST_CHECK(pblocktree->ReadAddressIndex(hashA, 1, page, 0, 0, &between, 1));
+    BOOST_REQUIRE_EQUAL(page.size(), 1);
+    BOOST_CHECK(page[0] == entries[6]);
+
+    // A cursor within a height range keeps to the range
+    page.clear();
+    BOOST_CHECK(pblocktree->ReadAddressIndex(hashA, 1, page, 3, 6, &entries[5].first, 0));
+    BOOST_CHECK(page == std::vector<CAddressIndexDbEntry>(entries.begin() + 6, entries.begin() + 12));
+}
+
+BOOST_AUTO_TEST_CASE(rpc_address_index_pages)
+{
+    fAddressIndex = true;
+    KeyIO keyIO(Params());
+    uint160 hashA = uint160(std::vector<unsigned char>(20, 0x03));
+    uint160 hashB = uint160(std::vector<unsigned char>(20, 0x04));
+    std::vector<CAddressIndexDbEntry> entriesA = WriteAddressIndexEntries(hashA, 10);
+    std::vector<CAddressIndexDbEntry> entriesB = WriteAddressIndexEntries(hashB, 5);
+    std::string addressA = keyIO.EncodeDestination(CKeyID(hashA));
+    std::string addressB = keyIO.EncodeDestination(CKeyID(hashB));
+
+    // Paging through the deltas gives the unpaged result, however the pages fall
+    UniValue all = CallRPC("getaddressdeltas " + AddressIndexQuery({addressA}, 0));
+    BOOST_REQUIRE(all.isArray());
+    BOOST_REQUIRE_EQUAL(all.size(), entriesA.size());
+    for (int nLimit : {3, 4, 20}) {
+        size_t nPages;
+        std::vector<UniValue> deltas = ReadAllPages("getaddressdeltas", "deltas", {addressA}, nLimit, nPages);
+        BOOST_CHECK_EQUAL(nPages, (entriesA.size() + nLimit - 1) / nLimit);
+        BOOST_REQUIRE_EQUAL(deltas.size(), all.size());
+        for (size_t i = 0; i < deltas.size(); i++) {
+            BOOST_CHECK_EQUAL(deltas[i].write(), all[i].write());
+        }
+    }
+
+    // Pages of several addresses go through them in turn, in index order
+    {
+        size_t nPages;
+        std::vector<UniValue> txids = ReadAllPages("getaddresstxids", "txids", {addressA, addressB}, 7, nPages);
+        BOOST_CHECK_EQUAL(nPages, 5);
+        BOOST_REQUIRE_EQUAL(txids.size(), entriesA.size() + entriesB.size());
+        for (size_t i = 0; i < entriesA.size(); i++) {
+            BOOST_CHECK_EQUAL(txids[i].get_str(), entriesA[i].first.txhash.GetHex());
+        }
+        for (size_t i = 0; i < entriesB.size(); i++) {
+            BOOST_CHECK_EQUAL(txids[entriesA.size() + i].get_str(), entriesB[i].first.txhash.GetHex());
+        }
+    }
+
+    // The last entry of an address as the cursor moves on to the next address
+    CDataStream ssLast(SER_DISK, CLIENT_VERSION);
+    ssLast << entriesA.back().first;
+    UniValue page = CallRPC("getaddresstxids " + AddressIndexQuery({addressA, addressB}, 1, HexStr(ssLast.begin(), ssLast.end())));
+    BOOST_CHECK_EQUAL(find_value(page, "txids")[0].get_str(), entriesB[0].first.txhash.GetHex());
+
+    // The page size is bounded
+    std::string limitError = "Limit is expected to be between 1 and 100000";
+    CheckPageError("getaddressdeltas " + AddressIndexQuery({addressA}, -1), limitError);
+    CheckPageError("getaddressdeltas {\"addresses\":[\"" + addressA + "\"],\"limit\":0}", limitError);
+    CheckPageError("getaddresstxids " + AddressIndexQuery({addressA}, 100001), limitError);
+    page = CallRPC("getaddresstxids " + AddressIndexQuery({addressA}, 100000));
+    BOOST_CHECK_EQUAL(find_value(page, "txids").size(), entriesA.size());
+    BOOST_CHECK(find_value(page, "cursor").isNull());
+
+    // Malformed cursors and cursors of other addresses are rejected
+    std::string cursor = find_value(CallRPC("getaddressdeltas " + AddressIndexQuery({addressA}, 2)), "cursor").get_str();
+    for (const std::string& bad : {std::string("zz"), cursor.substr(1), cursor.substr(2), cursor + "00"}) {
+        CheckPageError("getaddressdeltas " + AddressIndexQuery({addressA}, 2, bad), "Invalid cursor");
+    }
+    CheckPageError("getaddressdeltas " + AddressIndexQuery({addressB}, 2, cursor),
+                   "Cursor does not belong to the requested addresses");
+    CheckPageError("getaddresstxids {\"addresses\":[\"" + addressA + "\"],\"cursor\":\"" + cursor + "\"}",
+                   "Cursor is only valid together with a limit");
+
+    fAddressIndex = false;
+}
+
+BOOST_AUTO_TEST_CASE(rpc_address_index_merge_order)
+{
+    fAddressIndex = true;
+    KeyIO keyIO(Params());
+
+    // Addresses with overlapping heights, an odd number of them so that the
+    // pairwise merge has a run left over
+    std::vector<std::vector<CAddressIndexDbEntry>> entries;
+    std::vector<std::string> addresses;
+    std::vector<CAddressUnspentDbEntry> unspent;
+    int nRanges[][2] = {{1, 10}, {3, 7}, {5, 12}, {1, 1}, {12, 20}};
+    for (unsigned char n = 0; n < 5; n++) {
+        uint160 hash(std::vector<unsigned char>(20, 0x10 + n));
+        entries.push_back(WriteAddressIndexEntries(hash, nRanges[n][1], nRanges[n][0]));
+        addresses.push_back(keyIO.EncodeDestination(CKeyID(hash)));
+        // Unspent outputs are keyed by txid, so the index does not keep them in height order
+        for (const CAddressIndexDbEntry& entry : entries.back()) {
+            unspent.push_back(std::make_pair(CAddressUnspentKey(1, hash, entry.first.txhash, 0),
+                                             CAddressUnspentValue(entry.second, CScript(), entry.first.blockHeight)));
+        }
+    }
+    BOOST_CHECK(pblocktree->UpdateAddressUnspentIndex(unspent));
+
+    // Reading the addresses one after the other and sorting stably by height
+    std::vector<CAddressIndexDbEntry> serial;
+    std::set<std::pair<int, std::string>> serialTxids;
+    for (const std::vector<CAddressIndexDbEntry>& part : entries) {
+        serial.insert(serial.end(), part.begin(), part.end());
+        for (const CAddressIndexDbEntry& entry : part) {
+            serialTxids.insert(std::make_pair(entry.first.blockHeight, entry.first.txhash.GetHex()));
+        }
+    }
+    std::stable_sort(serial.begin(), serial.end(), [](const CAddressIndexDbEntry& a, const CAddressIndexDbEntry& b) {
+        return a.first.blockHeight < b.first.blockHeight;
+    });
+
+    UniValue deltas = CallRPC("getaddressdeltas " + AddressIndexQuery(addresses, 0));
+    BOOST_REQUIRE_EQUAL(deltas.size(), serial.size());
+    for (size_t i = 0; i < serial.size(); i++) {
+        BOOST_CHECK_EQUAL(find_value(deltas[i], "txid").get_str(), serial[i].first.txhash.GetHex());
+        BOOST_CHECK_EQUAL(find_value(deltas[i], "height").get_int(), serial[i].first.blockHeight);
+    }
+
+    UniValue txids = CallRPC("getaddresstxids " + AddressIndexQuery(addresses, 0));
+    BOOST_REQUIRE_EQUAL(txids.size(), serialTxids.size());
+    size_t i = 0;
+    for (const std::pair<int, std::string>& txid : serialTxids) {
+        BOOST_CHECK_EQUAL(txids[i++].get_str(), txid.second);
+    }
+
+    // The outputs of every address in height order, the same height in the
+    // order the addresses were given
+    UniValue utxos = CallRPC("getaddressutxos " + AddressIndexQuery(addresses, 0));
+    BOOST_REQUIRE_EQUAL(utxos.size(), serial.size());
+    for (size_t i = 1; i < utxos.size(); i++) {
+        int nPrevHeight = find_value(utxos[i - 1], "height").get_int();
+        int nHeight = find_value(utxos[i], "height").get_int();
+        BOOST_CHECK(nPrevHeight <= nHeight);
+        if (nPrevHeight == nHeight) {
+            size_t nPrevAddress = std::find(addresses.begin(), addresses.end(), find_value(utxos[i - 1], "address").get_str()) - addresses.begin();
+            size_t nAddress = std::find(addresses.begin(), addresses.end(), find_value(utxos[i], "address").get_str()) - addresses.begin();
+            BOOST_CHECK(nPrevAddress <= nAddress);
+        }
+    }
+
+    // A read that fails on one address fails the whole query, after the
+    // other readers are done
+    fAddressIndex = false;
+    CheckPageError("getaddressdeltas " + AddressIndexQuery(addresses, 0), "No information available for address");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
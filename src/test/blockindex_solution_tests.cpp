@@ -0,0 +1,177 @@
+// Copyright (c) 2021 The Gemlink developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chain.h"
+#include "chainparams.h"
+#include "main.h"
+#include "txdb.h"
+#include "utilstrencodings.h"
+
+#include "test/test_bitcoin.h"
+#include "test/test_util.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <univalue.h>
+
+static const std::vector<std::pair<int, const CBlockFileInfo*> > NO_FILES;
+
+BOOST_FIXTURE_TEST_SUITE(blockindex_solution_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(solution_trimmed_after_flush)
+{
+    const CBlock& genesis = Params().GenesisBlock();
+    FlushStateToDisk();
+
+    LOCK(cs_main);
+    CBlockIndex* pindexGenesis = chainActive.Genesis();
+    BOOST_CHECK(!pindexGenesis->HasSolution());
+
+    std::vector<unsigned char> solution;
+    BOOST_CHECK(pindexGenesis->GetSolution(solution));
+    BOOST_CHECK(solution == genesis.nSolution);
+    CBlockHeader header;
+    BOOST_CHECK(pindexGenesis->GetBlockHeader(header));
+    BOOST_CHECK(header.GetHash() == genesis.GetHash());
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << genesis.GetBlockHeader();
+    UniValue r = CallRPC("getblockheader " + genesis.GetHash().GetHex() + " false");
+    BOOST_CHECK_EQUAL(r.get_str(), HexStr(ss.begin(), ss.end()));
+    r = CallRPC("getblockheader " + genesis.GetHash().GetHex());
+    BOOST_CHECK_EQUAL(find_value(r.get_obj(), "solution").get_str(), HexStr(genesis.nSolution));
+
+    // A trimmed entry missing from the DB fails cleanly, and isn't written
+    // back without its solution
+    CBlockHeader headerLost = genesis.GetBlockHeader();
+    headerLost.nNonce = GetRandHash();
+    uint256 hashLost = headerLost.GetHash();
+    CBlockIndex indexLost(headerLost);
+    indexLost.phashBlock = &hashLost;
+    indexLost.TrimSolution();
+    BOOST_CHECK(!indexLost.GetSolution(solution));
+    BOOST_CHECK(!indexLost.GetBlockHeader(header));
+    BOOST_CHECK(!pblocktree->WriteBatchSync(NO_FILES, 0, std::vector<const CBlockIndex*>(1, &indexLost)));
+
+    mapBlockIndex[hashLost] = &indexLost;
+    BOOST_CHECK_THROW(CallRPC("getblockheader " + hashLost.GetHex()), std::runtime_error);
+    BOOST_CHECK_THROW(CallRPC("getblockheader " + hashLost.GetHex() + " false"), std::runtime_error);
+    mapBlockIndex.erase(hashLost);
+}
+
+BOOST_AUTO_TEST_CASE(getheaders_reads_trimmed_solutions)
+{
+    const CBlock& genesis = Params().GenesisBlock();
+
+    {
+        TestPeer peer;
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << CBlockLocator() << genesis.GetHash();
+        peer.Receive("getheaders", ss);
+        auto vSent = peer.TakeSent();
+        BOOST_REQUIRE_EQUAL(vSent.size(), 1);
+        BOOST_CHECK_EQUAL(vSent[0].first, "headers");
+        std::vector<CBlock> vHeaders;
+        vSent[0].second >> vHeaders;
+        BOOST_REQUIRE_EQUAL(vHeaders.size(), 1);
+        BOOST_CHECK(vHeaders[0].GetHash() == genesis.GetHash());
+        BOOST_CHECK(vHeaders[0].nSolution == genesis.nSolution);
+    }
+
+    // Extend the chain by an entry that was written and trimmed, and one
+    // whose solution is gone
+    CBlockHeader headerA = genesis.GetBlockHeader();
+    headerA.hashPrevBlock = genesis.GetHash();
+    headerA.nTime++;
+    uint256 hashA = headerA.GetHash();
+    CBlockIndex indexA(headerA);
+    indexA.phashBlock = &hashA;
+    indexA.nHeight = 1;
+
+    CBlockHeader headerB = headerA;
+    headerB.hashPrevBlock = hashA;
+    uint256 hashB = headerB.GetHash();
+    CBlockIndex indexB(headerB);
+    indexB.phashBlock = &hashB;
+    indexB.pprev = &indexA;
+    indexB.nHeight = 2;
+    indexB.TrimSolution();
+
+    {
+        LOCK(cs_main);
+        indexA.pprev = chainActive.Genesis();
+        BOOST_REQUIRE(pblocktree->WriteBatchSync(NO_FILES, 0, std::vector<const CBlockIndex*>(1, &indexA)));
+        indexA.TrimSolution();
+        chainActive.SetTip(&indexB);
+    }
+
+    {
+        TestPeer peer;
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << chainActive.GetLocator(chainActive.Genesis()) << uint256();
+        peer.Receive("getheaders", ss);
+        auto vSent = peer.TakeSent();
+        BOOST_REQUIRE_EQUAL(vSent.size(), 1);
+        BOOST_CHECK_EQUAL(vSent[0].first, "headers");
+        std::vector<CBlock> vHeaders;
+        vSent[0].second >> vHeaders;
+        // the reply stops before the entry it can't read
+        BOOST_REQUIRE_EQUAL(vHeaders.size(), 1);
+        BOOST_CHECK(vHeaders[0].GetHash() == hashA);
+        BOOST_CHECK(vHeaders[0].nSolution == headerA.nSolution);
+    }
+
+    {
+        LOCK(cs_main);
+        chainActive.SetTip(chainActive.Genesis());
+        BOOST_CHECK(pblocktree->EraseBatchSync(std::vector<const CBlockIndex*>(1, &indexA)));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(load_block_index_checks_hash)
+{
+    const CBlock& genesis = Params().GenesisBlock();
+
+    std::map<uint256, CBlockIndex*> mapLoaded;
+    auto insertBlockIndex = [&mapLoaded](const uint256& hash) -> CBlockIndex* {
+        if (hash.IsNull())
+            return NULL;
+        auto it = mapLoaded.find(hash);
+        if (it == mapLoaded.end()) {
+            it = mapLoaded.insert(std::make_pair(hash, new CBlockIndex())).first;
+            it->second->phashBlock = &it->first;
+        }
+        return it->second;
+    };
+
+    // Entries load without their solution and read it back on demand
+    BOOST_CHECK(pblocktree->LoadBlockIndexGuts(insertBlockIndex, Params()));
+    BOOST_REQUIRE(mapLoaded.count(genesis.GetHash()));
+    const CBlockIndex* pindex = mapLoaded[genesis.GetHash()];
+    BOOST_CHECK(!pindex->HasSolution());
+    CBlockHeader header;
+    BOOST_CHECK(pindex->GetBlockHeader(header));
+    BOOST_CHECK(header.GetHash() == genesis.GetHash());
+
+    // An entry whose stored solution no longer hashes to its key is refused
+    CBlockHeader headerC = genesis.GetBlockHeader();
+    headerC.hashPrevBlock = genesis.GetHash();
+    uint256 hashC = headerC.GetHash();
+    headerC.nSolution[0] ^= 1;
+    CBlockIndex indexC(headerC);
+    indexC.phashBlock = &hashC;
+    {
+        LOCK(cs_main);
+        indexC.pprev = chainActive.Genesis();
+        indexC.nHeight = 1;
+    }
+    BOOST_REQUIRE(pblocktree->WriteBatchSync(NO_FILES, 0, std::vector<const CBlockIndex*>(1, &indexC)));
+    BOOST_CHECK(!pblocktree->LoadBlockIndexGuts(insertBlockIndex, Params()));
+    BOOST_CHECK(pblocktree->EraseBatchSync(std::vector<const CBlockIndex*>(1, &indexC)));
+
+    for (auto& entry : mapLoaded)
+        delete entry.second;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -13,12 +13,15 @@
 #include "undo.h"
 #include "primitives/transaction.h"
 #include "pubkey.h"
+#include "txdb.h"
 #include "zcash/Note.hpp"
 
+#include <atomic>
 #include <vector>
 #include <map>
 
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 #include "zcash/IncrementalMerkleTree.hpp"
 
 namespace
@@ -212,18 +215,30 @@ public:
     void SelfTest() const
     {
         // Manually recompute the dynamic usage of the whole data, and compare it.
-        size_t ret = memusage::DynamicUsage(cacheCoins) +
-                     memusage::DynamicUsage(cacheSproutAnchors) +
+        size_t ret = memusage::DynamicUsage(cacheSproutAnchors) +
                      memusage::DynamicUsage(cacheSaplingAnchors) +
                      memusage::DynamicUsage(cacheSproutNullifiers) +
                      memusage::DynamicUsage(cacheSaplingNullifiers) +
                      memusage::DynamicUsage(historyCacheMap);
-        for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
-            ret += it->second.coins.DynamicMemoryUsage();
+        for (const CCoinsCacheShard& shard : cacheCoins) {
+            ret += memusage::DynamicUsage(shard.map);
+            for (CCoinsMap::const_iterator it = shard.map.begin(); it != shard.map.end(); it++) {
+                ret += it->second.coins.DynamicMemoryUsage();
+            }
         }
         BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
     }
 
+    //! Every coin must sit in the shard its txid hashes to
+    void CheckShards() const
+    {
+        for (const CCoinsCacheShard& shard : cacheCoins) {
+            for (CCoinsMap::const_iterator it = shard.map.begin(); it != shard.map.end(); it++) {
+                BOOST_CHECK(&GetShard(it->first) == &shard);
+            }
+        }
+    }
+
 };
 
 class TxWithNullifiers
@@ -841,6 +856,7 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
             }
             for (const CCoinsViewCacheTest *test : stack) {
                 test->SelfTest();
+                test->CheckShards();
             }
         }
 
@@ -882,6 +898,88 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(missed_an_entry);
 }
 
+BOOST_AUTO_TEST_CASE(coins_cache_concurrent_reads)
+{
+    CCoinsViewTest base;
+    std::vector<uint256> txids(1000);
+    {
+        CCoinsViewCacheTest writer(&base);
+        for (unsigned int i = 0; i < txids.size(); i++) {
+            txids[i] = GetRandHash();
+            CCoinsModifier coins = writer.ModifyNewCoins(txids[i]);
+            coins->nVersion = 1;
+            coins->vout.resize(1);
+            coins->vout[0].nValue = i + 1;
+        }
+        writer.Flush();
+    }
+
+    // Several threads pulling the same coins into the cache at once must
+    // each see every coin, and leave each coin cached exactly once.
+    CCoinsViewCacheTest cache(&base);
+    std::atomic<int> nMismatches(0);
+    boost::thread_group threads;
+    for (int t = 0; t < 4; t++) {
+        threads.create_thread([&]() {
+            for (unsigned int i = 0; i < txids.size(); i++) {
+                CCoins coins;
+                if (!cache.GetCoins(txids[i], coins) || coins.vout[0].nValue != (CAmount)(i + 1) || !cache.HaveCoins(txids[i]))
+                    nMismatches++;
+            }
+        });
+    }
+    threads.join_all();
+
+    BOOST_CHECK_EQUAL(nMismatches, 0);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), txids.size());
+    cache.SelfTest();
+    cache.CheckShards();
+}
+
+BOOST_AUTO_TEST_CASE(coins_cache_peek)
+{
+    CCoinsViewTest base;
+    uint256 txidBase = GetRandHash();
+    {
+        CCoinsViewCacheTest writer(&base);
+        {
+            CCoinsModifier coins = writer.ModifyNewCoins(txidBase);
+            coins->nVersion = 1;
+            coins->vout.resize(1);
+            coins->vout[0].nValue = 5;
+        }
+        writer.Flush();
+    }
+
+    // Peeking at coins the cache doesn't hold reads them from the base
+    // without inserting them, so an open modifier stays valid.
+    CCoinsViewCacheTest cache(&base);
+    uint256 txidNew = GetRandHash();
+    {
+        CCoinsModifier coins = cache.ModifyNewCoins(txidNew);
+        coins->nVersion = 1;
+        coins->vout.resize(1);
+        CCoins peeked;
+        BOOST_CHECK(cache.PeekCoins(txidBase, peeked));
+        BOOST_CHECK_EQUAL(peeked.vout[0].nValue, 5);
+        BOOST_CHECK(!cache.PeekCoins(GetRandHash(), peeked));
+        BOOST_CHECK_EQUAL(cache.GetCacheSize(), 1);
+        coins->vout[0].nValue = 7;
+    }
+
+    // Cached coins are returned as they stand in the cache.
+    CCoins peeked;
+    BOOST_CHECK(cache.PeekCoins(txidNew, peeked));
+    BOOST_CHECK_EQUAL(peeked.vout[0].nValue, 7);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 1);
+
+    // GetCoins still fills the cache.
+    BOOST_CHECK(cache.GetCoins(txidBase, peeked));
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 2);
+    cache.SelfTest();
+    cache.CheckShards();
+}
+
 BOOST_AUTO_TEST_CASE(coins_coinbase_spends)
 {
     CCoinsViewTest base;
@@ -1094,4 +1192,143 @@ BOOST_AUTO_TEST_CASE(ccoins_serialization)
     }
 }
 
+BOOST_AUTO_TEST_CASE(coins_cache_partial_flush)
+{
+    CCoinsViewTest base;
+    CCoinsViewCache cache(&base);
+    uint256 hot = GetRandHash();
+    uint256 cold = GetRandHash();
+    uint256 created = GetRandHash();
+    for (const uint256& txid : {hot, cold}) {
+        CCoinsModifier coins = cache.ModifyNewCoins(txid);
+        coins->vout.resize(1);
+        coins->vout[0].nValue = 1;
+    }
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0);
+
+    // Read one coin twice and the other once, and create a third
+    BOOST_CHECK(cache.AccessCoins(hot));
+    BOOST_CHECK(cache.AccessCoins(hot));
+    BOOST_CHECK(cache.AccessCoins(cold));
+    {
+        CCoinsModifier coins = cache.ModifyNewCoins(created);
+        coins->vout.resize(1);
+        coins->vout[0].nValue = 2;
+    }
+
+    // The created and the re-read coins stay, the base gets everything
+    BOOST_CHECK(cache.Flush(1 << 20));
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 2);
+    CCoins coins;
+    BOOST_CHECK(base.GetCoins(created, coins));
+    BOOST_CHECK_EQUAL(coins.vout[0].nValue, 2);
+
+    // Kept entries are clean: spending one is written like any other change
+    cache.ModifyCoins(created)->Spend(0);
+    BOOST_CHECK(cache.Flush(1 << 20));
+    BOOST_CHECK(!base.GetCoins(created, coins) || coins.IsPruned());
+
+    // Nothing is kept without room for it
+    BOOST_CHECK(cache.AccessCoins(hot));
+    BOOST_CHECK(cache.Flush(0));
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(coins_stats_set_hash)
+{
+    std::vector<std::pair<uint256, CCoins>> records;
+    for (int i = 0; i < 8; i++) {
+        CMutableTransaction mtx;
+        mtx.vout.resize(1 + i % 3);
+        for (unsigned int j = 0; j < mtx.vout.size(); j++) {
+            mtx.vout[j].nValue = 1000 * i + j;
+        }
+        CTransaction tx(mtx);
+        records.push_back(std::make_pair(tx.GetHash(), CCoins(tx, i)));
+    }
+
+    // Shards added in any order give the same totals and hash
+    CCoinsStats all, even, odd;
+    for (unsigned int i = 0; i < records.size(); i++) {
+        all.AddCoins(records[i].first, records[i].second);
+        (i % 2 ? odd : even).AddCoins(records[i].first, records[i].second);
+    }
+    odd.Merge(even);
+    BOOST_CHECK_EQUAL(all.nTransactions, records.size());
+    BOOST_CHECK_EQUAL(odd.nTransactions, all.nTransactions);
+    BOOST_CHECK_EQUAL(odd.nTransactionOutputs, all.nTransactionOutputs);
+    BOOST_CHECK_EQUAL(odd.nSerializedSize, all.nSerializedSize);
+    BOOST_CHECK_EQUAL(odd.nTotalAmount, all.nTotalAmount);
+    BOOST_CHECK(odd.setHash.GetHash() == all.setHash.GetHash());
+
+    // Spending an output changes the hash; restoring it brings it back
+    uint256 hashBefore = all.setHash.GetHash();
+    CCoins spent = records[1].second;
+    all.RemoveCoins(records[1].first, spent);
+    spent.Spend(0);
+    all.AddCoins(records[1].first, spent);
+    BOOST_CHECK(all.setHash.GetHash() != hashBefore);
+    all.RemoveCoins(records[1].first, spent);
+    all.AddCoins(records[1].first, records[1].second);
+    BOOST_CHECK(all.setHash.GetHash() == hashBefore);
+    BOOST_CHECK_EQUAL(all.nTotalAmount, odd.nTotalAmount);
+
+    // Pruned records are not part of the set
+    CCoins pruned;
+    all.AddCoins(uint256(), pruned);
+    BOOST_CHECK_EQUAL(all.nTransactions, records.size());
+    BOOST_CHECK(all.setHash.GetHash() == hashBefore);
+
+    // Changes that remove more than they add wrap around on their own, and
+    // still give the right totals once merged into the full set
+    CCoinsStats changes, rest;
+    changes.RemoveCoins(records[0].first, records[0].second);
+    for (unsigned int i = 1; i < records.size(); i++) {
+        rest.AddCoins(records[i].first, records[i].second);
+    }
+    all.Merge(changes);
+    BOOST_CHECK_EQUAL(all.nTransactions, rest.nTransactions);
+    BOOST_CHECK_EQUAL(all.nTransactionOutputs, rest.nTransactionOutputs);
+    BOOST_CHECK_EQUAL(all.nSerializedSize, rest.nSerializedSize);
+    BOOST_CHECK_EQUAL(all.nTotalAmount, rest.nTotalAmount);
+    BOOST_CHECK(all.setHash.GetHash() == rest.setHash.GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(coins_write_behind)
+{
+    CCoinsViewDB db(1 << 20, true);
+    uint256 spentTxid = GetRandHash();
+    uint256 blockHash = GetRandHash();
+    {
+        CCoinsViewWriteBehind writeBehind(&db, &db);
+        {
+            CCoinsViewCache cache(&writeBehind);
+            {
+                CCoinsModifier coins = cache.ModifyNewCoins(spentTxid);
+                coins->vout.resize(1);
+                coins->vout[0].nValue = 5;
+            }
+            cache.SetBestBlock(blockHash);
+            BOOST_CHECK(cache.Flush());
+        }
+
+        // Served from the handed over batch or the database, either way the same
+        CCoinsViewCache cache(&writeBehind);
+        CCoins coins;
+        BOOST_CHECK(writeBehind.GetBestBlock() == blockHash);
+        BOOST_CHECK(writeBehind.HaveCoins(spentTxid));
+
+        // Spend it, and flush again while the first batch may still be in flight
+        cache.ModifyCoins(spentTxid)->Spend(0);
+        BOOST_CHECK(cache.Flush());
+        BOOST_CHECK(!writeBehind.GetCoins(spentTxid, coins));
+
+        BOOST_CHECK(writeBehind.Sync());
+        BOOST_CHECK(db.GetBestBlock() == blockHash);
+        BOOST_CHECK(!db.HaveCoins(spentTxid));
+    }
+    BOOST_CHECK(db.GetBestBlock() == blockHash);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
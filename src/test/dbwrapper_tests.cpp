@@ -80,6 +80,45 @@ BOOST_AUTO_TEST_CASE(dbwrapper_batch)
     }
 }
 
+// Test reads through a snapshot
+BOOST_AUTO_TEST_CASE(dbwrapper_snapshot)
+{
+    {
+        path ph = temp_directory_path() / unique_path();
+        CDBWrapper dbw(ph, (1 << 20), true, false);
+
+        char key = 'j';
+        uint256 in = GetRandHash();
+        BOOST_CHECK(dbw.Write(key, in));
+
+        CDBSnapshot snapshot(dbw);
+
+        // Writes after the snapshot is taken are not seen through it
+        uint256 in2 = GetRandHash();
+        BOOST_CHECK(dbw.Write(key, in2));
+        char key2 = 'k';
+        BOOST_CHECK(dbw.Write(key2, in2));
+
+        uint256 res;
+        BOOST_CHECK(snapshot.Read(key, res));
+        BOOST_CHECK_EQUAL(res.ToString(), in.ToString());
+        BOOST_CHECK(!snapshot.Read(key2, res));
+        BOOST_CHECK(dbw.Read(key, res));
+        BOOST_CHECK_EQUAL(res.ToString(), in2.ToString());
+
+        boost::scoped_ptr<CDBIterator> it(snapshot.NewIterator());
+        it->SeekToFirst();
+        char key_res;
+        BOOST_REQUIRE(it->Valid());
+        BOOST_CHECK(it->GetKey(key_res));
+        BOOST_CHECK_EQUAL(key_res, key);
+        BOOST_CHECK(it->GetValue(res));
+        BOOST_CHECK_EQUAL(res.ToString(), in.ToString());
+        it->Next();
+        BOOST_CHECK(!it->Valid());
+    }
+}
+
 BOOST_AUTO_TEST_CASE(dbwrapper_iterator)
 {
     {
@@ -0,0 +1,112 @@
+// Copyright (c) 2021 The Gemlink developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bloom.h"
+#include "chainparams.h"
+#include "main.h"
+#include "merkleblock.h"
+#include "random.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(getdata_tests, TestingSetup)
+
+static std::vector<std::pair<std::string, CDataStream> > GetData(TestPeer& peer, const CInv& inv)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << std::vector<CInv>(1, inv);
+    peer.Receive("getdata", ss);
+    return peer.TakeSent();
+}
+
+BOOST_AUTO_TEST_CASE(getdata_sends_stored_block_bytes)
+{
+    const CBlock& genesis = Params().GenesisBlock();
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+    ssBlock << genesis;
+
+    // The bytes stored on disk are the block's network serialization, and
+    // go out unchanged
+    std::vector<unsigned char> vRawBlock;
+    {
+        LOCK(cs_main);
+        BOOST_REQUIRE(ReadRawBlockFromDisk(vRawBlock, chainActive.Genesis(), Params().MessageStart()));
+    }
+    BOOST_CHECK(std::string(vRawBlock.begin(), vRawBlock.end()) == ssBlock.str());
+
+    TestPeer peer;
+    auto vSent = GetData(peer, CInv(MSG_BLOCK, genesis.GetHash()));
+    BOOST_REQUIRE_EQUAL(vSent.size(), 1);
+    BOOST_CHECK_EQUAL(vSent[0].first, "block");
+    BOOST_CHECK(vSent[0].second.str() == ssBlock.str());
+
+    // A filtered block is still loaded and matched against the peer's
+    // filter, which by default matches everything
+    vSent = GetData(peer, CInv(MSG_FILTERED_BLOCK, genesis.GetHash()));
+    BOOST_REQUIRE_EQUAL(vSent.size(), 2);
+    BOOST_CHECK_EQUAL(vSent[0].first, "merkleblock");
+    CMerkleBlock merkleBlock;
+    vSent[0].second >> merkleBlock;
+    BOOST_CHECK(merkleBlock.header.GetHash() == genesis.GetHash());
+    BOOST_CHECK_EQUAL(vSent[1].first, "tx");
+    CTransaction tx;
+    vSent[1].second >> tx;
+    BOOST_CHECK(tx.GetHash() == genesis.vtx[0].GetHash());
+
+    // Without a filter, a filtered block gets no reply
+    {
+        LOCK(peer.node.cs_filter);
+        delete peer.node.pfilter;
+        peer.node.pfilter = NULL;
+    }
+    vSent = GetData(peer, CInv(MSG_FILTERED_BLOCK, genesis.GetHash()));
+    BOOST_CHECK(vSent.empty());
+}
+
+BOOST_AUTO_TEST_CASE(getdata_without_block_data)
+{
+    TestPeer peer;
+
+    // Unknown blocks get no reply
+    auto vSent = GetData(peer, CInv(MSG_BLOCK, GetRandHash()));
+    BOOST_CHECK(vSent.empty());
+
+    // Nor do blocks in the active chain whose data we don't have
+    CBlockHeader header = Params().GenesisBlock().GetBlockHeader();
+    header.nNonce = GetRandHash();
+    uint256 hashNoData = header.GetHash();
+    CBlockIndex indexNoData(header);
+    indexNoData.phashBlock = &hashNoData;
+    indexNoData.nHeight = 1;
+    {
+        LOCK(cs_main);
+        indexNoData.pprev = chainActive.Genesis();
+        mapBlockIndex[hashNoData] = &indexNoData;
+        chainActive.SetTip(&indexNoData);
+    }
+    vSent = GetData(peer, CInv(MSG_BLOCK, hashNoData));
+    BOOST_CHECK(vSent.empty());
+    vSent = GetData(peer, CInv(MSG_FILTERED_BLOCK, hashNoData));
+    BOOST_CHECK(vSent.empty());
+    {
+        LOCK(cs_main);
+        chainActive.SetTip(chainActive.Genesis());
+        mapBlockIndex.erase(hashNoData);
+    }
+
+    // Unknown transactions are answered with notfound
+    CInv invTx(MSG_TX, GetRandHash());
+    vSent = GetData(peer, invTx);
+    BOOST_REQUIRE_EQUAL(vSent.size(), 1);
+    BOOST_CHECK_EQUAL(vSent[0].first, "notfound");
+    std::vector<CInv> vNotFound;
+    vSent[0].second >> vNotFound;
+    BOOST_REQUIRE_EQUAL(vNotFound.size(), 1);
+    BOOST_CHECK_EQUAL(vNotFound[0].type, invTx.type);
+    BOOST_CHECK(vNotFound[0].hash == invTx.hash);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
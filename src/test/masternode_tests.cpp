@@ -0,0 +1,144 @@
+// Copyright (c) 2021 The Gemlink developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "main.h"
+#include "masternode.h"
+#include "masternodeman.h"
+#include "timedata.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(masternode_tests, TestingSetup)
+
+static CMasternode MakeMasternode(const COutPoint& outpoint, bool fEnabled)
+{
+    CMasternode mn;
+    mn.vin = CTxIn(outpoint);
+    mn.unitTest = true;
+    mn.sigTime = GetAdjustedTime() - 24 * 60 * 60;
+    mn.lastPing.vin = mn.vin;
+    mn.lastPing.blockHash = GetRandHash();
+    mn.lastPing.sigTime = GetAdjustedTime();
+    if (!fEnabled)
+        mn.lastPing.sigTime -= MASTERNODE_EXPIRATION_SECONDS + 60;
+    return mn;
+}
+
+BOOST_AUTO_TEST_CASE(score_table_matches_scan)
+{
+    // a chain of made-up blocks to score against
+    std::vector<uint256> vHashes(20);
+    std::vector<CBlockIndex> vBlocks(vHashes.size());
+    {
+        LOCK(cs_main);
+        for (size_t i = 0; i < vBlocks.size(); i++) {
+            vHashes[i] = GetRandHash();
+            vBlocks[i].phashBlock = &vHashes[i];
+            vBlocks[i].pprev = i == 0 ? chainActive.Genesis() : &vBlocks[i - 1];
+            vBlocks[i].nHeight = i + 1;
+            mapBlockIndex[vHashes[i]] = &vBlocks[i];
+        }
+        chainActive.SetTip(&vBlocks.back());
+    }
+    mapCacheBlockHashes.clear();
+
+    const int nHeight = 10;
+    uint256 hashBlock;
+    BOOST_REQUIRE(GetBlockHash(hashBlock, nHeight));
+
+    // find two collaterals with the same compact score
+    uint256 txid = GetRandHash();
+    CMasternode probe;
+    std::map<int64_t, uint32_t> mapSeen;
+    std::vector<uint32_t> vTied;
+    int64_t nTiedScore = 0;
+    for (uint32_t n = 0; n < (1 << 20) && vTied.empty(); n++) {
+        probe.vin = CTxIn(COutPoint(txid, n));
+        int64_t nScore = probe.CalculateScore(hashBlock).GetCompact(false);
+        auto it = mapSeen.find(nScore);
+        if (it != mapSeen.end()) {
+            // list the later one first, so the tie isn't settled by collateral
+            vTied = {n, it->second};
+            nTiedScore = nScore;
+        }
+        mapSeen.emplace(nScore, n);
+    }
+    BOOST_REQUIRE_EQUAL(vTied.size(), 2);
+
+    // the tie is the best score among the enabled Masternodes; a few better
+    // scores belong to expired ones
+    std::vector<CMasternode> vAdded;
+    vAdded.push_back(MakeMasternode(COutPoint(txid, vTied[0]), true));
+    vAdded.push_back(MakeMasternode(COutPoint(txid, vTied[1]), true));
+    int nAbove = 0, nBelow = 0;
+    for (const auto& seen : mapSeen) {
+        if (seen.second == vTied[0] || seen.second == vTied[1])
+            continue;
+        if (seen.first > nTiedScore && nAbove < 5) {
+            vAdded.push_back(MakeMasternode(COutPoint(txid, seen.second), false));
+            nAbove++;
+        } else if (seen.first < nTiedScore && nBelow < 5) {
+            vAdded.push_back(MakeMasternode(COutPoint(txid, seen.second), true));
+            nBelow++;
+        }
+    }
+    BOOST_REQUIRE(nBelow > 0);
+    // put a lower score ahead of the tie in the list
+    std::swap(vAdded[0], vAdded.back());
+    std::swap(vAdded[1], vAdded.back());
+
+    CMasternodeMan man;
+    for (CMasternode& mn : vAdded)
+        BOOST_CHECK(man.Add(mn));
+
+    // the scan the score tables replace: the first enabled Masternode with
+    // the highest score wins, and ties rank in list order
+    int64_t nBest = 0;
+    CTxIn vinWinner;
+    std::vector<int64_t> vScores;
+    for (CMasternode& mn : vAdded) {
+        mn.Check();
+        int64_t nScore = mn.CalculateScore(nHeight).GetCompact(false);
+        vScores.push_back(mn.IsEnabled() ? nScore : -1);
+        if (mn.IsEnabled() && nScore > nBest) {
+            nBest = nScore;
+            vinWinner = mn.vin;
+        }
+    }
+    BOOST_CHECK_EQUAL(nBest, nTiedScore);
+    BOOST_CHECK(vinWinner.prevout == COutPoint(txid, vTied[0]));
+
+    // the first query builds the table, the second reuses it
+    for (int nPass = 0; nPass < 2; nPass++) {
+        CMasternode* pWinner = man.GetCurrentMasterNode(1, nHeight, 0);
+        BOOST_REQUIRE(pWinner != NULL);
+        BOOST_CHECK(pWinner->vin == vinWinner);
+
+        for (size_t i = 0; i < vAdded.size(); i++) {
+            int nRank = -1;
+            if (vScores[i] >= 0) {
+                nRank = 1;
+                for (size_t j = 0; j < vAdded.size(); j++) {
+                    if (vScores[j] > vScores[i] || (vScores[j] == vScores[i] && j < i))
+                        nRank++;
+                }
+            }
+            BOOST_CHECK_EQUAL(man.GetMasternodeRank(vAdded[i].vin, nHeight), nRank);
+        }
+    }
+    BOOST_CHECK_EQUAL(man.GetMasternodeRank(CTxIn(COutPoint(txid, vTied[0])), nHeight), 1);
+    BOOST_CHECK_EQUAL(man.GetMasternodeRank(CTxIn(COutPoint(txid, vTied[1])), nHeight), 2);
+
+    {
+        LOCK(cs_main);
+        chainActive.SetTip(chainActive.Genesis());
+        for (const uint256& hash : vHashes)
+            mapBlockIndex.erase(hash);
+    }
+    mapCacheBlockHashes.clear();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
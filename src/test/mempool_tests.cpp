@@ -4,6 +4,7 @@
 
 #include "consensus/upgrades.h"
 #include "main.h"
+#include "mempoolindex.h"
 #include "txmempool.h"
 #include "util.h"
 
@@ -152,6 +153,136 @@ BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
     BOOST_CHECK(it == pool.mapTx.get<1>().end());
 }
 
+BOOST_AUTO_TEST_CASE(MempoolPackageStateTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+
+    // A low-fee parent, a high-fee child and a grandchild
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_11;
+    txParent.vout.resize(1);
+    txParent.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txParent.vout[0].nValue = 10 * COIN;
+    CMutableTransaction txChild;
+    txChild.vin.resize(1);
+    txChild.vin[0].scriptSig = CScript() << OP_11;
+    txChild.vin[0].prevout.hash = txParent.GetHash();
+    txChild.vin[0].prevout.n = 0;
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txChild.vout[0].nValue = 9 * COIN;
+    CMutableTransaction txGrandChild;
+    txGrandChild.vin.resize(1);
+    txGrandChild.vin[0].scriptSig = CScript() << OP_11;
+    txGrandChild.vin[0].prevout.hash = txChild.GetHash();
+    txGrandChild.vin[0].prevout.n = 0;
+    txGrandChild.vout.resize(1);
+    txGrandChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txGrandChild.vout[0].nValue = 8 * COIN;
+
+    // An unrelated transaction paying more than the parent alone
+    CMutableTransaction txOther;
+    txOther.vout.resize(1);
+    txOther.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txOther.vout[0].nValue = 1 * COIN;
+
+    pool.addUnchecked(txParent.GetHash(), entry.Fee(1000LL).FromTx(txParent));
+    pool.addUnchecked(txChild.GetHash(), entry.Fee(50000LL).FromTx(txChild));
+    pool.addUnchecked(txGrandChild.GetHash(), entry.Fee(2000LL).FromTx(txGrandChild));
+    pool.addUnchecked(txOther.GetHash(), entry.Fee(10000LL).FromTx(txOther));
+
+    auto parentIt = pool.mapTx.find(txParent.GetHash());
+    auto childIt = pool.mapTx.find(txChild.GetHash());
+    auto grandChildIt = pool.mapTx.find(txGrandChild.GetHash());
+    BOOST_CHECK_EQUAL(parentIt->GetCountWithDescendants(), 3);
+    BOOST_CHECK_EQUAL(parentIt->GetModFeesWithDescendants(), 53000);
+    BOOST_CHECK_EQUAL(childIt->GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(childIt->GetModFeesWithAncestors(), 51000);
+    BOOST_CHECK_EQUAL(childIt->GetSizeWithAncestors(), parentIt->GetTxSize() + childIt->GetTxSize());
+    BOOST_CHECK_EQUAL(grandChildIt->GetCountWithAncestors(), 3);
+    BOOST_CHECK_EQUAL(grandChildIt->GetModFeesWithAncestors(), 53000);
+
+    CTxMemPool::setEntries ancestors;
+    pool.CalculateMemPoolAncestors(grandChildIt, ancestors);
+    BOOST_CHECK_EQUAL(ancestors.size(), 2);
+
+    // The child pays for its parent, so its package comes first
+    auto it = pool.mapTx.get<ancestor_score>().begin();
+    BOOST_CHECK_EQUAL(it->GetTx().GetHash().ToString(), txChild.GetHash().ToString());
+
+    // Fee deltas reach the package sums on both sides
+    pool.PrioritiseTransaction(txChild.GetHash(), txChild.GetHash().ToString(), 0, 5000);
+    BOOST_CHECK_EQUAL(parentIt->GetModFeesWithDescendants(), 58000);
+    BOOST_CHECK_EQUAL(grandChildIt->GetModFeesWithAncestors(), 58000);
+
+    // Mining the parent leaves the child at the root of what remains
+    std::list<CTransaction> removed;
+    pool.remove(txParent, removed, false);
+    BOOST_CHECK_EQUAL(removed.size(), 1);
+    BOOST_CHECK_EQUAL(childIt->GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(childIt->GetModFeesWithAncestors(), 55000);
+    BOOST_CHECK_EQUAL(childIt->GetCountWithDescendants(), 2);
+    BOOST_CHECK_EQUAL(grandChildIt->GetCountWithAncestors(), 2);
+    BOOST_CHECK(pool.GetMemPoolParents(childIt).empty());
+
+    // Removing the child recursively takes the grandchild with it
+    removed.clear();
+    pool.remove(txChild, removed, true);
+    BOOST_CHECK_EQUAL(removed.size(), 2);
+    BOOST_CHECK_EQUAL(pool.size(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolPackageLimitsTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+
+    // A chain of five, each spending the one before
+    std::vector<CMutableTransaction> chain(6);
+    for (size_t i = 0; i < chain.size(); i++) {
+        chain[i].vin.resize(1);
+        chain[i].vin[0].scriptSig = CScript() << OP_11;
+        if (i > 0) {
+            chain[i].vin[0].prevout.hash = chain[i - 1].GetHash();
+            chain[i].vin[0].prevout.n = 0;
+        }
+        chain[i].vout.resize(1);
+        chain[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        chain[i].vout[0].nValue = (10 - i) * COIN;
+        if (i < 5)
+            pool.addUnchecked(chain[i].GetHash(), entry.FromTx(chain[i]));
+    }
+    CTxMemPoolEntry next = entry.FromTx(chain[5]);
+    const uint64_t nTxSize = next.GetTxSize();
+
+    CTxMemPool::setEntries ancestors;
+    std::string errString;
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(next, ancestors, 6, 6 * nTxSize, 6, 6 * nTxSize, errString));
+    BOOST_CHECK_EQUAL(ancestors.size(), 5);
+
+    // One over each limit in turn
+    ancestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(next, ancestors, 5, 6 * nTxSize, 6, 6 * nTxSize, errString));
+    BOOST_CHECK(errString.find("ancestors") != std::string::npos);
+    ancestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(next, ancestors, 6, 6 * nTxSize - 1, 6, 6 * nTxSize, errString));
+    BOOST_CHECK(errString.find("ancestor size") != std::string::npos);
+    ancestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(next, ancestors, 6, 6 * nTxSize, 5, 6 * nTxSize, errString));
+    BOOST_CHECK(errString.find("too many descendants") != std::string::npos);
+    ancestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(next, ancestors, 6, 6 * nTxSize, 6, 6 * nTxSize - 1, errString));
+    BOOST_CHECK(errString.find("descendant size") != std::string::npos);
+
+    // A parent limit is hit before any of the chain is walked
+    ancestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(next, ancestors, 1, 6 * nTxSize, 6, 6 * nTxSize, errString));
+    BOOST_CHECK(errString.find("parents") != std::string::npos);
+    BOOST_CHECK(ancestors.empty());
+}
+
 BOOST_AUTO_TEST_CASE(RemoveWithoutBranchId)
 {
     CTxMemPool pool(CFeeRate(0));
@@ -219,4 +350,91 @@ BOOST_AUTO_TEST_CASE(SetSanityCheck)
     BOOST_CHECK_EQUAL(pool.GetCheckFrequency(), 0);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolAddressIndexTest)
+{
+    CMempoolAddressIndex index;
+    uint160 addrA;
+    uint160 addrB;
+    *addrA.begin() = 1;
+    *addrB.begin() = 2;
+    uint256 tx1 = uint256S("11");
+    uint256 tx2 = uint256S("22");
+    COutPoint prevout(uint256S("33"), 4);
+
+    index.AddTx(tx1, 100, {{CScript::P2PKH, addrA, 1, false, 50, COutPoint()},
+                           {CScript::P2PKH, addrA, 0, false, 20, COutPoint()},
+                           {CScript::P2PKH, addrB, 2, false, 30, COutPoint()}});
+    index.AddTx(tx2, 200, {{CScript::P2PKH, addrA, 0, true, -70, prevout}});
+    BOOST_CHECK_EQUAL(index.Size(), 4);
+
+    // Deltas come back in key order: by txid, then index
+    std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta>> results;
+    index.GetDeltas(addrA, CScript::P2PKH, results);
+    BOOST_CHECK_EQUAL(results.size(), 3);
+    BOOST_CHECK(results[0].first.txhash == tx1 && results[0].first.index == 0);
+    BOOST_CHECK_EQUAL(results[0].second.amount, 20);
+    BOOST_CHECK(results[1].first.txhash == tx1 && results[1].first.index == 1);
+    BOOST_CHECK(results[2].first.txhash == tx2 && results[2].first.spending);
+    BOOST_CHECK_EQUAL(results[2].second.time, 200);
+    BOOST_CHECK(results[2].second.prevhash == prevout.hash);
+    BOOST_CHECK_EQUAL(results[2].second.prevout, 4);
+
+    // The same address under another type is another address
+    results.clear();
+    index.GetDeltas(addrA, CScript::P2SH, results);
+    BOOST_CHECK(results.empty());
+
+    index.RemoveTx(tx1);
+    BOOST_CHECK_EQUAL(index.Size(), 1);
+    results.clear();
+    index.GetDeltas(addrB, CScript::P2PKH, results);
+    BOOST_CHECK(results.empty());
+    index.GetDeltas(addrA, CScript::P2PKH, results);
+    BOOST_CHECK_EQUAL(results.size(), 1);
+    BOOST_CHECK(results[0].first.txhash == tx2);
+
+    // Removed slots are reused
+    size_t nCapacity = index.Capacity();
+    BOOST_CHECK_EQUAL(nCapacity, 4);
+    index.AddTx(tx1, 100, {{CScript::P2PKH, addrB, 0, false, 10, COutPoint()},
+                           {CScript::P2PKH, addrB, 1, false, 10, COutPoint()},
+                           {CScript::P2PKH, addrB, 2, false, 10, COutPoint()}});
+    BOOST_CHECK_EQUAL(index.Size(), 4);
+    BOOST_CHECK_EQUAL(index.Capacity(), nCapacity);
+    results.clear();
+    index.GetDeltas(addrB, CScript::P2PKH, results);
+    BOOST_CHECK_EQUAL(results.size(), 3);
+
+    index.RemoveTx(tx1);
+    index.RemoveTx(tx2);
+    BOOST_CHECK_EQUAL(index.Size(), 0);
+    // A drained pool gives its slots back
+    BOOST_CHECK_EQUAL(index.Capacity(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSpentIndexTest)
+{
+    CMempoolSpentIndex index;
+    CMutableTransaction mtx;
+    mtx.vin.push_back(CTxIn(COutPoint(uint256S("33"), 0)));
+    mtx.vin.push_back(CTxIn(COutPoint(uint256S("33"), 1)));
+    CTransaction tx(mtx);
+
+    for (unsigned int j = 0; j < tx.vin.size(); j++) {
+        index.Add(CSpentIndexKey(tx.vin[j].prevout.hash, tx.vin[j].prevout.n),
+                  CSpentIndexValue(tx.GetHash(), j, -1, 10, CScript::P2PKH, uint160()));
+    }
+    BOOST_CHECK_EQUAL(index.Size(), 2);
+
+    CSpentIndexValue value;
+    BOOST_CHECK(index.Get(CSpentIndexKey(uint256S("33"), 1), value));
+    BOOST_CHECK(value.txid == tx.GetHash());
+    BOOST_CHECK_EQUAL(value.inputIndex, 1);
+    BOOST_CHECK(!index.Get(CSpentIndexKey(uint256S("33"), 2), value));
+
+    index.RemoveTx(tx);
+    BOOST_CHECK_EQUAL(index.Size(), 0);
+    BOOST_CHECK(!index.Get(CSpentIndexKey(uint256S("33"), 0), value));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -10,6 +10,9 @@
 #include "pubkey.h"
 #include "uint256.h"
 #include "util.h"
+#ifdef ENABLE_WALLET
+#include "wallet/wallet.h"
+#endif
 //#include "pow/tromp/equi_miner.h"
 
 #include "test/test_bitcoin.h"
@@ -269,12 +272,57 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
 
         // Need to recreate the template each round because of mining slow start
         delete pblocktemplate;
+
+        // The live template follows the new tip
+        BOOST_CHECK(pblocktemplate = liveBlockTemplate.Snapshot(chainparams, scriptPubKey));
+        BOOST_CHECK(pblocktemplate->block.hashPrevBlock == chainActive.Tip()->GetBlockHash());
+        delete pblocktemplate;
     }
 
     // Just to make sure we can still make simple blocks
     BOOST_CHECK(pblocktemplate = CreateNewBlock(chainparams, scriptPubKey));
     delete pblocktemplate;
 
+#ifdef ENABLE_WALLET
+    // A rescan that meets a block no longer in the active chain carries on
+    // from where the active chain forks off; one that meets a block it can't
+    // read stops there. Every coinbase above pays the empty script.
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        BOOST_CHECK(pwalletMain->AddWatchOnly(CScript()));
+    }
+    const int nForkHeight = 10;
+    uint256 hashStale = GetRandHash();
+    CBlockIndex stale;
+    stale.phashBlock = &hashStale;
+    stale.pprev = chainActive[nForkHeight];
+    stale.nHeight = nForkHeight + 1;
+    stale.nTime = chainActive.Tip()->nTime;
+    BOOST_CHECK_EQUAL(pwalletMain->ScanForWalletTransactions(&stale, true), chainActive.Height() - nForkHeight);
+    for (int i = 1; i <= chainActive.Height(); i++) {
+        CBlock block;
+        BOOST_CHECK(ReadBlockFromDisk(block, chainActive[i], chainparams.GetConsensus()));
+        BOOST_CHECK_EQUAL(pwalletMain->mapWallet.count(block.vtx[0].GetHash()) != 0, i > nForkHeight);
+    }
+
+    uint256 hashUnreadable = GetRandHash();
+    CBlockIndex unreadable;
+    unreadable.phashBlock = &hashUnreadable;
+    unreadable.pprev = chainActive.Tip();
+    unreadable.nHeight = chainActive.Height() + 1;
+    unreadable.nTime = chainActive.Tip()->nTime;
+    {
+        LOCK(cs_main);
+        chainActive.SetTip(&unreadable);
+    }
+    BOOST_CHECK_EQUAL(pwalletMain->ScanForWalletTransactions(chainActive[unreadable.nHeight - 3], true), 3);
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        chainActive.SetTip(unreadable.pprev);
+        BOOST_CHECK(pwalletMain->RemoveWatchOnly(CScript()));
+    }
+#endif
+
     // block sigops > limit: 1000 CHECKMULTISIG + 1
     tx.vin.resize(1);
     // NOTE: OP_NOP is used to force 20 SigOps for the CHECKMULTISIG
@@ -382,6 +430,65 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     delete pblocktemplate;
     mempool.clear();
 
+    // live template: appended packages, and a rebuild when one leaves the mempool
+    BOOST_CHECK(pblocktemplate = liveBlockTemplate.Snapshot(chainparams, scriptPubKey));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1);
+    delete pblocktemplate;
+
+    tx.vin[0].prevout.hash = txFirst[0]->GetHash();
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vout[0].nValue = 40000LL;
+    tx.vout[0].scriptPubKey = CScript() << OP_1;
+    CTransaction txParent(tx);
+    mempool.addUnchecked(txParent.GetHash(), entry.Fee(10000).Time(GetTime()).SpendsCoinbase(true).FromTx(tx));
+    BOOST_CHECK(pblocktemplate = liveBlockTemplate.Snapshot(chainparams, scriptPubKey));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2);
+    BOOST_CHECK(pblocktemplate->block.vtx[1].GetHash() == txParent.GetHash());
+    delete pblocktemplate;
+
+    tx.vin[0].prevout.hash = txParent.GetHash();
+    tx.vout[0].nValue = 30000LL;
+    CTransaction txChild(tx);
+    mempool.addUnchecked(txChild.GetHash(), entry.Fee(10000).Time(GetTime()).SpendsCoinbase(false).FromTx(tx));
+    BOOST_CHECK(pblocktemplate = liveBlockTemplate.Snapshot(chainparams, scriptPubKey));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 3);
+    BOOST_CHECK(pblocktemplate->block.vtx[1].GetHash() == txParent.GetHash());
+    BOOST_CHECK(pblocktemplate->block.vtx[2].GetHash() == txChild.GetHash());
+    delete pblocktemplate;
+
+    {
+        std::list<CTransaction> removed;
+        mempool.remove(txParent, removed, true);
+        BOOST_CHECK_EQUAL(removed.size(), 2);
+    }
+    BOOST_CHECK(pblocktemplate = liveBlockTemplate.Snapshot(chainparams, scriptPubKey));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1);
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], 0);
+    delete pblocktemplate;
+
+    // a free transaction is left out, but is weighed again when it comes back prioritised
+    tx.vin[0].prevout.hash = txFirst[0]->GetHash();
+    tx.vout[0].nValue = 50000LL;
+    CTransaction txFree(tx);
+    mempool.addUnchecked(txFree.GetHash(), entry.Fee(0).Time(GetTime()).SpendsCoinbase(true).FromTx(tx));
+    BOOST_CHECK(pblocktemplate = liveBlockTemplate.Snapshot(chainparams, scriptPubKey));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1);
+    delete pblocktemplate;
+    {
+        std::list<CTransaction> removed;
+        mempool.remove(txFree, removed, true);
+        BOOST_CHECK_EQUAL(removed.size(), 1);
+    }
+    mempool.PrioritiseTransaction(txFree.GetHash(), txFree.GetHash().ToString(), 0, 10000);
+    mempool.addUnchecked(txFree.GetHash(), entry.Fee(0).Time(GetTime()).SpendsCoinbase(true).FromTx(tx));
+    BOOST_CHECK(pblocktemplate = liveBlockTemplate.Snapshot(chainparams, scriptPubKey));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2);
+    BOOST_CHECK(pblocktemplate->block.vtx[1].GetHash() == txFree.GetHash());
+    delete pblocktemplate;
+    mempool.ClearPrioritisation(txFree.GetHash());
+    entry.nFee = 11;
+    mempool.clear();
+
     // subsidy changing
     int nHeight = chainActive.Height();
     chainActive.Tip()->nHeight = 209999;
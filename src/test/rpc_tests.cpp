@@ -312,4 +312,18 @@ BOOST_AUTO_TEST_CASE(rpc_getnetworksolps)
     BOOST_CHECK_NO_THROW(CallRPC("getnetworksolps 120 -1"));
 }
 
+BOOST_AUTO_TEST_CASE(rpc_reply_format)
+{
+    UniValue result(UniValue::VARR);
+    result.push_back("a\"b");
+    UniValue inner(UniValue::VOBJ);
+    inner.push_back(Pair("x", 1));
+    result.push_back(inner);
+    UniValue id(UniValue::VNUM, "7");
+
+    BOOST_CHECK_EQUAL(JSONRPCReply(result, NullUniValue, id), JSONRPCReplyObj(result, NullUniValue, id).write() + "\n");
+    UniValue error = JSONRPCError(RPC_MISC_ERROR, "failed");
+    BOOST_CHECK_EQUAL(JSONRPCReply(result, error, id), JSONRPCReplyObj(result, error, id).write() + "\n");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
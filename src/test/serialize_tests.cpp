@@ -418,4 +418,27 @@ BOOST_AUTO_TEST_CASE(class_methods)
     BOOST_CHECK(methodtest3 == methodtest4);
 }
 
+BOOST_AUTO_TEST_CASE(span_reader)
+{
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << 100 << std::string("testing") << (uint8_t)7;
+    std::vector<char> vch(ss.begin(), ss.end());
+
+    CSpanReader reader(SER_DISK, PROTOCOL_VERSION, vch.data(), vch.data() + vch.size());
+    int intval;
+    std::string stringval;
+    reader >> intval >> stringval;
+    BOOST_CHECK_EQUAL(intval, 100);
+    BOOST_CHECK_EQUAL(stringval, "testing");
+    BOOST_CHECK_EQUAL(reader.tell(), vch.size() - 1);
+
+    // Reads past the end throw and leave the position alone
+    uint16_t shortval;
+    BOOST_CHECK_THROW(reader >> shortval, std::ios_base::failure);
+    BOOST_CHECK_EQUAL(reader.size(), 1);
+    reader.ignore(1);
+    BOOST_CHECK(reader.empty());
+    BOOST_CHECK_THROW(reader.ignore(1), std::ios_base::failure);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
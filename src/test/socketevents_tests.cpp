@@ -0,0 +1,110 @@
+// Copyright (c) 2021 The Gemlink developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
+#include "net.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/resource.h>
+#endif
+
+BOOST_FIXTURE_TEST_SUITE(socketevents_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(socketevents_parse)
+{
+    SocketEventsMode mode;
+    BOOST_CHECK(ParseSocketEventsMode("select", mode));
+    BOOST_CHECK_EQUAL(mode, SOCKETEVENTS_SELECT);
+    BOOST_CHECK(ParseSocketEventsMode(DEFAULT_SOCKETEVENTS, mode));
+#ifdef HAVE_SYS_EPOLL_H
+    BOOST_CHECK(ParseSocketEventsMode("epoll", mode));
+    BOOST_CHECK_EQUAL(mode, SOCKETEVENTS_EPOLL);
+#else
+    BOOST_CHECK(!ParseSocketEventsMode("epoll", mode));
+    BOOST_CHECK_EQUAL(mode, SOCKETEVENTS_SELECT);
+#endif
+
+    // Unknown modes are refused, and leave select()
+    BOOST_CHECK(!ParseSocketEventsMode("poll", mode));
+    BOOST_CHECK_EQUAL(mode, SOCKETEVENTS_SELECT);
+    BOOST_CHECK(!ParseSocketEventsMode("EPOLL", mode));
+    BOOST_CHECK_EQUAL(mode, SOCKETEVENTS_SELECT);
+    BOOST_CHECK(!ParseSocketEventsMode("", mode));
+    BOOST_CHECK_EQUAL(mode, SOCKETEVENTS_SELECT);
+}
+
+BOOST_AUTO_TEST_CASE(socketevents_init_falls_back_to_select)
+{
+    BOOST_CHECK_EQUAL(InitSocketEvents("poll"), SOCKETEVENTS_SELECT);
+    BOOST_CHECK_EQUAL(InitSocketEvents("select"), SOCKETEVENTS_SELECT);
+#ifdef HAVE_SYS_EPOLL_H
+    BOOST_CHECK_EQUAL(InitSocketEvents("epoll"), SOCKETEVENTS_EPOLL);
+
+    // With no descriptors left, epoll can't be set up
+    struct rlimit limit;
+    BOOST_REQUIRE(getrlimit(RLIMIT_NOFILE, &limit) == 0);
+    struct rlimit noFiles = limit;
+    noFiles.rlim_cur = 0;
+    BOOST_REQUIRE(setrlimit(RLIMIT_NOFILE, &noFiles) == 0);
+    SocketEventsMode mode = InitSocketEvents("epoll");
+    BOOST_REQUIRE(setrlimit(RLIMIT_NOFILE, &limit) == 0);
+    BOOST_CHECK_EQUAL(mode, SOCKETEVENTS_SELECT);
+#endif
+    BOOST_CHECK_EQUAL(InitSocketEvents("select"), SOCKETEVENTS_SELECT);
+}
+
+#ifndef WIN32
+BOOST_AUTO_TEST_CASE(socketevents_select_wait)
+{
+    BOOST_REQUIRE_EQUAL(InitSocketEvents("select"), SOCKETEVENTS_SELECT);
+
+    int fds[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    CNode* pnode = new CNode(fds[0], CAddress(), "", true);
+    {
+        LOCK(cs_vNodes);
+        vNodes.push_back(pnode);
+    }
+
+    // Nothing to receive yet, and nothing to send
+    std::set<SOCKET> recv_set, send_set, error_set;
+    WaitSocketEvents(recv_set, send_set, error_set);
+    BOOST_CHECK(!recv_set.count(fds[0]));
+    BOOST_CHECK(!send_set.count(fds[0]));
+
+    char c = 0;
+    BOOST_REQUIRE(send(fds[1], &c, 1, 0) == 1);
+    recv_set.clear();
+    WaitSocketEvents(recv_set, send_set, error_set);
+    BOOST_CHECK(recv_set.count(fds[0]));
+    BOOST_CHECK(!send_set.count(fds[0]));
+
+    // With data queued, it waits to send before receiving more
+    {
+        LOCK(pnode->cs_vSend);
+        pnode->vSendMsg.push_back(CSerializeData(1));
+    }
+    recv_set.clear();
+    WaitSocketEvents(recv_set, send_set, error_set);
+    BOOST_CHECK(!recv_set.count(fds[0]));
+    BOOST_CHECK(send_set.count(fds[0]));
+    BOOST_CHECK(error_set.empty());
+
+    {
+        LOCK(cs_vNodes);
+        vNodes.erase(std::remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+    }
+    delete pnode;
+    close(fds[1]);
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
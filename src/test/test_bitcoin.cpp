@@ -6,7 +6,9 @@
 
 #include "test_bitcoin.h"
 
+#include "chainparams.h"
 #include "crypto/common.h"
+#include "hash.h"
 #include "key.h"
 #include "main.h"
 #include "random.h"
@@ -134,6 +136,44 @@ TestingSetup::~TestingSetup()
 }
 
 
+TestPeer::TestPeer() : node(INVALID_SOCKET, CAddress(), "", true)
+{
+    node.nVersion = PROTOCOL_VERSION;
+    // With a message already queued, EndMessage never tries to write to the
+    // missing socket, which would disconnect the node mid-message.
+    node.vSendMsg.push_back(CSerializeData(1));
+}
+
+void TestPeer::Receive(const std::string& strCommand, const CDataStream& ssPayload)
+{
+    CMessageHeader hdr(Params().MessageStart(), strCommand.c_str(), ssPayload.size());
+    uint256 hash = Hash(ssPayload.begin(), ssPayload.end());
+    hdr.nChecksum = ReadLE32(hash.begin());
+    CDataStream ssMessage(SER_NETWORK, PROTOCOL_VERSION);
+    ssMessage << hdr;
+    ssMessage.write(ssPayload.data(), ssPayload.size());
+
+    LOCK(node.cs_vRecvMsg);
+    node.ReceiveMsgBytes(&ssMessage[0], ssMessage.size());
+    ProcessMessages(Params(), &node);
+}
+
+std::vector<std::pair<std::string, CDataStream> > TestPeer::TakeSent()
+{
+    std::vector<std::pair<std::string, CDataStream> > vMessages;
+    LOCK(node.cs_vSend);
+    while (node.vSendMsg.size() > 1) {
+        const CSerializeData& data = node.vSendMsg[1];
+        CDataStream ss(data.begin(), data.end(), SER_NETWORK, PROTOCOL_VERSION);
+        CMessageHeader hdr(Params().MessageStart());
+        ss >> hdr;
+        vMessages.push_back(std::make_pair(hdr.GetCommand(), ss));
+        node.nSendSize -= data.size();
+        node.vSendMsg.erase(node.vSendMsg.begin() + 1);
+    }
+    return vMessages;
+}
+
 CTxMemPoolEntry TestMemPoolEntryHelper::FromTx(CMutableTransaction& tx, CTxMemPool* pool)
 {
     return CTxMemPoolEntry(tx, nFee, nTime, dPriority, nHeight,
@@ -3,7 +3,9 @@
 
 #include "consensus/upgrades.h"
 #include "fs.h"
+#include "net.h"
 #include "pubkey.h"
+#include "streams.h"
 #include "txdb.h"
 
 #include <boost/filesystem.hpp>
@@ -39,6 +41,18 @@ struct TestingSetup : public JoinSplitTestingSetup {
     ~TestingSetup();
 };
 
+/** A peer whose messages are handed straight to ProcessMessages. What the
+ * node sends back stays queued in vSendMsg, where TakeSent() finds it.
+ */
+struct TestPeer {
+    CNode node;
+
+    TestPeer();
+    void Receive(const std::string& strCommand, const CDataStream& ssPayload);
+    //! The queued replies as (command, payload), oldest first
+    std::vector<std::pair<std::string, CDataStream> > TakeSent();
+};
+
 class CTxMemPoolEntry;
 class CTxMemPool;
 
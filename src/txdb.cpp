@@ -12,6 +12,7 @@
 #include "uint256.h"
 
 #include <stdint.h>
+#include <thread>
 
 #include <boost/thread.hpp>
 
@@ -42,6 +43,7 @@ static const char DB_MMR_ROOT = 'r';
 // insightexplorer
 static const char DB_ADDRESSINDEX = 'd';
 static const char DB_ADDRESSUNSPENTINDEX = 'u';
+static const char DB_ADDRESSBALANCEINDEX = 'y';
 static const char DB_SPENTINDEX = 'p';
 static const char DB_TIMESTAMPINDEX = 'T';
 static const char DB_BLOCKHASHINDEX = 'h';
@@ -166,9 +168,9 @@ uint256 CCoinsViewDB::GetHistoryRoot(uint32_t epochId) const {
     return root;
 }
 
-void BatchWriteNullifiers(CDBBatch& batch, CNullifiersMap& mapToUse, const char& dbChar)
+void BatchWriteNullifiers(CDBBatch& batch, const CNullifiersMap& mapToUse, const char& dbChar)
 {
-    for (CNullifiersMap::iterator it = mapToUse.begin(); it != mapToUse.end();) {
+    for (CNullifiersMap::const_iterator it = mapToUse.begin(); it != mapToUse.end(); it++) {
         if (it->second.flags & CNullifiersCacheEntry::DIRTY) {
             if (!it->second.entered)
                 batch.Erase(make_pair(dbChar, it->first));
@@ -176,14 +178,13 @@ void BatchWriteNullifiers(CDBBatch& batch, CNullifiersMap& mapToUse, const char&
                 batch.Write(make_pair(dbChar, it->first), true);
             // TODO: changed++? ... See comment in CCoinsViewDB::BatchWrite. If this is needed we could return an int
         }
-        it = mapToUse.erase(it);
     }
 }
 
 template<typename Map, typename MapIterator, typename MapEntry, typename Tree>
-void BatchWriteAnchors(CDBBatch& batch, Map& mapToUse, const char& dbChar)
+void BatchWriteAnchors(CDBBatch& batch, const Map& mapToUse, const char& dbChar)
 {
-    for (MapIterator it = mapToUse.begin(); it != mapToUse.end();) {
+    for (MapIterator it = mapToUse.begin(); it != mapToUse.end(); it++) {
         if (it->second.flags & MapEntry::DIRTY) {
             if (!it->second.entered)
                 batch.Erase(make_pair(dbChar, it->first));
@@ -194,13 +195,12 @@ void BatchWriteAnchors(CDBBatch& batch, Map& mapToUse, const char& dbChar)
             }
             // TODO: changed++?
         }
-        it = mapToUse.erase(it);
     }
 }
 
-void BatchWriteHistory(CDBBatch& batch, CHistoryCacheMap& historyCacheMap) {
+void BatchWriteHistory(CDBBatch& batch, const CHistoryCacheMap& historyCacheMap) {
     for (auto nextHistoryCache = historyCacheMap.begin(); nextHistoryCache != historyCacheMap.end(); nextHistoryCache++) {
-        auto historyCache = nextHistoryCache->second;
+        const auto& historyCache = nextHistoryCache->second;
         auto epochId = nextHistoryCache->first;
 
         // delete old entries since updateDepth
@@ -233,10 +233,30 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins,
                               CNullifiersMap &mapSproutNullifiers,
                               CNullifiersMap &mapSaplingNullifiers,
                               CHistoryCacheMap &historyCacheMap) {
+    bool ret = WriteCoins(mapCoins, hashBlock, hashSproutAnchor, hashSaplingAnchor,
+                          mapSproutAnchors, mapSaplingAnchors, mapSproutNullifiers, mapSaplingNullifiers,
+                          historyCacheMap);
+    mapCoins.clear();
+    mapSproutAnchors.clear();
+    mapSaplingAnchors.clear();
+    mapSproutNullifiers.clear();
+    mapSaplingNullifiers.clear();
+    return ret;
+}
+
+bool CCoinsViewDB::WriteCoins(const CCoinsMap &mapCoins,
+                              const uint256 &hashBlock,
+                              const uint256 &hashSproutAnchor,
+                              const uint256 &hashSaplingAnchor,
+                              const CAnchorsSproutMap &mapSproutAnchors,
+                              const CAnchorsSaplingMap &mapSaplingAnchors,
+                              const CNullifiersMap &mapSproutNullifiers,
+                              const CNullifiersMap &mapSaplingNullifiers,
+                              const CHistoryCacheMap &historyCacheMap) {
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
             if (it->second.coins.IsPruned())
                 batch.Erase(make_pair(DB_COINS, it->first));
@@ -245,11 +265,10 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins,
             changed++;
         }
         count++;
-        it = mapCoins.erase(it);
     }
 
-    ::BatchWriteAnchors<CAnchorsSproutMap, CAnchorsSproutMap::iterator, CAnchorsSproutCacheEntry, SproutMerkleTree>(batch, mapSproutAnchors, DB_SPROUT_ANCHOR);
-    ::BatchWriteAnchors<CAnchorsSaplingMap, CAnchorsSaplingMap::iterator, CAnchorsSaplingCacheEntry, SaplingMerkleTree>(batch, mapSaplingAnchors, DB_SAPLING_ANCHOR);
+    ::BatchWriteAnchors<CAnchorsSproutMap, CAnchorsSproutMap::const_iterator, CAnchorsSproutCacheEntry, SproutMerkleTree>(batch, mapSproutAnchors, DB_SPROUT_ANCHOR);
+    ::BatchWriteAnchors<CAnchorsSaplingMap, CAnchorsSaplingMap::const_iterator, CAnchorsSaplingCacheEntry, SaplingMerkleTree>(batch, mapSaplingAnchors, DB_SAPLING_ANCHOR);
 
     ::BatchWriteNullifiers(batch, mapSproutNullifiers, DB_NULLIFIER);
     ::BatchWriteNullifiers(batch, mapSaplingNullifiers, DB_SAPLING_NULLIFIER);
@@ -267,6 +286,286 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins,
     return db.WriteBatch(batch);
 }
 
+CCoinsViewWriteBehind::CCoinsViewWriteBehind(CCoinsView *baseIn, CCoinsViewDB *dbIn) :
+    CCoinsViewBacked(baseIn), db(dbIn), nPendingUsage(0), fFailed(false), fStop(false)
+{
+    writer = std::thread(&CCoinsViewWriteBehind::ThreadWrite, this);
+}
+
+CCoinsViewWriteBehind::~CCoinsViewWriteBehind()
+{
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        fStop = true;
+    }
+    cond.notify_all();
+    writer.join();
+}
+
+void CCoinsViewWriteBehind::ThreadWrite()
+{
+    RenameThread("gemlink-coinswrite");
+    std::unique_lock<std::mutex> lock(cs);
+    while (true) {
+        cond.wait(lock, [this] { return fStop || (pending && !fFailed); });
+        if (!pending || fFailed)
+            return;
+
+        const Batch& batch = *pending;
+        lock.unlock();
+        bool fOk = false;
+        try {
+            int64_t nStart = GetTimeMicros();
+            fOk = db->WriteCoins(batch.mapCoins, batch.hashBlock, batch.hashSproutAnchor, batch.hashSaplingAnchor,
+                                 batch.mapSproutAnchors, batch.mapSaplingAnchors,
+                                 batch.mapSproutNullifiers, batch.mapSaplingNullifiers,
+                                 batch.historyCacheMap);
+            LogPrint("coindb", "Wrote coin database batch for %s in %.2fms\n",
+                     batch.hashBlock.ToString(), (GetTimeMicros() - nStart) * 0.001);
+        } catch (const std::exception& e) {
+            LogPrintf("%s: %s\n", __func__, e.what());
+        }
+        lock.lock();
+
+        if (fOk) {
+            pending.reset();
+            nPendingUsage = 0;
+        } else {
+            LogPrintf("%s: failed to write to coin database\n", __func__);
+            fFailed = true;
+        }
+        cond.notify_all();
+    }
+}
+
+bool CCoinsViewWriteBehind::Sync() const
+{
+    std::unique_lock<std::mutex> lock(cs);
+    cond.wait(lock, [this] { return !pending || fFailed; });
+    return !fFailed;
+}
+
+size_t CCoinsViewWriteBehind::PendingUsage() const
+{
+    std::lock_guard<std::mutex> lock(cs);
+    return nPendingUsage;
+}
+
+/** Same accounting as CCoinsViewCache::DynamicMemoryUsage(). */
+template<typename Batch>
+static size_t BatchUsage(const Batch& batch)
+{
+    size_t usage = memusage::DynamicUsage(batch.mapCoins) +
+                   memusage::DynamicUsage(batch.mapSproutAnchors) +
+                   memusage::DynamicUsage(batch.mapSaplingAnchors) +
+                   memusage::DynamicUsage(batch.mapSproutNullifiers) +
+                   memusage::DynamicUsage(batch.mapSaplingNullifiers) +
+                   memusage::DynamicUsage(batch.historyCacheMap);
+    for (const auto& entry : batch.mapCoins)
+        usage += entry.second.coins.DynamicMemoryUsage();
+    for (const auto& entry : batch.mapSproutAnchors)
+        usage += entry.second.tree.DynamicMemoryUsage();
+    for (const auto& entry : batch.mapSaplingAnchors)
+        usage += entry.second.tree.DynamicMemoryUsage();
+    return usage;
+}
+
+bool CCoinsViewWriteBehind::BatchWrite(CCoinsMap &mapCoins,
+                                       const uint256 &hashBlock,
+                                       const uint256 &hashSproutAnchor,
+                                       const uint256 &hashSaplingAnchor,
+                                       CAnchorsSproutMap &mapSproutAnchors,
+                                       CAnchorsSaplingMap &mapSaplingAnchors,
+                                       CNullifiersMap &mapSproutNullifiers,
+                                       CNullifiersMap &mapSaplingNullifiers,
+                                       CHistoryCacheMap &historyCacheMap) {
+    std::unique_ptr<Batch> batch(new Batch());
+    batch->mapCoins.swap(mapCoins);
+    batch->hashBlock = hashBlock;
+    batch->hashSproutAnchor = hashSproutAnchor;
+    batch->hashSaplingAnchor = hashSaplingAnchor;
+    batch->mapSproutAnchors.swap(mapSproutAnchors);
+    batch->mapSaplingAnchors.swap(mapSaplingAnchors);
+    batch->mapSproutNullifiers.swap(mapSproutNullifiers);
+    batch->mapSaplingNullifiers.swap(mapSaplingNullifiers);
+    batch->historyCacheMap.swap(historyCacheMap);
+    size_t nUsage = BatchUsage(*batch);
+
+    std::unique_lock<std::mutex> lock(cs);
+    cond.wait(lock, [this] { return !pending || fFailed; });
+    if (fFailed)
+        return false;
+    pending = std::move(batch);
+    nPendingUsage = nUsage;
+    cond.notify_all();
+    return true;
+}
+
+bool CCoinsViewWriteBehind::GetCoins(const uint256 &txid, CCoins &coins) const {
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        if (pending) {
+            CCoinsMap::const_iterator it = pending->mapCoins.find(txid);
+            if (it != pending->mapCoins.end()) {
+                // Pruned entries are erased from the database
+                if (it->second.coins.IsPruned())
+                    return false;
+                coins = it->second.coins;
+                return true;
+            }
+        }
+    }
+    return base->GetCoins(txid, coins);
+}
+
+bool CCoinsViewWriteBehind::HaveCoins(const uint256 &txid) const {
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        if (pending) {
+            CCoinsMap::const_iterator it = pending->mapCoins.find(txid);
+            if (it != pending->mapCoins.end())
+                return !it->second.coins.IsPruned();
+        }
+    }
+    return base->HaveCoins(txid);
+}
+
+template<typename Map, typename Tree>
+static bool GetPendingAnchorAt(const Map& map, const uint256 &rt, Tree &tree, bool &fFound)
+{
+    typename Map::const_iterator it = map.find(rt);
+    // The empty root is never written, leave it to the database
+    fFound = it != map.end() && rt != Tree::empty_root();
+    if (fFound && it->second.entered)
+        tree = it->second.tree;
+    return fFound && it->second.entered;
+}
+
+bool CCoinsViewWriteBehind::GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const {
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        bool fFound = false;
+        if (pending) {
+            bool ret = GetPendingAnchorAt(pending->mapSproutAnchors, rt, tree, fFound);
+            if (fFound)
+                return ret;
+        }
+    }
+    return base->GetSproutAnchorAt(rt, tree);
+}
+
+bool CCoinsViewWriteBehind::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const {
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        bool fFound = false;
+        if (pending) {
+            bool ret = GetPendingAnchorAt(pending->mapSaplingAnchors, rt, tree, fFound);
+            if (fFound)
+                return ret;
+        }
+    }
+    return base->GetSaplingAnchorAt(rt, tree);
+}
+
+bool CCoinsViewWriteBehind::GetNullifier(const uint256 &nullifier, ShieldedType type) const {
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        if (pending) {
+            const CNullifiersMap* mapToUse;
+            switch (type) {
+                case SPROUT:
+                    mapToUse = &pending->mapSproutNullifiers;
+                    break;
+                case SAPLING:
+                    mapToUse = &pending->mapSaplingNullifiers;
+                    break;
+                default:
+                    throw std::runtime_error("Unknown shielded type");
+            }
+            CNullifiersMap::const_iterator it = mapToUse->find(nullifier);
+            if (it != mapToUse->end())
+                return it->second.entered;
+        }
+    }
+    return base->GetNullifier(nullifier, type);
+}
+
+uint256 CCoinsViewWriteBehind::GetBestBlock() const {
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        if (pending && !pending->hashBlock.IsNull())
+            return pending->hashBlock;
+    }
+    return base->GetBestBlock();
+}
+
+uint256 CCoinsViewWriteBehind::GetBestAnchor(ShieldedType type) const {
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        if (pending) {
+            switch (type) {
+                case SPROUT:
+                    if (!pending->hashSproutAnchor.IsNull())
+                        return pending->hashSproutAnchor;
+                    break;
+                case SAPLING:
+                    if (!pending->hashSaplingAnchor.IsNull())
+                        return pending->hashSaplingAnchor;
+                    break;
+                default:
+                    throw std::runtime_error("Unknown shielded type");
+            }
+        }
+    }
+    return base->GetBestAnchor(type);
+}
+
+HistoryIndex CCoinsViewWriteBehind::GetHistoryLength(uint32_t epochId) const {
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        if (pending) {
+            auto it = pending->historyCacheMap.find(epochId);
+            if (it != pending->historyCacheMap.end())
+                return it->second.length;
+        }
+    }
+    return base->GetHistoryLength(epochId);
+}
+
+HistoryNode CCoinsViewWriteBehind::GetHistoryAt(uint32_t epochId, HistoryIndex index) const {
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        if (pending) {
+            auto it = pending->historyCacheMap.find(epochId);
+            if (it != pending->historyCacheMap.end() && index >= it->second.updateDepth) {
+                auto node = it->second.appends.find(index);
+                if (node != it->second.appends.end())
+                    return node->second;
+            }
+        }
+    }
+    return base->GetHistoryAt(epochId, index);
+}
+
+uint256 CCoinsViewWriteBehind::GetHistoryRoot(uint32_t epochId) const {
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        if (pending) {
+            auto it = pending->historyCacheMap.find(epochId);
+            if (it != pending->historyCacheMap.end())
+                return it->second.root;
+        }
+    }
+    return base->GetHistoryRoot(epochId);
+}
+
+bool CCoinsViewWriteBehind::GetStats(CCoinsStats &stats) const {
+    // The statistics come from a scan of the database itself
+    if (!Sync())
+        return false;
+    return base->GetStats(stats);
+}
+
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
 }
 
@@ -290,49 +589,77 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
     return Read(DB_LAST_BLOCK, nFile);
 }
 
-bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
-    /* It seems that there are no "const iterators" for LevelDB.  Since we
-       only need read operations on it, use a const-cast to get around
-       that restriction.  */
-    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
-    pcursor->Seek(DB_COINS);
-
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = GetBestBlock();
-    ss << stats.hashBlock;
-    CAmount nTotalAmount = 0;
+/**
+ * Add up the coins whose txid starts with a byte in [nBegin, nEnd). The
+ * key space is sorted by the txid bytes, so each range is one seek and a
+ * contiguous scan.
+ */
+static bool GetStatsRange(const CDBSnapshot &snapshot, unsigned int nBegin, unsigned int nEnd, CCoinsStats &stats)
+{
+    boost::scoped_ptr<CDBIterator> pcursor(snapshot.NewIterator());
+    uint256 start;
+    *start.begin() = nBegin;
+    pcursor->Seek(make_pair(DB_COINS, start));
+
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
         std::pair<char, uint256> key;
         CCoins coins;
-        if (pcursor->GetKey(key) && key.first == DB_COINS) {
-            if (pcursor->GetValue(coins)) {
-                stats.nTransactions++;
-                for (unsigned int i=0; i<coins.vout.size(); i++) {
-                    const CTxOut &out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i+1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
-                    }
-                }
-                stats.nSerializedSize += 32 + pcursor->GetValueSize();
-                ss << VARINT(0);
-            } else {
-                return error("CCoinsViewDB::GetStats() : unable to read value");
-            }
-        } else {
+        if (!(pcursor->GetKey(key) && key.first == DB_COINS && *key.second.begin() < nEnd))
             break;
-        }
+        if (!pcursor->GetValue(coins))
+            return error("CCoinsViewDB::GetStats() : unable to read value");
+        stats.AddCoins(key.second, coins);
         pcursor->Next();
     }
+    return true;
+}
+
+bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
+    // The scan sees the database as of this snapshot, whatever is written
+    // to it meanwhile
+    CDBSnapshot snapshot(db);
+    if (!snapshot.Read(DB_BEST_BLOCK, stats.hashBlock))
+        stats.hashBlock.SetNull();
+
+    // Split the txid space into ranges scanned by their own thread. The
+    // workers stop at their next record when the caller is interrupted.
+    const unsigned int nRanges = std::max(1, std::min(GetNumCores(), MAX_COINS_STATS_THREADS));
+    std::vector<CCoinsStats> vRangeStats(nRanges);
+    std::vector<char> vRangeOk(nRanges, false);
+    boost::thread_group threads;
+    try {
+        for (unsigned int i = 0; i < nRanges; i++) {
+            threads.create_thread([&snapshot, i, nRanges, &vRangeStats, &vRangeOk]() {
+                try {
+                    vRangeOk[i] = GetStatsRange(snapshot, 256 * i / nRanges, 256 * (i + 1) / nRanges, vRangeStats[i]);
+                } catch (const std::exception& e) {
+                    LogPrintf("CCoinsViewDB::GetStats(): %s\n", e.what());
+                }
+            });
+        }
+        threads.join_all();
+    } catch (const boost::thread_resource_error& e) {
+        threads.interrupt_all();
+        threads.join_all();
+        return error("CCoinsViewDB::GetStats(): %s", e.what());
+    } catch (...) {
+        threads.interrupt_all();
+        threads.join_all();
+        throw;
+    }
+    for (unsigned int i = 0; i < nRanges; i++) {
+        if (!vRangeOk[i])
+            return false;
+        stats.Merge(vRangeStats[i]);
+    }
+    boost::this_thread::interruption_point();
+
     {
         LOCK(cs_main);
         stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
     }
-    stats.hashSerialized = ss.GetHash();
-    stats.nTotalAmount = nTotalAmount;
+    stats.hashSerialized = stats.setHash.GetHash();
     return true;
 }
 
@@ -343,11 +670,18 @@ bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockF
     }
     batch.Write(DB_LAST_BLOCK, nLastFile);
     for (std::vector<const CBlockIndex*>::const_iterator it=blockinfo.begin(); it != blockinfo.end(); it++) {
-        batch.Write(make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()), CDiskBlockIndex(*it));
+        CDiskBlockIndex diskindex(*it);
+        if (!diskindex.HasSolution())
+            return error("%s: no Equihash solution to write for %s", __func__, (*it)->GetBlockHash().ToString());
+        batch.Write(make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()), diskindex);
     }
     return WriteBatch(batch, true);
 }
 
+bool CBlockTreeDB::ReadDiskBlockIndex(const uint256 &blockhash, CDiskBlockIndex &dbindex) {
+    return Read(make_pair(DB_BLOCK_INDEX, blockhash), dbindex);
+}
+
 bool CBlockTreeDB::EraseBatchSync(const std::vector<const CBlockIndex*>& blockinfo) {
     CDBBatch batch(*this);
     for (std::vector<const CBlockIndex*>::const_iterator it=blockinfo.begin(); it != blockinfo.end(); it++) {
@@ -402,8 +736,58 @@ bool CBlockTreeDB::ReadAddressUnspentIndex(uint160 addressHash, int type, std::v
     return true;
 }
 
+typedef std::map<std::pair<unsigned int, uint160>, CAddressBalanceValue> CAddressBalanceMap;
+
+/**
+ * Adds the deltas of the address index entries to the balance totals of
+ * their addresses (subtracts them when fErase). Only entries whose presence
+ * in the index actually changes are counted, so that replaying a block
+ * whose index entries were already written leaves the totals unchanged.
+ */
+static void AccumulateAddressBalances(
+    const CDBWrapper &db, const std::vector<CAddressIndexDbEntry> &vect,
+    bool fErase, CAddressBalanceMap &balances)
+{
+    for (std::vector<CAddressIndexDbEntry>::const_iterator it=vect.begin(); it!=vect.end(); it++) {
+        if (db.Exists(make_pair(DB_ADDRESSINDEX, it->first)) != fErase)
+            continue;
+        CAddressBalanceValue &value = balances[make_pair(it->first.type, it->first.hashBytes)];
+        if (fErase) {
+            value.balance -= it->second;
+            if (it->second > 0)
+                value.received -= it->second;
+        } else {
+            value.balance += it->second;
+            if (it->second > 0)
+                value.received += it->second;
+        }
+    }
+}
+
+static void WriteAddressBalances(
+    const CDBWrapper &db, CDBBatch &batch, const CAddressBalanceMap &deltas)
+{
+    for (CAddressBalanceMap::const_iterator it=deltas.begin(); it!=deltas.end(); it++) {
+        if (it->second.IsNull())
+            continue;
+        CAddressIndexIteratorKey key(it->first.first, it->first.second);
+        CAddressBalanceValue value;
+        db.Read(make_pair(DB_ADDRESSBALANCEINDEX, key), value);
+        value.balance += it->second.balance;
+        value.received += it->second.received;
+        if (value.IsNull()) {
+            batch.Erase(make_pair(DB_ADDRESSBALANCEINDEX, key));
+        } else {
+            batch.Write(make_pair(DB_ADDRESSBALANCEINDEX, key), value);
+        }
+    }
+}
+
 bool CBlockTreeDB::WriteAddressIndex(const std::vector<CAddressIndexDbEntry> &vect) {
     CDBBatch batch(*this);
+    CAddressBalanceMap balances;
+    AccumulateAddressBalances(*this, vect, false, balances);
+    WriteAddressBalances(*this, batch, balances);
     for (std::vector<CAddressIndexDbEntry>::const_iterator it=vect.begin(); it!=vect.end(); it++)
         batch.Write(make_pair(DB_ADDRESSINDEX, it->first), it->second);
     return WriteBatch(batch);
@@ -411,35 +795,103 @@ bool CBlockTreeDB::WriteAddressIndex(const std::vector<CAddressIndexDbEntry> &ve
 
 bool CBlockTreeDB::EraseAddressIndex(const std::vector<CAddressIndexDbEntry> &vect) {
     CDBBatch batch(*this);
+    CAddressBalanceMap balances;
+    AccumulateAddressBalances(*this, vect, true, balances);
+    WriteAddressBalances(*this, batch, balances);
     for (std::vector<CAddressIndexDbEntry>::const_iterator it=vect.begin(); it!=vect.end(); it++)
         batch.Erase(make_pair(DB_ADDRESSINDEX, it->first));
     return WriteBatch(batch);
 }
 
+bool CBlockTreeDB::ReadAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &value)
+{
+    // An address without a total has never been seen, which is a zero balance
+    if (!Read(make_pair(DB_ADDRESSBALANCEINDEX, CAddressIndexIteratorKey(type, addressHash)), value))
+        value.SetNull();
+    return true;
+}
+
+bool CBlockTreeDB::BuildAddressBalanceIndex()
+{
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    CDBBatch batch(*this);
+
+    // The address index is sorted by (type, hash), so each address's
+    // entries are contiguous and can be summed in a single pass.
+    pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorKey()));
+
+    size_t nPending = 0;
+    bool fHaveAddress = false;
+    CAddressIndexIteratorKey address;
+    CAddressBalanceValue value;
+    while (true) {
+        boost::this_thread::interruption_point();
+        std::pair<char,CAddressIndexKey> key;
+        bool fValid = pcursor->Valid() && pcursor->GetKey(key) && key.first == DB_ADDRESSINDEX;
+        if (fHaveAddress && (!fValid || key.second.type != address.type || key.second.hashBytes != address.hashBytes)) {
+            if (!value.IsNull()) {
+                batch.Write(make_pair(DB_ADDRESSBALANCEINDEX, address), value);
+                if (++nPending >= 10000) {
+                    if (!WriteBatch(batch))
+                        return false;
+                    batch.Clear();
+                    nPending = 0;
+                }
+            }
+            fHaveAddress = false;
+        }
+        if (!fValid)
+            break;
+        if (!fHaveAddress) {
+            address = CAddressIndexIteratorKey(key.second.type, key.second.hashBytes);
+            value.SetNull();
+            fHaveAddress = true;
+        }
+        CAmount nValue;
+        if (!pcursor->GetValue(nValue))
+            return error("failed to get address index value");
+        value.balance += nValue;
+        if (nValue > 0)
+            value.received += nValue;
+        pcursor->Next();
+    }
+    return WriteBatch(batch);
+}
+
 bool CBlockTreeDB::ReadAddressIndex(
         uint160 addressHash, int type,
         std::vector<CAddressIndexDbEntry> &addressIndex,
-        int start, int end)
+        int start, int end,
+        const CAddressIndexKey *pAfter, size_t nLimit)
 {
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
-    if (start > 0 && end > 0) {
+    if (pAfter) {
+        // Resume just past the last entry of the previous page
+        pcursor->Seek(make_pair(DB_ADDRESSINDEX, *pAfter));
+    } else if (start > 0 && end > 0) {
         pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorHeightKey(type, addressHash, start)));
     } else {
         pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorKey(type, addressHash)));
     }
 
-    while (pcursor->Valid()) {
+    size_t nRead = 0;
+    while (pcursor->Valid() && (nLimit == 0 || nRead < nLimit)) {
         boost::this_thread::interruption_point();
         std::pair<char,CAddressIndexKey> key;
         if (!(pcursor->GetKey(key) && key.first == DB_ADDRESSINDEX && key.second.hashBytes == addressHash))
             break;
         if (end > 0 && key.second.blockHeight > end)
             break;
+        if ((pAfter && key.second == *pAfter) || (start > 0 && key.second.blockHeight < start)) {
+            pcursor->Next();
+            continue;
+        }
         CAmount nValue;
         if (!pcursor->GetValue(nValue))
             return error("failed to get address index value");
         addressIndex.push_back(make_pair(key.second, nValue));
+        nRead++;
         pcursor->Next();
     }
     return true;
@@ -539,8 +991,15 @@ bool CBlockTreeDB::LoadBlockIndexGuts(
         if (pcursor->GetKey(key) && key.first == DB_BLOCK_INDEX) {
             CDiskBlockIndex diskindex;
             if (pcursor->GetValue(diskindex)) {
-                // Construct block index object
-                CBlockIndex* pindexNew = insertBlockIndex(diskindex.GetBlockHash());
+                // Consistency checks
+                uint256 hash = diskindex.GetBlockHash();
+                if (hash != key.second)
+                    return error("LoadBlockIndex(): block header inconsistency detected: on-disk = %s, key = %s",
+                       diskindex.ToString(), key.second.ToString());
+
+                // Construct block index object. The Equihash solution is
+                // left on disk, see CBlockIndex::GetSolution().
+                CBlockIndex* pindexNew = insertBlockIndex(hash);
                 pindexNew->pprev          = insertBlockIndex(diskindex.hashPrev);
                 pindexNew->nHeight        = diskindex.nHeight;
                 pindexNew->nFile          = diskindex.nFile;
@@ -553,18 +1012,13 @@ bool CBlockTreeDB::LoadBlockIndexGuts(
                 pindexNew->nTime          = diskindex.nTime;
                 pindexNew->nBits          = diskindex.nBits;
                 pindexNew->nNonce         = diskindex.nNonce;
-                pindexNew->nSolution      = diskindex.nSolution;
                 pindexNew->nStatus        = diskindex.nStatus;
                 pindexNew->nCachedBranchId = diskindex.nCachedBranchId;
                 pindexNew->nTx            = diskindex.nTx;
                 pindexNew->nSproutValue   = diskindex.nSproutValue;
                 pindexNew->nSaplingValue  = diskindex.nSaplingValue;
+                pindexNew->TrimSolution();
 
-                // Consistency checks
-                auto header = pindexNew->GetBlockHeader();
-                if (header.GetHash() != pindexNew->GetBlockHash())
-                    return error("LoadBlockIndex(): block header inconsistency detected: on-disk = %s, in-memory = %s",
-                       diskindex.ToString(),  pindexNew->ToString());
                 if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits, Params().GetConsensus()))
                     return error("LoadBlockIndex(): CheckProofOfWork failed: %s", pindexNew->ToString());
 
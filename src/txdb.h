@@ -10,8 +10,12 @@
 #include "dbwrapper.h"
 #include "chain.h"
 
+#include <condition_variable>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -26,6 +30,7 @@ struct CAddressUnspentValue;
 struct CAddressIndexKey;
 struct CAddressIndexIteratorKey;
 struct CAddressIndexIteratorHeightKey;
+struct CAddressBalanceValue;
 struct CSpentIndexKey;
 struct CSpentIndexValue;
 struct CTimestampIndexKey;
@@ -46,6 +51,8 @@ static const int64_t nDefaultDbCache = 450;
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
+//! Maximum number of threads scanning the coin database for its statistics
+static const int MAX_COINS_STATS_THREADS = 16;
 
 struct CDiskTxPos : public CDiskBlockPos
 {
@@ -101,6 +108,94 @@ public:
                     CNullifiersMap &mapSaplingNullifiers,
                     CHistoryCacheMap &historyCacheMap);
     bool GetStats(CCoinsStats &stats) const;
+
+    //! Write the contents of a flushed cache, leaving the maps untouched
+    bool WriteCoins(const CCoinsMap &mapCoins,
+                    const uint256 &hashBlock,
+                    const uint256 &hashSproutAnchor,
+                    const uint256 &hashSaplingAnchor,
+                    const CAnchorsSproutMap &mapSproutAnchors,
+                    const CAnchorsSaplingMap &mapSaplingAnchors,
+                    const CNullifiersMap &mapSproutNullifiers,
+                    const CNullifiersMap &mapSaplingNullifiers,
+                    const CHistoryCacheMap &historyCacheMap);
+};
+
+/**
+ * Coins view layer that hands the contents of a flushed cache to a
+ * background thread for writing to the coin database, and serves reads from
+ * them until they are written. The best block is written in the same
+ * database batch as the coins, so the database is always at some flushed
+ * block. Only one batch is in flight: a flush while the previous one is
+ * still being written waits for it.
+ */
+class CCoinsViewWriteBehind : public CCoinsViewBacked
+{
+private:
+    /** The contents of one flushed cache. */
+    struct Batch
+    {
+        CCoinsMap mapCoins;
+        uint256 hashBlock;
+        uint256 hashSproutAnchor;
+        uint256 hashSaplingAnchor;
+        CAnchorsSproutMap mapSproutAnchors;
+        CAnchorsSaplingMap mapSaplingAnchors;
+        CNullifiersMap mapSproutNullifiers;
+        CNullifiersMap mapSaplingNullifiers;
+        CHistoryCacheMap historyCacheMap;
+    };
+
+    CCoinsViewDB *db;
+
+    mutable std::mutex cs;
+    mutable std::condition_variable cond;
+    //! Batch handed over and not yet written. Not modified while set, so the
+    //! writer reads it without holding cs.
+    std::unique_ptr<const Batch> pending;
+    //! Memory held by pending
+    size_t nPendingUsage;
+    //! Set when writing pending failed; it is then kept and never retried
+    bool fFailed;
+    bool fStop;
+    std::thread writer;
+
+    void ThreadWrite();
+
+public:
+    //! Reads fall through to base, writes go to db
+    CCoinsViewWriteBehind(CCoinsView *baseIn, CCoinsViewDB *dbIn);
+    //! Writes any pending batch before returning
+    ~CCoinsViewWriteBehind();
+
+    bool GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const;
+    bool GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const;
+    bool GetNullifier(const uint256 &nullifier, ShieldedType type) const;
+    bool GetCoins(const uint256 &txid, CCoins &coins) const;
+    bool HaveCoins(const uint256 &txid) const;
+    uint256 GetBestBlock() const;
+    uint256 GetBestAnchor(ShieldedType type) const;
+    HistoryIndex GetHistoryLength(uint32_t epochId) const;
+    HistoryNode GetHistoryAt(uint32_t epochId, HistoryIndex index) const;
+    uint256 GetHistoryRoot(uint32_t epochId) const;
+    bool BatchWrite(CCoinsMap &mapCoins,
+                    const uint256 &hashBlock,
+                    const uint256 &hashSproutAnchor,
+                    const uint256 &hashSaplingAnchor,
+                    CAnchorsSproutMap &mapSproutAnchors,
+                    CAnchorsSaplingMap &mapSaplingAnchors,
+                    CNullifiersMap &mapSproutNullifiers,
+                    CNullifiersMap &mapSaplingNullifiers,
+                    CHistoryCacheMap &historyCacheMap);
+    bool GetStats(CCoinsStats &stats) const;
+
+    //! Memory held by the batch handed over and not yet written. It is not
+    //! part of the cache that flushed it but still counts against -dbcache.
+    size_t PendingUsage() const;
+
+    //! Wait until everything handed over has been written. Returns false if
+    //! a write failed.
+    bool Sync() const;
 };
 
 /** Access to the block database (blocks/index/) */
@@ -114,6 +209,7 @@ private:
 public:
     bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo);
     bool EraseBatchSync(const std::vector<const CBlockIndex*>& blockinfo);
+    bool ReadDiskBlockIndex(const uint256 &blockhash, CDiskBlockIndex &dbindex);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo &info);
     bool ReadLastBlockFile(int &nFile);
     bool WriteReindexing(bool fReindexing);
@@ -126,7 +222,10 @@ public:
     bool ReadAddressUnspentIndex(uint160 addressHash, int type, std::vector<CAddressUnspentDbEntry> &vect);
     bool WriteAddressIndex(const std::vector<CAddressIndexDbEntry> &vect);
     bool EraseAddressIndex(const std::vector<CAddressIndexDbEntry> &vect);
-    bool ReadAddressIndex(uint160 addressHash, int type, std::vector<CAddressIndexDbEntry> &addressIndex, int start = 0, int end = 0);
+    bool ReadAddressIndex(uint160 addressHash, int type, std::vector<CAddressIndexDbEntry> &addressIndex, int start = 0, int end = 0,
+                          const CAddressIndexKey *pAfter = nullptr, size_t nLimit = 0);
+    bool ReadAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &value);
+    bool BuildAddressBalanceIndex();
     bool ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
     bool UpdateSpentIndex(const std::vector<CSpentIndexDbEntry> &vect);
     bool WriteTimestampIndex(const CTimestampIndexKey &timestampIndex);
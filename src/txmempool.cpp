@@ -24,7 +24,9 @@ using namespace std;
 
 CTxMemPoolEntry::CTxMemPoolEntry():
     nFee(0), nTxSize(0), nModSize(0), nUsageSize(0), nTime(0), dPriority(0.0),
-    hadNoDependencies(false), spendsCoinbase(false)
+    hadNoDependencies(false), spendsCoinbase(false), nFeeDelta(0), nEntrySequence(0),
+    nCountWithAncestors(1), nSizeWithAncestors(0), nModFeesWithAncestors(0),
+    nCountWithDescendants(1), nSizeWithDescendants(0), nModFeesWithDescendants(0)
 {
     nHeight = MEMPOOL_HEIGHT;
 }
@@ -35,12 +37,15 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
                                  bool _spendsCoinbase, uint32_t _nBranchId):
     tx(_tx), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight),
     hadNoDependencies(poolHasNoInputsOf),
-    spendsCoinbase(_spendsCoinbase), nBranchId(_nBranchId)
+    spendsCoinbase(_spendsCoinbase), nBranchId(_nBranchId), nFeeDelta(0), nEntrySequence(0)
 {
     nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
     nModSize = tx.CalculateModifiedSize(nTxSize);
     nUsageSize = RecursiveDynamicUsage(tx);
     feeRate = CFeeRate(nFee, nTxSize);
+
+    SetAncestorState(1, nTxSize, nFee);
+    SetDescendantState(1, nTxSize, nFee);
 }
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
@@ -57,6 +62,43 @@ CTxMemPoolEntry::GetPriority(unsigned int currentHeight) const
     return dResult;
 }
 
+void CTxMemPoolEntry::UpdateFeeDelta(CAmount newFeeDelta)
+{
+    nModFeesWithAncestors += newFeeDelta - nFeeDelta;
+    nModFeesWithDescendants += newFeeDelta - nFeeDelta;
+    nFeeDelta = newFeeDelta;
+}
+
+void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount)
+{
+    nSizeWithAncestors += modifySize;
+    nModFeesWithAncestors += modifyFee;
+    nCountWithAncestors += modifyCount;
+    assert(int64_t(nCountWithAncestors) > 0);
+}
+
+void CTxMemPoolEntry::UpdateDescendantState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount)
+{
+    nSizeWithDescendants += modifySize;
+    nModFeesWithDescendants += modifyFee;
+    nCountWithDescendants += modifyCount;
+    assert(int64_t(nCountWithDescendants) > 0);
+}
+
+void CTxMemPoolEntry::SetAncestorState(uint64_t nCount, uint64_t nSize, CAmount nModFees)
+{
+    nCountWithAncestors = nCount;
+    nSizeWithAncestors = nSize;
+    nModFeesWithAncestors = nModFees;
+}
+
+void CTxMemPoolEntry::SetDescendantState(uint64_t nCount, uint64_t nSize, CAmount nModFees)
+{
+    nCountWithDescendants = nCount;
+    nSizeWithDescendants = nSize;
+    nModFeesWithDescendants = nModFees;
+}
+
 CTxMemPool::CTxMemPool(const CFeeRate& _minRelayFee) :
     nTransactionsUpdated(0)
 {
@@ -100,6 +142,200 @@ void CTxMemPool::AddTransactionsUpdated(unsigned int n)
     nTransactionsUpdated += n;
 }
 
+const CTxMemPool::setEntries& CTxMemPool::GetMemPoolParents(txiter entry) const
+{
+    assert(entry != mapTx.end());
+    txlinksMap::const_iterator it = mapLinks.find(entry);
+    assert(it != mapLinks.end());
+    return it->second.parents;
+}
+
+const CTxMemPool::setEntries& CTxMemPool::GetMemPoolChildren(txiter entry) const
+{
+    assert(entry != mapTx.end());
+    txlinksMap::const_iterator it = mapLinks.find(entry);
+    assert(it != mapLinks.end());
+    return it->second.children;
+}
+
+void CTxMemPool::CalculateMemPoolAncestors(txiter entry, setEntries& ancestors) const
+{
+    const setEntries& parents = GetMemPoolParents(entry);
+    std::vector<txiter> vStack(parents.begin(), parents.end());
+    while (!vStack.empty()) {
+        txiter it = vStack.back();
+        vStack.pop_back();
+        if (!ancestors.insert(it).second)
+            continue;
+        for (txiter parent : GetMemPoolParents(it)) {
+            if (!ancestors.count(parent))
+                vStack.push_back(parent);
+        }
+    }
+}
+
+bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry& entry, setEntries& ancestors,
+                                           uint64_t limitAncestorCount, uint64_t limitAncestorSize,
+                                           uint64_t limitDescendantCount, uint64_t limitDescendantSize,
+                                           std::string& errString) const
+{
+    LOCK(cs);
+    setEntries parents;
+    for (const CTxIn& txin : entry.GetTx().vin) {
+        txiter parent = mapTx.find(txin.prevout.hash);
+        if (parent == mapTx.end())
+            continue;
+        parents.insert(parent);
+        if (parents.size() + 1 > limitAncestorCount) {
+            errString = strprintf("too many unconfirmed parents [limit: %u]", limitAncestorCount);
+            return false;
+        }
+    }
+
+    // Stop at the first limit crossed, so a long chain is never walked in full
+    uint64_t nSizeWithAncestors = entry.GetTxSize();
+    std::vector<txiter> vStack(parents.begin(), parents.end());
+    while (!vStack.empty()) {
+        txiter it = vStack.back();
+        vStack.pop_back();
+        if (!ancestors.insert(it).second)
+            continue;
+        nSizeWithAncestors += it->GetTxSize();
+
+        if (it->GetSizeWithDescendants() + entry.GetTxSize() > limitDescendantSize) {
+            errString = strprintf("exceeds descendant size limit for tx %s [limit: %u]", it->GetTx().GetHash().ToString(), limitDescendantSize);
+            return false;
+        } else if (it->GetCountWithDescendants() + 1 > limitDescendantCount) {
+            errString = strprintf("too many descendants for tx %s [limit: %u]", it->GetTx().GetHash().ToString(), limitDescendantCount);
+            return false;
+        } else if (nSizeWithAncestors > limitAncestorSize) {
+            errString = strprintf("exceeds ancestor size limit [limit: %u]", limitAncestorSize);
+            return false;
+        } else if (ancestors.size() + 1 > limitAncestorCount) {
+            errString = strprintf("too many unconfirmed ancestors [limit: %u]", limitAncestorCount);
+            return false;
+        }
+
+        for (txiter parent : GetMemPoolParents(it)) {
+            if (!ancestors.count(parent))
+                vStack.push_back(parent);
+        }
+    }
+    return true;
+}
+
+void CTxMemPool::CalculateDescendants(txiter entry, setEntries& descendants) const
+{
+    const setEntries& children = GetMemPoolChildren(entry);
+    std::vector<txiter> vStack(children.begin(), children.end());
+    while (!vStack.empty()) {
+        txiter it = vStack.back();
+        vStack.pop_back();
+        if (!descendants.insert(it).second)
+            continue;
+        for (txiter child : GetMemPoolChildren(it)) {
+            if (!descendants.count(child))
+                vStack.push_back(child);
+        }
+    }
+}
+
+void CTxMemPool::UpdateParent(txiter entry, txiter parent, bool add)
+{
+    setEntries& parents = mapLinks[entry].parents;
+    if (add ? parents.insert(parent).second : parents.erase(parent) != 0)
+        add ? nLinks++ : nLinks--;
+}
+
+void CTxMemPool::UpdateChild(txiter entry, txiter child, bool add)
+{
+    setEntries& children = mapLinks[entry].children;
+    if (add ? children.insert(child).second : children.erase(child) != 0)
+        add ? nLinks++ : nLinks--;
+}
+
+void CTxMemPool::UpdatePackageStateFromScratch(txiter entry)
+{
+    setEntries ancestors;
+    setEntries descendants;
+    CalculateMemPoolAncestors(entry, ancestors);
+    CalculateDescendants(entry, descendants);
+
+    uint64_t nSizeWithAncestors = entry->GetTxSize();
+    CAmount nModFeesWithAncestors = entry->GetModifiedFee();
+    for (txiter it : ancestors) {
+        nSizeWithAncestors += it->GetTxSize();
+        nModFeesWithAncestors += it->GetModifiedFee();
+    }
+    uint64_t nSizeWithDescendants = entry->GetTxSize();
+    CAmount nModFeesWithDescendants = entry->GetModifiedFee();
+    for (txiter it : descendants) {
+        nSizeWithDescendants += it->GetTxSize();
+        nModFeesWithDescendants += it->GetModifiedFee();
+    }
+
+    uint64_t nAncestors = ancestors.size() + 1;
+    uint64_t nDescendants = descendants.size() + 1;
+    mapTx.modify(entry, [&](CTxMemPoolEntry& e) {
+        e.SetAncestorState(nAncestors, nSizeWithAncestors, nModFeesWithAncestors);
+        e.SetDescendantState(nDescendants, nSizeWithDescendants, nModFeesWithDescendants);
+    });
+}
+
+void CTxMemPool::RemovePackageState(const setEntries& stage, bool fUpdateDescendants)
+{
+    setEntries setRebuild;
+    for (txiter removeIt : stage) {
+        const int64_t nSize = removeIt->GetTxSize();
+        const CAmount nModFee = removeIt->GetModifiedFee();
+
+        setEntries ancestors;
+        CalculateMemPoolAncestors(removeIt, ancestors);
+        setEntries outsideAncestors;
+        for (txiter it : ancestors) {
+            if (stage.count(it))
+                continue;
+            outsideAncestors.insert(it);
+            mapTx.modify(it, [&](CTxMemPoolEntry& e) { e.UpdateDescendantState(-nSize, -nModFee, -1); });
+        }
+
+        if (!fUpdateDescendants)
+            continue;
+        setEntries descendants;
+        CalculateDescendants(removeIt, descendants);
+        for (txiter it : descendants) {
+            if (stage.count(it))
+                continue;
+            if (outsideAncestors.empty()) {
+                mapTx.modify(it, [&](CTxMemPoolEntry& e) { e.UpdateAncestorState(-nSize, -nModFee, -1); });
+            } else {
+                // Removing a transaction from the middle of a chain also cuts
+                // the descendants off from the ancestors above it
+                setRebuild.insert(it);
+                setRebuild.insert(outsideAncestors.begin(), outsideAncestors.end());
+            }
+        }
+    }
+
+    for (txiter removeIt : stage) {
+        for (txiter parent : GetMemPoolParents(removeIt)) {
+            UpdateChild(parent, removeIt, false);
+        }
+        for (txiter child : GetMemPoolChildren(removeIt)) {
+            UpdateParent(child, removeIt, false);
+        }
+    }
+    for (txiter removeIt : stage) {
+        const TxLinks& links = mapLinks[removeIt];
+        nLinks -= links.parents.size() + links.children.size();
+        mapLinks.erase(removeIt);
+    }
+
+    for (txiter it : setRebuild) {
+        UpdatePackageStateFromScratch(it);
+    }
+}
+
 
 bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry, bool fCurrentEstimate)
 {
@@ -108,8 +344,19 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     // all the appropriate checks.
     LOCK(cs);
     weightedTxTree->add(WeightedTxInfo::from(entry.GetTx(), entry.GetFee()));
-    mapTx.insert(entry);
-    const CTransaction& tx = mapTx.find(hash)->GetTx();
+    txiter newit = mapTx.insert(entry).first;
+    mapLinks.insert(make_pair(newit, TxLinks()));
+    uint64_t nSequence = ++nEntrySequence;
+    mapTx.modify(newit, [nSequence](CTxMemPoolEntry& e) { e.SetEntrySequence(nSequence); });
+
+    // Apply a prioritisation made before the transaction arrived
+    std::map<uint256, std::pair<double, CAmount> >::const_iterator pos = mapDeltas.find(hash);
+    if (pos != mapDeltas.end() && pos->second.second != 0) {
+        CAmount nFeeDelta = pos->second.second;
+        mapTx.modify(newit, [nFeeDelta](CTxMemPoolEntry& e) { e.UpdateFeeDelta(nFeeDelta); });
+    }
+
+    const CTransaction& tx = newit->GetTx();
     mapRecentlyAddedTx[tx.GetHash()] = &tx;
     nRecentlyAddedSequence += 1;
     for (unsigned int i = 0; i < tx.vin.size(); i++)
@@ -122,6 +369,54 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     for (const SpendDescription &spendDescription : tx.vShieldedSpend) {
         mapSaplingNullifiers[spendDescription.nullifier] = &tx;
     }
+
+    // Link the transaction to its in-mempool parents, and to children that are
+    // already in the pool when it returns from a disconnected block
+    for (const CTxIn& txin : tx.vin) {
+        txiter parent = mapTx.find(txin.prevout.hash);
+        if (parent != mapTx.end()) {
+            UpdateParent(newit, parent, true);
+            UpdateChild(parent, newit, true);
+        }
+    }
+    bool fHasChildren = false;
+    for (unsigned int i = 0; i < tx.vout.size(); i++) {
+        std::map<COutPoint, CInPoint>::const_iterator it = mapNextTx.find(COutPoint(hash, i));
+        if (it == mapNextTx.end())
+            continue;
+        txiter child = mapTx.find(it->second.ptx->GetHash());
+        assert(child != mapTx.end());
+        UpdateChild(newit, child, true);
+        UpdateParent(child, newit, true);
+        fHasChildren = true;
+    }
+
+    setEntries ancestors;
+    CalculateMemPoolAncestors(newit, ancestors);
+    if (!fHasChildren) {
+        const int64_t nSize = newit->GetTxSize();
+        const CAmount nModFee = newit->GetModifiedFee();
+        uint64_t nSizeWithAncestors = nSize;
+        CAmount nModFeesWithAncestors = nModFee;
+        for (txiter it : ancestors) {
+            mapTx.modify(it, [&](CTxMemPoolEntry& e) { e.UpdateDescendantState(nSize, nModFee, 1); });
+            nSizeWithAncestors += it->GetTxSize();
+            nModFeesWithAncestors += it->GetModifiedFee();
+        }
+        uint64_t nAncestors = ancestors.size() + 1;
+        mapTx.modify(newit, [&](CTxMemPoolEntry& e) {
+            e.SetAncestorState(nAncestors, nSizeWithAncestors, nModFeesWithAncestors);
+        });
+    } else {
+        setEntries affected;
+        CalculateDescendants(newit, affected);
+        affected.insert(ancestors.begin(), ancestors.end());
+        affected.insert(newit);
+        for (txiter it : affected) {
+            UpdatePackageStateFromScratch(it);
+        }
+    }
+
     nTransactionsUpdated++;
     totalTxSize += entry.GetTxSize();
     cachedInnerUsage += entry.DynamicMemoryUsage();
@@ -134,19 +429,16 @@ void CTxMemPool::addAddressIndex(const CTxMemPoolEntry &entry, const CCoinsViewC
 {
     LOCK(cs);
     const CTransaction& tx = entry.GetTx();
-    std::vector<CMempoolAddressDeltaKey> inserted;
+    std::vector<CMempoolAddressIndex::Delta> deltas;
+    deltas.reserve(tx.vin.size() + tx.vout.size());
 
-    uint256 txhash = tx.GetHash();
     for (unsigned int j = 0; j < tx.vin.size(); j++) {
         const CTxIn input = tx.vin[j];
         const CTxOut &prevout = view.GetOutputFor(input);
         CScript::ScriptType type = prevout.scriptPubKey.GetType();
         if (type == CScript::UNKNOWN)
             continue;
-        CMempoolAddressDeltaKey key(type, prevout.scriptPubKey.AddressHash(), txhash, j, 1);
-        CMempoolAddressDelta delta(entry.GetTime(), prevout.nValue * -1, input.prevout.hash, input.prevout.n);
-        mapAddress.insert(make_pair(key, delta));
-        inserted.push_back(key);
+        deltas.push_back({type, prevout.scriptPubKey.AddressHash(), j, true, prevout.nValue * -1, input.prevout});
     }
 
     for (unsigned int j = 0; j < tx.vout.size(); j++) {
@@ -154,12 +446,10 @@ void CTxMemPool::addAddressIndex(const CTxMemPoolEntry &entry, const CCoinsViewC
         CScript::ScriptType type = out.scriptPubKey.GetType();
         if (type == CScript::UNKNOWN)
             continue;
-        CMempoolAddressDeltaKey key(type, out.scriptPubKey.AddressHash(), txhash, j, 0);
-        mapAddress.insert(make_pair(key, CMempoolAddressDelta(entry.GetTime(), out.nValue)));
-        inserted.push_back(key);
+        deltas.push_back({type, out.scriptPubKey.AddressHash(), j, false, out.nValue, COutPoint()});
     }
 
-    mapAddressInserted.insert(make_pair(txhash, inserted));
+    addressIndex.AddTx(tx.GetHash(), entry.GetTime(), deltas);
 }
 
 // START insightexplorer
@@ -169,26 +459,14 @@ void CTxMemPool::getAddressIndex(
 {
     LOCK(cs);
     for (const auto& it : addresses) {
-        auto ait = mapAddress.lower_bound(CMempoolAddressDeltaKey(it.second, it.first));
-        while (ait != mapAddress.end() && (*ait).first.addressBytes == it.first && (*ait).first.type == it.second) {
-            results.push_back(*ait);
-            ait++;
-        }
+        addressIndex.GetDeltas(it.first, it.second, results);
     }
 }
 
 void CTxMemPool::removeAddressIndex(const uint256& txhash)
 {
     LOCK(cs);
-    auto it = mapAddressInserted.find(txhash);
-
-    if (it != mapAddressInserted.end()) {
-        std::vector<CMempoolAddressDeltaKey> keys = it->second;
-        for (const auto& mit : keys) {
-            mapAddress.erase(mit);
-        }
-        mapAddressInserted.erase(it);
-    }
+    addressIndex.RemoveTx(txhash);
 }
 
 void CTxMemPool::addSpentIndex(const CTxMemPoolEntry &entry, const CCoinsViewCache &view)
@@ -196,7 +474,6 @@ void CTxMemPool::addSpentIndex(const CTxMemPoolEntry &entry, const CCoinsViewCac
     LOCK(cs);
     const CTransaction& tx = entry.GetTx();
     uint256 txhash = tx.GetHash();
-    std::vector<CSpentIndexKey> inserted;
 
     for (unsigned int j = 0; j < tx.vin.size(); j++) {
         const CTxIn input = tx.vin[j];
@@ -205,35 +482,20 @@ void CTxMemPool::addSpentIndex(const CTxMemPoolEntry &entry, const CCoinsViewCac
         CSpentIndexValue value = CSpentIndexValue(txhash, j, -1, prevout.nValue,
             prevout.scriptPubKey.GetType(),
             prevout.scriptPubKey.AddressHash());
-        mapSpent.insert(make_pair(key, value));
-        inserted.push_back(key);
+        spentIndex.Add(key, value);
     }
-    mapSpentInserted.insert(make_pair(txhash, inserted));
 }
 
 bool CTxMemPool::getSpentIndex(const CSpentIndexKey &key, CSpentIndexValue &value)
 {
     LOCK(cs);
-    std::map<CSpentIndexKey, CSpentIndexValue, CSpentIndexKeyCompare>::iterator it = mapSpent.find(key);
-    if (it != mapSpent.end()) {
-        value = it->second;
-        return true;
-    }
-    return false;
+    return spentIndex.Get(key, value);
 }
 
-void CTxMemPool::removeSpentIndex(const uint256 txhash)
+void CTxMemPool::removeSpentIndex(const CTransaction& tx)
 {
     LOCK(cs);
-    auto it = mapSpentInserted.find(txhash);
-
-    if (it != mapSpentInserted.end()) {
-        std::vector<CSpentIndexKey> keys = (*it).second;
-        for (std::vector<CSpentIndexKey>::iterator mit = keys.begin(); mit != keys.end(); mit++) {
-            mapSpent.erase(*mit);
-        }
-        mapSpentInserted.erase(it);
-    }
+    spentIndex.RemoveTx(tx);
 }
 // END insightexplorer
 
@@ -256,13 +518,17 @@ void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& rem
                 txToRemove.push_back(it->second.ptx->GetHash());
             }
         }
+        std::vector<txiter> vRemove;
+        setEntries stage;
         while (!txToRemove.empty())
         {
             uint256 hash = txToRemove.front();
             txToRemove.pop_front();
-            if (!mapTx.count(hash))
+            txiter removeIt = mapTx.find(hash);
+            if (removeIt == mapTx.end() || !stage.insert(removeIt).second)
                 continue;
-            const CTransaction& tx = mapTx.find(hash)->GetTx();
+            vRemove.push_back(removeIt);
+            const CTransaction& tx = removeIt->GetTx();
             if (fRecursive) {
                 for (unsigned int i = 0; i < tx.vout.size(); i++) {
                     std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(COutPoint(hash, i));
@@ -271,6 +537,14 @@ void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& rem
                     txToRemove.push_back(it->second.ptx->GetHash());
                 }
             }
+        }
+
+        RemovePackageState(stage, !fRecursive);
+
+        for (txiter removeIt : vRemove)
+        {
+            const uint256 hash = removeIt->GetTx().GetHash();
+            const CTransaction& tx = removeIt->GetTx();
             mapRecentlyAddedTx.erase(hash);
             for (const CTxIn& txin : tx.vin)
                 mapNextTx.erase(txin.prevout);
@@ -283,17 +557,18 @@ void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& rem
                 mapSaplingNullifiers.erase(spendDescription.nullifier);
             }
             removed.push_back(tx);
-            totalTxSize -= mapTx.find(hash)->GetTxSize();
-            cachedInnerUsage -= mapTx.find(hash)->DynamicMemoryUsage();
-            mapTx.erase(hash);
-            nTransactionsUpdated++;
-            minerPolicyEstimator->removeTx(hash);
 
-            // insightexplorer
+            // insightexplorer; the spent index finds its entries from the inputs
             if (fAddressIndex)
                 removeAddressIndex(hash);
             if (fSpentIndex)
-                removeSpentIndex(hash);
+                removeSpentIndex(tx);
+
+            totalTxSize -= removeIt->GetTxSize();
+            cachedInnerUsage -= removeIt->DynamicMemoryUsage();
+            mapTx.erase(removeIt);
+            nTransactionsUpdated++;
+            minerPolicyEstimator->removeTx(hash);
         }
         for (CTransaction tx : removed) {
             weightedTxTree->remove(tx.GetHash());
@@ -483,6 +758,8 @@ void CTxMemPool::removeWithoutBranchId(uint32_t nMemPoolBranchId)
 void CTxMemPool::clear()
 {
     LOCK(cs);
+    mapLinks.clear();
+    nLinks = 0;
     mapTx.clear();
     mapNextTx.clear();
     totalTxSize = 0;
@@ -533,6 +810,46 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
             i++;
         }
 
+        // Check the links to in-mempool parents and children, and the package state
+        setEntries setParentCheck;
+        for (const CTxIn &txin : tx.vin) {
+            indexed_transaction_set::const_iterator it2 = mapTx.find(txin.prevout.hash);
+            if (it2 != mapTx.end())
+                setParentCheck.insert(it2);
+        }
+        assert(setParentCheck == GetMemPoolParents(it));
+        setEntries setChildrenCheck;
+        for (unsigned int n = 0; n < tx.vout.size(); n++) {
+            std::map<COutPoint, CInPoint>::const_iterator it3 = mapNextTx.find(COutPoint(tx.GetHash(), n));
+            if (it3 != mapNextTx.end())
+                setChildrenCheck.insert(mapTx.find(it3->second.ptx->GetHash()));
+        }
+        assert(setChildrenCheck == GetMemPoolChildren(it));
+
+        setEntries ancestors;
+        CalculateMemPoolAncestors(it, ancestors);
+        uint64_t nSizeCheck = it->GetTxSize();
+        CAmount nFeesCheck = it->GetModifiedFee();
+        for (txiter ancestor : ancestors) {
+            nSizeCheck += ancestor->GetTxSize();
+            nFeesCheck += ancestor->GetModifiedFee();
+        }
+        assert(it->GetCountWithAncestors() == ancestors.size() + 1);
+        assert(it->GetSizeWithAncestors() == nSizeCheck);
+        assert(it->GetModFeesWithAncestors() == nFeesCheck);
+
+        setEntries descendants;
+        CalculateDescendants(it, descendants);
+        nSizeCheck = it->GetTxSize();
+        nFeesCheck = it->GetModifiedFee();
+        for (txiter descendant : descendants) {
+            nSizeCheck += descendant->GetTxSize();
+            nFeesCheck += descendant->GetModifiedFee();
+        }
+        assert(it->GetCountWithDescendants() == descendants.size() + 1);
+        assert(it->GetSizeWithDescendants() == nSizeCheck);
+        assert(it->GetModFeesWithDescendants() == nFeesCheck);
+
         // The SaltedTxidHasher is fine to use here; it salts the map keys automatically
         // with randomness generated on construction.
         boost::unordered_map<uint256, SproutMerkleTree, SaltedTxidHasher> intermediates;
@@ -605,6 +922,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
 
     assert(totalTxSize == checkTotal);
     assert(innerUsage == cachedInnerUsage);
+    assert(mapLinks.size() == mapTx.size());
 }
 
 void CTxMemPool::checkNullifiers(ShieldedType type) const
@@ -701,6 +1019,23 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const string strHash,
         std::pair<double, CAmount> &deltas = mapDeltas[hash];
         deltas.first += dPriorityDelta;
         deltas.second += nFeeDelta;
+
+        txiter it = mapTx.find(hash);
+        if (it != mapTx.end() && nFeeDelta != 0) {
+            CAmount newFeeDelta = deltas.second;
+            mapTx.modify(it, [newFeeDelta](CTxMemPoolEntry& e) { e.UpdateFeeDelta(newFeeDelta); });
+            // The package fee rates of its ancestors and descendants change with it
+            setEntries ancestors;
+            setEntries descendants;
+            CalculateMemPoolAncestors(it, ancestors);
+            CalculateDescendants(it, descendants);
+            for (txiter ancestor : ancestors) {
+                mapTx.modify(ancestor, [nFeeDelta](CTxMemPoolEntry& e) { e.UpdateDescendantState(0, nFeeDelta, 0); });
+            }
+            for (txiter descendant : descendants) {
+                mapTx.modify(descendant, [nFeeDelta](CTxMemPoolEntry& e) { e.UpdateAncestorState(0, nFeeDelta, 0); });
+            }
+        }
     }
     LogPrintf("PrioritiseTransaction: %s priority += %f, fee += %d\n", strHash, dPriorityDelta, FormatMoney(nFeeDelta));
 }
@@ -798,9 +1133,9 @@ size_t CTxMemPool::DynamicMemoryUsage() const {
 
     size_t total = 0;
 
-    // Estimate the overhead of mapTx to be 6 pointers + an allocation, as no exact formula for
+    // Estimate the overhead of mapTx to be 12 pointers + an allocation, as no exact formula for
     // boost::multi_index_contained is implemented.
-    total += memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 6 * sizeof(void*)) * mapTx.size();
+    total += memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 12 * sizeof(void*)) * mapTx.size();
 
     // Two metadata maps inherited from Bitcoin Core
     total += memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas);
@@ -808,6 +1143,9 @@ size_t CTxMemPool::DynamicMemoryUsage() const {
     // Saves iterating over the full map
     total += cachedInnerUsage;
 
+    // Package links
+    total += memusage::DynamicUsage(mapLinks) + memusage::MallocUsage(sizeof(memusage::stl_tree_node<txiter>)) * nLinks;
+
     // Wallet notification
     total += memusage::DynamicUsage(mapRecentlyAddedTx);
 
@@ -819,10 +1157,8 @@ size_t CTxMemPool::DynamicMemoryUsage() const {
 
     // Insight-related structures
     size_t insight = 0;
-    insight += memusage::DynamicUsage(mapAddress);
-    insight += memusage::DynamicUsage(mapAddressInserted);
-    insight += memusage::DynamicUsage(mapSpent);
-    insight += memusage::DynamicUsage(mapSpentInserted);
+    insight += addressIndex.DynamicMemoryUsage();
+    insight += spentIndex.DynamicMemoryUsage();
     total += insight;
 
     return total;
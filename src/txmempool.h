@@ -7,6 +7,8 @@
 #define BITCOIN_TXMEMPOOL_H
 
 #include <list>
+#include <map>
+#include <set>
 
 #include "amount.h"
 #include "coins.h"
@@ -15,12 +17,14 @@
 #include "sync.h"
 #include "random.h"
 #include "addressindex.h"
+#include "mempoolindex.h"
 #include "spentindex.h"
 
 #undef foreach
 #include "boost/multi_index_container.hpp"
 #include "boost/multi_index/ordered_index.hpp"
 #include "boost/multi_index/hashed_index.hpp"
+#include "boost/multi_index/mem_fun.hpp"
 
 class CAutoFile;
 
@@ -57,6 +61,17 @@ private:
     bool hadNoDependencies;    //!< Not dependent on any other txs when it entered the mempool
     bool spendsCoinbase;       //!< keep track of transactions that spend a coinbase
     uint32_t nBranchId;        //!< Branch ID this transaction is known to commit to, cached for efficiency
+    CAmount nFeeDelta;         //!< Fee delta from PrioritiseTransaction
+    uint64_t nEntrySequence;   //!< Order of entry into the mempool, set by CTxMemPool
+
+    // Package state, kept up to date by CTxMemPool. Each sum covers this
+    // transaction and all of its in-mempool ancestors (or descendants).
+    uint64_t nCountWithAncestors;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
+    uint64_t nCountWithDescendants;
+    uint64_t nSizeWithDescendants;
+    CAmount nModFeesWithDescendants;
 
 public:
     CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
@@ -77,6 +92,24 @@ public:
 
     bool GetSpendsCoinbase() const { return spendsCoinbase; }
     uint32_t GetValidatedBranchId() const { return nBranchId; }
+    uint64_t GetEntrySequence() const { return nEntrySequence; }
+    void SetEntrySequence(uint64_t n) { nEntrySequence = n; }
+
+    //! Fee including any PrioritiseTransaction delta
+    CAmount GetModifiedFee() const { return nFee + nFeeDelta; }
+    void UpdateFeeDelta(CAmount newFeeDelta);
+    //! Adjust the ancestor (descendant) sums for a transaction joining or leaving the package
+    void UpdateAncestorState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount);
+    void UpdateDescendantState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount);
+    void SetAncestorState(uint64_t nCount, uint64_t nSize, CAmount nModFees);
+    void SetDescendantState(uint64_t nCount, uint64_t nSize, CAmount nModFees);
+
+    uint64_t GetCountWithAncestors() const { return nCountWithAncestors; }
+    uint64_t GetSizeWithAncestors() const { return nSizeWithAncestors; }
+    CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
+    uint64_t GetCountWithDescendants() const { return nCountWithDescendants; }
+    uint64_t GetSizeWithDescendants() const { return nSizeWithDescendants; }
+    CAmount GetModFeesWithDescendants() const { return nModFeesWithDescendants; }
 };
 
 // extracts a TxMemPoolEntry's transaction hash
@@ -92,7 +125,7 @@ struct mempoolentry_txid
 class CompareTxMemPoolEntryByFee
 {
 public:
-    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b)
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
     {
         if (a.GetFeeRate() == b.GetFeeRate())
             return a.GetTime() < b.GetTime();
@@ -100,6 +133,30 @@ public:
     }
 };
 
+/**
+ * Sort by the fee rate of a transaction together with its in-mempool
+ * ancestors, highest first: the order in which CreateNewBlock considers
+ * packages.
+ */
+class CompareTxMemPoolEntryByAncestorFee
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        double f1 = (double)a.GetModFeesWithAncestors() * b.GetSizeWithAncestors();
+        double f2 = (double)b.GetModFeesWithAncestors() * a.GetSizeWithAncestors();
+        if (f1 == f2) {
+            return a.GetTx().GetHash() < b.GetTx().GetHash();
+        }
+        return f1 > f2;
+    }
+};
+
+// Tag for the ancestor fee rate index of CTxMemPool::mapTx
+struct ancestor_score {};
+// Tag for the index of CTxMemPool::mapTx in order of entry
+struct entry_sequence {};
+
 class CBlockPolicyEstimator;
 
 /** An inpoint - a combination of a transaction and an index n into its vin */
@@ -139,6 +196,7 @@ private:
     std::map<uint256, const CTransaction*> mapRecentlyAddedTx;
     uint64_t nRecentlyAddedSequence = 0;
     uint64_t nNotifiedSequence = 0;
+    uint64_t nEntrySequence = 0;
 
     std::map<uint256, const CTransaction*> mapSproutNullifiers;
     std::map<uint256, const CTransaction*> mapSaplingNullifiers;
@@ -157,6 +215,17 @@ public:
             boost::multi_index::ordered_non_unique<
                 boost::multi_index::identity<CTxMemPoolEntry>,
                 CompareTxMemPoolEntryByFee
+            >,
+            // sorted by fee rate with ancestors
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<ancestor_score>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByAncestorFee
+            >,
+            // in order of entry, so that what entered since a given point can be found
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<entry_sequence>,
+                boost::multi_index::const_mem_fun<CTxMemPoolEntry, uint64_t, &CTxMemPoolEntry::GetEntrySequence>
             >
         >
     > indexed_transaction_set;
@@ -164,12 +233,39 @@ public:
     mutable CCriticalSection cs;
     indexed_transaction_set mapTx;
 
+    typedef indexed_transaction_set::nth_index<0>::type::const_iterator txiter;
+    struct CompareIteratorByHash {
+        bool operator()(const txiter& a, const txiter& b) const
+        {
+            return a->GetTx().GetHash() < b->GetTx().GetHash();
+        }
+    };
+    typedef std::set<txiter, CompareIteratorByHash> setEntries;
+
 private:
+    struct TxLinks {
+        setEntries parents;
+        setEntries children;
+    };
+    typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
+    //! In-mempool parents and children of every mempool transaction
+    txlinksMap mapLinks;
+    uint64_t nLinks = 0; //!< Number of parent and child links, for DynamicMemoryUsage
+
+    void UpdateParent(txiter entry, txiter parent, bool add);
+    void UpdateChild(txiter entry, txiter child, bool add);
+    /** Recompute the ancestor and descendant sums of an entry by walking its package. */
+    void UpdatePackageStateFromScratch(txiter entry);
+    /**
+     * Take the transactions of stage out of the package state of the rest
+     * of the pool, and unlink them. With fUpdateDescendants, descendants
+     * that stay in the pool are updated too.
+     */
+    void RemovePackageState(const setEntries& stage, bool fUpdateDescendants);
+
     // insightexplorer
-    std::map<CMempoolAddressDeltaKey, CMempoolAddressDelta, CMempoolAddressDeltaKeyCompare> mapAddress;
-    std::map<uint256, std::vector<CMempoolAddressDeltaKey> > mapAddressInserted;
-    std::map<CSpentIndexKey, CSpentIndexValue, CSpentIndexKeyCompare> mapSpent;
-    std::map<uint256, std::vector<CSpentIndexKey>> mapSpentInserted;
+    CMempoolAddressIndex addressIndex;
+    CMempoolSpentIndex spentIndex;
 
 public:
     std::map<COutPoint, CInPoint> mapNextTx;
@@ -197,7 +293,7 @@ public:
 
     void addSpentIndex(const CTxMemPoolEntry &entry, const CCoinsViewCache &view);
     bool getSpentIndex(const CSpentIndexKey &key, CSpentIndexValue &value);
-    void removeSpentIndex(const uint256 txhash);
+    void removeSpentIndex(const CTransaction& tx);
     // END insightexplorer
 
     void remove(const CTransaction &tx, std::list<CTransaction>& removed, bool fRecursive = false);
@@ -219,6 +315,22 @@ public:
      */
     bool HasNoInputsOf(const CTransaction& tx) const;
 
+    const setEntries& GetMemPoolParents(txiter entry) const;
+    const setEntries& GetMemPoolChildren(txiter entry) const;
+    /** All in-mempool ancestors (descendants) of entry, not including entry itself. cs must be held. */
+    void CalculateMemPoolAncestors(txiter entry, setEntries& ancestors) const;
+    /**
+     * The in-mempool ancestors of an entry that is not in the pool yet, found
+     * from its inputs. Returns false, with the reason in errString, as soon as
+     * adding the entry would take it or any of its ancestors over the limits
+     * on package count and size (in bytes).
+     */
+    bool CalculateMemPoolAncestors(const CTxMemPoolEntry& entry, setEntries& ancestors,
+                                   uint64_t limitAncestorCount, uint64_t limitAncestorSize,
+                                   uint64_t limitDescendantCount, uint64_t limitDescendantSize,
+                                   std::string& errString) const;
+    void CalculateDescendants(txiter entry, setEntries& descendants) const;
+
     /** Affect CreateNewBlock prioritisation of transactions */
     void PrioritiseTransaction(const uint256 hash, const std::string strHash, double dPriorityDelta, const CAmount& nFeeDelta);
     void ApplyDeltas(const uint256 hash, double &dPriorityDelta, CAmount &nFeeDelta);
@@ -11,6 +11,7 @@
 #include "util.h"
 #include "utilstrencodings.h"
 
+#include <memory>
 #include <stdint.h>
 
 #ifndef WIN32
@@ -25,6 +26,7 @@ using namespace std;
 
 
 unsigned int nWalletDBUpdated;
+bool fWalletLogBackend = false;
 
 
 //
@@ -272,7 +274,7 @@ void CDBEnv::CheckpointLSN(const std::string& strFile)
 }
 
 
-CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnCloseIn) : pdb(NULL), activeTxn(NULL)
+CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnCloseIn) : pdb(NULL), plog(NULL), activeTxn(NULL)
 {
     int ret;
     fReadOnly = (!strchr(pszMode, '+') && !strchr(pszMode, 'w'));
@@ -281,6 +283,21 @@ CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnClose
         return;
 
     bool fCreate = strchr(pszMode, 'c') != NULL;
+    if (IsLogStore(strFilename)) {
+        plog = logdb.Open(strFilename, fCreate);
+        if (plog == NULL)
+            throw runtime_error(strprintf("CDB: can't open log store %s", strFilename));
+        strFile = strFilename;
+
+        if (fCreate && !Exists(string("version"))) {
+            bool fTmp = fReadOnly;
+            fReadOnly = false;
+            WriteVersion(CLIENT_VERSION);
+            fReadOnly = fTmp;
+        }
+        return;
+    }
+
     unsigned int nFlags = DB_THREAD;
     if (fCreate)
         nFlags |= DB_CREATE;
@@ -335,6 +352,12 @@ void CDB::Flush()
 {
     if (activeTxn)
         return;
+    // Only commit a log store; the wallet flush thread compacts it
+    if (plog) {
+        if (!fReadOnly)
+            plog->Commit();
+        return;
+    }
 
     // Flush database activity from memory pool to disk log
     unsigned int nMinutes = 0;
@@ -346,6 +369,13 @@ void CDB::Flush()
 
 void CDB::Close()
 {
+    if (plog) {
+        logTxn.reset();
+        if (fFlushOnClose)
+            Flush();
+        plog = NULL;
+        return;
+    }
     if (!pdb)
         return;
     if (activeTxn)
@@ -362,6 +392,83 @@ void CDB::Close()
     }
 }
 
+bool CDB::ReadLog(const CDataStream& ssKey, CDataStream& ssValue)
+{
+    CLogDB::Key key(ssKey.begin(), ssKey.end());
+    CLogDB::Value value;
+    if (logTxn && logTxn->count(key)) {
+        const std::optional<CLogDB::Value>& pending = logTxn->at(key);
+        if (!pending)
+            return false;
+        value = *pending;
+    } else if (!plog->Read(key, value)) {
+        return false;
+    }
+    ssValue.write(value.data(), value.size());
+    return true;
+}
+
+bool CDB::WriteLog(const CDataStream& ssKey, const CDataStream& ssValue, bool fOverwrite)
+{
+    if (!fOverwrite && ExistsLog(ssKey))
+        return false;
+
+    CLogDB::Key key(ssKey.begin(), ssKey.end());
+    CLogDB::Value value(ssValue.begin(), ssValue.end());
+    if (logTxn) {
+        (*logTxn)[key] = std::move(value);
+        return true;
+    }
+    CLogDB::Batch batch;
+    batch.emplace(std::move(key), std::move(value));
+    return plog->Write(batch);
+}
+
+bool CDB::EraseLog(const CDataStream& ssKey)
+{
+    CLogDB::Key key(ssKey.begin(), ssKey.end());
+    if (logTxn) {
+        (*logTxn)[key] = std::nullopt;
+        return true;
+    }
+    CLogDB::Batch batch;
+    batch.emplace(std::move(key), std::nullopt);
+    return plog->Write(batch);
+}
+
+bool CDB::ExistsLog(const CDataStream& ssKey)
+{
+    CLogDB::Key key(ssKey.begin(), ssKey.end());
+    if (logTxn && logTxn->count(key))
+        return logTxn->at(key) != std::nullopt;
+    return plog->Exists(key);
+}
+
+int CDB::ReadAtLogCursor(CDBCursor* pcursor, CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags)
+{
+    // Only the positioning that the wallet uses: a range lookup, then walking forward
+    CLogDB::Key key;
+    CLogDB::Value value;
+    bool fFound;
+    if (fFlags == DB_SET_RANGE)
+        fFound = pcursor->plog->Seek(CLogDB::Key(ssKey.begin(), ssKey.end()), false, key, value);
+    else if (fFlags == DB_NEXT)
+        fFound = pcursor->plog->Seek(pcursor->keyLast ? *pcursor->keyLast : CLogDB::Key(), pcursor->keyLast != std::nullopt, key, value);
+    else
+        return EINVAL;
+    if (!fFound)
+        return DB_NOTFOUND;
+
+    ssKey.SetType(SER_DISK);
+    ssKey.clear();
+    ssKey.write((const char*)key.data(), key.size());
+    ssValue.SetType(SER_DISK);
+    ssValue.clear();
+    ssValue.write(value.data(), value.size());
+    pcursor->keyLast = std::move(key);
+    return 0;
+}
+
 void CDBEnv::CloseDb(const string& strFile)
 {
     {
@@ -387,6 +494,25 @@ bool CDBEnv::RemoveDb(const string& strFile)
 
 bool CDB::Rewrite(const string& strFile, const char* pszSkip)
 {
+    if (IsLogStore(strFile)) {
+        // Compaction already writes the live records to a new file
+        LogPrintf("CDB::Rewrite: Rewriting %s...\n", strFile);
+        CLogDB* plog = logdb.Open(strFile, false);
+        bool fSuccess = plog != NULL;
+        if (fSuccess) {
+            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+            ssKey << string("version");
+            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+            ssValue << CLIENT_VERSION;
+            CLogDB::Batch batch;
+            batch.emplace(CLogDB::Key(ssKey.begin(), ssKey.end()), CLogDB::Value(ssValue.begin(), ssValue.end()));
+            fSuccess = plog->Write(batch) && plog->Compact(pszSkip);
+        }
+        if (!fSuccess)
+            LogPrintf("CDB::Rewrite: Failed to rewrite log store %s\n", strFile);
+        return fSuccess;
+    }
+
     while (true) {
         {
             LOCK(bitdb.cs_db);
@@ -414,12 +540,12 @@ bool CDB::Rewrite(const string& strFile, const char* pszSkip)
                         fSuccess = false;
                     }
 
-                    Dbc* pcursor = db.GetCursor();
+                    std::unique_ptr<CDBCursor> pcursor(db.GetCursor());
                     if (pcursor)
                         while (fSuccess) {
                             CDataStream ssKey(SER_DISK, CLIENT_VERSION);
                             CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-                            int ret = db.ReadAtCursor(pcursor, ssKey, ssValue, DB_NEXT);
+                            int ret = db.ReadAtCursor(pcursor.get(), ssKey, ssValue, DB_NEXT);
                             if (ret == DB_NOTFOUND) {
                                 pcursor->close();
                                 break;
@@ -468,6 +594,151 @@ bool CDB::Rewrite(const string& strFile, const char* pszSkip)
     return false;
 }
 
+bool CDB::IsLogStore(const string& strFile)
+{
+    if (logdb.IsOpen(strFile))
+        return true;
+    {
+        LOCK(bitdb.cs_db);
+        if (bitdb.IsMock() || bitdb.mapDb[strFile] != NULL)
+            return false;
+    }
+
+    // An existing file stays in whichever backend wrote it until it is migrated
+    boost::filesystem::path path = GetDataDir() / strFile;
+    if (boost::filesystem::exists(path))
+        return CLogDB::IsLogFile(path);
+    return fWalletLogBackend;
+}
+
+bool CDB::Migrate(const string& strFile)
+{
+    // Without -walletbackend, a wallet stays in whichever format it is in
+    boost::filesystem::path path = GetDataDir() / strFile;
+    if (!mapArgs.count("-walletbackend") || bitdb.IsMock() || !boost::filesystem::exists(path))
+        return true;
+    bool fLogStore = IsLogStore(strFile);
+    if (fLogStore == fWalletLogBackend)
+        return true;
+
+    int64_t nStart = GetTimeMillis();
+    LogPrintf("CDB::Migrate: Moving %s to a %s...\n", strFile, fWalletLogBackend ? "log store" : "Berkeley database");
+
+    std::vector<std::pair<CLogDB::Key, CLogDB::Value>> vRecords;
+    { // surround usage of db with extra {}
+        CDB db(strFile.c_str(), "r");
+        std::unique_ptr<CDBCursor> pcursor(db.GetCursor());
+        if (!pcursor)
+            return error("CDB::Migrate: Can't read %s", strFile);
+        while (true) {
+            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+            int ret = db.ReadAtCursor(pcursor.get(), ssKey, ssValue, DB_NEXT);
+            if (ret == DB_NOTFOUND)
+                break;
+            else if (ret != 0)
+                return error("CDB::Migrate: Error %d reading %s", ret, strFile);
+            vRecords.emplace_back(CLogDB::Key(ssKey.begin(), ssKey.end()), CLogDB::Value(ssValue.begin(), ssValue.end()));
+        }
+    }
+
+    // Write the copy under another name, so that a failure leaves the original as the wallet
+    string strCopy = strFile + ".migrate";
+    boost::filesystem::path pathCopy = GetDataDir() / strCopy;
+    bool fSuccess = true;
+    if (fWalletLogBackend) {
+        boost::filesystem::remove(pathCopy);
+        CLogDB logCopy(pathCopy);
+        fSuccess = logCopy.Open(true);
+        CLogDB::Batch batch;
+        size_t nBatchBytes = 0;
+        for (size_t i = 0; fSuccess && i < vRecords.size(); i++) {
+            nBatchBytes += vRecords[i].first.size() + vRecords[i].second.size();
+            batch.emplace(std::move(vRecords[i].first), std::move(vRecords[i].second));
+            if (nBatchBytes >= LOGDB_COMPACT_BATCH_BYTES || i + 1 == vRecords.size()) {
+                fSuccess = logCopy.Write(batch);
+                batch.clear();
+                nBatchBytes = 0;
+            }
+        }
+        fSuccess = fSuccess && logCopy.Flush();
+        logCopy.Close();
+        if (!fSuccess)
+            boost::filesystem::remove(pathCopy);
+    } else {
+        LOCK(bitdb.cs_db);
+        if (!bitdb.Open(GetDataDir()))
+            return error("CDB::Migrate: Failed to open database environment");
+        bitdb.RemoveDb(strCopy);
+        std::unique_ptr<Db> pdbCopy(new Db(bitdb.dbenv, 0));
+        int ret = pdbCopy->open(NULL,            // Txn pointer
+                                strCopy.c_str(), // Filename
+                                "main",          // Logical db name
+                                DB_BTREE,        // Database type
+                                DB_CREATE,       // Flags
+                                0);
+        if (ret > 0)
+            return error("CDB::Migrate: Can't create database file %s", strCopy);
+
+        DbTxn* ptxn = bitdb.TxnBegin();
+        fSuccess = ptxn != NULL;
+        for (size_t i = 0; fSuccess && i < vRecords.size(); i++) {
+            Dbt datKey(&vRecords[i].first[0], vRecords[i].first.size());
+            Dbt datValue(&vRecords[i].second[0], vRecords[i].second.size());
+            if (pdbCopy->put(ptxn, &datKey, &datValue, DB_NOOVERWRITE) != 0)
+                fSuccess = false;
+        }
+        if (ptxn != NULL) {
+            if (fSuccess)
+                fSuccess = ptxn->commit(0) == 0;
+            else
+                ptxn->abort();
+        }
+        if (pdbCopy->close(0) != 0)
+            fSuccess = false;
+        if (fSuccess)
+            bitdb.CheckpointLSN(strCopy);
+        else
+            bitdb.RemoveDb(strCopy);
+    }
+    if (!fSuccess)
+        return error("CDB::Migrate: Failed to write %s, %s is unchanged", strCopy, strFile);
+
+    // Keep the original as a backup, as wallet recovery does
+    string strBackup = strprintf("%s.%d.bak", strFile, GetTime());
+    for (int i = 1; boost::filesystem::exists(GetDataDir() / strBackup); i++)
+        strBackup = strprintf("%s.%d.%d.bak", strFile, GetTime(), i);
+    if (fLogStore) {
+        logdb.Close(strFile);
+        try {
+            boost::filesystem::rename(path, GetDataDir() / strBackup);
+        } catch (const boost::filesystem::filesystem_error& e) {
+            return error("CDB::Migrate: Can't rename %s to %s: %s", strFile, strBackup, e.what());
+        }
+    } else {
+        LOCK(bitdb.cs_db);
+        bitdb.CloseDb(strFile);
+        bitdb.CheckpointLSN(strFile);
+        bitdb.mapFileUseCount.erase(strFile);
+        if (bitdb.dbenv->dbrename(NULL, strFile.c_str(), NULL, strBackup.c_str(), DB_AUTO_COMMIT) != 0)
+            return error("CDB::Migrate: Can't rename %s to %s", strFile, strBackup);
+    }
+    LogPrintf("CDB::Migrate: Renamed %s to %s\n", strFile, strBackup);
+
+    if (fWalletLogBackend) {
+        fSuccess = RenameOver(pathCopy, path);
+    } else {
+        LOCK(bitdb.cs_db);
+        bitdb.CloseDb(strCopy);
+        fSuccess = bitdb.dbenv->dbrename(NULL, strCopy.c_str(), NULL, strFile.c_str(), DB_AUTO_COMMIT) == 0;
+    }
+    if (!fSuccess)
+        return error("CDB::Migrate: Can't rename %s to %s, the original is in %s", strCopy, strFile, strBackup);
+
+    LogPrintf("CDB::Migrate: Moved %u records of %s in %dms\n", vRecords.size(), strFile, GetTimeMillis() - nStart);
+    return true;
+}
+
 
 void CDBEnv::Flush(bool fShutdown)
 {
@@ -11,8 +11,10 @@
 #include "streams.h"
 #include "sync.h"
 #include "version.h"
+#include "wallet/logdb.h"
 
 #include <map>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -21,6 +23,8 @@
 #include <db_cxx.h>
 
 extern unsigned int nWalletDBUpdated;
+/** Create new wallet files as log stores rather than Berkeley databases (-walletbackend=log). */
+extern bool fWalletLogBackend;
 
 class CDBEnv
 {
@@ -87,14 +91,36 @@ public:
 
 extern CDBEnv bitdb;
 
+/** A cursor over a Berkeley database, or over a log store in key order. */
+class CDBCursor
+{
+public:
+    Dbc* pcursor;
+    CLogDB* plog;
+    //! Key of the last record read from the log store
+    std::optional<CLogDB::Key> keyLast;
+
+    CDBCursor(Dbc* pcursorIn, CLogDB* plogIn) : pcursor(pcursorIn), plog(plogIn) {}
+    ~CDBCursor() { close(); }
+
+    void close()
+    {
+        if (pcursor)
+            pcursor->close();
+        pcursor = NULL;
+    }
+};
 
-/** RAII class that provides access to a Berkeley database */
+/** RAII class that provides access to a Berkeley database, or to a log store */
 class CDB
 {
 protected:
     Db* pdb;
+    CLogDB* plog;
     std::string strFile;
     DbTxn* activeTxn;
+    //! Writes held back until TxnCommit on a log store
+    std::optional<CLogDB::Batch> logTxn;
     bool fReadOnly;
     bool fFlushOnClose;
 
@@ -109,17 +135,35 @@ private:
     CDB(const CDB&);
     void operator=(const CDB&);
 
+    bool ReadLog(const CDataStream& ssKey, CDataStream& ssValue);
+    bool WriteLog(const CDataStream& ssKey, const CDataStream& ssValue, bool fOverwrite);
+    bool EraseLog(const CDataStream& ssKey);
+    bool ExistsLog(const CDataStream& ssKey);
+    int ReadAtLogCursor(CDBCursor* pcursor, CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags);
+
 protected:
     template <typename K, typename T>
     bool Read(const K& key, T& value)
     {
-        if (!pdb)
+        if (!pdb && !plog)
             return false;
 
         // Key
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
+
+        if (plog) {
+            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+            if (!ReadLog(ssKey, ssValue))
+                return false;
+            try {
+                ssValue >> value;
+            } catch (const std::exception&) {
+                return false;
+            }
+            return true;
+        }
         Dbt datKey(&ssKey[0], ssKey.size());
 
         // Read
@@ -147,7 +191,7 @@ protected:
     template <typename K, typename T>
     bool Write(const K& key, const T& value, bool fOverwrite = true)
     {
-        if (!pdb)
+        if (!pdb && !plog)
             return false;
         if (fReadOnly)
             assert(!"Write called on database in read-only mode");
@@ -156,12 +200,15 @@ protected:
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
-        Dbt datKey(&ssKey[0], ssKey.size());
 
         // Value
         CDataStream ssValue(SER_DISK, CLIENT_VERSION);
         ssValue.reserve(10000);
         ssValue << value;
+
+        if (plog)
+            return WriteLog(ssKey, ssValue, fOverwrite);
+        Dbt datKey(&ssKey[0], ssKey.size());
         Dbt datValue(&ssValue[0], ssValue.size());
 
         // Write
@@ -176,7 +223,7 @@ protected:
     template <typename K>
     bool Erase(const K& key)
     {
-        if (!pdb)
+        if (!pdb && !plog)
             return false;
         if (fReadOnly)
             assert(!"Erase called on database in read-only mode");
@@ -185,6 +232,8 @@ protected:
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
+        if (plog)
+            return EraseLog(ssKey);
         Dbt datKey(&ssKey[0], ssKey.size());
 
         // Erase
@@ -198,13 +247,15 @@ protected:
     template <typename K>
     bool Exists(const K& key)
     {
-        if (!pdb)
+        if (!pdb && !plog)
             return false;
 
         // Key
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
+        if (plog)
+            return ExistsLog(ssKey);
         Dbt datKey(&ssKey[0], ssKey.size());
 
         // Exists
@@ -215,19 +266,24 @@ protected:
         return (ret == 0);
     }
 
-    Dbc* GetCursor()
+    CDBCursor* GetCursor()
     {
+        if (plog)
+            return new CDBCursor(NULL, plog);
         if (!pdb)
             return NULL;
         Dbc* pcursor = NULL;
         int ret = pdb->cursor(NULL, &pcursor, 0);
         if (ret != 0)
             return NULL;
-        return pcursor;
+        return new CDBCursor(pcursor, NULL);
     }
 
-    int ReadAtCursor(Dbc* pcursor, CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags = DB_NEXT)
+    int ReadAtCursor(CDBCursor* pcursor, CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags = DB_NEXT)
     {
+        if (pcursor->plog)
+            return ReadAtLogCursor(pcursor, ssKey, ssValue, fFlags);
+
         // Read at cursor
         Dbt datKey;
         if (fFlags == DB_SET || fFlags == DB_SET_RANGE || fFlags == DB_GET_BOTH || fFlags == DB_GET_BOTH_RANGE) {
@@ -241,7 +297,7 @@ protected:
         }
         datKey.set_flags(DB_DBT_MALLOC);
         datValue.set_flags(DB_DBT_MALLOC);
-        int ret = pcursor->get(&datKey, &datValue, fFlags);
+        int ret = pcursor->pcursor->get(&datKey, &datValue, fFlags);
         if (ret != 0)
             return ret;
         else if (datKey.get_data() == NULL || datValue.get_data() == NULL)
@@ -266,6 +322,12 @@ protected:
 public:
     bool TxnBegin()
     {
+        if (plog) {
+            if (logTxn)
+                return false;
+            logTxn.emplace();
+            return true;
+        }
         if (!pdb || activeTxn)
             return false;
         DbTxn* ptxn = bitdb.TxnBegin();
@@ -277,6 +339,13 @@ public:
 
     bool TxnCommit()
     {
+        if (plog) {
+            if (!logTxn)
+                return false;
+            bool ret = plog->Write(*logTxn);
+            logTxn.reset();
+            return ret;
+        }
         if (!pdb || !activeTxn)
             return false;
         int ret = activeTxn->commit(0);
@@ -286,6 +355,12 @@ public:
 
     bool TxnAbort()
     {
+        if (plog) {
+            if (!logTxn)
+                return false;
+            logTxn.reset();
+            return true;
+        }
         if (!pdb || !activeTxn)
             return false;
         int ret = activeTxn->abort();
@@ -305,6 +380,14 @@ public:
     }
 
     bool static Rewrite(const std::string& strFile, const char* pszSkip = NULL);
+    /** Whether strFile is, or will be created as, a log store rather than a Berkeley database. */
+    bool static IsLogStore(const std::string& strFile);
+    /**
+     * Move strFile to the backend chosen by -walletbackend, if it is kept in
+     * the other one, leaving the original behind as a backup.
+     * This must be called BEFORE strFile is opened.
+     */
+    bool static Migrate(const std::string& strFile);
 };
 
 #endif // BITCOIN_WALLET_DB_H
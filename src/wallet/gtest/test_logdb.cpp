@@ -0,0 +1,555 @@
+#include <gtest/gtest.h>
+
+#include "fs.h"
+#include "util.h"
+#include "wallet/db.h"
+#include "wallet/logdb.h"
+#include "wallet/wallet.h"
+#include "wallet/walletdb.h"
+
+#include <memory>
+#include <string>
+#include <thread>
+
+static CLogDB::Key K(const std::string& s)
+{
+    return CLogDB::Key(s.begin(), s.end());
+}
+
+static CLogDB::Value V(const std::string& s)
+{
+    return CLogDB::Value(s.begin(), s.end());
+}
+
+/** A log path in a temporary directory that is removed with it. */
+class TempLogPath
+{
+public:
+    fs::path dir;
+    fs::path path;
+
+    TempLogPath() : dir(fs::temp_directory_path() / fs::unique_path()), path(dir / "wallet.dat")
+    {
+        fs::create_directories(dir);
+    }
+    ~TempLogPath() { fs::remove_all(dir); }
+    operator const fs::path&() const { return path; }
+};
+
+static void FlipByte(const fs::path& path, uint64_t nPos)
+{
+    FILE* file = fsbridge::fopen(path, "rb+");
+    ASSERT_TRUE(file != nullptr);
+    fseek(file, nPos, SEEK_SET);
+    int c = fgetc(file);
+    fseek(file, nPos, SEEK_SET);
+    fputc(c ^ 0xff, file);
+    fclose(file);
+}
+
+TEST(LogDBTest, RecordsSurviveReopen) {
+    TempLogPath path;
+    {
+        CLogDB db(path);
+        ASSERT_TRUE(db.Open(true));
+        CLogDB::Batch batch;
+        batch[K("a")] = V("1");
+        batch[K("b")] = V("2");
+        ASSERT_TRUE(db.Write(batch));
+
+        CLogDB::Batch batch2;
+        batch2[K("a")] = V("3");
+        batch2[K("b")] = std::nullopt;
+        ASSERT_TRUE(db.Write(batch2));
+    }
+    EXPECT_TRUE(CLogDB::IsLogFile(path));
+
+    CLogDB db(path);
+    ASSERT_TRUE(db.Open(false));
+    CLogDB::Value value;
+    ASSERT_TRUE(db.Read(K("a"), value));
+    EXPECT_EQ(V("3"), value);
+    EXPECT_FALSE(db.Exists(K("b")));
+    EXPECT_EQ(1, db.GetRecordCount());
+}
+
+TEST(LogDBTest, OpenWithoutCreate) {
+    TempLogPath path;
+    CLogDB db(path);
+    EXPECT_FALSE(db.Open(false));
+    EXPECT_FALSE(CLogDB::IsLogFile(path));
+}
+
+TEST(LogDBTest, TornBatchIsDropped) {
+    TempLogPath path;
+    uint64_t nFirstBatch;
+    {
+        CLogDB db(path);
+        ASSERT_TRUE(db.Open(true));
+        CLogDB::Batch batch;
+        batch[K("a")] = V("1");
+        ASSERT_TRUE(db.Write(batch));
+        nFirstBatch = db.GetLogBytes();
+
+        CLogDB::Batch batch2;
+        batch2[K("b")] = V("2");
+        ASSERT_TRUE(db.Write(batch2));
+    }
+
+    // Cut the second batch short, as a crash in the middle of a write would
+    uint64_t nTornBytes = fs::file_size(path) - 1;
+    fs::resize_file(path, nTornBytes);
+    EXPECT_TRUE(CLogDB::Verify(path));
+
+    CLogDB db(path);
+    ASSERT_TRUE(db.Open(false));
+    EXPECT_TRUE(db.Exists(K("a")));
+    EXPECT_FALSE(db.Exists(K("b")));
+    EXPECT_EQ(nFirstBatch, db.GetLogBytes());
+    EXPECT_EQ(nFirstBatch, fs::file_size(path));
+
+    // What was dropped is kept beside the log
+    unsigned int nSaved = 0;
+    for (fs::directory_iterator it(path.dir); it != fs::directory_iterator(); ++it) {
+        if (it->path().filename().string().find("wallet.dat.torn.") == 0) {
+            EXPECT_EQ(nTornBytes - nFirstBatch, fs::file_size(it->path()));
+            nSaved++;
+        }
+    }
+    EXPECT_EQ(1, nSaved);
+
+    // Writes carry on from the last good batch
+    CLogDB::Batch batch;
+    batch[K("c")] = V("3");
+    ASSERT_TRUE(db.Write(batch));
+    db.Close();
+    ASSERT_TRUE(db.Open(false));
+    EXPECT_TRUE(db.Exists(K("a")));
+    EXPECT_TRUE(db.Exists(K("c")));
+}
+
+TEST(LogDBTest, CorruptBatchIsKeptForSalvage) {
+    TempLogPath path;
+    uint64_t nFirstBatch = 0;
+    {
+        CLogDB db(path);
+        ASSERT_TRUE(db.Open(true));
+        for (const std::string& key : {"a", "b", "c"}) {
+            CLogDB::Batch batch;
+            batch[K(key)] = V(key);
+            ASSERT_TRUE(db.Write(batch));
+            if (key == "a")
+                nFirstBatch = db.GetLogBytes();
+        }
+    }
+    uint64_t nFileBytes = fs::file_size(path);
+
+    // Damage the middle batch, which has another after it
+    FlipByte(path, nFirstBatch + 10);
+    EXPECT_FALSE(CLogDB::Verify(path));
+    {
+        CLogDB db(path);
+        EXPECT_FALSE(db.Open(false));
+    }
+    EXPECT_EQ(nFileBytes, fs::file_size(path));
+
+    fs::path pathBackup = path.dir / "wallet.dat.bak";
+    ASSERT_TRUE(CLogDB::Salvage(path, pathBackup));
+    EXPECT_EQ(nFileBytes, fs::file_size(pathBackup));
+    EXPECT_TRUE(CLogDB::Verify(path));
+
+    CLogDB db(path);
+    ASSERT_TRUE(db.Open(false));
+    EXPECT_TRUE(db.Exists(K("a")));
+    EXPECT_FALSE(db.Exists(K("b")));
+    EXPECT_TRUE(db.Exists(K("c")));
+}
+
+TEST(LogDBTest, DamagedBatchSizeIsNotTakenForTorn) {
+    TempLogPath path;
+    uint64_t nFirstBatch = 0;
+    {
+        CLogDB db(path);
+        ASSERT_TRUE(db.Open(true));
+        for (const std::string& key : {"a", "b", "c", "d"}) {
+            CLogDB::Batch batch;
+            batch[K(key)] = V(key);
+            ASSERT_TRUE(db.Write(batch));
+            if (key == "a")
+                nFirstBatch = db.GetLogBytes();
+        }
+    }
+    uint64_t nFileBytes = fs::file_size(path);
+
+    // The top byte of the second batch's size, making it point past the end
+    // of the file, as a torn append would
+    FlipByte(path, nFirstBatch + 3);
+    EXPECT_FALSE(CLogDB::Verify(path));
+    {
+        CLogDB db(path);
+        EXPECT_FALSE(db.Open(false));
+    }
+    EXPECT_EQ(nFileBytes, fs::file_size(path));
+
+    // Salvage finds the batches after the one whose size can't be trusted
+    fs::path pathBackup = path.dir / "wallet.dat.bak";
+    ASSERT_TRUE(CLogDB::Salvage(path, pathBackup));
+    CLogDB db(path);
+    ASSERT_TRUE(db.Open(false));
+    EXPECT_TRUE(db.Exists(K("a")));
+    EXPECT_FALSE(db.Exists(K("b")));
+    EXPECT_TRUE(db.Exists(K("c")));
+    EXPECT_TRUE(db.Exists(K("d")));
+}
+
+TEST(LogDBTest, ZeroFilledEndIsTorn) {
+    TempLogPath path;
+    uint64_t nBytes;
+    {
+        CLogDB db(path);
+        ASSERT_TRUE(db.Open(true));
+        CLogDB::Batch batch;
+        batch[K("a")] = V("1");
+        ASSERT_TRUE(db.Write(batch));
+        nBytes = db.GetLogBytes();
+    }
+
+    // A crash can extend the file without writing what was appended
+    fs::resize_file(path, nBytes + 100);
+    EXPECT_TRUE(CLogDB::Verify(path));
+    CLogDB db(path);
+    ASSERT_TRUE(db.Open(false));
+    EXPECT_TRUE(db.Exists(K("a")));
+    EXPECT_EQ(nBytes, fs::file_size(path));
+}
+
+TEST(LogDBTest, CompactKeepsLiveRecords) {
+    TempLogPath path;
+    CLogDB db(path);
+    ASSERT_TRUE(db.Open(true));
+    for (int i = 0; i < 100; i++) {
+        CLogDB::Batch batch;
+        batch[K("key")] = V(std::string(1000, 'a' + i % 26));
+        batch[K("\x04pool" + std::to_string(i % 3))] = V("p");
+        ASSERT_TRUE(db.Write(batch));
+    }
+    uint64_t nBefore = db.GetLogBytes();
+
+    ASSERT_TRUE(db.Compact("\x04pool"));
+    EXPECT_LT(db.GetLogBytes(), nBefore / 10);
+    EXPECT_EQ(db.GetLogBytes(), fs::file_size(path));
+    EXPECT_EQ(1, db.GetRecordCount());
+
+    // The compacted log is what gets read back, and can still be appended to
+    CLogDB::Batch batch;
+    batch[K("other")] = V("x");
+    ASSERT_TRUE(db.Write(batch));
+    db.Close();
+    ASSERT_TRUE(db.Open(false));
+    CLogDB::Value value;
+    ASSERT_TRUE(db.Read(K("key"), value));
+    EXPECT_EQ(V(std::string(1000, 'a' + 99 % 26)), value);
+    EXPECT_TRUE(db.Exists(K("other")));
+    EXPECT_FALSE(db.Exists(K("\x04pool0")));
+    EXPECT_EQ(2, db.GetRecordCount());
+}
+
+TEST(LogDBTest, WritesDuringCompactionAreKept) {
+    TempLogPath path;
+    CLogDB db(path);
+    ASSERT_TRUE(db.Open(true));
+    for (int i = 0; i < 1000; i++) {
+        CLogDB::Batch batch;
+        batch[K("old" + std::to_string(i))] = V(std::string(1000, 'o'));
+        batch[K("\x04pool" + std::to_string(i))] = V("p");
+        ASSERT_TRUE(db.Write(batch));
+    }
+
+    // However the writes fall around the compaction, none of them is lost
+    std::thread writer([&db] {
+        for (int i = 0; i < 1000; i++) {
+            CLogDB::Batch batch;
+            batch[K("new" + std::to_string(i))] = V(std::to_string(i));
+            batch[K("old" + std::to_string(i))] = std::nullopt;
+            batch[K("\x04pool" + std::to_string(i))] = V("q");
+            EXPECT_TRUE(db.Write(batch));
+        }
+    });
+    EXPECT_TRUE(db.Compact("\x04pool"));
+    writer.join();
+
+    for (int i = 0; i < 1000; i++) {
+        CLogDB::Value value;
+        ASSERT_TRUE(db.Read(K("new" + std::to_string(i)), value));
+        EXPECT_EQ(V(std::to_string(i)), value);
+        EXPECT_FALSE(db.Exists(K("old" + std::to_string(i))));
+    }
+    EXPECT_EQ(db.GetLogBytes(), fs::file_size(path));
+    db.Close();
+    ASSERT_TRUE(db.Open(false));
+    size_t nPool = 0;
+    for (int i = 0; i < 1000; i++) {
+        CLogDB::Value value;
+        ASSERT_TRUE(db.Read(K("new" + std::to_string(i)), value));
+        EXPECT_EQ(V(std::to_string(i)), value);
+        if (db.Read(K("\x04pool" + std::to_string(i)), value)) {
+            // Only a pool record written after the compaction started survives it
+            EXPECT_EQ(V("q"), value);
+            nPool++;
+        }
+    }
+    EXPECT_EQ(2000 + nPool, db.GetRecordCount() + 1000);
+}
+
+TEST(LogDBTest, NeedsCompaction) {
+    TempLogPath path;
+    CLogDB db(path);
+    ASSERT_TRUE(db.Open(true));
+    CLogDB::Batch batch;
+    batch[K("key")] = V(std::string(LOGDB_MIN_COMPACT_BYTES / 8, 'x'));
+    for (int i = 0; i < 4; i++) {
+        ASSERT_TRUE(db.Write(batch));
+    }
+    EXPECT_FALSE(db.NeedsCompaction());
+    for (int i = 0; i < 8; i++) {
+        ASSERT_TRUE(db.Write(batch));
+    }
+    EXPECT_TRUE(db.NeedsCompaction());
+
+    ASSERT_TRUE(db.Flush());
+    EXPECT_FALSE(db.NeedsCompaction());
+    EXPECT_EQ(1, db.GetRecordCount());
+}
+
+TEST(LogDBTest, SeekInKeyOrder) {
+    TempLogPath path;
+    CLogDB db(path);
+    ASSERT_TRUE(db.Open(true));
+    CLogDB::Batch batch;
+    batch[K("b")] = V("2");
+    batch[K("a")] = V("1");
+    batch[K("ba")] = V("3");
+    batch[K("c")] = V("4");
+    ASSERT_TRUE(db.Write(batch));
+
+    CLogDB::Key key;
+    CLogDB::Value value;
+    ASSERT_TRUE(db.Seek(K("b"), false, key, value));
+    EXPECT_EQ(K("b"), key);
+    ASSERT_TRUE(db.Seek(key, true, key, value));
+    EXPECT_EQ(K("ba"), key);
+    EXPECT_EQ(V("3"), value);
+    ASSERT_TRUE(db.Seek(key, true, key, value));
+    EXPECT_EQ(K("c"), key);
+    EXPECT_FALSE(db.Seek(key, true, key, value));
+    ASSERT_TRUE(db.Seek(CLogDB::Key(), false, key, value));
+    EXPECT_EQ(K("a"), key);
+}
+
+/** Exposes the record access that CWalletDB is built on. */
+class CTestDB : public CDB
+{
+public:
+    explicit CTestDB(const std::string& strFilename, const char* pszMode = "r+") : CDB(strFilename, pszMode) {}
+
+    using CDB::Erase;
+    using CDB::Exists;
+    using CDB::GetCursor;
+    using CDB::Read;
+    using CDB::ReadAtCursor;
+    using CDB::Write;
+};
+
+/** Wallet files in a fresh data directory, with its own database environment. */
+class LogDBWalletTest : public ::testing::Test
+{
+protected:
+    fs::path pathTemp;
+
+    void SetUp()
+    {
+        bitdb.Flush(true);
+        bitdb.Reset();
+        pathTemp = fs::temp_directory_path() / fs::unique_path();
+        fs::create_directories(pathTemp);
+        mapArgs["-datadir"] = pathTemp.string();
+        ClearDatadirCache();
+        ASSERT_TRUE(bitdb.Open(GetDataDir()));
+    }
+
+    void TearDown()
+    {
+        logdb.Flush(true);
+        bitdb.Flush(true);
+        bitdb.Reset();
+        fWalletLogBackend = false;
+        mapArgs.erase("-walletbackend");
+        mapArgs.erase("-datadir");
+        ClearDatadirCache();
+        fs::remove_all(pathTemp);
+    }
+};
+
+TEST_F(LogDBWalletTest, RecordsAndTransactions) {
+    fWalletLogBackend = true;
+    {
+        CTestDB db("test.dat", "cr+");
+        EXPECT_TRUE(db.Exists(std::string("version")));
+
+        int n;
+        EXPECT_TRUE(db.Write(std::string("a"), 1));
+        EXPECT_FALSE(db.Write(std::string("a"), 2, false));
+        ASSERT_TRUE(db.Read(std::string("a"), n));
+        EXPECT_EQ(1, n);
+        EXPECT_TRUE(db.Erase(std::string("a")));
+        EXPECT_FALSE(db.Exists(std::string("a")));
+        EXPECT_FALSE(db.Read(std::string("a"), n));
+
+        // A transaction sees its own writes, and the log only gets them on commit
+        ASSERT_TRUE(db.TxnBegin());
+        EXPECT_TRUE(db.Write(std::string("b"), 2));
+        ASSERT_TRUE(db.Read(std::string("b"), n));
+        EXPECT_EQ(2, n);
+        ASSERT_TRUE(db.TxnAbort());
+        EXPECT_FALSE(db.Exists(std::string("b")));
+
+        ASSERT_TRUE(db.TxnBegin());
+        EXPECT_TRUE(db.Write(std::string("b"), 3));
+        EXPECT_TRUE(db.Write(std::string("c"), 4));
+        EXPECT_TRUE(db.Erase(std::string("c")));
+        EXPECT_FALSE(db.Exists(std::string("c")));
+        ASSERT_TRUE(db.TxnCommit());
+    }
+    EXPECT_TRUE(CLogDB::IsLogFile(GetDataDir() / "test.dat"));
+    EXPECT_EQ(0, bitdb.mapFileUseCount.count("test.dat"));
+
+    // Read back from the file
+    logdb.Close("test.dat");
+    CTestDB db("test.dat");
+    int n;
+    ASSERT_TRUE(db.Read(std::string("b"), n));
+    EXPECT_EQ(3, n);
+    EXPECT_FALSE(db.Exists(std::string("c")));
+}
+
+TEST_F(LogDBWalletTest, CursorWalksInKeyOrder) {
+    fWalletLogBackend = true;
+    CTestDB db("test.dat", "cr+");
+    ASSERT_TRUE(db.Write(std::string("c"), 3));
+    ASSERT_TRUE(db.Write(std::string("a"), 1));
+    ASSERT_TRUE(db.Write(std::string("b"), 2));
+
+    std::unique_ptr<CDBCursor> pcursor(db.GetCursor());
+    ASSERT_TRUE(pcursor != nullptr);
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+    ssKey << std::string("b");
+    unsigned int fFlags = DB_SET_RANGE;
+    std::vector<std::string> keys;
+    while (true) {
+        int ret = db.ReadAtCursor(pcursor.get(), ssKey, ssValue, fFlags);
+        fFlags = DB_NEXT;
+        if (ret == DB_NOTFOUND)
+            break;
+        ASSERT_EQ(0, ret);
+        std::string key;
+        ssKey >> key;
+        keys.push_back(key);
+    }
+    EXPECT_EQ(std::vector<std::string>({"b", "c", "version"}), keys);
+}
+
+TEST_F(LogDBWalletTest, WalletDBRoundTrip) {
+    fWalletLogBackend = true;
+    {
+        CWalletDB walletdb("wallet.dat", "cr+");
+        CKeyPool keypool;
+        keypool.nTime = 42;
+        ASSERT_TRUE(walletdb.WritePool(1, keypool));
+        ASSERT_TRUE(walletdb.WritePool(2, keypool));
+        ASSERT_TRUE(walletdb.ErasePool(2));
+
+        CAccountingEntry entry;
+        entry.strAccount = "a";
+        entry.nCreditDebit = 5;
+        ASSERT_TRUE(walletdb.WriteAccountingEntry(entry));
+        entry.nCreditDebit = 7;
+        ASSERT_TRUE(walletdb.WriteAccountingEntry(entry));
+        entry.strAccount = "b";
+        ASSERT_TRUE(walletdb.WriteAccountingEntry(entry));
+    }
+    logdb.Close("wallet.dat");
+
+    CWalletDB walletdb("wallet.dat");
+    CKeyPool keypool;
+    ASSERT_TRUE(walletdb.ReadPool(1, keypool));
+    EXPECT_EQ(42, keypool.nTime);
+    EXPECT_FALSE(walletdb.ReadPool(2, keypool));
+    EXPECT_EQ(12, walletdb.GetAccountCreditDebit("a"));
+    std::list<CAccountingEntry> entries;
+    walletdb.ListAccountCreditDebit("*", entries);
+    EXPECT_EQ(3, entries.size());
+
+    // A backup is a log store with the same records
+    fs::create_directories(pathTemp / "backups");
+    CWallet wallet("wallet.dat");
+    ASSERT_TRUE(BackupWallet(wallet, (pathTemp / "backups").string()));
+    fs::path pathBackup = pathTemp / "backups" / "wallet.dat";
+    EXPECT_TRUE(CLogDB::IsLogFile(pathBackup));
+    CLogDB backup(pathBackup);
+    ASSERT_TRUE(backup.Open(false));
+    EXPECT_EQ(logdb.Open("wallet.dat", false)->GetRecordCount(), backup.GetRecordCount());
+}
+
+TEST_F(LogDBWalletTest, MigrateBothWays) {
+    fs::path path = GetDataDir() / "wallet.dat";
+    {
+        CWalletDB walletdb("wallet.dat", "cr+");
+        CKeyPool keypool;
+        keypool.nTime = 42;
+        ASSERT_TRUE(walletdb.WritePool(1, keypool));
+        CAccountingEntry entry;
+        entry.strAccount = "a";
+        entry.nCreditDebit = 5;
+        ASSERT_TRUE(walletdb.WriteAccountingEntry(entry));
+    }
+    ASSERT_FALSE(CLogDB::IsLogFile(path));
+
+    // Without -walletbackend a wallet stays where it is
+    fWalletLogBackend = true;
+    ASSERT_TRUE(CDB::Migrate("wallet.dat"));
+    EXPECT_FALSE(CLogDB::IsLogFile(path));
+
+    mapArgs["-walletbackend"] = "log";
+    ASSERT_TRUE(CDB::Migrate("wallet.dat"));
+    EXPECT_TRUE(CLogDB::IsLogFile(path));
+    {
+        CWalletDB walletdb("wallet.dat");
+        CKeyPool keypool;
+        ASSERT_TRUE(walletdb.ReadPool(1, keypool));
+        EXPECT_EQ(42, keypool.nTime);
+        EXPECT_EQ(5, walletdb.GetAccountCreditDebit("a"));
+    }
+
+    mapArgs["-walletbackend"] = "bdb";
+    fWalletLogBackend = false;
+    ASSERT_TRUE(CDB::Migrate("wallet.dat"));
+    EXPECT_FALSE(CLogDB::IsLogFile(path));
+    EXPECT_FALSE(logdb.IsOpen("wallet.dat"));
+    {
+        CWalletDB walletdb("wallet.dat");
+        CKeyPool keypool;
+        ASSERT_TRUE(walletdb.ReadPool(1, keypool));
+        EXPECT_EQ(42, keypool.nTime);
+        EXPECT_EQ(5, walletdb.GetAccountCreditDebit("a"));
+    }
+
+    // Each move left the original behind, and nothing under the temporary name
+    EXPECT_FALSE(fs::exists(GetDataDir() / "wallet.dat.migrate"));
+    int nBackups = 0;
+    for (fs::directory_iterator it(GetDataDir()); it != fs::directory_iterator(); ++it) {
+        if (it->path().extension() == ".bak")
+            nBackups++;
+    }
+    EXPECT_EQ(2, nBackups);
+}
@@ -11,6 +11,7 @@
 #include "transaction_builder.h"
 #include "utiltest.h"
 #include "wallet/wallet.h"
+#include "wallet/witnessupdate.h"
 #include "zcash/JoinSplit.hpp"
 #include "zcash/Note.hpp"
 #include "zcash/NoteEncryption.hpp"
@@ -323,6 +324,134 @@ TEST(WalletTests, FindUnspentSproutNotes) {
     RegtestDeactivateSapling();
 }
 
+TEST(WalletTests, GetFilteredNotesByAddress) {
+    CWallet wallet;
+    LOCK2(cs_main, wallet.cs_wallet);
+
+    auto sk1 = libzcash::SproutSpendingKey::random();
+    auto sk2 = libzcash::SproutSpendingKey::random();
+    wallet.AddSproutSpendingKey(sk1);
+    wallet.AddSproutSpendingKey(sk2);
+
+    auto addNote = [&](const libzcash::SproutSpendingKey& sk, CAmount value) {
+        auto wtx = GetValidSproutReceive(sk, value, true);
+        auto note = GetSproutNote(sk, wtx, 0, 1);
+        mapSproutNoteData_t noteData;
+        noteData[JSOutPoint {wtx.GetHash(), 0, 1}] = SproutNoteData {sk.address(), note.nullifier(sk)};
+        wtx.SetSproutNoteData(noteData);
+        wallet.AddToWallet(wtx, true, NULL);
+    };
+    addNote(sk1, 10);
+    addNote(sk2, 20);
+    addNote(sk2, 30);
+
+    std::vector<SproutNoteEntry> sproutEntries;
+    std::vector<SaplingNoteEntry> saplingEntries;
+    std::set<libzcash::PaymentAddress> filter;
+    wallet.GetFilteredNotes(sproutEntries, saplingEntries, filter, -1);
+    EXPECT_EQ(3, sproutEntries.size());
+
+    sproutEntries.clear();
+    filter.insert(sk2.address());
+    wallet.GetFilteredNotes(sproutEntries, saplingEntries, filter, -1);
+    ASSERT_EQ(2, sproutEntries.size());
+    EXPECT_EQ(sk2.address(), sproutEntries[0].address);
+    EXPECT_EQ(sk2.address(), sproutEntries[1].address);
+    EXPECT_EQ(-1, sproutEntries[0].confirmations);
+    EXPECT_EQ(50, sproutEntries[0].note.value() + sproutEntries[1].note.value());
+
+    // A note added after the cache was filled is picked up
+    addNote(sk1, 40);
+    sproutEntries.clear();
+    filter.clear();
+    filter.insert(sk1.address());
+    wallet.GetFilteredNotes(sproutEntries, saplingEntries, filter, -1);
+    EXPECT_EQ(2, sproutEntries.size());
+}
+
+TEST(WalletTests, UnspentOutputsFollowSpendsInMainChain) {
+    TestWallet wallet;
+    LOCK2(cs_main, wallet.cs_wallet);
+
+    CKey tsk = AddTestCKeyToKeyStore(wallet);
+    auto scriptPubKey = GetScriptForDestination(tsk.GetPubKey().GetID());
+    CScript scriptOther = GetScriptForDestination(CKeyID(uint160(ParseHex("0102030405060708090a0b0c0d0e0f1011121314"))));
+
+    // A transaction paying us and someone else
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    mtx.vout.resize(2);
+    mtx.vout[0].nValue = 5 * COIN;
+    mtx.vout[0].scriptPubKey = scriptPubKey;
+    mtx.vout[1].nValue = 3 * COIN;
+    mtx.vout[1].scriptPubKey = scriptOther;
+    CWalletTx wtx {&wallet, mtx};
+    wallet.AddToWallet(wtx, true, NULL);
+
+    // Fake-mine it
+    EXPECT_EQ(-1, chainActive.Height());
+    CBlock block;
+    block.vtx.push_back(wtx);
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    auto blockHash = block.GetHash();
+    CBlockIndex fakeIndex {block};
+    mapBlockIndex.insert(std::make_pair(blockHash, &fakeIndex));
+    chainActive.SetTip(&fakeIndex);
+    wtx.SetMerkleBranch(block);
+    wallet.AddToWallet(wtx, true, NULL);
+
+    // Only our own output counts
+    std::vector<COutput> vCoins;
+    wallet.AvailableCoins(vCoins);
+    ASSERT_EQ(1, vCoins.size());
+    EXPECT_EQ(wtx.GetHash(), vCoins[0].tx->GetHash());
+    EXPECT_EQ(0, vCoins[0].i);
+    EXPECT_EQ(5 * COIN, wallet.GetBalance());
+
+    // Spend it to someone else, and fake-mine the spend
+    CMutableTransaction mtxSpend;
+    mtxSpend.vin.resize(1);
+    mtxSpend.vin[0].prevout = COutPoint(wtx.GetHash(), 0);
+    mtxSpend.vout.resize(1);
+    mtxSpend.vout[0].nValue = 5 * COIN;
+    mtxSpend.vout[0].scriptPubKey = scriptOther;
+    CWalletTx wtxSpend {&wallet, mtxSpend};
+    CBlock block2;
+    block2.vtx.push_back(wtxSpend);
+    block2.hashMerkleRoot = block2.BuildMerkleTree();
+    block2.hashPrevBlock = blockHash;
+    auto blockHash2 = block2.GetHash();
+    CBlockIndex fakeIndex2 {block2};
+    mapBlockIndex.insert(std::make_pair(blockHash2, &fakeIndex2));
+    fakeIndex2.nHeight = 1;
+    fakeIndex2.pprev = &fakeIndex;
+    chainActive.SetTip(&fakeIndex2);
+    wtxSpend.SetMerkleBranch(block2);
+    wallet.AddToWallet(wtxSpend, true, NULL);
+    wallet.MarkAffectedTransactionsDirty(wtxSpend);
+
+    wallet.AvailableCoins(vCoins);
+    EXPECT_EQ(0, vCoins.size());
+    EXPECT_EQ(0, wallet.GetBalance());
+
+    // Disconnect the block of the spend; once the wallet hears about it, the
+    // output is unspent again
+    chainActive.SetTip(&fakeIndex);
+    wallet.AddToWallet(wtxSpend, true, NULL);
+    wallet.MarkAffectedTransactionsDirty(wtxSpend);
+
+    wallet.AvailableCoins(vCoins);
+    ASSERT_EQ(1, vCoins.size());
+    EXPECT_EQ(wtx.GetHash(), vCoins[0].tx->GetHash());
+    EXPECT_EQ(5 * COIN, wallet.GetBalance());
+
+    // Tear down
+    chainActive.SetTip(NULL);
+    mapBlockIndex.erase(blockHash);
+    mapBlockIndex.erase(blockHash2);
+}
+
 
 TEST(WalletTests, SetSproutNoteAddrsInCWalletTx) {
     auto sk = libzcash::SproutSpendingKey::random();
@@ -525,6 +654,118 @@ TEST(WalletTests, FindMySaplingNotes) {
     RegtestDeactivateSapling();
 }
 
+TEST(WalletTests, FindMySaplingNotesWithManyKeys) {
+    auto consensusParams = RegtestActivateSapling();
+
+    TestWallet wallet;
+    LOCK(wallet.cs_wallet);
+
+    auto sk = GetTestMasterSaplingSpendingKey();
+    auto expsk = sk.expsk;
+    auto extfvk = sk.ToXFVK();
+    auto pa = sk.DefaultAddress();
+
+    auto testNote = GetTestSaplingNote(pa, 50000);
+
+    auto builder = TransactionBuilder(consensusParams, 1);
+    builder.AddSaplingSpend(expsk, testNote.note, testNote.tree.root(), testNote.tree.witness());
+    builder.AddSaplingOutput(extfvk.fvk.ovk, pa, 25000, {});
+    auto tx = builder.Build().GetTxOrThrow();
+
+    // Bury the matching key among enough others that the trials are split
+    // into several jobs per output
+    for (uint32_t i = 0; i < 100; i++) {
+        ASSERT_TRUE(wallet.AddSaplingZKey(sk.Derive(i)));
+    }
+    ASSERT_TRUE(wallet.AddSaplingZKey(sk));
+    auto ivk = extfvk.fvk.in_viewing_key();
+
+    // Serially, in parallel (the master alone drains the queue here), and
+    // from a block prefetch, the same notes are found with the same ivk
+    CBlock block;
+    block.vtx.push_back(tx);
+    for (int nThreads : {0, 4}) {
+        nWalletWorkerThreads = nThreads;
+        auto noteMap = wallet.FindMySaplingNotes(tx, 1).first;
+        ASSERT_EQ(2, noteMap.size());
+        for (const auto& nd : noteMap) {
+            EXPECT_EQ(ivk, nd.second.ivk);
+        }
+
+        wallet.PrefetchSaplingDecryptions(block, 1);
+        auto prefetchedNoteMap = wallet.FindMySaplingNotes(tx, 1).first;
+        ASSERT_EQ(2, prefetchedNoteMap.size());
+        for (const auto& nd : prefetchedNoteMap) {
+            EXPECT_EQ(ivk, nd.second.ivk);
+        }
+    }
+    nWalletWorkerThreads = 0;
+
+    // Revert to default
+    RegtestDeactivateSapling();
+}
+
+TEST(WalletTests, AdvanceNoteWitnesses) {
+    // Witnesses of notes at every position of a tree, and the next block
+    SproutMerkleTree tree;
+    std::vector<SproutWitness> witnesses;
+    for (size_t i = 0; i < 100; i++) {
+        tree.append(GetRandHash());
+        for (SproutWitness& witness : witnesses) {
+            witness.append(tree.last());
+        }
+        witnesses.push_back(tree.witness());
+    }
+    std::vector<uint256> block;
+    for (size_t i = 0; i < 10; i++) {
+        block.push_back(GetRandHash());
+    }
+
+    // As BuildWitnessCache does, most notes share the block's frontier and
+    // the rest are advanced on their own
+    SproutWitnessSet shared(tree);
+    std::vector<const SproutWitness*> vUnshared;
+    std::vector<SproutWitness> expected;
+    for (size_t i = 0; i < witnesses.size(); i++) {
+        if (i % 3 == 0) {
+            vUnshared.push_back(&witnesses[i]);
+        } else {
+            shared.add(witnesses[i]);
+            expected.push_back(witnesses[i]);
+        }
+    }
+    for (const SproutWitness* witness : vUnshared) {
+        expected.push_back(*witness);
+    }
+    for (SproutWitness& witness : expected) {
+        for (const uint256& cm : block) {
+            witness.append(cm);
+        }
+    }
+    for (const uint256& cm : block) {
+        shared.append(cm);
+    }
+
+    // Serially, and in parallel with the master alone draining the queue,
+    // every note ends up with the witness appending the block would give it
+    std::vector<SproutWitness> serial;
+    for (int nThreads : {0, 4}) {
+        nWalletWorkerThreads = nThreads;
+        std::vector<SproutWitness> updated = AdvanceNoteWitnesses(shared, vUnshared, block);
+        ASSERT_EQ(expected.size(), updated.size());
+        for (size_t i = 0; i < expected.size(); i++) {
+            EXPECT_TRUE(expected[i] == updated[i]);
+            EXPECT_EQ(expected[i].root(), updated[i].root());
+        }
+        if (nThreads == 0) {
+            serial = updated;
+        } else {
+            EXPECT_TRUE(serial == updated);
+        }
+    }
+    nWalletWorkerThreads = 0;
+}
+
 TEST(WalletTests, FindMySproutNotes) {
     CWallet wallet;
     LOCK(wallet.cs_wallet);
@@ -0,0 +1,694 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "wallet/logdb.h"
+
+#include "clientversion.h"
+#include "crypto/common.h"
+#include "hash.h"
+#include "streams.h"
+#include "util.h"
+
+#include <limits>
+#include <string.h>
+
+CLogDBEnv logdb;
+
+/** The first bytes of every log store. */
+static const unsigned char LOGDB_MAGIC[8] = {'G', 'L', 'M', 'W', 'L', 'O', 'G', 0x01};
+/**
+ * Each batch starts with the size of its records, their checksum, and a
+ * checksum of those two, so that a damaged size is never trusted.
+ */
+static const size_t LOGDB_BATCH_HEADER_SIZE = 12;
+
+enum LogRecordType : uint8_t {
+    LOGDB_PUT = 1,
+    LOGDB_ERASE = 2,
+};
+
+enum LogBatchStatus {
+    BATCH_OK,
+    //! No more batches
+    BATCH_END,
+    //! A bad batch running to the end of the file, as an interrupted append leaves
+    BATCH_TORN,
+    //! A bad batch with more of the log after it
+    BATCH_CORRUPT,
+};
+
+static uint32_t BatchChecksum(const CSerializeData& data)
+{
+    return ReadLE32(Hash(data.begin(), data.end()).begin());
+}
+
+static uint32_t HeaderChecksum(const unsigned char* header)
+{
+    return ReadLE32(Hash(header, header + 8).begin());
+}
+
+/** How many of the next nMax bytes from where file is positioned are zero before the first that is not. */
+static uint64_t CountZeroBytes(FILE* file, uint64_t nMax)
+{
+    unsigned char buf[4096];
+    uint64_t nZero = 0;
+    while (nZero < nMax) {
+        size_t nRead = std::min<uint64_t>(nMax - nZero, sizeof(buf));
+        if (fread(buf, 1, nRead, file) != nRead)
+            break;
+        for (size_t i = 0; i < nRead; i++) {
+            if (buf[i] != 0)
+                return nZero + i;
+        }
+        nZero += nRead;
+    }
+    return nZero;
+}
+
+static uint64_t RecordBytes(const CLogDB::Key& key, const CLogDB::RecordPos& pos)
+{
+    return key.size() + pos.nSize;
+}
+
+/** Read the value at pos in file. */
+static bool ReadValue(FILE* file, const CLogDB::RecordPos& pos, CLogDB::Value& value)
+{
+    value.resize(pos.nSize);
+    return fseek(file, pos.nPos, SEEK_SET) == 0 && fread(value.data(), 1, pos.nSize, file) == pos.nSize;
+}
+
+/**
+ * Read the batch at nPos, where file is positioned, and where in the file its
+ * values are if pposBatch is set. nBatchBytes is set to
+ * the length of the batch whenever its header checks out, so that a
+ * corrupt batch can be stepped over; a corrupt batch with a damaged header
+ * leaves it 0.
+ *
+ * A batch is only taken for torn when the damage can't be anything but an
+ * append cut short: a header cut off by the end of the file, an intact
+ * header whose records run past it, records ending exactly at it, or a
+ * zero-filled remainder. Anything else is corrupt, with records after it
+ * that must not be dropped.
+ */
+static LogBatchStatus ReadBatch(FILE* file, uint64_t nPos, uint64_t nFileBytes, CLogDB::Batch& batch, uint64_t& nBatchBytes,
+                                CLogDB::PosBatch* pposBatch = nullptr)
+{
+    batch.clear();
+    if (pposBatch)
+        pposBatch->clear();
+    nBatchBytes = 0;
+    if (nPos >= nFileBytes)
+        return BATCH_END;
+
+    unsigned char header[LOGDB_BATCH_HEADER_SIZE];
+    if (nFileBytes - nPos < sizeof(header) || fread(header, 1, sizeof(header), file) != sizeof(header))
+        return BATCH_TORN;
+    if (HeaderChecksum(header) != ReadLE32(header + 8)) {
+        // A crash can leave the end of the file zero-filled
+        bool fZero = true;
+        for (unsigned char c : header)
+            fZero &= c == 0;
+        uint64_t nRest = nFileBytes - nPos - sizeof(header);
+        return fZero && CountZeroBytes(file, nRest) == nRest ? BATCH_TORN : BATCH_CORRUPT;
+    }
+    uint32_t nSize = ReadLE32(header);
+    if (nSize > nFileBytes - nPos - sizeof(header))
+        return BATCH_TORN;
+    nBatchBytes = sizeof(header) + nSize;
+    const LogBatchStatus bad = nPos + nBatchBytes == nFileBytes ? BATCH_TORN : BATCH_CORRUPT;
+
+    CSerializeData data(nSize);
+    if (fread(data.data(), 1, nSize, file) != nSize || BatchChecksum(data) != ReadLE32(header + 4))
+        return bad;
+
+    try {
+        CDataStream ssRecords(data.begin(), data.end(), SER_DISK, CLIENT_VERSION);
+        uint64_t nRecords = ReadCompactSize(ssRecords);
+        for (uint64_t i = 0; i < nRecords; i++) {
+            uint8_t nType;
+            CLogDB::Key key;
+            ssRecords >> nType >> key;
+            if (nType == LOGDB_PUT) {
+                CLogDB::Value value;
+                ssRecords >> value;
+                if (pposBatch) {
+                    uint64_t nEnd = nPos + sizeof(header) + nSize - ssRecords.size();
+                    (*pposBatch)[key] = CLogDB::RecordPos{nEnd - value.size(), (uint32_t)value.size()};
+                }
+                batch[key] = std::move(value);
+            } else if (nType == LOGDB_ERASE) {
+                if (pposBatch)
+                    (*pposBatch)[key] = std::nullopt;
+                batch[key] = std::nullopt;
+            } else {
+                throw std::ios_base::failure("unknown record type");
+            }
+        }
+    } catch (const std::exception& e) {
+        // The checksum matched, so this was written this way
+        LogPrintf("ReadBatch: bad records at %u: %s\n", nPos, e.what());
+        batch.clear();
+        if (pposBatch)
+            pposBatch->clear();
+        return BATCH_CORRUPT;
+    }
+    return BATCH_OK;
+}
+
+/** Copy the bytes of file from nPos up to nEnd to a new file at pathOut. */
+static bool CopyTail(FILE* file, uint64_t nPos, uint64_t nEnd, const fs::path& pathOut)
+{
+    FILE* fileOut = fsbridge::fopen(pathOut, "wb");
+    if (!fileOut)
+        return false;
+    bool fSuccess = fseek(file, nPos, SEEK_SET) == 0;
+    unsigned char buf[4096];
+    while (fSuccess && nPos < nEnd) {
+        size_t nRead = std::min<uint64_t>(nEnd - nPos, sizeof(buf));
+        fSuccess = fread(buf, 1, nRead, file) == nRead && fwrite(buf, 1, nRead, fileOut) == nRead;
+        nPos += nRead;
+    }
+    if (fSuccess)
+        FileCommit(fileOut);
+    fclose(fileOut);
+    return fSuccess;
+}
+
+/** Open path for reading its batches, positioned after the magic. */
+static FILE* OpenLogFile(const fs::path& path, const char* pszMode)
+{
+    FILE* file = fsbridge::fopen(path, pszMode);
+    if (!file)
+        return nullptr;
+    unsigned char magic[sizeof(LOGDB_MAGIC)];
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) ||
+        memcmp(magic, LOGDB_MAGIC, sizeof(magic)) != 0) {
+        fclose(file);
+        return nullptr;
+    }
+    return file;
+}
+
+CLogDB::CLogDB(const fs::path& pathIn) : path(pathIn), file(nullptr), nLogBytes(0), nLiveBytes(0), fDirty(false)
+{
+}
+
+CLogDB::~CLogDB()
+{
+    Close();
+}
+
+bool CLogDB::IsLogFile(const fs::path& path)
+{
+    FILE* f = fsbridge::fopen(path, "rb");
+    if (!f)
+        return false;
+    unsigned char magic[sizeof(LOGDB_MAGIC)];
+    bool fLog = fread(magic, 1, sizeof(magic), f) == sizeof(magic) &&
+                memcmp(magic, LOGDB_MAGIC, sizeof(magic)) == 0;
+    fclose(f);
+    return fLog;
+}
+
+bool CLogDB::AppendBatch(FILE* fileOut, const Batch& batch, uint64_t& nBytes, PosBatch& posBatch)
+{
+    posBatch.clear();
+    CDataStream ssRecords(SER_DISK, CLIENT_VERSION);
+    WriteCompactSize(ssRecords, batch.size());
+    for (const auto& record : batch) {
+        ssRecords << uint8_t(record.second ? LOGDB_PUT : LOGDB_ERASE);
+        ssRecords << record.first;
+        if (record.second) {
+            ssRecords << *record.second;
+            uint64_t nEnd = nBytes + LOGDB_BATCH_HEADER_SIZE + ssRecords.size();
+            posBatch[record.first] = RecordPos{nEnd - record.second->size(), (uint32_t)record.second->size()};
+        } else {
+            posBatch[record.first] = std::nullopt;
+        }
+    }
+    CSerializeData data;
+    ssRecords.GetAndClear(data);
+    if (data.size() > std::numeric_limits<uint32_t>::max())
+        return error("CLogDB::AppendBatch: batch of %u bytes is too large", data.size());
+
+    unsigned char header[LOGDB_BATCH_HEADER_SIZE];
+    WriteLE32(header, data.size());
+    WriteLE32(header + 4, BatchChecksum(data));
+    WriteLE32(header + 8, HeaderChecksum(header));
+    if (fwrite(header, 1, sizeof(header), fileOut) != sizeof(header) ||
+        fwrite(data.data(), 1, data.size(), fileOut) != data.size() ||
+        fflush(fileOut) != 0)
+        return false;
+
+    nBytes += sizeof(header) + data.size();
+    return true;
+}
+
+void CLogDB::ApplyBatch(RecordIndex& index, const PosBatch& posBatch, uint64_t& nLive)
+{
+    for (const auto& record : posBatch) {
+        auto it = index.find(record.first);
+        if (it != index.end()) {
+            nLive -= RecordBytes(it->first, it->second);
+            if (!record.second) {
+                index.erase(it);
+                continue;
+            }
+            it->second = *record.second;
+        } else if (record.second) {
+            it = index.emplace(record.first, *record.second).first;
+        } else {
+            continue;
+        }
+        nLive += RecordBytes(it->first, it->second);
+    }
+}
+
+bool CLogDB::Open(bool fCreate)
+{
+    LOCK(cs_log);
+    if (file)
+        return true;
+
+    bool fExists = fs::exists(path);
+    if (!fExists && !fCreate)
+        return error("CLogDB::Open: %s does not exist", path.string());
+
+    file = fsbridge::fopen(path, fExists ? "rb+" : "wb+");
+    if (!file)
+        return error("CLogDB::Open: can't open %s", path.string());
+
+    mapRecords.clear();
+    nLiveBytes = 0;
+    if (!fExists) {
+        if (fwrite(LOGDB_MAGIC, 1, sizeof(LOGDB_MAGIC), file) != sizeof(LOGDB_MAGIC)) {
+            fclose(file);
+            file = nullptr;
+            return error("CLogDB::Open: can't write to %s", path.string());
+        }
+        FileCommit(file);
+        nLogBytes = sizeof(LOGDB_MAGIC);
+        return true;
+    }
+
+    unsigned char magic[sizeof(LOGDB_MAGIC)];
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) ||
+        memcmp(magic, LOGDB_MAGIC, sizeof(magic)) != 0) {
+        fclose(file);
+        file = nullptr;
+        return error("CLogDB::Open: %s is not a log store", path.string());
+    }
+
+    // Replay the batches up to the end, or up to a batch torn by a crash
+    const uint64_t nFileBytes = fs::file_size(path);
+    uint64_t nPos = sizeof(LOGDB_MAGIC);
+    LogBatchStatus status;
+    while (true) {
+        Batch batch;
+        PosBatch posBatch;
+        uint64_t nBatchBytes;
+        status = ReadBatch(file, nPos, nFileBytes, batch, nBatchBytes, &posBatch);
+        if (status != BATCH_OK)
+            break;
+        ApplyBatch(mapRecords, posBatch, nLiveBytes);
+        nPos += nBatchBytes;
+    }
+
+    if (status == BATCH_CORRUPT) {
+        // Records after a damaged batch are still there; leave them to Salvage
+        fclose(file);
+        file = nullptr;
+        mapRecords.clear();
+        nLiveBytes = 0;
+        return error("CLogDB::Open: %s is corrupt at offset %u", path.string(), nPos);
+    }
+    if (status == BATCH_TORN) {
+        // Keep what is dropped, should it ever turn out to be more than an
+        // interrupted append
+        fs::path pathTorn = strprintf("%s.torn.%d.bak", path.string(), GetTime());
+        if (!CopyTail(file, nPos, nFileBytes, pathTorn)) {
+            fclose(file);
+            file = nullptr;
+            mapRecords.clear();
+            nLiveBytes = 0;
+            return error("CLogDB::Open: can't save the torn end of %s to %s", path.string(), pathTorn.string());
+        }
+        LogPrintf("CLogDB::Open: dropping a torn batch of %u bytes at the end of %s, saved to %s\n",
+                  nFileBytes - nPos, path.string(), pathTorn.string());
+        if (!TruncateFile(file, nPos)) {
+            fclose(file);
+            file = nullptr;
+            return error("CLogDB::Open: can't truncate %s", path.string());
+        }
+        FileCommit(file);
+    }
+    fseek(file, 0, SEEK_END);
+    nLogBytes = nPos;
+
+    LogPrint("db", "CLogDB::Open: %s has %u records, %u of %u bytes live\n",
+             path.string(), mapRecords.size(), nLiveBytes, nLogBytes);
+    return true;
+}
+
+void CLogDB::Close()
+{
+    LOCK2(cs_compact, cs_log);
+    if (!file)
+        return;
+    FileCommit(file);
+    fclose(file);
+    file = nullptr;
+    mapRecords.clear();
+    nLogBytes = 0;
+    nLiveBytes = 0;
+    fDirty = false;
+}
+
+bool CLogDB::Verify(const fs::path& path)
+{
+    FILE* file = OpenLogFile(path, "rb");
+    if (!file)
+        return error("CLogDB::Verify: %s is not a log store", path.string());
+
+    const uint64_t nFileBytes = fs::file_size(path);
+    uint64_t nPos = sizeof(LOGDB_MAGIC);
+    LogBatchStatus status;
+    while (true) {
+        Batch batch;
+        uint64_t nBatchBytes;
+        status = ReadBatch(file, nPos, nFileBytes, batch, nBatchBytes);
+        if (status != BATCH_OK)
+            break;
+        nPos += nBatchBytes;
+    }
+    fclose(file);
+    if (status == BATCH_CORRUPT)
+        return error("CLogDB::Verify: %s is corrupt at offset %u", path.string(), nPos);
+    return true;
+}
+
+bool CLogDB::Salvage(const fs::path& path, const fs::path& pathBackup)
+{
+    FILE* file = OpenLogFile(path, "rb");
+    if (!file)
+        return error("CLogDB::Salvage: %s is not a log store", path.string());
+
+    fs::path pathSalvage = path.string() + ".salvage";
+    fs::remove(pathSalvage);
+    CLogDB logSalvage(pathSalvage);
+    bool fSuccess = logSalvage.Open(true);
+
+    // Replay every batch that reads back, stepping over the damaged ones
+    const uint64_t nFileBytes = fs::file_size(path);
+    uint64_t nPos = sizeof(LOGDB_MAGIC);
+    unsigned int nSkipped = 0;
+    bool fResyncing = false;
+    while (fSuccess) {
+        Batch batch;
+        uint64_t nBatchBytes;
+        LogBatchStatus status = ReadBatch(file, nPos, nFileBytes, batch, nBatchBytes);
+        if (status == BATCH_END || status == BATCH_TORN)
+            break;
+        if (status == BATCH_CORRUPT && nBatchBytes == 0) {
+            // Without a size to step over the batch, look for the next header
+            // that checks out, crossing zero-filled stretches in one step
+            if (!fResyncing) {
+                LogPrintf("CLogDB::Salvage: skipping a batch with a damaged header at %u in %s\n", nPos, path.string());
+                nSkipped++;
+                fResyncing = true;
+            }
+            fseek(file, nPos, SEEK_SET);
+            uint64_t nZero = CountZeroBytes(file, nFileBytes - nPos);
+            nPos += nZero > LOGDB_BATCH_HEADER_SIZE ? nZero - LOGDB_BATCH_HEADER_SIZE : 1;
+            fseek(file, nPos, SEEK_SET);
+            continue;
+        }
+        fResyncing = false;
+        if (status == BATCH_CORRUPT) {
+            LogPrintf("CLogDB::Salvage: skipping a damaged batch of %u bytes at %u in %s\n", nBatchBytes, nPos, path.string());
+            nSkipped++;
+            nPos += nBatchBytes;
+            fseek(file, nPos, SEEK_SET);
+            continue;
+        }
+        fSuccess = logSalvage.Write(batch);
+        nPos += nBatchBytes;
+    }
+    fclose(file);
+    logSalvage.Close();
+    if (!fSuccess) {
+        fs::remove(pathSalvage);
+        return error("CLogDB::Salvage: can't write %s", pathSalvage.string());
+    }
+
+    try {
+        fs::rename(path, pathBackup);
+    } catch (const fs::filesystem_error& e) {
+        fs::remove(pathSalvage);
+        return error("CLogDB::Salvage: can't rename %s to %s: %s", path.string(), pathBackup.string(), e.what());
+    }
+    if (!RenameOver(pathSalvage, path))
+        return error("CLogDB::Salvage: can't rename %s to %s", pathSalvage.string(), path.string());
+    LogPrintf("CLogDB::Salvage: recovered %s, skipping %u damaged batches; the original is in %s\n",
+              path.string(), nSkipped, pathBackup.string());
+    return true;
+}
+
+bool CLogDB::Read(const Key& key, Value& value) const
+{
+    LOCK(cs_log);
+    auto it = mapRecords.find(key);
+    if (it == mapRecords.end())
+        return false;
+    if (!ReadValue(file, it->second, value))
+        return error("CLogDB::Read: can't read %s at %u", path.string(), it->second.nPos);
+    return true;
+}
+
+bool CLogDB::Exists(const Key& key) const
+{
+    LOCK(cs_log);
+    return mapRecords.count(key) != 0;
+}
+
+bool CLogDB::Seek(const Key& key, bool fAfter, Key& keyOut, Value& valueOut) const
+{
+    LOCK(cs_log);
+    auto it = fAfter ? mapRecords.upper_bound(key) : mapRecords.lower_bound(key);
+    if (it == mapRecords.end())
+        return false;
+    if (!ReadValue(file, it->second, valueOut))
+        return error("CLogDB::Seek: can't read %s at %u", path.string(), it->second.nPos);
+    keyOut = it->first;
+    return true;
+}
+
+bool CLogDB::Write(const Batch& batch)
+{
+    LOCK(cs_log);
+    if (!file)
+        return false;
+    if (batch.empty())
+        return true;
+
+    // Reads leave the file positioned anywhere
+    PosBatch posBatch;
+    if (fseek(file, nLogBytes, SEEK_SET) != 0 || !AppendBatch(file, batch, nLogBytes, posBatch)) {
+        // Don't leave a partial batch for the next write to follow
+        TruncateFile(file, nLogBytes);
+        fseek(file, 0, SEEK_END);
+        return error("CLogDB::Write: can't append to %s", path.string());
+    }
+    fDirty = true;
+    ApplyBatch(mapRecords, posBatch, nLiveBytes);
+    return true;
+}
+
+bool CLogDB::NeedsCompaction() const
+{
+    LOCK(cs_log);
+    return nLogBytes >= LOGDB_MIN_COMPACT_BYTES && nLogBytes > LOGDB_COMPACT_RATIO * nLiveBytes;
+}
+
+bool CLogDB::Commit()
+{
+    LOCK(cs_log);
+    if (!file)
+        return false;
+    if (fDirty) {
+        FileCommit(file);
+        fDirty = false;
+    }
+    return true;
+}
+
+bool CLogDB::Flush()
+{
+    if (NeedsCompaction())
+        return Compact();
+    return Commit();
+}
+
+bool CLogDB::Compact(const char* pszSkip)
+{
+    LOCK(cs_compact);
+    RecordIndex mapLive;
+    uint64_t nSnapshotBytes;
+    {
+        LOCK(cs_log);
+        if (!file)
+            return false;
+        mapLive = mapRecords;
+        nSnapshotBytes = nLogBytes;
+    }
+
+    int64_t nStart = GetTimeMillis();
+    fs::path pathCompact = path.string() + ".compact";
+    FILE* fileCompact = fsbridge::fopen(pathCompact, "wb");
+    if (!fileCompact)
+        return error("CLogDB::Compact: can't create %s", pathCompact.string());
+
+    // Write the live records to a new log; until it is renamed over the old
+    // one, a crash leaves the old log as it was. Nothing before
+    // nSnapshotBytes is written again, so their values are read through a
+    // handle of our own without holding cs_log.
+    RecordIndex mapCompact;
+    uint64_t nCompactBytes = sizeof(LOGDB_MAGIC);
+    uint64_t nCompactLive = 0;
+    FILE* fileIn = fsbridge::fopen(path, "rb");
+    bool fSuccess = fileIn && fwrite(LOGDB_MAGIC, 1, sizeof(LOGDB_MAGIC), fileCompact) == sizeof(LOGDB_MAGIC);
+    Batch batch;
+    PosBatch posBatch;
+    uint64_t nBatchBytes = 0;
+    for (auto it = mapLive.begin(); fSuccess && it != mapLive.end(); ++it) {
+        if (pszSkip && memcmp(it->first.data(), pszSkip, std::min(it->first.size(), strlen(pszSkip))) == 0)
+            continue;
+        Value value;
+        if (!ReadValue(fileIn, it->second, value)) {
+            fSuccess = false;
+            break;
+        }
+        batch.emplace(it->first, std::move(value));
+        nBatchBytes += RecordBytes(it->first, it->second);
+        if (nBatchBytes >= LOGDB_COMPACT_BATCH_BYTES) {
+            fSuccess = AppendBatch(fileCompact, batch, nCompactBytes, posBatch);
+            ApplyBatch(mapCompact, posBatch, nCompactLive);
+            batch.clear();
+            nBatchBytes = 0;
+        }
+    }
+    if (fSuccess && !batch.empty()) {
+        fSuccess = AppendBatch(fileCompact, batch, nCompactBytes, posBatch);
+        ApplyBatch(mapCompact, posBatch, nCompactLive);
+    }
+    if (fileIn)
+        fclose(fileIn);
+    mapLive.clear();
+
+    {
+        LOCK(cs_log);
+        // Copy over what was written meanwhile, keys starting with pszSkip and all
+        uint64_t nPos = nSnapshotBytes;
+        if (fSuccess && nPos < nLogBytes)
+            fSuccess = fseek(file, nPos, SEEK_SET) == 0;
+        while (fSuccess && nPos < nLogBytes) {
+            uint64_t nBytes;
+            fSuccess = ReadBatch(file, nPos, nLogBytes, batch, nBytes) == BATCH_OK &&
+                       AppendBatch(fileCompact, batch, nCompactBytes, posBatch);
+            ApplyBatch(mapCompact, posBatch, nCompactLive);
+            nPos += nBytes;
+        }
+        if (fSuccess)
+            FileCommit(fileCompact);
+        fclose(fileCompact);
+        if (!fSuccess) {
+            fs::remove(pathCompact);
+            return error("CLogDB::Compact: can't write %s", pathCompact.string());
+        }
+
+        fclose(file);
+        file = nullptr;
+        if (!RenameOver(pathCompact, path)) {
+            file = fsbridge::fopen(path, "rb+");
+            if (file)
+                fseek(file, 0, SEEK_END);
+            return error("CLogDB::Compact: can't rename %s over %s", pathCompact.string(), path.string());
+        }
+        file = fsbridge::fopen(path, "rb+");
+        if (!file)
+            return error("CLogDB::Compact: can't reopen %s", path.string());
+        fseek(file, 0, SEEK_END);
+
+        LogPrint("db", "CLogDB::Compact: %s from %u to %u bytes, %u of them written meanwhile, %dms\n",
+                 path.string(), nLogBytes, nCompactBytes, nLogBytes - nSnapshotBytes, GetTimeMillis() - nStart);
+        mapRecords.swap(mapCompact);
+        nLiveBytes = nCompactLive;
+        nLogBytes = nCompactBytes;
+        fDirty = false;
+        return true;
+    }
+}
+
+bool CLogDB::Backup(const fs::path& dest)
+{
+    LOCK(cs_log);
+    if (!file)
+        return false;
+    FileCommit(file);
+    fDirty = false;
+    try {
+        fs::copy_file(path, dest, fs::copy_option::overwrite_if_exists);
+    } catch (const fs::filesystem_error& e) {
+        return error("CLogDB::Backup: can't copy %s to %s: %s", path.string(), dest.string(), e.what());
+    }
+    return true;
+}
+
+uint64_t CLogDB::GetLogBytes() const
+{
+    LOCK(cs_log);
+    return nLogBytes;
+}
+
+size_t CLogDB::GetRecordCount() const
+{
+    LOCK(cs_log);
+    return mapRecords.size();
+}
+
+
+CLogDB* CLogDBEnv::Open(const std::string& strFile, bool fCreate)
+{
+    LOCK(cs_logdb);
+    auto it = mapLogDb.find(strFile);
+    if (it != mapLogDb.end())
+        return it->second.get();
+
+    std::unique_ptr<CLogDB> plog(new CLogDB(GetDataDir() / strFile));
+    if (!plog->Open(fCreate))
+        return nullptr;
+    return mapLogDb.emplace(strFile, std::move(plog)).first->second.get();
+}
+
+bool CLogDBEnv::IsOpen(const std::string& strFile)
+{
+    LOCK(cs_logdb);
+    return mapLogDb.count(strFile) != 0;
+}
+
+void CLogDBEnv::Close(const std::string& strFile)
+{
+    LOCK(cs_logdb);
+    mapLogDb.erase(strFile);
+}
+
+void CLogDBEnv::Flush(bool fShutdown)
+{
+    LOCK(cs_logdb);
+    for (auto& item : mapLogDb) {
+        item.second->Flush();
+    }
+    if (fShutdown)
+        mapLogDb.clear();
+}
@@ -0,0 +1,143 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_WALLET_LOGDB_H
+#define BITCOIN_WALLET_LOGDB_H
+
+#include "fs.h"
+#include "support/allocators/zeroafterfree.h"
+#include "sync.h"
+
+#include <map>
+#include <memory>
+#include <optional>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+/** A log store is only compacted once it has grown past this many bytes. */
+static const uint64_t LOGDB_MIN_COMPACT_BYTES = 1 << 20;
+/** A log store is compacted once it is this many times the size of its live records. */
+static const uint64_t LOGDB_COMPACT_RATIO = 4;
+/** Compaction, and anything else writing many records, uses batches of about this many bytes. */
+static const size_t LOGDB_COMPACT_BATCH_BYTES = 1 << 20;
+
+/**
+ * A key/value store kept as an append-only log of record batches, with the
+ * position of every live record in the file indexed in memory. Values are
+ * read back from the file when they are asked for.
+ *
+ * Every write appends a batch of puts and erases to the end of the file,
+ * checksummed so that a batch torn by a crash at the end of the file is
+ * dropped the next time the log is opened; the dropped bytes are saved
+ * beside the log. The batch header has a checksum of its own, so a damaged
+ * size is never mistaken for a torn batch. A damaged batch with more of the
+ * log after it is not dropped: the log won't open until it is salvaged.
+ * Records are never updated in place, so superseded ones pile up until
+ * Compact rewrites the live records to a new file and renames it over the
+ * old one. Keys are ordered as bytes,
+ * as a Berkeley DB btree orders them.
+ */
+class CLogDB
+{
+public:
+    typedef std::vector<unsigned char> Key;
+    typedef CSerializeData Value;
+    /** Records written together; a key mapped to nullopt is erased. */
+    typedef std::map<Key, std::optional<Value>> Batch;
+    /** Where a value is in the log file. */
+    struct RecordPos {
+        uint64_t nPos;
+        uint32_t nSize;
+    };
+    typedef std::map<Key, RecordPos> RecordIndex;
+    /** Where the values of a batch went; a key mapped to nullopt is erased. */
+    typedef std::map<Key, std::optional<RecordPos>> PosBatch;
+
+private:
+    //! Held throughout a compaction, so that only one runs and the log isn't closed under it
+    CCriticalSection cs_compact;
+    mutable CCriticalSection cs_log;
+    fs::path path;
+    FILE* file;
+    RecordIndex mapRecords;
+    //! Bytes in the log file, and how many of them the live records would take
+    uint64_t nLogBytes;
+    uint64_t nLiveBytes;
+    //! Whether batches were appended since the log was last committed to disk
+    bool fDirty;
+
+    static bool AppendBatch(FILE* fileOut, const Batch& batch, uint64_t& nBytes, PosBatch& posBatch);
+    static void ApplyBatch(RecordIndex& index, const PosBatch& posBatch, uint64_t& nLive);
+
+public:
+    explicit CLogDB(const fs::path& pathIn);
+    ~CLogDB();
+
+    /** Whether the file at path is a log store, rather than a Berkeley DB file. */
+    static bool IsLogFile(const fs::path& path);
+
+    /** Whether the log at path reads back, apart from a torn batch at its end. */
+    static bool Verify(const fs::path& path);
+    /**
+     * Rewrite the log at path from the batches that read back, moving the
+     * original to pathBackup.
+     */
+    static bool Salvage(const fs::path& path, const fs::path& pathBackup);
+
+    /** Read the log into memory, dropping a torn batch at its end. */
+    bool Open(bool fCreate);
+    void Close();
+
+    bool Read(const Key& key, Value& value) const;
+    bool Exists(const Key& key) const;
+    /**
+     * Find the first record with a key not below key, or above it if
+     * fAfter, for cursors that step through the store in key order.
+     */
+    bool Seek(const Key& key, bool fAfter, Key& keyOut, Value& valueOut) const;
+    bool Write(const Batch& batch);
+
+    /** Commit what was written to disk. */
+    bool Commit();
+    /** Commit the log to disk, compacting it first if it has grown enough. */
+    bool Flush();
+    /**
+     * Rewrite the live records to a new log, leaving out keys starting with
+     * pszSkip. Writes carry on while the records are copied; only the
+     * batches written meanwhile are copied with the log locked.
+     */
+    bool Compact(const char* pszSkip = nullptr);
+    bool NeedsCompaction() const;
+    /** Copy a self-contained log to dest. */
+    bool Backup(const fs::path& dest);
+
+    uint64_t GetLogBytes() const;
+    size_t GetRecordCount() const;
+};
+
+/**
+ * The log stores open in the data directory, by file name. Unlike the
+ * Berkeley DB environment there are no environment files to keep: each
+ * store is a single file.
+ */
+class CLogDBEnv
+{
+private:
+    CCriticalSection cs_logdb;
+    std::map<std::string, std::unique_ptr<CLogDB>> mapLogDb;
+
+public:
+    /** The open store for strFile, opening it first if need be. */
+    CLogDB* Open(const std::string& strFile, bool fCreate);
+    bool IsOpen(const std::string& strFile);
+    void Close(const std::string& strFile);
+    /** Flush every open store, and close them all on shutdown. */
+    void Flush(bool fShutdown);
+};
+
+extern CLogDBEnv logdb;
+
+#endif // BITCOIN_WALLET_LOGDB_H
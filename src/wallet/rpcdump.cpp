@@ -589,71 +589,79 @@ UniValue z_importkey(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_WALLET_ENCRYPTION_FAILED, "Error: cannot import private address in an encrypted wallet.");
     }
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
-    EnsureWalletIsUnlocked();
-
-    // Whether to perform rescan after import
-    bool fRescan = true;
-    bool fIgnoreExistingKey = true;
-    if (params.size() > 1) {
-        auto rescan = params[1].get_str();
-        if (rescan.compare("whenkeyisnew") != 0) {
-            fIgnoreExistingKey = false;
-            if (rescan.compare("yes") == 0) {
-                fRescan = true;
-            } else if (rescan.compare("no") == 0) {
-                fRescan = false;
-            } else {
-                // Handle older API
-                UniValue jVal;
-                if (!jVal.read(std::string("[")+rescan+std::string("]")) ||
-                    !jVal.isArray() || jVal.size()!=1 || !jVal[0].isBool()) {
-                    throw JSONRPCError(
-                        RPC_INVALID_PARAMETER,
-                        "rescan must be \"yes\", \"no\" or \"whenkeyisnew\"");
+    UniValue result(UniValue::VOBJ);
+    CBlockIndex* pindexRescan = nullptr;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+
+        EnsureWalletIsUnlocked();
+
+        // Whether to perform rescan after import
+        bool fRescan = true;
+        bool fIgnoreExistingKey = true;
+        if (params.size() > 1) {
+            auto rescan = params[1].get_str();
+            if (rescan.compare("whenkeyisnew") != 0) {
+                fIgnoreExistingKey = false;
+                if (rescan.compare("yes") == 0) {
+                    fRescan = true;
+                } else if (rescan.compare("no") == 0) {
+                    fRescan = false;
+                } else {
+                    // Handle older API
+                    UniValue jVal;
+                    if (!jVal.read(std::string("[")+rescan+std::string("]")) ||
+                        !jVal.isArray() || jVal.size()!=1 || !jVal[0].isBool()) {
+                        throw JSONRPCError(
+                            RPC_INVALID_PARAMETER,
+                            "rescan must be \"yes\", \"no\" or \"whenkeyisnew\"");
+                    }
+                    fRescan = jVal[0].getBool();
                 }
-                fRescan = jVal[0].getBool();
             }
         }
-    }
 
-    // Height to rescan from
-    int nRescanHeight = 0;
-    if (params.size() > 2)
-        nRescanHeight = params[2].get_int();
-    if (nRescanHeight < 0 || nRescanHeight > chainActive.Height()) {
-        throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
-    }
+        // Height to rescan from
+        int nRescanHeight = 0;
+        if (params.size() > 2)
+            nRescanHeight = params[2].get_int();
+        if (nRescanHeight < 0 || nRescanHeight > chainActive.Height()) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
+        }
 
-    KeyIO keyIO(Params());
-    string strSecret = params[0].get_str();
-    auto spendingkey = keyIO.DecodeSpendingKey(strSecret);
-    if (!IsValidSpendingKey(spendingkey)) {
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid spending key");
-    }
+        KeyIO keyIO(Params());
+        string strSecret = params[0].get_str();
+        auto spendingkey = keyIO.DecodeSpendingKey(strSecret);
+        if (!IsValidSpendingKey(spendingkey)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid spending key");
+        }
 
-    auto addrInfo = std::visit(libzcash::AddressInfoFromSpendingKey{}, spendingkey);
-    UniValue result(UniValue::VOBJ);
-    result.pushKV("type", addrInfo.first);
-    result.pushKV("address", keyIO.EncodePaymentAddress(addrInfo.second));
+        auto addrInfo = std::visit(libzcash::AddressInfoFromSpendingKey{}, spendingkey);
+        result.pushKV("type", addrInfo.first);
+        result.pushKV("address", keyIO.EncodePaymentAddress(addrInfo.second));
 
-    // Sapling support
-    auto addResult = std::visit(AddSpendingKeyToWallet(pwalletMain, Params().GetConsensus()), spendingkey);
-    if (addResult == KeyAlreadyExists && fIgnoreExistingKey) {
-        return result;
-    }
-    pwalletMain->MarkDirty();
-    if (addResult == KeyNotAdded) {
-        throw JSONRPCError(RPC_WALLET_ERROR, "Error adding spending key to wallet");
-    }
+        // Sapling support
+        auto addResult = std::visit(AddSpendingKeyToWallet(pwalletMain, Params().GetConsensus()), spendingkey);
+        if (addResult == KeyAlreadyExists && fIgnoreExistingKey) {
+            return result;
+        }
+        pwalletMain->MarkDirty();
+        if (addResult == KeyNotAdded) {
+            throw JSONRPCError(RPC_WALLET_ERROR, "Error adding spending key to wallet");
+        }
+
+        // whenever a key is imported, we need to scan the whole chain
+        pwalletMain->nTimeFirstKey = 1; // 0 would be considered 'no value'
 
-    // whenever a key is imported, we need to scan the whole chain
-    pwalletMain->nTimeFirstKey = 1; // 0 would be considered 'no value'
+        if (fRescan) {
+            pindexRescan = chainActive[nRescanHeight];
+        }
+    }
 
-    // We want to scan for transactions and notes
-    if (fRescan) {
-        pwalletMain->ScanForWalletTransactions(chainActive[nRescanHeight], true);
+    // We want to scan for transactions and notes. The rescan takes cs_main
+    // and cs_wallet itself, a batch of blocks at a time.
+    if (pindexRescan) {
+        pwalletMain->ScanForWalletTransactions(pindexRescan, true);
     }
 
     return result;
@@ -682,65 +690,73 @@ UniValue z_importviewingkey(const UniValue& params, bool fHelp)
             "\nAs a JSON-RPC call\n" + HelpExampleRpc("z_importviewingkey", "\"vkey\", \"no\""));
 
     
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
-    EnsureWalletIsUnlocked();
-
-    // Whether to perform rescan after import
-    bool fRescan = true;
-    bool fIgnoreExistingKey = true;
-    if (params.size() > 1) {
-        auto rescan = params[1].get_str();
-        if (rescan.compare("whenkeyisnew") != 0) {
-            fIgnoreExistingKey = false;
-            if (rescan.compare("no") == 0) {
-                fRescan = false;
-            } else if (rescan.compare("yes") != 0) {
-                throw JSONRPCError(
-                    RPC_INVALID_PARAMETER,
-                    "rescan must be \"yes\", \"no\" or \"whenkeyisnew\"");
+    UniValue result(UniValue::VOBJ);
+    CBlockIndex* pindexRescan = nullptr;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+
+        EnsureWalletIsUnlocked();
+
+        // Whether to perform rescan after import
+        bool fRescan = true;
+        bool fIgnoreExistingKey = true;
+        if (params.size() > 1) {
+            auto rescan = params[1].get_str();
+            if (rescan.compare("whenkeyisnew") != 0) {
+                fIgnoreExistingKey = false;
+                if (rescan.compare("no") == 0) {
+                    fRescan = false;
+                } else if (rescan.compare("yes") != 0) {
+                    throw JSONRPCError(
+                        RPC_INVALID_PARAMETER,
+                        "rescan must be \"yes\", \"no\" or \"whenkeyisnew\"");
+                }
             }
         }
-    }
 
-    // Height to rescan from
-    int nRescanHeight = 0;
-    if (params.size() > 2) {
-        nRescanHeight = params[2].get_int();
-    }
-    if (nRescanHeight < 0 || nRescanHeight > chainActive.Height()) {
-        throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
-    }
+        // Height to rescan from
+        int nRescanHeight = 0;
+        if (params.size() > 2) {
+            nRescanHeight = params[2].get_int();
+        }
+        if (nRescanHeight < 0 || nRescanHeight > chainActive.Height()) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
+        }
 
-    KeyIO keyIO(Params());
-    string strVKey = params[0].get_str();
-    auto viewingkey = keyIO.DecodeViewingKey(strVKey);
-    if (!IsValidViewingKey(viewingkey)) {
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid viewing key");
-    }
+        KeyIO keyIO(Params());
+        string strVKey = params[0].get_str();
+        auto viewingkey = keyIO.DecodeViewingKey(strVKey);
+        if (!IsValidViewingKey(viewingkey)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid viewing key");
+        }
 
-    auto addrInfo = std::visit(libzcash::AddressInfoFromViewingKey{}, viewingkey);
-    UniValue result(UniValue::VOBJ);
-    const string strAddress = keyIO.EncodePaymentAddress(addrInfo.second);
-    result.pushKV("type", addrInfo.first);
-    result.pushKV("address", strAddress);
-
-    auto addResult = std::visit(AddViewingKeyToWallet(pwalletMain), viewingkey);
-    if (addResult == SpendingKeyExists) {
-        throw JSONRPCError(
-            RPC_WALLET_ERROR,
-            "The wallet already contains the private key for this viewing key (address: " + strAddress + ")");
-    } else if (addResult == KeyAlreadyExists && fIgnoreExistingKey) {
-        return result;
-    }
-    pwalletMain->MarkDirty();
-    if (addResult == KeyNotAdded) {
-        throw JSONRPCError(RPC_WALLET_ERROR, "Error adding viewing key to wallet");
+        auto addrInfo = std::visit(libzcash::AddressInfoFromViewingKey{}, viewingkey);
+        const string strAddress = keyIO.EncodePaymentAddress(addrInfo.second);
+        result.pushKV("type", addrInfo.first);
+        result.pushKV("address", strAddress);
+
+        auto addResult = std::visit(AddViewingKeyToWallet(pwalletMain), viewingkey);
+        if (addResult == SpendingKeyExists) {
+            throw JSONRPCError(
+                RPC_WALLET_ERROR,
+                "The wallet already contains the private key for this viewing key (address: " + strAddress + ")");
+        } else if (addResult == KeyAlreadyExists && fIgnoreExistingKey) {
+            return result;
+        }
+        pwalletMain->MarkDirty();
+        if (addResult == KeyNotAdded) {
+            throw JSONRPCError(RPC_WALLET_ERROR, "Error adding viewing key to wallet");
+        }
+
+        if (fRescan) {
+            pindexRescan = chainActive[nRescanHeight];
+        }
     }
 
-    // We want to scan for transactions and notes
-    if (fRescan) {
-        pwalletMain->ScanForWalletTransactions(chainActive[nRescanHeight], true);
+    // We want to scan for transactions and notes. The rescan takes cs_main
+    // and cs_wallet itself, a batch of blocks at a time.
+    if (pindexRescan) {
+        pwalletMain->ScanForWalletTransactions(pindexRescan, true);
     }
 
     return result;
@@ -0,0 +1,167 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "wallet/trialdecryption.h"
+
+#include "wallet/workerpool.h"
+#include "zcash/Note.hpp"
+
+#include "librustzcash.h"
+
+#include <algorithm>
+#include <memory>
+#include <string.h>
+
+using namespace libzcash;
+
+/** Fewest ivks worth giving their own job when an output's ivks are split. */
+static const size_t SAPLING_DECRYPTION_MIN_IVKS_PER_JOB = 32;
+
+/**
+ * Trial decryption of one output against a contiguous range of ivks.
+ * The match, if any, is written to a result slot owned by the caller.
+ */
+class CSaplingTrialDecryption
+{
+private:
+    const Consensus::Params* params;
+    int height;
+    const OutputDescription* output;
+    const std::vector<SaplingIncomingViewingKey>* ivks;
+    size_t nBegin;
+    size_t nEnd;
+    std::optional<SaplingTrialDecryptionMatch>* result;
+
+public:
+    CSaplingTrialDecryption(const Consensus::Params& paramsIn, int heightIn, const OutputDescription& outputIn,
+                            const std::vector<SaplingIncomingViewingKey>& ivksIn, size_t nBeginIn, size_t nEndIn,
+                            std::optional<SaplingTrialDecryptionMatch>& resultIn) :
+        params(&paramsIn), height(heightIn), output(&outputIn), ivks(&ivksIn), nBegin(nBeginIn), nEnd(nEndIn), result(&resultIn) {}
+
+    // An output that none of the ivks decrypt just isn't ours.
+    void operator()()
+    {
+        const size_t n = nEnd - nBegin;
+        if (n == 0) {
+            return;
+        }
+
+        std::vector<unsigned char> sks(n * 32);
+        std::vector<unsigned char> dhsecrets(n * 32);
+        std::unique_ptr<bool[]> valid(new bool[n]);
+        for (size_t i = 0; i < n; i++) {
+            memcpy(&sks[i * 32], (*ivks)[nBegin + i].begin(), 32);
+        }
+
+        // One key agreement table for the ephemeral key, shared by every ivk
+        if (!librustzcash_sapling_ka_agree_batch(output->ephemeralKey.begin(), sks.data(), n, dhsecrets.data(), valid.get())) {
+            return;
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            if (!valid[i]) {
+                continue;
+            }
+            uint256 dhsecret;
+            memcpy(dhsecret.begin(), &dhsecrets[i * 32], 32);
+
+            auto plaintext = SaplingNotePlaintext::decrypt_with_shared_secret(
+                *params, height, output->encCiphertext, (*ivks)[nBegin + i], output->ephemeralKey, dhsecret, output->cm);
+            if (plaintext) {
+                *result = SaplingTrialDecryptionMatch{nBegin + i, plaintext->d};
+                break;
+            }
+        }
+    }
+};
+
+std::vector<std::optional<SaplingTrialDecryptionMatch>> TrialDecryptSaplingOutputs(
+    const Consensus::Params& params,
+    int height,
+    const std::vector<const OutputDescription*>& outputs,
+    const std::vector<SaplingIncomingViewingKey>& ivks)
+{
+    std::vector<std::optional<SaplingTrialDecryptionMatch>> matches(outputs.size());
+    if (outputs.empty() || ivks.empty()) {
+        return matches;
+    }
+
+    const bool fParallel = nWalletWorkerThreads != 0 &&
+        outputs.size() * ivks.size() >= SAPLING_DECRYPTION_MIN_PARALLEL_TRIALS;
+
+    // Split each output's ivks when there are fewer outputs than workers, so
+    // that a single transaction still spreads across the pool.
+    size_t nRangesPerOutput = 1;
+    if (fParallel) {
+        size_t nWanted = (nWalletWorkerThreads + outputs.size() - 1) / outputs.size();
+        nRangesPerOutput = std::max<size_t>(1, std::min(nWanted, ivks.size() / SAPLING_DECRYPTION_MIN_IVKS_PER_JOB));
+    }
+    const size_t nRangeSize = (ivks.size() + nRangesPerOutput - 1) / nRangesPerOutput;
+
+    std::vector<std::optional<SaplingTrialDecryptionMatch>> rangeMatches(outputs.size() * nRangesPerOutput);
+    std::vector<CSaplingTrialDecryption> vChecks;
+    vChecks.reserve(rangeMatches.size());
+    for (size_t i = 0; i < outputs.size(); i++) {
+        for (size_t r = 0; r < nRangesPerOutput; r++) {
+            size_t nBegin = std::min(ivks.size(), r * nRangeSize);
+            size_t nEnd = std::min(ivks.size(), nBegin + nRangeSize);
+            vChecks.emplace_back(params, height, *outputs[i], ivks, nBegin, nEnd, rangeMatches[i * nRangesPerOutput + r]);
+        }
+    }
+
+    if (fParallel) {
+        RunWalletJobs(vChecks.size(), [&](size_t i) { vChecks[i](); });
+    } else {
+        for (CSaplingTrialDecryption& check : vChecks) {
+            check();
+        }
+    }
+
+    // The ranges are in ivk order, so the first range with a match holds the
+    // first ivk that decrypts the output.
+    for (size_t i = 0; i < outputs.size(); i++) {
+        for (size_t r = 0; r < nRangesPerOutput; r++) {
+            if (rangeMatches[i * nRangesPerOutput + r]) {
+                matches[i] = rangeMatches[i * nRangesPerOutput + r];
+                break;
+            }
+        }
+    }
+    return matches;
+}
+
+SaplingTrialDecryptionBatch TrialDecryptSaplingBlock(
+    const Consensus::Params& params,
+    const CBlock& block,
+    int height,
+    const std::vector<SaplingIncomingViewingKey>& ivks)
+{
+    SaplingTrialDecryptionBatch batch;
+    batch.hashBlock = block.GetHash();
+    batch.nHeight = height;
+    batch.ivks = ivks;
+
+    std::vector<const OutputDescription*> outputs;
+    for (const CTransaction& tx : block.vtx) {
+        for (const OutputDescription& output : tx.vShieldedOutput) {
+            outputs.push_back(&output);
+        }
+    }
+    if (outputs.empty()) {
+        return batch;
+    }
+
+    auto matches = TrialDecryptSaplingOutputs(params, height, outputs, ivks);
+
+    auto next = matches.begin();
+    for (const CTransaction& tx : block.vtx) {
+        if (tx.vShieldedOutput.empty()) {
+            continue;
+        }
+        auto end = next + tx.vShieldedOutput.size();
+        batch.mapTxMatches[tx.GetHash()].assign(next, end);
+        next = end;
+    }
+    return batch;
+}
@@ -0,0 +1,61 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_WALLET_TRIALDECRYPTION_H
+#define BITCOIN_WALLET_TRIALDECRYPTION_H
+
+#include "consensus/params.h"
+#include "primitives/block.h"
+#include "primitives/transaction.h"
+#include "zcash/address/sapling.hpp"
+
+#include <map>
+#include <optional>
+#include <vector>
+
+/** Below this many (output, ivk) trials a batch is decrypted on the calling thread. */
+static const size_t SAPLING_DECRYPTION_MIN_PARALLEL_TRIALS = 64;
+
+/** An output that one of the trialled ivks could decrypt. */
+struct SaplingTrialDecryptionMatch
+{
+    //! Index of the first ivk (in the order passed in) that decrypted the output
+    size_t ivkIndex;
+    //! Diversifier of the recipient address
+    libzcash::diversifier_t d;
+};
+
+/**
+ * Trial-decrypt every output against every ivk, on the wallet workers when
+ * they are running. The key agreement with each output's
+ * ephemeral key is computed once for its whole range of ivks.
+ *
+ * Returns one entry per output, holding the first ivk that decrypted it,
+ * which is the same ivk a serial scan in ivk order would have found.
+ */
+std::vector<std::optional<SaplingTrialDecryptionMatch>> TrialDecryptSaplingOutputs(
+    const Consensus::Params& params,
+    int height,
+    const std::vector<const OutputDescription*>& outputs,
+    const std::vector<libzcash::SaplingIncomingViewingKey>& ivks);
+
+/** The trial decryptions of all the Sapling outputs of one block. */
+struct SaplingTrialDecryptionBatch
+{
+    uint256 hashBlock;
+    int nHeight = 0;
+    //! The ivks the block was trialled against, in the order passed in
+    std::vector<libzcash::SaplingIncomingViewingKey> ivks;
+    //! Per transaction with Sapling outputs, one entry per output
+    std::map<uint256, std::vector<std::optional<SaplingTrialDecryptionMatch>>> mapTxMatches;
+};
+
+/** Trial-decrypt every Sapling output of a block as one batch. */
+SaplingTrialDecryptionBatch TrialDecryptSaplingBlock(
+    const Consensus::Params& params,
+    const CBlock& block,
+    int height,
+    const std::vector<libzcash::SaplingIncomingViewingKey>& ivks);
+
+#endif // BITCOIN_WALLET_TRIALDECRYPTION_H
@@ -26,9 +26,11 @@
 #include "timedata.h"
 #include "utilmoneystr.h"
 #include "wallet/asyncrpcoperation_saplingmigration.h"
+#include "wallet/witnessupdate.h"
 #include "zcash/Note.hpp"
 
 #include <assert.h>
+#include <deque>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
@@ -871,6 +873,7 @@ set<uint256> CWallet::GetConflicts(const uint256& txid) const
 void CWallet::Flush(bool shutdown)
 {
     bitdb.Flush(shutdown);
+    logdb.Flush(shutdown);
 }
 
 bool CWallet::Verify(const string& walletFile, string& warningString, string& errorString)
@@ -895,13 +898,33 @@ bool CWallet::Verify(const string& walletFile, string& warningString, string& er
         }
     }
 
-    if (GetBoolArg("-salvagewallet", false)) {
+    bool fLogStore = CDB::IsLogStore(walletFile);
+    if (fLogStore) {
+        // A torn write at the end is dropped when the log is opened; damage anywhere else is salvaged here
+        boost::filesystem::path pathWallet = GetDataDir() / walletFile;
+        if (boost::filesystem::exists(pathWallet) && !CLogDB::Verify(pathWallet)) {
+            std::string strBackup = strprintf("%s.%d.bak", walletFile, GetTime());
+            if (CLogDB::Salvage(pathWallet, GetDataDir() / strBackup)) {
+                warningString += strprintf(_("Warning: %s corrupt, data salvaged!"
+                                             " Original %s saved as %s in %s; if"
+                                             " your balance or transactions are incorrect you should"
+                                             " restore from a backup."),
+                                           walletFile, walletFile, strBackup, GetDataDir());
+                // Rescan for any transactions that were in the damaged batches
+                SoftSetBoolArg("-rescan", true);
+            } else {
+                errorString += strprintf(_("%s corrupt, salvage failed"), walletFile);
+            }
+        }
+    }
+
+    if (GetBoolArg("-salvagewallet", false) && !fLogStore) {
         // Recover readable keypairs:
         if (!CWalletDB::Recover(bitdb, walletFile, true))
             return false;
     }
 
-    if (boost::filesystem::exists(GetDataDir() / walletFile)) {
+    if (boost::filesystem::exists(GetDataDir() / walletFile) && !fLogStore) {
         CDBEnv::VerifyResult r = bitdb.Verify(walletFile, CWalletDB::Recover);
         if (r == CDBEnv::RECOVER_OK) {
             warningString += strprintf(_("Warning: wallet.dat corrupt, data salvaged!"
@@ -914,6 +937,9 @@ bool CWallet::Verify(const string& walletFile, string& warningString, string& er
             errorString += _("wallet.dat corrupt, salvage failed");
     }
 
+    if (errorString.empty() && !CDB::Migrate(walletFile))
+        errorString += strprintf(_("Error moving %s to the wallet backend chosen by -walletbackend"), walletFile);
+
     return true;
 }
 
@@ -973,6 +999,25 @@ bool CWallet::IsSpent(const uint256& hash, unsigned int n) const
     return false;
 }
 
+/**
+ * Outpoint is spent in the main chain if a wallet transaction in a block
+ * of the main chain spends it. Unlike IsSpent, this can only change when
+ * the spending transaction is synced with the wallet again.
+ */
+bool CWallet::IsSpentInMainChain(const uint256& hash, unsigned int n) const
+{
+    const COutPoint outpoint(hash, n);
+    pair<TxSpends::const_iterator, TxSpends::const_iterator> range;
+    range = mapTxSpends.equal_range(outpoint);
+
+    for (TxSpends::const_iterator it = range.first; it != range.second; ++it) {
+        std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(it->second);
+        if (mit != mapWallet.end() && mit->second.IsInMainChain())
+            return true;
+    }
+    return false;
+}
+
 unsigned int CWallet::GetSpendDepth(const uint256& hash, unsigned int n) const
 {
     const COutPoint outpoint(hash, n);
@@ -1339,6 +1384,45 @@ int CWallet::VerifyAndSetInitialWitness(const CBlockIndex* pindex, bool witnessO
   int nMinimumHeight = pindex->nHeight;
   bool walletHasNotes = false; //Use to enable z_sendmany when no notes are present
 
+  //The roots of the cached witnesses still to be validated are computed up
+  //front on the wallet workers, one note per job
+  std::vector<const SproutNoteData*> vSproutToValidate;
+  std::vector<const SaplingNoteData*> vSaplingToValidate;
+  for (const std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+    if (wtxItem.second.mapSproutNoteData.empty() && wtxItem.second.mapSaplingNoteData.empty())
+      continue;
+    if (wtxItem.second.GetDepthInMainChain() <= 0)
+      continue;
+    for (const mapSproutNoteData_t::value_type& item : wtxItem.second.mapSproutNoteData) {
+      const SproutNoteData& nd = item.second;
+      if (nd.nullifier && !nd.witnesses.empty() && nd.witnessHeight > 0 && !nd.witnessRootValidated
+          && nd.witnessHeight <= pindex->nHeight - 1)
+        vSproutToValidate.push_back(&nd);
+    }
+    for (const mapSaplingNoteData_t::value_type& item : wtxItem.second.mapSaplingNoteData) {
+      const SaplingNoteData& nd = item.second;
+      if (nd.nullifier && !nd.witnesses.empty() && nd.witnessHeight > 0 && !nd.witnessRootValidated
+          && nd.witnessHeight <= pindex->nHeight - 1)
+        vSaplingToValidate.push_back(&nd);
+    }
+  }
+  std::vector<uint256> vSproutRoots(vSproutToValidate.size());
+  UpdateNoteWitnesses(vSproutRoots.size(), [&](size_t i) {
+    vSproutRoots[i] = vSproutToValidate[i]->witnesses.front().root();
+  });
+  std::vector<uint256> vSaplingRoots(vSaplingToValidate.size());
+  UpdateNoteWitnesses(vSaplingRoots.size(), [&](size_t i) {
+    vSaplingRoots[i] = vSaplingToValidate[i]->witnesses.front().root();
+  });
+  std::map<const SproutNoteData*, uint256> mapSproutRoots;
+  for (size_t i = 0; i < vSproutToValidate.size(); i++) {
+    mapSproutRoots.emplace(vSproutToValidate[i], vSproutRoots[i]);
+  }
+  std::map<const SaplingNoteData*, uint256> mapSaplingRoots;
+  for (size_t i = 0; i < vSaplingToValidate.size(); i++) {
+    mapSaplingRoots.emplace(vSaplingToValidate[i], vSaplingRoots[i]);
+  }
+
   for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
     nWitnessTxIncrement += 1;
 
@@ -1380,7 +1464,8 @@ int CWallet::VerifyAndSetInitialWitness(const CBlockIndex* pindex, bool witnessO
           }
 
           //Validate the witness at the witness height
-          witnessRoot = nd->witnesses.front().root();
+          auto itRoot = mapSproutRoots.find(nd);
+          witnessRoot = itRoot != mapSproutRoots.end() ? itRoot->second : nd->witnesses.front().root();
           pblockindex = chainActive[nd->witnessHeight];
           blockRoot = pblockindex->hashFinalSproutRoot;
           if (witnessRoot == blockRoot) {
@@ -1470,7 +1555,8 @@ int CWallet::VerifyAndSetInitialWitness(const CBlockIndex* pindex, bool witnessO
           }
 
           //Validate the witness at the witness height
-          witnessRoot = nd->witnesses.front().root();
+          auto itRoot = mapSaplingRoots.find(nd);
+          witnessRoot = itRoot != mapSaplingRoots.end() ? itRoot->second : nd->witnesses.front().root();
           pblockindex = chainActive[nd->witnessHeight];
           blockRoot = pblockindex->hashFinalSaplingRoot;
           if (witnessRoot == blockRoot) {
@@ -1569,6 +1655,16 @@ void CWallet::BuildWitnessCache(const CBlockIndex* pindex, bool witnessOnly)
     CBlock block;
     ReadBlockFromDisk(block, pblockindex, Params().GetConsensus());
 
+    //The witnesses advanced through this block share one frontier per pool, so
+    //each commitment of the block is appended once however many notes there are
+    SproutWitnessSet sproutWitnesses(sproutTree);
+    SaplingWitnessSet saplingWitnesses(saplingTree);
+    std::vector<SproutNoteData*> vSproutNotes;
+    std::vector<SaplingNoteData*> vSaplingNotes;
+    //Witnesses out of step with the block's tree keep being appended to one by one
+    std::vector<SproutNoteData*> vSproutUnshared;
+    std::vector<SaplingNoteData*> vSaplingUnshared;
+
     for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
 
       if (wtxItem.second.mapSproutNoteData.empty() && wtxItem.second.mapSaplingNoteData.empty())
@@ -1583,21 +1679,13 @@ void CWallet::BuildWitnessCache(const CBlockIndex* pindex, bool witnessOnly)
               && GetSproutSpendDepth(*item.second.nullifier) <= WITNESS_CACHE_SIZE) {
 
 
-            nd->witnesses.push_front(nd->witnesses.front());
-            while (nd->witnesses.size() > WITNESS_CACHE_SIZE) {
-                nd->witnesses.pop_back();
-            }
-
-            for (const CTransaction& tx : block.vtx) {
-              for (size_t i = 0; i < tx.vjoinsplit.size(); i++) {
-                const JSDescription& jsdesc = tx.vjoinsplit[i];
-                for (uint8_t j = 0; j < jsdesc.commitments.size(); j++) {
-                  const uint256& note_commitment = jsdesc.commitments[j];
-                  nd->witnesses.front().append(note_commitment);
-                }
-              }
+            try {
+              sproutWitnesses.add(nd->witnesses.front());
+              vSproutNotes.push_back(nd);
+            } catch (const std::runtime_error& e) {
+              LogPrintf("Sprout witness for %s at height %i not shared: %s\n", item.first.ToString(), nd->witnessHeight, e.what());
+              vSproutUnshared.push_back(nd);
             }
-            nd->witnessHeight = pblockindex->nHeight;
           }
         }
 
@@ -1607,23 +1695,73 @@ void CWallet::BuildWitnessCache(const CBlockIndex* pindex, bool witnessOnly)
           if (nd->nullifier && nd->witnessHeight == pblockindex->nHeight - 1
               && GetSaplingSpendDepth(*item.second.nullifier) <= WITNESS_CACHE_SIZE) {
 
-            nd->witnesses.push_front(nd->witnesses.front());
-            while (nd->witnesses.size() > WITNESS_CACHE_SIZE) {
-                nd->witnesses.pop_back();
-            }
-
-            for (const CTransaction& tx : block.vtx) {
-              for (uint32_t i = 0; i < tx.vShieldedOutput.size(); i++) {
-                const uint256& note_commitment = tx.vShieldedOutput[i].cm;
-                nd->witnesses.front().append(note_commitment);
-              }
+            try {
+              saplingWitnesses.add(nd->witnesses.front());
+              vSaplingNotes.push_back(nd);
+            } catch (const std::runtime_error& e) {
+              LogPrintf("Sapling witness for %s at height %i not shared: %s\n", item.first.ToString(), nd->witnessHeight, e.what());
+              vSaplingUnshared.push_back(nd);
             }
-            nd->witnessHeight = pblockindex->nHeight;
           }
         }
       }
     }
 
+    std::vector<uint256> vSproutCommitments;
+    std::vector<uint256> vSaplingCommitments;
+    for (const CTransaction& tx : block.vtx) {
+      for (const JSDescription& jsdesc : tx.vjoinsplit) {
+        for (const uint256& note_commitment : jsdesc.commitments) {
+          vSproutCommitments.push_back(note_commitment);
+        }
+      }
+      for (const OutputDescription& output : tx.vShieldedOutput) {
+        vSaplingCommitments.push_back(output.cm);
+      }
+    }
+
+    if (!vSproutNotes.empty()) {
+      for (const uint256& note_commitment : vSproutCommitments)
+        sproutWitnesses.append(note_commitment);
+    }
+    if (!vSaplingNotes.empty()) {
+      for (const uint256& note_commitment : vSaplingCommitments)
+        saplingWitnesses.append(note_commitment);
+    }
+
+    //The new witness of each note only depends on its own previous witness and
+    //the block, so they are worked out on the wallet workers and then merged
+    //into the wallet here, still under cs_wallet
+    std::vector<const SproutWitness*> vSproutUnsharedWitnesses;
+    for (const SproutNoteData* nd : vSproutUnshared)
+      vSproutUnsharedWitnesses.push_back(&nd->witnesses.front());
+    std::vector<SproutWitness> vSproutWitnesses =
+        AdvanceNoteWitnesses(sproutWitnesses, vSproutUnsharedWitnesses, vSproutCommitments);
+    std::vector<const SaplingWitness*> vSaplingUnsharedWitnesses;
+    for (const SaplingNoteData* nd : vSaplingUnshared)
+      vSaplingUnsharedWitnesses.push_back(&nd->witnesses.front());
+    std::vector<SaplingWitness> vSaplingWitnesses =
+        AdvanceNoteWitnesses(saplingWitnesses, vSaplingUnsharedWitnesses, vSaplingCommitments);
+
+    vSproutNotes.insert(vSproutNotes.end(), vSproutUnshared.begin(), vSproutUnshared.end());
+    for (size_t i = 0; i < vSproutNotes.size(); i++) {
+      SproutNoteData* nd = vSproutNotes[i];
+      nd->witnesses.push_front(vSproutWitnesses[i]);
+      while (nd->witnesses.size() > WITNESS_CACHE_SIZE) {
+          nd->witnesses.pop_back();
+      }
+      nd->witnessHeight = pblockindex->nHeight;
+    }
+    vSaplingNotes.insert(vSaplingNotes.end(), vSaplingUnshared.begin(), vSaplingUnshared.end());
+    for (size_t i = 0; i < vSaplingNotes.size(); i++) {
+      SaplingNoteData* nd = vSaplingNotes[i];
+      nd->witnesses.push_front(vSaplingWitnesses[i]);
+      while (nd->witnesses.size() > WITNESS_CACHE_SIZE) {
+          nd->witnesses.pop_back();
+      }
+      nd->witnessHeight = pblockindex->nHeight;
+    }
+
     if (pblockindex == pindex)
       break;
 
@@ -1762,6 +1900,7 @@ void CWallet::MarkDirty()
         LOCK(cs_wallet);
         for (PAIRTYPE(const uint256, CWalletTx) & item : mapWallet)
             item.second.MarkDirty();
+        fUnspentOutputsStale = true;
     }
 }
 
@@ -1947,6 +2086,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         mapWallet[hash].BindWallet(this);
         UpdateNullifierNoteMapWithTx(mapWallet[hash]);
         AddToSpends(hash);
+        setNoteCacheDirty.insert(hash);
+        MarkUnspentOutputsDirty(wtxIn);
     }
     else
     {
@@ -1956,6 +2097,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         CWalletTx& wtx = (*ret.first).second;
         wtx.BindWallet(this);
         UpdateNullifierNoteMapWithTx(wtx);
+        setNoteCacheDirty.insert(hash);
+        MarkUnspentOutputsDirty(wtx);
         bool fInsertedNew = ret.second;
         if (fInsertedNew)
         {
@@ -2156,6 +2299,17 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
 void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock, const int nHeight)
 {
     LOCK(cs_wallet);
+    if (pblock && !tx.vShieldedOutput.empty()) {
+        bool fPrefetched;
+        {
+            LOCK(cs_KeyStore);
+            fPrefetched = saplingDecryptionBatch.mapTxMatches.count(tx.GetHash()) &&
+                          saplingDecryptionBatch.hashBlock == pblock->GetHash();
+        }
+        if (!fPrefetched) {
+            PrefetchSaplingDecryptions(*pblock, nHeight);
+        }
+    }
     if (!AddToWalletIfInvolvingMe(tx, pblock, nHeight, true))
         return; // Not one of ours
 
@@ -2195,8 +2349,13 @@ void CWallet::EraseFromWallet(const uint256& hash)
         return;
     {
         LOCK(cs_wallet);
-        if (mapWallet.erase(hash))
+        auto it = mapWallet.find(hash);
+        if (it != mapWallet.end()) {
+            MarkUnspentOutputsDirty(it->second);
+            mapWallet.erase(it);
+            setNoteCacheDirty.insert(hash);
             CWalletDB(strWalletFile).EraseTx(hash);
+        }
     }
     return;
 }
@@ -2300,33 +2459,66 @@ std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> CWallet::FindMySap
     mapSaplingNoteData_t noteData;
     SaplingIncomingViewingKeyMap viewingKeysToAdd;
 
+    if (tx.vShieldedOutput.empty() || mapSaplingFullViewingKeys.empty()) {
+        return std::make_pair(noteData, viewingKeysToAdd);
+    }
+
     // Protocol Spec: 4.19 Block Chain Scanning (Sapling)
-    for (uint32_t i = 0; i < tx.vShieldedOutput.size(); ++i) {
-        const OutputDescription output = tx.vShieldedOutput[i];
-        for (auto it = mapSaplingFullViewingKeys.begin(); it != mapSaplingFullViewingKeys.end(); ++it) {
-            SaplingIncomingViewingKey ivk = it->first;
+    // Use the block's prefetched batch if it was trialled against the same keys,
+    // otherwise trial-decrypt this transaction's outputs on their own.
+    std::vector<SaplingIncomingViewingKey> ivks;
+    std::vector<std::optional<SaplingTrialDecryptionMatch>> matches;
+    auto batchIt = saplingDecryptionBatch.mapTxMatches.find(hash);
+    if (batchIt != saplingDecryptionBatch.mapTxMatches.end() &&
+        saplingDecryptionBatch.nHeight == height &&
+        saplingDecryptionBatch.ivks.size() == mapSaplingFullViewingKeys.size()) {
+        ivks = saplingDecryptionBatch.ivks;
+        matches = batchIt->second;
+    } else {
+        ivks = GetSaplingIncomingViewingKeys();
+        std::vector<const OutputDescription*> outputs;
+        for (const OutputDescription& output : tx.vShieldedOutput) {
+            outputs.push_back(&output);
+        }
+        matches = TrialDecryptSaplingOutputs(Params().GetConsensus(), height, outputs, ivks);
+    }
 
-            auto result = SaplingNotePlaintext::decrypt(Params().GetConsensus(), height, output.encCiphertext, ivk, output.ephemeralKey, output.cm);
-            if (!result) {
-                continue;
-            }
-            auto address = ivk.address(result.value().d);
-            if (address && mapSaplingIncomingViewingKeys.count(address.value()) == 0) {
-                viewingKeysToAdd[address.value()] = ivk;
-            }
-            // We don't cache the nullifier here as computing it requires knowledge of the note position
-            // in the commitment tree, which can only be determined when the transaction has been mined.
-            SaplingOutPoint op {hash, i};
-            SaplingNoteData nd;
-            nd.ivk = ivk;
-            noteData.insert(std::make_pair(op, nd));
-            break;
+    for (uint32_t i = 0; i < tx.vShieldedOutput.size(); ++i) {
+        if (!matches[i]) {
+            continue;
         }
+        const SaplingIncomingViewingKey& ivk = ivks[matches[i]->ivkIndex];
+        auto address = ivk.address(matches[i]->d);
+        if (address && mapSaplingIncomingViewingKeys.count(address.value()) == 0) {
+            viewingKeysToAdd[address.value()] = ivk;
+        }
+        // We don't cache the nullifier here as computing it requires knowledge of the note position
+        // in the commitment tree, which can only be determined when the transaction has been mined.
+        SaplingOutPoint op {hash, i};
+        SaplingNoteData nd;
+        nd.ivk = ivk;
+        noteData.insert(std::make_pair(op, nd));
     }
 
     return std::make_pair(noteData, viewingKeysToAdd);
 }
 
+void CWallet::PrefetchSaplingDecryptions(const CBlock& block, int height)
+{
+    LOCK(cs_KeyStore);
+    saplingDecryptionBatch = TrialDecryptSaplingBlock(Params().GetConsensus(), block, height, GetSaplingIncomingViewingKeys());
+}
+
+std::vector<SaplingIncomingViewingKey> CWallet::GetSaplingIncomingViewingKeys() const
+{
+    LOCK(cs_KeyStore);
+    std::vector<SaplingIncomingViewingKey> ivks;
+    for (auto it = mapSaplingFullViewingKeys.begin(); it != mapSaplingFullViewingKeys.end(); ++it) {
+        ivks.push_back(it->first);
+    }
+    return ivks;
+}
+
 bool CWallet::IsSproutNullifierFromMe(const uint256& nullifier) const
 {
     {
@@ -3274,7 +3466,11 @@ void CWallet::DeleteTransactions(std::vector<uint256>& removeTxs)
     CWalletDB walletdb(strWalletFile, "r+", false);
 
     for (int i = 0; i < removeTxs.size(); i++) {
-        if (mapWallet.erase(removeTxs[i])) {
+        auto it = mapWallet.find(removeTxs[i]);
+        if (it != mapWallet.end()) {
+            MarkUnspentOutputsDirty(it->second);
+            mapWallet.erase(it);
+            setNoteCacheDirty.insert(removeTxs[i]);
             walletdb.EraseTx(removeTxs[i]);
             LogPrint("deletetx", "Delete Tx - Deleting tx %s, %i.\n", removeTxs[i].ToString(), i);
         } else {
@@ -3483,10 +3679,129 @@ void CWallet::DeleteWalletTransactions(const CBlockIndex* pindex)
     }
 }
 
+namespace {
+
+/**
+ * Bounded hand-off between the stages of a rescan. Closing it makes
+ * producers stop pushing and lets consumers drain what is left.
+ */
+template <typename T>
+class CRescanQueue
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable condPush;
+    boost::condition_variable condPop;
+    std::deque<T> queue;
+    const size_t nMaxSize;
+    bool fClosed;
+
+public:
+    CRescanQueue(size_t nMaxSizeIn) : nMaxSize(nMaxSizeIn), fClosed(false) {}
+
+    //! Block while the queue is full. Returns false if it has been closed.
+    bool Push(T&& item)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!fClosed && queue.size() >= nMaxSize)
+            condPush.wait(lock);
+        if (fClosed)
+            return false;
+        queue.push_back(std::move(item));
+        condPop.notify_one();
+        return true;
+    }
+
+    //! Block while the queue is empty. Returns false once it is closed and drained.
+    bool Pop(T& item)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!fClosed && queue.empty())
+            condPop.wait(lock);
+        if (queue.empty())
+            return false;
+        item = std::move(queue.front());
+        queue.pop_front();
+        condPush.notify_one();
+        return true;
+    }
+
+    void Close()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fClosed = true;
+        condPush.notify_all();
+        condPop.notify_all();
+    }
+};
+
+struct CRescanBlock
+{
+    CBlockIndex* pindex = nullptr;
+    CBlock block;
+    //! The block could not be read; the rescan stops here
+    bool fReadFailed = false;
+    SaplingTrialDecryptionBatch batch;
+};
+
+/**
+ * First stage of a rescan: read and deserialize blocks ahead of the commit
+ * stage, from the positions the commit stage feeds it.
+ */
+void ThreadRescanReadBlocks(CRescanQueue<std::pair<CBlockIndex*, CDiskBlockPos>>& in,
+                            CRescanQueue<CRescanBlock>& out,
+                            const Consensus::Params& params)
+{
+    RenameThread("gemlink-rescanrd");
+    std::pair<CBlockIndex*, CDiskBlockPos> blockPos;
+    while (in.Pop(blockPos)) {
+        CRescanBlock item;
+        item.pindex = blockPos.first;
+        if (!ReadBlockFromDisk(item.block, blockPos.second, params)) {
+            // Hand on a marker, so the commit stage stops at this height
+            item.fReadFailed = true;
+            out.Push(std::move(item));
+            break;
+        }
+        if (!out.Push(std::move(item)))
+            break;
+    }
+    in.Close();
+    out.Close();
+}
+
+/** Second stage of a rescan: trial-decrypt each block's Sapling outputs on the decryption workers. */
+void ThreadRescanDecryptBlocks(CRescanQueue<CRescanBlock>& in,
+                               CRescanQueue<CRescanBlock>& out,
+                               const std::vector<SaplingIncomingViewingKey>& ivks,
+                               const Consensus::Params& params)
+{
+    RenameThread("gemlink-rescandc");
+    CRescanBlock item;
+    while (in.Pop(item)) {
+        if (!item.fReadFailed)
+            item.batch = TrialDecryptSaplingBlock(params, item.block, item.pindex->nHeight, ivks);
+        if (!out.Push(std::move(item)))
+            break;
+    }
+    // Unblock the reader if we stopped early
+    in.Close();
+    out.Close();
+}
+
+} // namespace
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
  * exist in the wallet will be updated.
+ *
+ * Blocks are read and trial-decrypted by a pipeline of helper threads
+ * running ahead of this one, which commits them in batches and only
+ * holds cs_main and cs_wallet while committing a batch (unless the
+ * caller already holds them). The helpers never take cs_main: the
+ * positions of the blocks to read are fed to them a bounded distance
+ * ahead of the commits. The rescan stops at a block that can't be read.
  */
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
@@ -3495,8 +3810,8 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
     const CChainParams& chainParams = Params();
 
     CBlockIndex* pindex = pindexStart;
-
-    std::vector<uint256> myTxHashes;
+    double dProgressStart;
+    double dProgressTip;
 
     {
         LOCK2(cs_main, cs_wallet);
@@ -3508,47 +3823,140 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
         }
 
         ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
-        double dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
-        while (pindex)
-        {
-            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
-                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+        dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
+        dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
+    }
+
+    // Blocks fed to the reader but not committed yet, at most
+    const size_t nFeedAhead = 2 * RESCAN_PREFETCH_BLOCKS + RESCAN_COMMIT_BATCH_BLOCKS;
 
-            CBlock block;
-            ReadBlockFromDisk(block, pindex, Params().GetConsensus());
-            for (CTransaction& tx : block.vtx)
+    while (pindex)
+    {
+        CRescanQueue<std::pair<CBlockIndex*, CDiskBlockPos>> posQueue(nFeedAhead);
+        CRescanQueue<CRescanBlock> readQueue(RESCAN_PREFETCH_BLOCKS);
+        CRescanQueue<CRescanBlock> decryptedQueue(RESCAN_PREFETCH_BLOCKS);
+        std::vector<SaplingIncomingViewingKey> ivks = GetSaplingIncomingViewingKeys();
+
+        // Feed the reader up to the tip as it is now. If the tip moves on
+        // while we commit, the next pass picks up the new blocks.
+        CBlockIndex* pindexFeed = pindex;
+        size_t nFed = 0;
+        size_t nCommitted = 0;
+        auto feedReader = [&]() {
+            AssertLockHeld(cs_main);
+            while (pindexFeed && nFed - nCommitted < nFeedAhead) {
+                posQueue.Push(std::make_pair(pindexFeed, pindexFeed->GetBlockPos()));
+                nFed++;
+                pindexFeed = chainActive.Next(pindexFeed);
+            }
+            if (!pindexFeed)
+                posQueue.Close();
+        };
+
+        boost::thread reader;
+        boost::thread decryptor;
+        auto stopPipeline = [&]() {
+            decryptedQueue.Close();
+            readQueue.Close();
+            posQueue.Close();
+            if (decryptor.joinable())
+                decryptor.join();
+            if (reader.joinable())
+                reader.join();
+        };
+
+        CBlockIndex* pindexResume = nullptr;
+        try {
             {
-                if (AddToWalletIfInvolvingMe(tx, &block, pindex->nHeight, fUpdate)) {
-                    myTxHashes.push_back(tx.GetHash());
-                    ret++;
-                }
+                LOCK(cs_main);
+                feedReader();
             }
-
-            SproutMerkleTree sproutTree;
-            SaplingMerkleTree saplingTree;
-            // This should never fail: we should always be able to get the tree
-            // state on the path to the tip of our chain
-            assert(pcoinsTip->GetSproutAnchorAt(pindex->hashSproutAnchor, sproutTree));
-            if (pindex->pprev) {
-                if (Params().GetConsensus().NetworkUpgradeActive(pindex->pprev->nHeight,  Consensus::UPGRADE_SAPLING)) {
-                    assert(pcoinsTip->GetSaplingAnchorAt(pindex->pprev->hashFinalSaplingRoot, saplingTree));
+            reader = boost::thread(std::bind(&ThreadRescanReadBlocks, std::ref(posQueue), std::ref(readQueue), std::cref(chainParams.GetConsensus())));
+            decryptor = boost::thread(std::bind(&ThreadRescanDecryptBlocks, std::ref(readQueue), std::ref(decryptedQueue), std::cref(ivks), std::cref(chainParams.GetConsensus())));
+
+            std::vector<CRescanBlock> vCommit;
+            bool fStopped = false;
+            while (!fStopped) {
+                vCommit.clear();
+                CRescanBlock item;
+                while (vCommit.size() < RESCAN_COMMIT_BATCH_BLOCKS && decryptedQueue.Pop(item)) {
+                    vCommit.push_back(std::move(item));
                 }
-            }
+                if (vCommit.empty())
+                    break;
 
-            // Build inital witness caches
-            BuildWitnessCache(pindex, true);
+                LOCK2(cs_main, cs_wallet);
+                for (CRescanBlock& commit : vCommit) {
+                    pindex = commit.pindex;
+                    if (!chainActive.Contains(pindex)) {
+                        // The chain reorganized while the locks were released;
+                        // carry on from where the new branch forks off.
+                        pindexResume = chainActive.Next(chainActive.FindFork(pindex));
+                        fStopped = true;
+                        break;
+                    }
+                    if (commit.fReadFailed) {
+                        LogPrintf("ScanForWalletTransactions: can't read block %d (%s) from disk, stopping the rescan there\n",
+                                  pindex->nHeight, pindex->GetBlockHash().ToString());
+                        pindexResume = nullptr;
+                        fStopped = true;
+                        break;
+                    }
 
-            //Delete Transactions
-            if (pindex->nHeight % fDeleteInterval == 0)
-              DeleteWalletTransactions(pindex);
+                    if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
+                        ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
 
-            pindex = chainActive.Next(pindex);
-            if (GetTime() >= nNow + 60) {
-                nNow = GetTime();
-                LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
+                    {
+                        LOCK(cs_KeyStore);
+                        saplingDecryptionBatch = std::move(commit.batch);
+                    }
+                    for (CTransaction& tx : commit.block.vtx)
+                    {
+                        if (AddToWalletIfInvolvingMe(tx, &commit.block, pindex->nHeight, fUpdate)) {
+                            ret++;
+                        }
+                    }
+
+                    SproutMerkleTree sproutTree;
+                    SaplingMerkleTree saplingTree;
+                    // This should never fail: we should always be able to get the tree
+                    // state on the path to the tip of our chain
+                    assert(pcoinsTip->GetSproutAnchorAt(pindex->hashSproutAnchor, sproutTree));
+                    if (pindex->pprev) {
+                        if (Params().GetConsensus().NetworkUpgradeActive(pindex->pprev->nHeight,  Consensus::UPGRADE_SAPLING)) {
+                            assert(pcoinsTip->GetSaplingAnchorAt(pindex->pprev->hashFinalSaplingRoot, saplingTree));
+                        }
+                    }
+
+                    // Build inital witness caches
+                    BuildWitnessCache(pindex, true);
+
+                    //Delete Transactions
+                    if (pindex->nHeight % fDeleteInterval == 0)
+                      DeleteWalletTransactions(pindex);
+
+                    if (GetTime() >= nNow + 60) {
+                        nNow = GetTime();
+                        LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
+                    }
+                    nCommitted++;
+                }
+                if (!fStopped) {
+                    pindexResume = chainActive.Next(pindex);
+                    feedReader();
+                }
             }
+        } catch (...) {
+            stopPipeline();
+            throw;
         }
+        stopPipeline();
+
+        pindex = pindexResume;
+    }
+
+    {
+        LOCK2(cs_main, cs_wallet);
 
         //Update all witness caches
         BuildWitnessCache(chainActive.Tip(), false);
@@ -3848,13 +4256,79 @@ void CWallet::ResendWalletTransactions(int64_t nBestBlockTime)
  */
 
 
+/**
+ * A transaction's outputs have to be looked at again when it changes, and so
+ * do the outputs it spends, since whether it is in the main chain decides if
+ * they are still unspent.
+ */
+void CWallet::MarkUnspentOutputsDirty(const CTransaction& tx)
+{
+    AssertLockHeld(cs_wallet);
+
+    setUnspentOutputsDirty.insert(tx.GetHash());
+    if (tx.IsCoinBase())
+        return;
+    for (const CTxIn& txin : tx.vin) {
+        setUnspentOutputsDirty.insert(txin.prevout.hash);
+    }
+}
+
+/**
+ * Bring setUnspentOutputs up to date, looking only at the outputs of the
+ * transactions marked dirty since the last call, or of all of mapWallet when
+ * the outputs are stale.
+ */
+void CWallet::UpdateUnspentOutputs() const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    if (fUnspentOutputsStale) {
+        setUnspentOutputs.clear();
+        setUnspentOutputsDirty.clear();
+        for (const std::pair<const uint256, CWalletTx>& item : mapWallet) {
+            setUnspentOutputsDirty.insert(setUnspentOutputsDirty.end(), item.first);
+        }
+        fUnspentOutputsStale = false;
+    }
+
+    for (const uint256& hash : setUnspentOutputsDirty) {
+        // Drop what was kept for the transaction
+        auto it = setUnspentOutputs.lower_bound(COutPoint(hash, 0));
+        while (it != setUnspentOutputs.end() && it->hash == hash) {
+            it = setUnspentOutputs.erase(it);
+        }
+
+        auto wtxIt = mapWallet.find(hash);
+        if (wtxIt == mapWallet.end())
+            continue;
+        const CWalletTx& wtx = wtxIt->second;
+        for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+            if (IsMine(wtx.vout[i]) != ISMINE_NO && !IsSpentInMainChain(hash, i))
+                setUnspentOutputs.insert(setUnspentOutputs.end(), COutPoint(hash, i));
+        }
+    }
+    setUnspentOutputsDirty.clear();
+}
+
+std::vector<const CWalletTx*> CWallet::GetUnspentOutputTransactions() const
+{
+    UpdateUnspentOutputs();
+
+    std::vector<const CWalletTx*> vWtx;
+    for (const COutPoint& output : setUnspentOutputs) {
+        if (vWtx.empty() || vWtx.back()->GetHash() != output.hash)
+            vWtx.push_back(&mapWallet.at(output.hash));
+    }
+    return vWtx;
+}
+
 CAmount CWallet::GetBalance() const
 {
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
+        for (const CWalletTx* pcoin : GetUnspentOutputTransactions()) {
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableCredit();
         }
@@ -3871,9 +4345,7 @@ CAmount CWallet::GetUnlockedCoins() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-
+        for (const CWalletTx* pcoin : GetUnspentOutputTransactions()) {
             if (pcoin->IsTrusted() && pcoin->GetDepthInMainChain() > 0)
                 nTotal += pcoin->GetUnlockedCredit();
         }
@@ -3890,9 +4362,7 @@ CAmount CWallet::GetLockedCoins() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
-
+        for (const CWalletTx* pcoin : GetUnspentOutputTransactions()) {
             if (pcoin->IsTrusted() && pcoin->GetDepthInMainChain() > 0)
                 nTotal += pcoin->GetLockedCredit();
         }
@@ -3906,8 +4376,7 @@ CAmount CWallet::GetUnconfirmedBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
+        for (const CWalletTx* pcoin : GetUnspentOutputTransactions()) {
             if (!CheckFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
                 nTotal += pcoin->GetAvailableCredit();
         }
@@ -3920,8 +4389,7 @@ CAmount CWallet::GetImmatureBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
+        for (const CWalletTx* pcoin : GetUnspentOutputTransactions()) {
             nTotal += pcoin->GetImmatureCredit();
         }
     }
@@ -3933,8 +4401,7 @@ CAmount CWallet::GetWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
+        for (const CWalletTx* pcoin : GetUnspentOutputTransactions()) {
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
         }
@@ -3948,8 +4415,7 @@ CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
+        for (const CWalletTx* pcoin : GetUnspentOutputTransactions()) {
             if (!CheckFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
         }
@@ -3962,8 +4428,7 @@ CAmount CWallet::GetImmatureWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
+        for (const CWalletTx* pcoin : GetUnspentOutputTransactions()) {
             nTotal += pcoin->GetImmatureWatchOnlyCredit();
         }
     }
@@ -3985,76 +4450,75 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins,
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        UpdateUnspentOutputs();
+
+        // Only outputs that are ours and not spent in the main chain can be
+        // available, and the transaction checks are made once per transaction
+        const CWalletTx* pcoin = nullptr;
+        bool fSkipTx = true;
+        int nDepth = 0;
+        for (const COutPoint& output : setUnspentOutputs)
         {
-            const uint256& wtxid = it->first;
-            const CWalletTx* pcoin = &(*it).second;
-
-            if (!CheckFinalTx(*pcoin))
+            const uint256& wtxid = output.hash;
+            const unsigned int i = output.n;
+
+            if (!pcoin || pcoin->GetHash() != wtxid) {
+                pcoin = &mapWallet.at(wtxid);
+                nDepth = pcoin->GetDepthInMainChain();
+                fSkipTx = !CheckFinalTx(*pcoin) ||
+                          (fOnlyConfirmed && !pcoin->IsTrusted()) ||
+                          (pcoin->IsCoinBase() && !fIncludeCoinBase) ||
+                          (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0) ||
+                          nDepth < nMinDepth;
+            }
+            if (fSkipTx)
                 continue;
 
-            if (fOnlyConfirmed && !pcoin->IsTrusted())
-                continue;
+            bool found = false;
+            if (coin_type == ONLY_10000) {
+                found = pcoin->vout[i].nValue == Params().GetMasternodeCollateral(chainActive.Height()) * COIN;
+            } else {
+                found = true;
+            }
 
-            if (pcoin->IsCoinBase() && !fIncludeCoinBase)
+            if (!found)
                 continue;
 
-            bool isCoinbase = pcoin->IsCoinBase();
-            if (isCoinbase && pcoin->GetBlocksToMaturity() > 0)
-                continue;
+            isminetype mine = IsMine(pcoin->vout[i]);
 
-            int nDepth = pcoin->GetDepthInMainChain();
-            if (nDepth < nMinDepth)
+            if (IsSpent(wtxid, i))
+            {
                 continue;
+            }
 
-            for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
-                bool found = false;
-                if (coin_type == ONLY_10000) {
-                    found = pcoin->vout[i].nValue == Params().GetMasternodeCollateral(chainActive.Height()) * COIN;
-                } else {
-                    found = true;
-                }
-
-                if (!found)
-                    continue;
-
-
-                isminetype mine = IsMine(pcoin->vout[i]);
+            if (mine == ISMINE_NO)
+            {
+                continue;
+            }
 
-                if (IsSpent(wtxid, i))
-                {
-                    continue;
-                }
+            if (IsLockedCoin(wtxid, i) && coin_type != ONLY_10000)
+            {
+                continue;
+            }
 
-                if (mine == ISMINE_NO)
-                {
-                    continue;
-                }
+            if (coinControl && coinControl->HasSelected() && !coinControl->fAllowOtherInputs && !coinControl->IsSelected(wtxid, i))
+            {
+                continue;
+            }
 
-                if (IsLockedCoin((*it).first, i) && coin_type != ONLY_10000)
-                {
-                    continue;
-                }
+            bool fIsSpendable = false;
+            if ((mine & ISMINE_SPENDABLE) != ISMINE_NO)
+                fIsSpendable = true;
 
-                if (coinControl && coinControl->HasSelected() && !coinControl->fAllowOtherInputs && !coinControl->IsSelected((*it).first, i))
-                {
+            // Filter by specific destinations if needed
+            if (onlyFilterByDests && !onlyFilterByDests->empty()) {
+                CTxDestination address;
+                if (!ExtractDestination(pcoin->vout[i].scriptPubKey, address) || onlyFilterByDests->count(address) == 0) {
                     continue;
                 }
-
-                bool fIsSpendable = false;
-                if ((mine & ISMINE_SPENDABLE) != ISMINE_NO)
-                    fIsSpendable = true;
-
-                // Filter by specific destinations if needed
-                if (onlyFilterByDests && !onlyFilterByDests->empty()) {
-                    CTxDestination address;
-                    if (!ExtractDestination(pcoin->vout[i].scriptPubKey, address) || onlyFilterByDests->count(address) == 0) {
-                        continue;
-                    }
-                }
-
-                vCoins.emplace_back(COutput(pcoin, i, nDepth, fIsSpendable));
             }
+
+            vCoins.emplace_back(COutput(pcoin, i, nDepth, fIsSpendable));
         }
     }
 }
@@ -5619,10 +6083,116 @@ void CWallet::GetFilteredNotes(
     GetFilteredNotes(sproutEntries, saplingEntries, filterAddresses, minDepth, INT_MAX, ignoreSpent, requireSpendingKey);
 }
 
+/**
+ * Decrypt the notes of the transactions added, changed or erased since the
+ * last call, replacing whatever the note cache held for them. The plaintext
+ * of an outpoint never changes, so nothing else has to be decrypted again.
+ */
+void CWallet::UpdateNoteCache()
+{
+    AssertLockHeld(cs_wallet);
+
+    KeyIO keyIO(Params());
+    while (!setNoteCacheDirty.empty()) {
+        uint256 hash = *setNoteCacheDirty.begin();
+
+        // Drop what was cached for the transaction
+        auto sproutIt = mapSproutNoteCache.lower_bound(JSOutPoint(hash, 0, 0));
+        while (sproutIt != mapSproutNoteCache.end() && sproutIt->first.hash == hash) {
+            auto addrIt = mapSproutNotesByAddress.find(sproutIt->second.entry.address);
+            addrIt->second.erase(sproutIt->first);
+            if (addrIt->second.empty())
+                mapSproutNotesByAddress.erase(addrIt);
+            sproutIt = mapSproutNoteCache.erase(sproutIt);
+        }
+        auto saplingIt = mapSaplingNoteCache.lower_bound(SaplingOutPoint(hash, 0));
+        while (saplingIt != mapSaplingNoteCache.end() && saplingIt->first.hash == hash) {
+            auto addrIt = mapSaplingNotesByAddress.find(saplingIt->second.address);
+            addrIt->second.erase(saplingIt->first);
+            if (addrIt->second.empty())
+                mapSaplingNotesByAddress.erase(addrIt);
+            saplingIt = mapSaplingNoteCache.erase(saplingIt);
+        }
+
+        auto wtxIt = mapWallet.find(hash);
+        if (wtxIt != mapWallet.end()) {
+            const CWalletTx& wtx = wtxIt->second;
+
+            for (const auto& pair : wtx.mapSproutNoteData) {
+                const JSOutPoint& jsop = pair.first;
+                const SproutPaymentAddress& pa = pair.second.address;
+
+                CachedSproutNote cached;
+                cached.entry.jsop = jsop;
+                cached.entry.address = pa;
+                cached.entry.confirmations = 0;
+
+                int i = jsop.js; // Index into CTransaction.vjoinsplit
+                int j = jsop.n; // Index into JSDescription.ciphertexts
+
+                // Get cached decryptor
+                ZCNoteDecryption decryptor;
+                if (!GetNoteDecryptor(pa, decryptor)) {
+                    // Note decryptors are created when the wallet is loaded, so it should always exist
+                    cached.strError = strprintf("Could not find note decryptor for payment address %s", keyIO.EncodePaymentAddress(pa));
+                } else {
+                    // determine amount of funds in the note
+                    auto hSig = ZCJoinSplit::h_sig(
+                        wtx.vjoinsplit[i].randomSeed,
+                        wtx.vjoinsplit[i].nullifiers,
+                        wtx.joinSplitPubKey);
+                    try {
+                        SproutNotePlaintext plaintext = SproutNotePlaintext::decrypt(
+                                decryptor,
+                                wtx.vjoinsplit[i].ciphertexts[j],
+                                wtx.vjoinsplit[i].ephemeralKey,
+                                hSig,
+                                (unsigned char) j);
+                        cached.entry.note = plaintext.note(pa);
+                        cached.entry.memo = plaintext.memo();
+                    } catch (const note_decryption_failed &err) {
+                        // Couldn't decrypt with this spending key
+                        cached.strError = strprintf("Could not decrypt note for payment address %s", keyIO.EncodePaymentAddress(pa));
+                    } catch (const std::exception &exc) {
+                        // Unexpected failure
+                        cached.strError = strprintf("Error while decrypting note for payment address %s: %s", keyIO.EncodePaymentAddress(pa), exc.what());
+                    }
+                }
+
+                mapSproutNotesByAddress[pa].insert(jsop);
+                mapSproutNoteCache.emplace(jsop, std::move(cached));
+            }
+
+            for (const auto& pair : wtx.mapSaplingNoteData) {
+                const SaplingOutPoint& op = pair.first;
+                const SaplingNoteData& nd = pair.second;
+
+                auto optDeserialized = SaplingNotePlaintext::attempt_sapling_enc_decryption_deserialization(wtx.vShieldedOutput[op.n].encCiphertext, nd.ivk, wtx.vShieldedOutput[op.n].ephemeralKey);
+
+                // The transaction would not have entered the wallet unless
+                // its plaintext had been successfully decrypted previously.
+                assert(optDeserialized != std::nullopt);
+
+                auto notePt = optDeserialized.value();
+                auto maybe_pa = nd.ivk.address(notePt.d);
+                assert(static_cast<bool>(maybe_pa));
+                auto pa = maybe_pa.value();
+
+                auto note = notePt.note(nd.ivk).value();
+                mapSaplingNotesByAddress[pa].insert(op);
+                mapSaplingNoteCache.emplace(op, SaplingNoteEntry {
+                    op, pa, note, notePt.memo(), 0 });
+            }
+        }
+
+        setNoteCacheDirty.erase(setNoteCacheDirty.begin());
+    }
+}
+
 /**
  * Find notes in the wallet filtered by payment addresses, min depth, max depth, 
  * if the note is spent, if a spending key is required, and if the notes are locked.
- * These notes are decrypted and added to the output parameter vector, outEntries.
+ * These notes are taken from the note cache and added to the output parameter vector, outEntries.
  */
 void CWallet::GetFilteredNotes(
     std::vector<SproutNoteEntry>& sproutEntries,
@@ -5636,119 +6206,113 @@ void CWallet::GetFilteredNotes(
 {
     LOCK2(cs_main, cs_wallet);
 
-    KeyIO keyIO(Params());
-    for (auto & p : mapWallet) {
-        CWalletTx wtx = p.second;
-
-        // Filter the transactions before checking for notes
-        if (!CheckFinalTx(wtx) ||
-            wtx.GetDepthInMainChain() < minDepth ||
-            wtx.GetDepthInMainChain() > maxDepth) {
-            continue;
+    UpdateNoteCache();
+
+    // Outpoints sort by transaction first, so the transaction filters below
+    // run once per transaction, and notes come out in wallet order.
+    std::set<JSOutPoint> sproutNotes;
+    std::set<SaplingOutPoint> saplingNotes;
+    for (const PaymentAddress& address : filterAddresses) {
+        if (auto sproutAddr = std::get_if<SproutPaymentAddress>(&address)) {
+            auto it = mapSproutNotesByAddress.find(*sproutAddr);
+            if (it != mapSproutNotesByAddress.end())
+                sproutNotes.insert(it->second.begin(), it->second.end());
+        } else if (auto saplingAddr = std::get_if<SaplingPaymentAddress>(&address)) {
+            auto it = mapSaplingNotesByAddress.find(*saplingAddr);
+            if (it != mapSaplingNotesByAddress.end())
+                saplingNotes.insert(it->second.begin(), it->second.end());
+        }
+    }
+
+    // Filter the transactions before checking for notes
+    uint256 hashLast;
+    const CWalletTx* pwtx = nullptr;
+    int nDepth = 0;
+    auto selectTx = [&](const uint256& hash) -> const CWalletTx* {
+        if (pwtx == nullptr || hash != hashLast) {
+            hashLast = hash;
+            pwtx = &mapWallet.at(hash);
+            nDepth = pwtx->GetDepthInMainChain();
+        }
+        if (!CheckFinalTx(*pwtx) || nDepth < minDepth || nDepth > maxDepth) {
+            return nullptr;
         }
-
         // Filter coinbase transactions that don't have Sapling outputs
-        if (wtx.IsCoinBase() && wtx.mapSaplingNoteData.empty()) {
-            continue;
+        if (pwtx->IsCoinBase() && pwtx->mapSaplingNoteData.empty()) {
+            return nullptr;
         }
+        return pwtx;
+    };
 
-        for (auto & pair : wtx.mapSproutNoteData) {
-            JSOutPoint jsop = pair.first;
-            SproutNoteData nd = pair.second;
-            SproutPaymentAddress pa = nd.address;
-
-            // skip notes which belong to a different payment address in the wallet
-            if (!(filterAddresses.empty() || filterAddresses.count(pa))) {
-                continue;
-            }
-
-            // skip note which has been spent
-            if (ignoreSpent && nd.nullifier && IsSproutSpent(*nd.nullifier)) {
-                continue;
-            }
-
-            // skip notes which cannot be spent
-            if (requireSpendingKey && !HaveSproutSpendingKey(pa)) {
-                continue;
-            }
-
-            // skip locked notes
-            if (ignoreLocked && IsLockedNote(jsop)) {
-                continue;
-            }
-
-            int i = jsop.js; // Index into CTransaction.vjoinsplit
-            int j = jsop.n; // Index into JSDescription.ciphertexts
-
-            // Get cached decryptor
-            ZCNoteDecryption decryptor;
-            if (!GetNoteDecryptor(pa, decryptor)) {
-                // Note decryptors are created when the wallet is loaded, so it should always exist
-                throw std::runtime_error(strprintf("Could not find note decryptor for payment address %s", keyIO.EncodePaymentAddress(pa)));
-            }
+    auto addSproutNote = [&](const CachedSproutNote& cached) {
+        const JSOutPoint& jsop = cached.entry.jsop;
+        const CWalletTx* wtx = selectTx(jsop.hash);
+        if (wtx == nullptr) {
+            return;
+        }
 
-            // determine amount of funds in the note
-            auto hSig = ZCJoinSplit::h_sig(
-                wtx.vjoinsplit[i].randomSeed,
-                wtx.vjoinsplit[i].nullifiers,
-                wtx.joinSplitPubKey);
-            try {
-                SproutNotePlaintext plaintext = SproutNotePlaintext::decrypt(
-                        decryptor,
-                        wtx.vjoinsplit[i].ciphertexts[j],
-                        wtx.vjoinsplit[i].ephemeralKey,
-                        hSig,
-                        (unsigned char) j);
-
-                sproutEntries.push_back(SproutNoteEntry {
-                    jsop, pa, plaintext.note(pa), plaintext.memo(), wtx.GetDepthInMainChain() });
-
-            } catch (const note_decryption_failed &err) {
-                // Couldn't decrypt with this spending key
-                throw std::runtime_error(strprintf("Could not decrypt note for payment address %s", keyIO.EncodePaymentAddress(pa)));
-            } catch (const std::exception &exc) {
-                // Unexpected failure
-                throw std::runtime_error(strprintf("Error while decrypting note for payment address %s: %s", keyIO.EncodePaymentAddress(pa), exc.what()));
-            }
+        // skip note which has been spent
+        const SproutNoteData& nd = wtx->mapSproutNoteData.at(jsop);
+        if (ignoreSpent && nd.nullifier && IsSproutSpent(*nd.nullifier)) {
+            return;
         }
 
-        for (auto & pair : wtx.mapSaplingNoteData) {
-            SaplingOutPoint op = pair.first;
-            SaplingNoteData nd = pair.second;
+        // skip notes which cannot be spent
+        if (requireSpendingKey && !HaveSproutSpendingKey(cached.entry.address)) {
+            return;
+        }
 
-            auto optDeserialized = SaplingNotePlaintext::attempt_sapling_enc_decryption_deserialization(wtx.vShieldedOutput[op.n].encCiphertext, nd.ivk, wtx.vShieldedOutput[op.n].ephemeralKey);
+        // skip locked notes
+        if (ignoreLocked && IsLockedNote(jsop)) {
+            return;
+        }
 
-            // The transaction would not have entered the wallet unless
-            // its plaintext had been successfully decrypted previously.
-            assert(optDeserialized != std::nullopt);
+        if (!cached.strError.empty()) {
+            throw std::runtime_error(cached.strError);
+        }
+        sproutEntries.push_back(cached.entry);
+        sproutEntries.back().confirmations = nDepth;
+    };
 
-            auto notePt = optDeserialized.value();
-            auto maybe_pa = nd.ivk.address(notePt.d);
-            assert(static_cast<bool>(maybe_pa));
-            auto pa = maybe_pa.value();
+    auto addSaplingNote = [&](const SaplingNoteEntry& cached) {
+        const SaplingOutPoint& op = cached.op;
+        const CWalletTx* wtx = selectTx(op.hash);
+        if (wtx == nullptr) {
+            return;
+        }
 
-            // skip notes which belong to a different payment address in the wallet
-            if (!(filterAddresses.empty() || filterAddresses.count(pa))) {
-                continue;
-            }
+        const SaplingNoteData& nd = wtx->mapSaplingNoteData.at(op);
+        if (ignoreSpent && nd.nullifier && IsSaplingSpent(*nd.nullifier)) {
+            return;
+        }
 
-            if (ignoreSpent && nd.nullifier && IsSaplingSpent(*nd.nullifier)) {
-                continue;
-            }
+        // skip notes which cannot be spent
+        if (requireSpendingKey && !HaveSpendingKeyForPaymentAddress(this)(cached.address)) {
+            return;
+        }
 
-            // skip notes which cannot be spent
-            if (requireSpendingKey && !HaveSpendingKeyForPaymentAddress(this)(pa)) {
-                continue;
-            }
+        // skip locked notes
+        if (ignoreLocked && IsLockedNote(op)) {
+            return;
+        }
 
-            // skip locked notes
-            if (ignoreLocked && IsLockedNote(op)) {
-                continue;
-            }
+        saplingEntries.push_back(cached);
+        saplingEntries.back().confirmations = nDepth;
+    };
 
-            auto note = notePt.note(nd.ivk).value();
-            saplingEntries.push_back(SaplingNoteEntry {
-                op, pa, note, notePt.memo(), wtx.GetDepthInMainChain() });
+    if (filterAddresses.empty()) {
+        for (const auto& pair : mapSproutNoteCache) {
+            addSproutNote(pair.second);
+        }
+        for (const auto& pair : mapSaplingNoteCache) {
+            addSaplingNote(pair.second);
+        }
+    } else {
+        for (const JSOutPoint& jsop : sproutNotes) {
+            addSproutNote(mapSproutNoteCache.at(jsop));
+        }
+        for (const SaplingOutPoint& op : saplingNotes) {
+            addSaplingNote(mapSaplingNoteCache.at(op));
         }
     }
 }
@@ -22,6 +22,7 @@
 #include "validationinterface.h"
 #include "wallet/crypter.h"
 #include "wallet/rpcwallet.h"
+#include "wallet/trialdecryption.h"
 #include "wallet/wallet_ismine.h"
 #include "wallet/walletdb.h"
 #include "zcash/Address.hpp"
@@ -86,6 +87,11 @@ static const int MAX_DELETE_TX_SIZE = 50000;
 
 static const int DEFAULT_KEYPOOL_SIZE = 1000;
 
+//! Blocks a rescan reads and trial-decrypts ahead of the blocks it is committing
+static const size_t RESCAN_PREFETCH_BLOCKS = 64;
+//! Blocks a rescan commits per acquisition of cs_main and cs_wallet
+static const size_t RESCAN_COMMIT_BATCH_BLOCKS = 16;
+
 static const bool DEFAULT_WALLETBROADCAST = true;
 
 class CBlockIndex;
@@ -875,6 +881,14 @@ private:
     std::vector<CTransaction> pendingSaplingConsolidationTxs;
     AsyncRPCOperationId saplingConsolidationOperationId;
 
+    /**
+     * Trial decryptions of the Sapling outputs of the block being synced,
+     * computed as one batch ahead of the block's transactions and then
+     * consumed transaction by transaction in FindMySaplingNotes.
+     * Guarded by cs_KeyStore.
+     */
+    SaplingTrialDecryptionBatch saplingDecryptionBatch;
+
     void AddToTransparentSpends(const COutPoint& outpoint, const uint256& wtxid);
     void AddToSproutSpends(const uint256& nullifier, const uint256& wtxid);
     void AddToSaplingSpends(const uint256& nullifier, const uint256& wtxid);
@@ -959,6 +973,47 @@ private:
     void SyncMetaData(std::pair<typename TxSpendMap<T>::iterator, typename TxSpendMap<T>::iterator>);
     void ChainTipAdded(const CBlockIndex *pindex, const CBlock *pblock, SproutMerkleTree sproutTree, SaplingMerkleTree saplingTree);
 
+    /** A Sprout note decrypted for the note cache, or why it couldn't be. */
+    struct CachedSproutNote {
+        SproutNoteEntry entry;
+        std::string strError;
+    };
+
+    /**
+     * The notes of the wallet's transactions, decrypted once and kept by
+     * outpoint and by payment address for GetFilteredNotes. Transactions in
+     * setNoteCacheDirty were added, changed or erased since they were last
+     * decrypted, and are brought up to date by UpdateNoteCache.
+     */
+    std::map<JSOutPoint, CachedSproutNote> mapSproutNoteCache;
+    std::map<SaplingOutPoint, SaplingNoteEntry> mapSaplingNoteCache;
+    std::map<libzcash::SproutPaymentAddress, std::set<JSOutPoint>> mapSproutNotesByAddress;
+    std::map<libzcash::SaplingPaymentAddress, std::set<SaplingOutPoint>> mapSaplingNotesByAddress;
+    std::set<uint256> setNoteCacheDirty;
+
+    void UpdateNoteCache();
+
+    /**
+     * The transparent outputs of the wallet's transactions that are ours and
+     * not spent by a wallet transaction in the main chain. They are the only
+     * outputs the balance and coin queries can count, which still check them
+     * with IsSpent, as a spend that is only in the mempool can drop out at
+     * any time. Transactions in setUnspentOutputsDirty were added, changed
+     * or erased, or spend outputs of one that was, since their outputs were
+     * last looked at, and are brought up to date by UpdateUnspentOutputs.
+     * fUnspentOutputsStale has all of mapWallet looked at again, after keys
+     * or scripts changed what is ours.
+     */
+    mutable std::set<COutPoint> setUnspentOutputs;
+    mutable std::set<uint256> setUnspentOutputsDirty;
+    mutable bool fUnspentOutputsStale = true;
+
+    void MarkUnspentOutputsDirty(const CTransaction& tx);
+    bool IsSpentInMainChain(const uint256& hash, unsigned int n) const;
+    void UpdateUnspentOutputs() const;
+    //! The wallet transactions with outputs in setUnspentOutputs, in mapWallet order
+    std::vector<const CWalletTx*> GetUnspentOutputTransactions() const;
+
 protected:
     bool UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx);
     void MarkAffectedTransactionsDirty(const CTransaction& tx);
@@ -1329,6 +1384,13 @@ public:
         uint8_t n) const;
     mapSproutNoteData_t FindMySproutNotes(const CTransaction& tx) const;
     std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> FindMySaplingNotes(const CTransaction& tx, int height) const;
+    /**
+     * Trial-decrypt all the Sapling outputs of a block in one parallel batch,
+     * ahead of the per-transaction FindMySaplingNotes calls for that block.
+     */
+    void PrefetchSaplingDecryptions(const CBlock& block, int height);
+    //! The ivks of mapSaplingFullViewingKeys, in map order
+    std::vector<libzcash::SaplingIncomingViewingKey> GetSaplingIncomingViewingKeys() const;
     bool IsSproutNullifierFromMe(const uint256& nullifier) const;
     bool IsSaplingNullifierFromMe(const uint256& nullifier) const;
 
@@ -315,7 +315,7 @@ void CWalletDB::ListAccountCreditDebit(const string& strAccount, list<CAccountin
 {
     bool fAllAccounts = (strAccount == "*");
 
-    Dbc* pcursor = GetCursor();
+    std::unique_ptr<CDBCursor> pcursor(GetCursor());
     if (!pcursor)
         throw runtime_error("CWalletDB::ListAccountCreditDebit(): cannot create DB cursor");
     unsigned int fFlags = DB_SET_RANGE;
@@ -325,7 +325,7 @@ void CWalletDB::ListAccountCreditDebit(const string& strAccount, list<CAccountin
         if (fFlags == DB_SET_RANGE)
             ssKey << std::make_pair(std::string("acentry"), std::make_pair((fAllAccounts ? string("") : strAccount), uint64_t(0)));
         CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-        int ret = ReadAtCursor(pcursor, ssKey, ssValue, fFlags);
+        int ret = ReadAtCursor(pcursor.get(), ssKey, ssValue, fFlags);
         fFlags = DB_NEXT;
         if (ret == DB_NOTFOUND)
             break;
@@ -806,7 +806,7 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
         }
 
         // Get cursor
-        Dbc* pcursor = GetCursor();
+        std::unique_ptr<CDBCursor> pcursor(GetCursor());
         if (!pcursor) {
             LogPrintf("Error getting wallet database cursor\n");
             return DB_CORRUPT;
@@ -816,7 +816,7 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
             // Read next record
             CDataStream ssKey(SER_DISK, CLIENT_VERSION);
             CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-            int ret = ReadAtCursor(pcursor, ssKey, ssValue);
+            int ret = ReadAtCursor(pcursor.get(), ssKey, ssValue);
             if (ret == DB_NOTFOUND)
                 break;
             else if (ret != 0) {
@@ -901,7 +901,7 @@ DBErrors CWalletDB::FindWalletTx(CWallet* pwallet, vector<uint256>& vTxHash, vec
         }
 
         // Get cursor
-        Dbc* pcursor = GetCursor();
+        std::unique_ptr<CDBCursor> pcursor(GetCursor());
         if (!pcursor) {
             LogPrintf("Error getting wallet database cursor\n");
             return DB_CORRUPT;
@@ -911,7 +911,7 @@ DBErrors CWalletDB::FindWalletTx(CWallet* pwallet, vector<uint256>& vTxHash, vec
             // Read next record
             CDataStream ssKey(SER_DISK, CLIENT_VERSION);
             CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-            int ret = ReadAtCursor(pcursor, ssKey, ssValue);
+            int ret = ReadAtCursor(pcursor.get(), ssKey, ssValue);
             if (ret == DB_NOTFOUND)
                 break;
             else if (ret != 0) {
@@ -994,7 +994,15 @@ void ThreadFlushWalletDB(const string& strFile)
             nLastWalletUpdate = GetTime();
         }
 
-        if (nLastFlushed != nWalletDBUpdated && GetTime() - nLastWalletUpdate >= 2) {
+        if (nLastFlushed != nWalletDBUpdated && GetTime() - nLastWalletUpdate >= 2 && CDB::IsLogStore(strFile)) {
+            // A log store is always self contained; commit it, compacting it if it has grown enough
+            boost::this_thread::interruption_point();
+            LogPrint("db", "Flushing %s\n", strFile);
+            nLastFlushed = nWalletDBUpdated;
+            int64_t nStart = GetTimeMillis();
+            logdb.Flush(false);
+            LogPrint("db", "Flushed %s %dms\n", strFile, GetTimeMillis() - nStart);
+        } else if (nLastFlushed != nWalletDBUpdated && GetTime() - nLastWalletUpdate >= 2) {
             TRY_LOCK(bitdb.cs_db, lockDb);
             if (lockDb) {
                 // Don't do this if any databases are in use
@@ -1030,6 +1038,18 @@ bool BackupWallet(const CWallet& wallet, const string& strDest)
 {
     if (!wallet.fFileBacked)
         return false;
+    if (CDB::IsLogStore(wallet.strWalletFile)) {
+        CLogDB* plog = logdb.Open(wallet.strWalletFile, false);
+        boost::filesystem::path pathDest(strDest);
+        if (boost::filesystem::is_directory(pathDest))
+            pathDest /= wallet.strWalletFile;
+        if (plog == NULL || !plog->Backup(pathDest)) {
+            LogPrintf("error copying %s to %s\n", wallet.strWalletFile, pathDest.string());
+            return false;
+        }
+        LogPrintf("copied %s to %s\n", wallet.strWalletFile, pathDest.string());
+        return true;
+    }
     while (true) {
         {
             LOCK(bitdb.cs_db);
@@ -1062,6 +1082,10 @@ bool BackupWallet(const CWallet& wallet, const string& strDest)
 
 bool CWalletDB::Compact(CDBEnv& dbenv, const std::string& strFile)
 {
+    if (CDB::IsLogStore(strFile)) {
+        CLogDB* plog = logdb.Open(strFile, false);
+        return plog != NULL && plog->Compact();
+    }
     bool fSuccess = dbenv.Compact(strFile);
     return fSuccess;
 }
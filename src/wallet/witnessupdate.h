@@ -0,0 +1,61 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_WALLET_WITNESSUPDATE_H
+#define BITCOIN_WALLET_WITNESSUPDATE_H
+
+#include "uint256.h"
+#include "wallet/workerpool.h"
+
+#include <functional>
+#include <stddef.h>
+#include <vector>
+
+/** Below this many notes their witnesses are updated on the calling thread. */
+static const size_t WITNESS_UPDATE_MIN_PARALLEL_NOTES = 16;
+
+/**
+ * Call update(i) for every note i in [0, nNotes), on the wallet workers when
+ * there are enough notes to be worth it, and return once all have finished.
+ *
+ * The updates of different notes must be independent of each other: each
+ * may only read shared state and write the results of its own note. The
+ * caller merges those results into the wallet afterwards.
+ */
+inline void UpdateNoteWitnesses(size_t nNotes, const std::function<void(size_t)>& update)
+{
+    if (nNotes < WITNESS_UPDATE_MIN_PARALLEL_NOTES) {
+        for (size_t i = 0; i < nNotes; i++) {
+            update(i);
+        }
+        return;
+    }
+    RunWalletJobs(nNotes, update);
+}
+
+/**
+ * The witnesses of a block's notes once its commitments are in: first those
+ * read back from the shared set the commitments were appended to, then the
+ * unshared ones, each advanced by appending the commitments to a copy of it.
+ */
+template <typename WitnessSet, typename Witness>
+std::vector<Witness> AdvanceNoteWitnesses(const WitnessSet& shared,
+                                          const std::vector<const Witness*>& vUnshared,
+                                          const std::vector<uint256>& vCommitments)
+{
+    std::vector<Witness> vWitnesses(shared.size() + vUnshared.size());
+    UpdateNoteWitnesses(vWitnesses.size(), [&](size_t i) {
+        if (i < shared.size()) {
+            vWitnesses[i] = shared.witness(i);
+        } else {
+            Witness witness = *vUnshared[i - shared.size()];
+            for (const uint256& note_commitment : vCommitments)
+                witness.append(note_commitment);
+            vWitnesses[i] = witness;
+        }
+    });
+    return vWitnesses;
+}
+
+#endif // BITCOIN_WALLET_WITNESSUPDATE_H
@@ -0,0 +1,80 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "wallet/workerpool.h"
+
+#include "checkqueue.h"
+#include "sync.h"
+#include "util.h"
+
+#include <algorithm>
+#include <vector>
+
+int nWalletWorkerThreads = 0;
+
+/** Chunks handed out per worker, so that uneven jobs still balance out. */
+static const size_t WALLET_CHUNKS_PER_THREAD = 4;
+
+/** A contiguous range of wallet jobs. */
+class CWalletJobRange
+{
+private:
+    const std::function<void(size_t)>* job;
+    size_t nBegin;
+    size_t nEnd;
+
+public:
+    CWalletJobRange() : job(nullptr), nBegin(0), nEnd(0) {}
+    CWalletJobRange(const std::function<void(size_t)>& jobIn, size_t nBeginIn, size_t nEndIn) :
+        job(&jobIn), nBegin(nBeginIn), nEnd(nEndIn) {}
+
+    bool operator()()
+    {
+        for (size_t i = nBegin; i < nEnd; i++) {
+            (*job)(i);
+        }
+        return true;
+    }
+
+    void swap(CWalletJobRange& check)
+    {
+        std::swap(job, check.job);
+        std::swap(nBegin, check.nBegin);
+        std::swap(nEnd, check.nEnd);
+    }
+};
+
+static CCheckQueue<CWalletJobRange> walletworkqueue(16);
+/** A check queue serves one master at a time. */
+static CCriticalSection cs_walletWorkQueue;
+
+void ThreadWalletWorker()
+{
+    RenameThread("gemlink-wallet");
+    walletworkqueue.Thread();
+}
+
+void RunWalletJobs(size_t nJobs, const std::function<void(size_t)>& job)
+{
+    if (nWalletWorkerThreads == 0 || nJobs < 2) {
+        for (size_t i = 0; i < nJobs; i++) {
+            job(i);
+        }
+        return;
+    }
+
+    const size_t nChunks = std::min(nJobs, nWalletWorkerThreads * WALLET_CHUNKS_PER_THREAD);
+    const size_t nChunkSize = (nJobs + nChunks - 1) / nChunks;
+
+    std::vector<CWalletJobRange> vChecks;
+    vChecks.reserve(nChunks);
+    for (size_t nBegin = 0; nBegin < nJobs; nBegin += nChunkSize) {
+        vChecks.emplace_back(job, nBegin, std::min(nJobs, nBegin + nChunkSize));
+    }
+
+    LOCK(cs_walletWorkQueue);
+    CCheckQueueControl<CWalletJobRange> control(&walletworkqueue);
+    control.Add(vChecks);
+    control.Wait();
+}
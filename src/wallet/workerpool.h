@@ -0,0 +1,32 @@
+// Copyright (c) 2021 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_WALLET_WORKERPOOL_H
+#define BITCOIN_WALLET_WORKERPOOL_H
+
+#include <functional>
+#include <stddef.h>
+
+/** Maximum number of wallet worker threads. */
+static const int MAX_WALLET_WORKER_THREADS = 16;
+/** -walletthreads default (number of threads, 0 = auto) */
+static const int DEFAULT_WALLET_WORKER_THREADS = 0;
+
+/** Threads sharing wallet work, counting the caller; 0 when it is all done on the caller. */
+extern int nWalletWorkerThreads;
+
+/** Run an instance of the wallet worker thread */
+void ThreadWalletWorker();
+
+/**
+ * Call job(i) for every i in [0, nJobs), spread over the wallet workers when
+ * they are running, and return once all have finished. Trial decryption and
+ * note witness updates share the one pool.
+ *
+ * The jobs must be independent of each other: each may only read shared
+ * state and write its own results.
+ */
+void RunWalletJobs(size_t nJobs, const std::function<void(size_t)>& job);
+
+#endif // BITCOIN_WALLET_WORKERPOOL_H
@@ -358,6 +358,97 @@ void IncrementalWitness<Depth, Hash>::append(Hash obj)
     }
 }
 
+// The frontier of the rightmost subtree of the given depth. It is the bottom
+// of the shared frontier, with the empty parents above it dropped.
+template <size_t Depth, typename Hash>
+IncrementalMerkleTree<Depth, Hash> IncrementalWitnessSet<Depth, Hash>::subtree(size_t depth) const
+{
+    IncrementalMerkleTree<Depth, Hash> sub;
+    sub.left = tree.left;
+    sub.right = tree.right;
+    for (size_t i = 0; i + 1 < depth && i < tree.parents.size(); i++) {
+        sub.parents.push_back(tree.parents[i]);
+    }
+    while (!sub.parents.empty() && !sub.parents.back()) {
+        sub.parents.pop_back();
+    }
+    return sub;
+}
+
+// Register a witness for the next subtree to the right of its note.
+template <size_t Depth, typename Hash>
+void IncrementalWitnessSet<Depth, Hash>::wait(size_t i)
+{
+    const IncrementalWitness<Depth, Hash>& w = witnesses[i];
+    size_t depth = w.tree.next_depth(w.filled.size());
+    if (depth >= Depth) {
+        return;
+    }
+    uint64_t index = (w.position() >> depth) + 1;
+    waiting.insert(std::make_pair(std::make_pair(depth, index), i));
+}
+
+template <size_t Depth, typename Hash>
+size_t IncrementalWitnessSet<Depth, Hash>::add(const IncrementalWitness<Depth, Hash>& witness)
+{
+    if (witness.position() >= tree.size()) {
+        throw std::runtime_error("witness is ahead of the tree");
+    }
+    size_t depth = witness.tree.next_depth(witness.filled.size());
+    if (depth < Depth && ((witness.position() >> depth) + 2) << depth <= tree.size()) {
+        throw std::runtime_error("witness is behind the tree");
+    }
+
+    size_t i = witnesses.size();
+    witnesses.push_back(witness);
+    witnesses.back().cursor = std::nullopt;
+    wait(i);
+    return i;
+}
+
+template <size_t Depth, typename Hash>
+void IncrementalWitnessSet<Depth, Hash>::append(Hash obj)
+{
+    tree.append(obj);
+
+    // Each subtree the commitment completes is handed to the witnesses
+    // waiting on it, which then wait on a subtree that has yet to begin.
+    uint64_t n = tree.size();
+    for (size_t depth = 0; depth < Depth && n % ((uint64_t)1 << depth) == 0; depth++) {
+        auto range = waiting.equal_range(std::make_pair(depth, (n >> depth) - 1));
+        if (range.first == range.second) {
+            continue;
+        }
+        Hash root = depth == 0 ? obj : subtree(depth).root(depth);
+
+        std::vector<size_t> ready;
+        for (auto it = range.first; it != range.second; ++it) {
+            ready.push_back(it->second);
+        }
+        waiting.erase(range.first, range.second);
+        for (size_t i : ready) {
+            witnesses[i].filled.push_back(root);
+            wait(i);
+        }
+    }
+}
+
+template <size_t Depth, typename Hash>
+IncrementalWitness<Depth, Hash> IncrementalWitnessSet<Depth, Hash>::witness(size_t i) const
+{
+    IncrementalWitness<Depth, Hash> w = witnesses.at(i);
+    size_t depth = w.tree.next_depth(w.filled.size());
+    if (depth > 0 && depth < Depth && ((w.position() >> depth) + 1) << depth < tree.size()) {
+        w.cursor = subtree(depth);
+        w.cursor_depth = depth;
+    } else {
+        // IncrementalWitness::append leaves the depth of the last subtree
+        // it filled behind once its cursor is gone.
+        w.cursor_depth = w.filled.empty() ? 0 : w.tree.next_depth(w.filled.size() - 1);
+    }
+    return w;
+}
+
 template class IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH, SHA256Compress>;
 template class IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, SHA256Compress>;
 
@@ -370,4 +461,9 @@ template class IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, Pede
 template class IncrementalWitness<SAPLING_INCREMENTAL_MERKLE_TREE_DEPTH, PedersenHash>;
 template class IncrementalWitness<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, PedersenHash>;
 
+template class IncrementalWitnessSet<INCREMENTAL_MERKLE_TREE_DEPTH, SHA256Compress>;
+template class IncrementalWitnessSet<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, SHA256Compress>;
+template class IncrementalWitnessSet<SAPLING_INCREMENTAL_MERKLE_TREE_DEPTH, PedersenHash>;
+template class IncrementalWitnessSet<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, PedersenHash>;
+
 } // namespace libzcash
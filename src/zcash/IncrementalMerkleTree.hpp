@@ -5,6 +5,7 @@
 #include <boost/optional.hpp>
 #include <boost/static_assert.hpp>
 #include <deque>
+#include <map>
 
 #include "serialize.h"
 #include "uint256.h"
@@ -90,10 +91,14 @@ bool operator==(const EmptyMerkleRoots<Depth, Hash>& a,
 template <size_t Depth, typename Hash>
 class IncrementalWitness;
 
+template <size_t Depth, typename Hash>
+class IncrementalWitnessSet;
+
 template <size_t Depth, typename Hash>
 class IncrementalMerkleTree
 {
     friend class IncrementalWitness<Depth, Hash>;
+    friend class IncrementalWitnessSet<Depth, Hash>;
 
 public:
     BOOST_STATIC_ASSERT(Depth >= 1);
@@ -170,6 +175,7 @@ template <size_t Depth, typename Hash>
 class IncrementalWitness
 {
     friend class IncrementalMerkleTree<Depth, Hash>;
+    friend class IncrementalWitnessSet<Depth, Hash>;
 
 public:
     // Required for Unserialize()
@@ -234,6 +240,53 @@ bool operator==(const IncrementalWitness<Depth, Hash>& a,
             a.cursor_depth == b.cursor_depth);
 }
 
+/**
+ * Keeps a set of witnesses into the same tree up to date, appending each
+ * commitment once to a shared frontier rather than once per witness.
+ *
+ * A witness needs, to the right of its note, the roots of the subtrees that
+ * have completed (`filled`) and the frontier of the one still filling
+ * (`cursor`). The latter is always the bottom of the shared frontier, so it
+ * is only read off when the witness is taken out; and each completed subtree
+ * root is computed once, from the shared frontier, for all the witnesses
+ * waiting on it. Appending costs the same whatever the number of witnesses.
+ */
+template <size_t Depth, typename Hash>
+class IncrementalWitnessSet
+{
+public:
+    IncrementalWitnessSet(const IncrementalMerkleTree<Depth, Hash>& tree) : tree(tree) {}
+
+    // Track a witness that is current with the tree, returning its index.
+    size_t add(const IncrementalWitness<Depth, Hash>& witness);
+
+    void append(Hash obj);
+
+    // The witness at an index, as appending the same commitments to it
+    // directly would have left it.
+    IncrementalWitness<Depth, Hash> witness(size_t i) const;
+
+    const IncrementalMerkleTree<Depth, Hash>& frontier() const
+    {
+        return tree;
+    }
+
+    size_t size() const
+    {
+        return witnesses.size();
+    }
+
+private:
+    IncrementalMerkleTree<Depth, Hash> tree;
+    // The witnesses, without their cursors
+    std::vector<IncrementalWitness<Depth, Hash>> witnesses;
+    // Witnesses by the (depth, index) of the subtree they wait on to fill
+    std::multimap<std::pair<size_t, uint64_t>, size_t> waiting;
+
+    void wait(size_t i);
+    IncrementalMerkleTree<Depth, Hash> subtree(size_t depth) const;
+};
+
 class SHA256Compress : public uint256
 {
 public:
@@ -282,4 +335,9 @@ typedef libzcash::IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, l
 typedef libzcash::IncrementalWitness<SAPLING_INCREMENTAL_MERKLE_TREE_DEPTH, libzcash::PedersenHash> SaplingWitness;
 typedef libzcash::IncrementalWitness<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, libzcash::PedersenHash> SaplingTestingWitness;
 
+typedef libzcash::IncrementalWitnessSet<INCREMENTAL_MERKLE_TREE_DEPTH, libzcash::SHA256Compress> SproutWitnessSet;
+typedef libzcash::IncrementalWitnessSet<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, libzcash::SHA256Compress> SproutTestingWitnessSet;
+typedef libzcash::IncrementalWitnessSet<SAPLING_INCREMENTAL_MERKLE_TREE_DEPTH, libzcash::PedersenHash> SaplingWitnessSet;
+typedef libzcash::IncrementalWitnessSet<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, libzcash::PedersenHash> SaplingTestingWitnessSet;
+
 #endif /* ZC_INCREMENTALMERKLETREE_H_ */
@@ -235,6 +235,45 @@ std::optional<SaplingNotePlaintext> SaplingNotePlaintext::decrypt(
     }
 }
 
+std::optional<SaplingNotePlaintext> SaplingNotePlaintext::decrypt_with_shared_secret(
+    const Consensus::Params& params,
+    int height,
+    const SaplingEncCiphertext &ciphertext,
+    const uint256 &ivk,
+    const uint256 &epk,
+    const uint256 &dhsecret,
+    const uint256 &cmu
+)
+{
+    auto encPlaintext = AttemptSaplingEncDecryptionWithSharedSecret(ciphertext, dhsecret, epk);
+
+    if (!encPlaintext) {
+        return std::nullopt;
+    }
+
+    // Deserialize from the plaintext
+    SaplingNotePlaintext plaintext;
+    try {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << encPlaintext.value();
+        ss >> plaintext;
+        assert(ss.size() == 0);
+    } catch (const boost::thread_interrupted&) {
+        throw;
+    } catch (...) {
+        return std::nullopt;
+    }
+
+    // Check leadbyte is allowed at block height
+    if (!plaintext_version_is_valid(params, height, plaintext.get_leadbyte())) {
+        LogPrint("receiveunsafe", "Received note plaintext with invalid lead byte %d at height %d",
+                 plaintext.get_leadbyte(), height);
+        return std::nullopt;
+    }
+
+    return plaintext_checks_without_height(plaintext, ivk, epk, cmu);
+}
+
 std::optional<SaplingNotePlaintext> SaplingNotePlaintext::attempt_sapling_enc_decryption_deserialization(
     const SaplingEncCiphertext &ciphertext,
     const uint256 &ivk,
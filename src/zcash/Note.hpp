@@ -156,6 +156,18 @@ public:
         const uint256 &cmu
     );
 
+    // As decrypt, but with the ivk/epk key agreement already computed by
+    // the caller, so that it can be shared across a batch of ivks.
+    static std::optional<SaplingNotePlaintext> decrypt_with_shared_secret(
+        const Consensus::Params& params,
+        int height,
+        const SaplingEncCiphertext &ciphertext,
+        const uint256 &ivk,
+        const uint256 &epk,
+        const uint256 &dhsecret,
+        const uint256 &cmu
+    );
+
     static std::optional<SaplingNotePlaintext> plaintext_checks_without_height(
         const SaplingNotePlaintext &plaintext,
         const uint256 &ivk,
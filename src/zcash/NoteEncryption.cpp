@@ -153,6 +153,15 @@ std::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption(
         return std::nullopt;
     }
 
+    return AttemptSaplingEncDecryptionWithSharedSecret(ciphertext, dhsecret, epk);
+}
+
+std::optional<SaplingEncPlaintext> AttemptSaplingEncDecryptionWithSharedSecret(
+    const SaplingEncCiphertext &ciphertext,
+    const uint256 &dhsecret,
+    const uint256 &epk
+)
+{
     // Construct the symmetric key
     unsigned char K[NOTEENCRYPTION_CIPHER_KEYSIZE];
     KDF_Sapling(K, dhsecret, epk);
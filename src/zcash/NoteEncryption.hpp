@@ -74,6 +74,15 @@ std::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption(
     const uint256 &epk
 );
 
+// Attempts to decrypt a Sapling note with the shared secret already agreed
+// between ivk and epk (see librustzcash_sapling_ka_agree_batch). This will
+// not check that the contents of the ciphertext are correct.
+std::optional<SaplingEncPlaintext> AttemptSaplingEncDecryptionWithSharedSecret(
+    const SaplingEncCiphertext &ciphertext,
+    const uint256 &dhsecret,
+    const uint256 &epk
+);
+
 // Attempts to decrypt a Sapling note using outgoing plaintext.
 // This will not check that the contents of the ciphertext are correct.
 std::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption (